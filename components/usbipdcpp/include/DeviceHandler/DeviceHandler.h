@@ -1,7 +1,9 @@
 #pragma once
 
+#include <array>
 #include <vector>
 #include <cstdint>
+#include <mutex>
 #include <optional>
 #include <system_error>
 #include <spdlog/spdlog.h>
@@ -26,19 +28,32 @@ namespace usbipdcpp {
 
         AbstDeviceHandler(AbstDeviceHandler &&other) noexcept;
 
+        /**
+         * @brief 通过导入时建立的路由表分发URB，不再按端点类型逐个判断
+         *
+         * 默认只对同一个端点加锁，不同端点可以在多个线程同时提交。顺序保证：
+         * - 同一端点的URB不会同时进入handler，由同一线程依次调用时按调用顺序提交
+         * - 端点0的IN和OUT是同一个控制管道，共用一把锁
+         * - 不同端点之间没有顺序保证，handler中跨端点共享的状态需要自行加锁
+         * 从多个线程分发同一端点时按抢到锁的顺序提交，需要保持线路上的顺序时同一端点只能在一个线程中分发
+         * @param route 来自 UsbDevice::route，entry 不为空
+         */
         virtual void dispatch_urb(
-                const UsbIpCommand::UsbIpCmdSubmit &cmd,
+                const UsbEndpointRoute &route,
                 std::uint32_t seqnum,
-                const UsbEndpoint &ep,
-                std::optional<UsbInterface> &interface,
                 std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length, const SetupPacket &setup_packet,
                 const data_type &out_data, const std::vector<UsbIpIsoPacketDescriptor> &iso_packet_descriptors,
-                usbipdcpp::error_code
-                &ec
+                usbipdcpp::error_code &ec
                 );
 
         /**
-         * @brief 新的客户端连接时会调这个函数，可以阻塞
+         * @brief 返回某种传输类型在路由表中的入口
+         */
+        static UsbUrbEntry route_entry(EndpointAttributes transfer_type);
+
+        /**
+         * @brief 新的客户端连接时会调这个函数，在Server的设备回调线程上执行，可以阻塞。
+         * 所有设备共用这个线程，阻塞会推迟其他设备的连接和断开，但不影响会话的收发
          * @param current_session 请自行储存通信用的session
          * @param ec 发生的ec
          */
@@ -46,7 +61,7 @@ namespace usbipdcpp {
 
         /**
          * @brief 当发生错误等情况需要完全终止传输时会调用这个函数。被调用后禁止再提交消息和使用Session对象\n
-         * 可以阻塞，处理所有需要处理的事务
+         * 在Server的设备回调线程上执行，可以阻塞，处理所有需要处理的事务
          */
         virtual void on_disconnection(error_code &ec);
         /**
@@ -104,12 +119,43 @@ namespace usbipdcpp {
 
         virtual ~AbstDeviceHandler() = default;
 
+    private:
+        static void route_control(AbstDeviceHandler &handler, const UsbEndpointRoute &route,
+                                  std::uint32_t seqnum, std::uint32_t transfer_flags,
+                                  std::uint32_t transfer_buffer_length, const SetupPacket &setup_packet,
+                                  const data_type &out_data,
+                                  const std::vector<UsbIpIsoPacketDescriptor> &iso_packet_descriptors,
+                                  error_code &ec);
+        static void route_bulk(AbstDeviceHandler &handler, const UsbEndpointRoute &route,
+                               std::uint32_t seqnum, std::uint32_t transfer_flags,
+                               std::uint32_t transfer_buffer_length, const SetupPacket &setup_packet,
+                               const data_type &out_data,
+                               const std::vector<UsbIpIsoPacketDescriptor> &iso_packet_descriptors,
+                               error_code &ec);
+        static void route_interrupt(AbstDeviceHandler &handler, const UsbEndpointRoute &route,
+                                    std::uint32_t seqnum, std::uint32_t transfer_flags,
+                                    std::uint32_t transfer_buffer_length, const SetupPacket &setup_packet,
+                                    const data_type &out_data,
+                                    const std::vector<UsbIpIsoPacketDescriptor> &iso_packet_descriptors,
+                                    error_code &ec);
+        static void route_isochronous(AbstDeviceHandler &handler, const UsbEndpointRoute &route,
+                                      std::uint32_t seqnum, std::uint32_t transfer_flags,
+                                      std::uint32_t transfer_buffer_length, const SetupPacket &setup_packet,
+                                      const data_type &out_data,
+                                      const std::vector<UsbIpIsoPacketDescriptor> &iso_packet_descriptors,
+                                      error_code &ec);
+
     protected:
+        /**
+         * @brief 分发某个端点的URB时持有的锁，子类可以改成更粗的粒度
+         */
+        virtual std::mutex &dispatch_mutex(const UsbEndpointRoute &route);
+
         UsbDevice &handle_device;
         std::atomic<Session *> session = nullptr;
 
     private:
-        std::mutex self_mutex;
+        std::array<std::mutex, UsbDevice::route_count> endpoint_mutexes;
     };
 
     class DeviceHandlerBase : public AbstDeviceHandler {
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "device.h"
+#include "StringPool.h"
+#include "HidCompositeVirtualInterfaceHandler.h"
+
+namespace usbipdcpp {
+
+    struct HidCompositeDeviceConfig {
+        std::string busid = "2-3";
+        UsbSpeed speed = UsbSpeed::High;
+        // 中断 IN 端点的 bInterval，高速设备以 2^(n-1) 个微帧计，1 为 125us；全速设备以毫秒计
+        std::uint8_t interval = 1;
+        // 中断 IN 端点的最大包长，要能放下最长的输入报告加 1 字节 report id
+        std::uint16_t max_packet_size = 64;
+    };
+
+    /**
+     * @brief 把多个 HID 成员合成一个只有一个 HID 接口的设备（1209:0002），输入报告走中断 IN 端点 0x81，
+     * 输出报告通过控制端点的 SET_REPORT 发送。报告描述符无法合并时返回空。
+     * string_pool 要比设备活得久。
+     */
+    std::shared_ptr<UsbDevice> make_hid_composite_device(StringPool &string_pool,
+                                                         std::vector<std::unique_ptr<HidReportSource>> &&sources,
+                                                         const HidCompositeDeviceConfig &config);
+}
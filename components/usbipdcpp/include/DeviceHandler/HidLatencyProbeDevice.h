@@ -0,0 +1,27 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "device.h"
+#include "StringPool.h"
+#include "HidLatencyProbeVirtualInterfaceHandler.h"
+
+namespace usbipdcpp {
+
+    struct HidLatencyProbeDeviceConfig {
+        std::string busid = "2-2";
+        UsbSpeed speed = UsbSpeed::High;
+        // 中断 IN 端点的 bInterval，高速设备以 2^(n-1) 个微帧计，1 为 125us；全速设备以毫秒计
+        std::uint8_t interval = 1;
+        HidLatencyProbeVirtualInterfaceHandler::Config interface{};
+    };
+
+    /**
+     * @brief 生成一个延迟测试用的 HID 设备（1209:0001），只有一个 64 字节的中断 IN 端点 0x81，
+     * 输出报告通过控制端点的 SET_REPORT 发送。报告格式见 HidLatencyProbeVirtualInterfaceHandler。
+     * string_pool 要比设备活得久。
+     */
+    std::shared_ptr<UsbDevice> make_hid_latency_probe_device(StringPool &string_pool,
+                                                             const HidLatencyProbeDeviceConfig &config);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "constant.h"
+#include "device.h"
+#include "type.h"
+
+namespace usbipdcpp {
+
+    /**
+     * @brief 录制下来的一次设备会话，由 ReplayVirtualDeviceHandler 按录制时的样子应答 URB。
+     *
+     * 文本格式，每行一条，# 开头的行和空行忽略，十六进制数据连续书写，没有数据写 -：
+     *   usbipdcpp-replay 1
+     *   speed <UsbSpeed 的数值>                         可选，默认高速
+     *   device <设备描述符>
+     *   config <完整的配置描述符>
+     *   c <8 字节 setup 包> <状态> <处理时间us> <IN 数据>  控制传输
+     *   i <端点地址> <状态> <处理时间us> <数据>            IN 传输
+     *   o <端点地址> <状态> <处理时间us> <实际长度>        OUT 传输
+     * 状态是 URB 的状态（0 成功，-32 EPIPE 等），处理时间是录制时从提交到完成的时间。
+     * tools/usbmon_to_replay 可以把 Linux usbmon 抓的 pcap 转成这个格式。
+     */
+    struct ReplayTrace {
+        struct Response {
+            std::int32_t status = 0;
+            std::uint32_t service_us = 0;
+            // IN 传输返回的数据
+            data_type data;
+            // OUT 传输录制时的实际长度
+            std::uint32_t actual_length = 0;
+        };
+
+        struct ControlExchange {
+            array_data_type<8> setup{};
+            Response response;
+        };
+
+        UsbSpeed speed = UsbSpeed::High;
+        data_type device_descriptor;
+        data_type configuration_descriptor;
+        // 按录制顺序，同一个 setup 包可以出现多次
+        std::vector<ControlExchange> control;
+        // 每个端点按录制顺序排列的应答
+        std::map<std::uint8_t, std::vector<Response>> endpoints;
+
+        /**
+         * @brief 解析文本格式的录制文件，格式错误时打印所在行并返回空
+         */
+        static std::optional<ReplayTrace> parse(std::string_view text);
+
+        /**
+         * @brief 按设备描述符和配置描述符生成设备，只用第一个配置。
+         * 同一个接口的各个备用设置的端点都加到该接口中，不挂接口 handler。
+         * 描述符不完整时返回空
+         */
+        [[nodiscard]] std::shared_ptr<UsbDevice> make_device(const std::string &busid) const;
+    };
+}
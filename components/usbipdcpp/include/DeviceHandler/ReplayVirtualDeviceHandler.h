@@ -0,0 +1,136 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#include "DeviceHandler.h"
+#include "ReplayTrace.h"
+
+namespace usbipdcpp {
+
+    /**
+     * @brief 按录制文件应答 URB 的虚拟设备，不需要真实硬件就能重复同一次 ST-Link 烧录或 U 盘拷贝，
+     * 用来对比协议和 Session 改动前后的性能。
+     *
+     * 控制传输按 setup 包的前 6 字节（不含 wLength）匹配，同一个 setup 包录了多次时依次使用，用完后从头循环；
+     * 没有录到的 SET_ADDRESS、SET_CONFIGURATION 等标准请求直接成功，其余应答 EPIPE。
+     * 其他端点按录制顺序逐个应答，不看 OUT 的内容，用完后从头循环。
+     * IN 数据直接指向录制文件，不复制。
+     * U 盘的 CSW 会换成主机这次 CBW 的 tag，不然主机会认为状态不匹配而复位设备。
+     */
+    class ReplayVirtualDeviceHandler : public DeviceHandlerBase {
+    public:
+        enum class Timing {
+            Recorded, // 按录制时的处理时间延迟应答
+            Scaled,   // 处理时间乘以 scale
+            Zero,     // 立即应答，只测服务器自身的开销
+        };
+
+        struct Config {
+            Timing timing = Timing::Recorded;
+            double scale = 1.0;
+            bool fix_bot_tags = true;
+        };
+
+        struct Stats {
+            std::uint64_t replayed = 0;          // 按录制内容应答的 URB
+            std::uint64_t unmatched_control = 0; // 没有录到、应答 EPIPE 的控制请求
+            std::uint64_t length_mismatches = 0; // OUT 长度或 IN 请求长度和录制时不同
+            std::uint64_t wrapped = 0;           // 某个端点或控制请求的录制内容用完后从头循环的次数
+        };
+
+        ReplayVirtualDeviceHandler(UsbDevice &handle_device, std::shared_ptr<const ReplayTrace> trace,
+                                   const Config &config);
+        ~ReplayVirtualDeviceHandler() override;
+
+        void on_new_connection(Session &current_session, error_code &ec) override;
+        void on_disconnection(error_code &ec) override;
+        /**
+         * @brief 延迟中的 URB 到期时再检查 unlink
+         */
+        void handle_unlink_seqnum(std::uint32_t seqnum) override {
+        }
+
+        [[nodiscard]] Stats stats() const;
+
+    protected:
+        void handle_control_urb(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
+                                const SetupPacket &setup_packet, const data_type &out_data,
+                                std::error_code &ec) override;
+        void handle_bulk_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                  UsbInterface &interface, std::uint32_t transfer_flags,
+                                  std::uint32_t transfer_buffer_length, const data_type &out_data,
+                                  std::error_code &ec) override;
+        void handle_interrupt_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                       UsbInterface &interface, std::uint32_t transfer_flags,
+                                       std::uint32_t transfer_buffer_length, const data_type &out_data,
+                                       std::error_code &ec) override;
+        void handle_isochronous_transfer(std::uint32_t seqnum,
+                                         const UsbEndpoint &ep, UsbInterface &interface,
+                                         std::uint32_t transfer_flags,
+                                         std::uint32_t transfer_buffer_length, const data_type &out_data,
+                                         const std::vector<UsbIpIsoPacketDescriptor> &iso_packet_descriptors,
+                                         std::error_code &ec) override;
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        static std::uint64_t control_key(const SetupPacket &setup_packet);
+        static std::uint64_t control_key(const array_data_type<8> &setup);
+
+        void handle_endpoint_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                      std::uint32_t transfer_buffer_length, const data_type &out_data);
+        UsbIpResponse::UsbIpRetSubmit make_in_reply(std::uint32_t seqnum, const ReplayTrace::Response &response,
+                                                    std::uint32_t transfer_buffer_length);
+        UsbIpResponse::UsbIpRetSubmit make_out_reply(std::uint32_t seqnum, const ReplayTrace::Response &response,
+                                                     const data_type &out_data);
+        /**
+         * @brief 按计时方式立即应答或放进延迟队列，同一端点的应答保持顺序
+         */
+        void reply(std::uint8_t ep_address, std::uint32_t service_us, UsbIpResponse::UsbIpRetSubmit &&ret);
+        void delay_loop();
+
+        const std::shared_ptr<const ReplayTrace> trace;
+        const Config config;
+
+        // setup 包前 6 字节到录制中下标的索引，构造后只读
+        std::unordered_map<std::uint64_t, std::vector<std::size_t>> control_index;
+        // 以下游标只在对应端点的分发锁内访问，端点 0 的 IN 和 OUT 共用一把锁
+        std::unordered_map<std::uint64_t, std::size_t> control_cursors;
+        std::array<std::size_t, UsbDevice::route_count> endpoint_cursors{};
+        // 最近一个 CBW 的 tag，小端
+        std::atomic<std::uint32_t> last_cbw_tag = 0;
+
+        std::atomic<std::uint64_t> replayed = 0;
+        std::atomic<std::uint64_t> unmatched_control = 0;
+        std::atomic<std::uint64_t> length_mismatches = 0;
+        std::atomic<std::uint64_t> wrapped = 0;
+
+        std::mutex delay_mutex;
+        std::condition_variable delay_cv;
+        // 到期时间相同的按插入顺序排列
+        std::multimap<clock::time_point, UsbIpResponse::UsbIpRetSubmit> delayed;
+        std::array<clock::time_point, UsbDevice::route_count> last_due{};
+        bool delay_stop = false;
+        std::thread delay_thread;
+    };
+
+    struct ReplayDeviceConfig {
+        std::string busid = "3-1";
+        ReplayVirtualDeviceHandler::Config handler{};
+    };
+
+    /**
+     * @brief 按录制文件生成设备并挂上 ReplayVirtualDeviceHandler，描述符不完整时返回空
+     */
+    std::shared_ptr<UsbDevice> make_replay_device(std::shared_ptr<const ReplayTrace> trace,
+                                                  const ReplayDeviceConfig &config);
+}
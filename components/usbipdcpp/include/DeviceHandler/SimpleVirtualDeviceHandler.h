@@ -0,0 +1,55 @@
+#pragma once
+
+#include "VirtualDeviceHandler.h"
+
+namespace usbipdcpp {
+
+    /**
+     * @brief 只有一个配置、设备本身没有自定义请求的虚拟设备，标准请求按最常见的方式应答。
+     * 功能全部由接口的handler实现，U盘、串口等虚拟设备直接使用这个类
+     */
+    class SimpleVirtualDeviceHandler : public VirtualDeviceHandler {
+    public:
+        using VirtualDeviceHandler::VirtualDeviceHandler;
+
+        void set_descriptor(std::uint16_t configuration_value) override {
+        }
+
+    protected:
+        void handle_non_standard_request_type_control_urb(
+                std::uint32_t seqnum, const UsbEndpoint &ep,
+                std::uint32_t transfer_flags,
+                std::uint32_t transfer_buffer_length,
+                const SetupPacket &setup_packet,
+                const data_type &out_data,
+                std::error_code &ec) override;
+
+        void request_clear_feature(std::uint16_t feature_selector, std::uint32_t *p_status) override {
+        }
+
+        std::uint16_t request_get_status(std::uint32_t *p_status) override {
+            // 总线供电，不支持远程唤醒
+            return 0;
+        }
+
+        void request_set_address(std::uint16_t address, std::uint32_t *status) override {
+        }
+
+        void request_set_configuration(std::uint16_t configuration_value, std::uint32_t *p_status) override;
+
+        void request_set_descriptor(std::uint8_t desc_type, std::uint8_t desc_index,
+                                    std::uint16_t language_id, std::uint16_t descriptor_length,
+                                    const data_type &descriptor, std::uint32_t *p_status) override {
+            *p_status = static_cast<std::uint32_t>(UrbStatusType::StatusEPIPE);
+        }
+
+        void request_set_feature(std::uint16_t feature_selector, std::uint32_t *p_status) override {
+        }
+
+        data_type get_other_speed_descriptor(std::uint8_t language_id, std::uint16_t descriptor_length,
+                                             std::uint32_t *p_status) override {
+            *p_status = static_cast<std::uint32_t>(UrbStatusType::StatusEPIPE);
+            return {};
+        }
+    };
+}
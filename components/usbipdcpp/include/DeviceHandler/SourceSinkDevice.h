@@ -0,0 +1,29 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "device.h"
+#include "StringPool.h"
+#include "SourceSinkVirtualInterfaceHandler.h"
+
+namespace usbipdcpp {
+
+    struct SourceSinkDeviceConfig {
+        std::string busid = "2-1";
+        UsbSpeed speed = UsbSpeed::High;
+        // bulk 端点的最大包长，全速设备最大 64
+        std::uint16_t max_packet_size = 512;
+        // 额外带一对中断端点，OUT 收到的数据从 IN 返回
+        bool interrupt_loopback = false;
+        SourceSinkVirtualInterfaceHandler::Config interface{};
+    };
+
+    /**
+     * @brief 生成一个 source/sink 测试设备，VID/PID 和 Linux gadget zero 相同（0525:a4a0），
+     * 客户端导入后可以直接用 usbtest 驱动测试。
+     * 端点：0x81 bulk IN、0x01 bulk OUT，interrupt_loopback 时加上 0x82 中断 IN、0x02 中断 OUT。
+     * string_pool 要比设备活得久。
+     */
+    std::shared_ptr<UsbDevice> make_source_sink_device(StringPool &string_pool, const SourceSinkDeviceConfig &config);
+}
@@ -12,14 +12,17 @@ namespace usbipdcpp {
             DeviceHandlerBase(handle_device), string_pool(string_pool), usb_version(usb_version) {
             change_device_ep0_max_size_by_speed();
 
-            string_configuration_value = string_pool.new_string(L"Default Configuration");
-            string_manufacturer_value = string_pool.new_string(L"Usbipdcpp");
-            string_product_value = string_pool.new_string(L"Usbipdcpp Virtual Device");
-            string_serial_value = string_pool.new_string(L"Usbipdcpp Serial");
+            string_configuration_value = string_pool.new_string(u"Default Configuration");
+            string_manufacturer_value = string_pool.new_string(u"Usbipdcpp");
+            string_product_value = string_pool.new_string(u"Usbipdcpp Virtual Device");
+            string_serial_value = string_pool.new_string(u"Usbipdcpp Serial");
         }
 
-        void dispatch_urb(const UsbIpCommand::UsbIpCmdSubmit &cmd, std::uint32_t seqnum,
-                          const UsbEndpoint &ep, std::optional<UsbInterface> &interface, std::uint32_t transfer_flags,
+        /**
+         * @brief 虚拟接口的handler假定同一接口上的调用不会并发，这里按接口加锁，不同接口之间可以并发。
+         * 控制传输可能转给任意接口的handler，执行时独占整个设备
+         */
+        void dispatch_urb(const UsbEndpointRoute &route, std::uint32_t seqnum, std::uint32_t transfer_flags,
                           std::uint32_t transfer_buffer_length, const SetupPacket &setup_packet,
                           const data_type &out_data,
                           const std::vector<UsbIpIsoPacketDescriptor> &iso_packet_descriptors,
@@ -34,8 +37,36 @@ namespace usbipdcpp {
          * @brief 当发生错误、客户端detach、主动关闭服务器等情况需要完全终止传输时会调用这个函数。被调用后不可以再提交消息
          */
         void on_disconnection(error_code& ec) override;
+        /**
+         * @brief 转给所有接口的handler，由暂存了该URB的接口应答
+         */
+        void handle_unlink_seqnum(std::uint32_t seqnum) override;
 
     protected:
+        /**
+         * @brief 设备、配置、BOS 和 device qualifier 描述符，生成后只读，请求时直接引用其中的数据发送
+         */
+        struct DescriptorSet {
+            descriptor_ptr device;
+            descriptor_ptr configuration;
+            descriptor_ptr bos;
+            descriptor_ptr device_qualifier;
+        };
+
+        /**
+         * @brief 取得描述符集合，第一次调用时生成
+         */
+        std::shared_ptr<const DescriptorSet> descriptor_set();
+        /**
+         * @brief 取得已经生成好的标准描述符，GET_DESCRIPTOR 直接引用它发送，不复制
+         * @return 设备、配置、BOS、device qualifier 和字符串以外的类型或者不存在时返回空
+         */
+        descriptor_ptr find_cached_descriptor(std::uint8_t type, std::uint8_t index);
+        /**
+         * @brief 修改了设备信息或接口布局后调用，下一个请求会重新生成描述符
+         */
+        void invalidate_descriptors();
+
         void change_device_ep0_max_size_by_speed();
 
         void handle_control_urb(
@@ -86,16 +117,20 @@ namespace usbipdcpp {
         void request_set_interface(std::uint16_t alternate_setting, std::uint16_t intf, std::uint32_t *p_status);
 
 
-        virtual data_type get_device_descriptor(std::uint16_t language_id, std::uint16_t descriptor_length,
-                                                std::uint32_t *p_status);
-        virtual data_type get_bos_descriptor(std::uint16_t language_id, std::uint16_t descriptor_length,
-                                             std::uint32_t *p_status);
-        virtual data_type get_configuration_descriptor(std::uint16_t language_id, std::uint16_t descriptor_length,
-                                                       std::uint32_t *p_status);
-        virtual data_type get_string_descriptor(std::uint8_t language_id, std::uint16_t descriptor_length,
-                                                std::uint32_t *p_status);
-        virtual data_type get_device_qualifier_descriptor(std::uint8_t language_id, std::uint16_t descriptor_length,
-                                                          std::uint32_t *p_status);
+        /**
+         * @brief 以下几个描述符以 descriptor_set 和 string_pool 中生成好的数据为准，GET_DESCRIPTOR 直接发送这些数据，
+         * 不经过这些函数，因此不能重写。要改变描述符请修改设备信息或接口布局后调用 invalidate_descriptors
+         */
+        data_type get_device_descriptor(std::uint16_t language_id, std::uint16_t descriptor_length,
+                                        std::uint32_t *p_status);
+        data_type get_bos_descriptor(std::uint16_t language_id, std::uint16_t descriptor_length,
+                                     std::uint32_t *p_status);
+        data_type get_configuration_descriptor(std::uint16_t language_id, std::uint16_t descriptor_length,
+                                               std::uint32_t *p_status);
+        data_type get_string_descriptor(std::uint8_t language_id, std::uint16_t descriptor_length,
+                                        std::uint32_t *p_status);
+        data_type get_device_qualifier_descriptor(std::uint8_t language_id, std::uint16_t descriptor_length,
+                                                  std::uint32_t *p_status);
         virtual data_type get_other_speed_descriptor(std::uint8_t language_id, std::uint16_t descriptor_length,
                                                      std::uint32_t *p_status) =0;
 
@@ -112,44 +147,32 @@ namespace usbipdcpp {
 
         virtual void set_descriptor(std::uint16_t configuration_value) =0;
 
-        void change_string_configuration(const std::wstring &new_str) {
-            auto ret = string_pool.get_string(string_configuration_value);
-            if (ret) {
-                string_pool.remove_string(string_configuration_value);
-                string_configuration_value = string_pool.new_string(new_str);
+        void change_string_configuration(std::u16string_view new_str) {
+            if (string_pool.replace_string(string_configuration_value, new_str)) {
                 return;
             }
             SPDLOG_CRITICAL("string_configuration_value无效");
             throw std::system_error(std::make_error_code(std::errc::invalid_argument));
         }
 
-        void change_string_manufacturer(const std::wstring &new_str) {
-            auto ret = string_pool.get_string(string_manufacturer_value);
-            if (ret) {
-                string_pool.remove_string(string_manufacturer_value);
-                string_manufacturer_value = string_pool.new_string(new_str);
+        void change_string_manufacturer(std::u16string_view new_str) {
+            if (string_pool.replace_string(string_manufacturer_value, new_str)) {
                 return;
             }
             SPDLOG_CRITICAL("string_manufacturer_value无效");
             throw std::system_error(std::make_error_code(std::errc::invalid_argument));
         }
 
-        void change_string_product(const std::wstring &new_str) {
-            auto ret = string_pool.get_string(string_product_value);
-            if (ret) {
-                string_pool.remove_string(string_product_value);
-                string_product_value = string_pool.new_string(new_str);
+        void change_string_product(std::u16string_view new_str) {
+            if (string_pool.replace_string(string_product_value, new_str)) {
                 return;
             }
             SPDLOG_CRITICAL("string_product_value无效");
             throw std::system_error(std::make_error_code(std::errc::invalid_argument));
         }
 
-        void change_string_serial(const std::wstring &new_str) {
-            auto ret = string_pool.get_string(string_serial_value);
-            if (ret) {
-                string_pool.remove_string(string_serial_value);
-                string_serial_value = string_pool.new_string(new_str);
+        void change_string_serial(std::u16string_view new_str) {
+            if (string_pool.replace_string(string_serial_value, new_str)) {
                 return;
             }
             SPDLOG_CRITICAL("string_serial_value无效");
@@ -166,5 +189,13 @@ namespace usbipdcpp {
 
         Version usb_version;
         std::shared_mutex data_mutex;
+
+    private:
+        std::shared_ptr<const DescriptorSet> build_descriptor_set();
+
+        std::atomic<std::shared_ptr<const DescriptorSet>> descriptors;
+
+        std::shared_mutex control_dispatch_mutex;
+        std::array<std::mutex, 32> interface_dispatch_mutexes;
     };
 }
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <array>
+#include <deque>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+
+#include <asio/awaitable.hpp>
+#include <asio/cancellation_signal.hpp>
+#include <asio/executor_work_guard.hpp>
+#include <asio/io_context.hpp>
+
+#include "VirtualInterfaceHandler.h"
+#include "SetupPacket.h"
+#include "device.h"
+#include "endpoint.h"
+#include "protocol.h"
+
+namespace usbipdcpp
+{
+    /**
+     * @brief 协程式的虚拟接口：bulk、中断和类/厂商控制请求改为实现 async_* 协程，co_return 要应答的 RET_SUBMIT。
+     *
+     * 同步的 handle_* 钩子由本类实现，只把 URB 复制一份交给接口自己的执行器（单线程的 io_context）后立即返回，
+     * 不会阻塞 Session 的网络线程。协程可以 co_await 定时器、socket 或其他异步操作，所有协程都在同一个线程上运行，
+     * 互相之间不需要加锁，但不要在协程里做长时间的同步阻塞。
+     *
+     * 每个端点最多同时运行 max_in_flight_per_endpoint 个协程，多出的 URB 按到达顺序排队。
+     * 收到 CMD_UNLINK 时，排队中的 URB 直接应答 RET_UNLINK；运行中的协程收到 terminal 取消，
+     * 正在 co_await 的异步操作以 operation_aborted 结束，协程结束后本类应答 RET_UNLINK，协程不需要自己处理 unlink。
+     * 协程抛出其他异常时应答 EPIPE。
+     *
+     * 标准请求仍然走 VirtualInterfaceHandler 的同步 request_* 接口，已有的同步接口不受影响，
+     * 同一个设备里可以混用两种接口。
+     * 派生类析构时要先调用 shutdown()，避免协程在派生类析构后继续运行。
+     */
+    class AsyncVirtualInterfaceHandler : public VirtualInterfaceHandler
+    {
+    public:
+        /**
+         * @brief 协程拿到的 URB，数据已经复制，协程运行期间一直有效
+         */
+        struct AsyncUrb
+        {
+            std::uint32_t seqnum;
+            UsbEndpoint ep;
+            std::uint32_t transfer_flags;
+            std::uint32_t transfer_buffer_length;
+            data_type out_data;
+            // 只有控制请求有效
+            SetupPacket setup;
+        };
+
+        using ret_submit_awaitable = asio::awaitable<UsbIpResponse::UsbIpRetSubmit>;
+
+        static constexpr std::size_t DEFAULT_MAX_IN_FLIGHT_PER_ENDPOINT = 4;
+
+        AsyncVirtualInterfaceHandler(UsbInterface &handle_interface, StringPool &string_pool,
+                                     std::size_t max_in_flight_per_endpoint = DEFAULT_MAX_IN_FLIGHT_PER_ENDPOINT);
+        ~AsyncVirtualInterfaceHandler() override;
+
+        void handle_bulk_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                  std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
+                                  const data_type &out_data,
+                                  error_code &ec) override;
+        void handle_interrupt_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                       std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
+                                       const data_type &out_data,
+                                       std::error_code &ec) override;
+        void handle_non_standard_request_type_control_urb(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                                          std::uint32_t transfer_flags,
+                                                          std::uint32_t transfer_buffer_length,
+                                                          const SetupPacket &setup_packet,
+                                                          const data_type &out_data, std::error_code &ec) override;
+        void handle_unlink_seqnum(std::uint32_t seqnum) override;
+        void on_new_connection(Session &current_session, error_code &ec) override;
+        /**
+         * @brief 取消所有协程并丢弃排队的 URB，返回后不会再提交任何应答
+         */
+        void on_disconnection(error_code &ec) override;
+
+        /**
+         * @brief 协程运行的执行器，协程里也可以用 co_await asio::this_coro::executor 拿到
+         */
+        asio::io_context::executor_type get_executor()
+        {
+            return io_context.get_executor();
+        }
+
+    protected:
+        /**
+         * @brief 以下三个协程默认应答 EPIPE，按需要覆盖
+         */
+        virtual ret_submit_awaitable async_bulk_transfer(AsyncUrb urb);
+        virtual ret_submit_awaitable async_interrupt_transfer(AsyncUrb urb);
+        /**
+         * @brief 类和厂商控制请求，OUT 请求的数据在 urb.out_data 中
+         */
+        virtual ret_submit_awaitable async_control_transfer(AsyncUrb urb);
+
+        /**
+         * @brief 取消所有协程并停止执行器线程，可以重复调用
+         */
+        void shutdown();
+
+    private:
+        enum class UrbKind
+        {
+            Bulk,
+            Interrupt,
+            Control,
+        };
+
+        struct QueuedUrb
+        {
+            UrbKind kind;
+            AsyncUrb urb;
+        };
+
+        struct EndpointQueue
+        {
+            std::size_t in_flight = 0;
+            std::deque<QueuedUrb> waiting;
+        };
+
+        struct RunningUrb
+        {
+            asio::cancellation_signal cancel;
+            // 协程已经结束，取消信号等协程栈完全退出后再删除
+            bool done = false;
+        };
+
+        // 以下函数只在执行器线程上调用
+        void enqueue(UrbKind kind, AsyncUrb &&urb);
+        void start(UrbKind kind, AsyncUrb &&urb);
+        asio::awaitable<std::optional<UsbIpResponse::UsbIpRetSubmit>> run_hook(UrbKind kind, AsyncUrb urb);
+        void finish(std::size_t route, std::uint32_t seqnum, std::uint64_t started_generation,
+                    std::optional<UsbIpResponse::UsbIpRetSubmit> &&ret);
+        void unlink(std::uint32_t seqnum);
+        void cancel_all();
+
+        /**
+         * @brief 在执行器线程上运行 f 并等它完成，已经在执行器线程上时直接调用
+         */
+        template<typename F>
+        void run_on_executor_and_wait(F &&f);
+
+        const std::size_t max_in_flight_per_endpoint;
+
+        asio::io_context io_context{1};
+        asio::executor_work_guard<asio::io_context::executor_type> work_guard;
+        std::thread executor_thread;
+
+        // 以下成员只在执行器线程上访问
+        std::array<EndpointQueue, UsbDevice::route_count> endpoints{};
+        std::unordered_map<std::uint32_t, RunningUrb> running;
+        // 每次断开加 1，上一次连接遗留的协程结束后不再应答
+        std::uint64_t generation = 0;
+    };
+}
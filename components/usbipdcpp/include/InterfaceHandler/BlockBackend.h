@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+namespace usbipdcpp
+{
+    /**
+     * @brief 虚拟U盘的块存储后端，偏移和长度都以字节为单位，调用方保证不越界，但不保证按块对齐
+     *
+     * 同一个后端只会被一个 MassStorageVirtualInterfaceHandler 串行访问，实现不需要加锁
+     */
+    class BlockBackend
+    {
+    public:
+        virtual ~BlockBackend() = default;
+
+        [[nodiscard]] virtual std::uint32_t block_size() const = 0;
+        [[nodiscard]] virtual std::uint64_t block_count() const = 0;
+
+        [[nodiscard]] virtual bool read_only() const
+        {
+            return false;
+        }
+
+        /**
+         * @brief 数据可以直接按地址读取时（RAM 盘、mmap 的 flash）返回 offset 处的地址，
+         * READ 命令的应答直接指向这里发送，不经过中间缓冲区。
+         * 返回的地址在下一次 write 之前有效，不支持时返回空指针
+         */
+        [[nodiscard]] virtual const std::uint8_t *map(std::uint64_t offset, std::size_t length)
+        {
+            return nullptr;
+        }
+
+        virtual bool read(std::uint64_t offset, std::uint8_t *dst, std::size_t length) = 0;
+        virtual bool write(std::uint64_t offset, const std::uint8_t *src, std::size_t length) = 0;
+
+        /**
+         * @brief SYNCHRONIZE CACHE 时调用
+         */
+        virtual bool flush()
+        {
+            return true;
+        }
+    };
+}
@@ -0,0 +1,315 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "type.h"
+
+namespace usbipdcpp
+{
+    class Session;
+    class CdcAcmPort;
+
+    namespace cdc
+    {
+        constexpr std::uint8_t INTERFACE_CLASS_COMMUNICATION = 0x02;
+        constexpr std::uint8_t INTERFACE_SUBCLASS_ACM = 0x02;
+        constexpr std::uint8_t INTERFACE_PROTOCOL_AT = 0x01;
+        constexpr std::uint8_t INTERFACE_CLASS_DATA = 0x0A;
+
+        constexpr std::uint8_t REQUEST_SET_LINE_CODING = 0x20;
+        constexpr std::uint8_t REQUEST_GET_LINE_CODING = 0x21;
+        constexpr std::uint8_t REQUEST_SET_CONTROL_LINE_STATE = 0x22;
+        constexpr std::uint8_t REQUEST_SEND_BREAK = 0x23;
+
+        constexpr std::uint8_t NOTIFICATION_SERIAL_STATE = 0x20;
+        constexpr std::size_t SERIAL_STATE_NOTIFICATION_LENGTH = 10;
+
+        // SET_CONTROL_LINE_STATE 的 wValue
+        constexpr std::uint16_t CONTROL_LINE_DTR = 0x01;
+        constexpr std::uint16_t CONTROL_LINE_RTS = 0x02;
+
+        // SERIAL_STATE 通知的 UART 状态位，BREAK 之后的几位只报告一次
+        constexpr std::uint16_t SERIAL_STATE_DCD = 0x01;
+        constexpr std::uint16_t SERIAL_STATE_DSR = 0x02;
+        constexpr std::uint16_t SERIAL_STATE_BREAK = 0x04;
+        constexpr std::uint16_t SERIAL_STATE_RING = 0x08;
+        constexpr std::uint16_t SERIAL_STATE_FRAMING = 0x10;
+        constexpr std::uint16_t SERIAL_STATE_PARITY = 0x20;
+        constexpr std::uint16_t SERIAL_STATE_OVERRUN = 0x40;
+        constexpr std::uint16_t SERIAL_STATE_ONE_SHOT_MASK = 0x7C;
+    }
+
+    /**
+     * @brief SET_LINE_CODING / GET_LINE_CODING 的 7 字节数据
+     */
+    struct CdcLineCoding
+    {
+        std::uint32_t baud_rate = 115200;
+        std::uint8_t stop_bits = 0; // 0: 1 位，1: 1.5 位，2: 2 位
+        std::uint8_t parity = 0;    // 0: 无，1: 奇，2: 偶，3: mark，4: space
+        std::uint8_t data_bits = 8;
+
+        static constexpr std::size_t length = 7;
+
+        [[nodiscard]] data_type to_bytes() const
+        {
+            return {
+                static_cast<std::uint8_t>(baud_rate),
+                static_cast<std::uint8_t>(baud_rate >> 8),
+                static_cast<std::uint8_t>(baud_rate >> 16),
+                static_cast<std::uint8_t>(baud_rate >> 24),
+                stop_bits,
+                parity,
+                data_bits,
+            };
+        }
+
+        static std::optional<CdcLineCoding> parse(const data_type &data)
+        {
+            if (data.size() < length)
+            {
+                return std::nullopt;
+            }
+            return CdcLineCoding{
+                .baud_rate = static_cast<std::uint32_t>(data[0]) | (static_cast<std::uint32_t>(data[1]) << 8) |
+                             (static_cast<std::uint32_t>(data[2]) << 16) |
+                             (static_cast<std::uint32_t>(data[3]) << 24),
+                .stop_bits = data[4],
+                .parity = data[5],
+                .data_bits = data[6]};
+        }
+    };
+
+    /**
+     * @brief 虚拟串口另一端的实现，例如回环、UART
+     *
+     * 所有回调都在不持有 CdcAcmPort 内部锁的情况下调用，可以在回调中读写 port。
+     * on_data_from_host 和 on_space_to_host 可能在不同线程同时调用。
+     */
+    class CdcAcmBackend
+    {
+    public:
+        virtual ~CdcAcmBackend() = default;
+
+        /**
+         * @brief 客户端导入设备时调用
+         */
+        virtual void start(CdcAcmPort &port)
+        {
+        }
+
+        /**
+         * @brief 客户端断开时调用，返回后不能再访问 port
+         */
+        virtual void stop()
+        {
+        }
+
+        /**
+         * @brief 主机发来了新数据，用 CdcAcmPort::read 取走
+         */
+        virtual void on_data_from_host(CdcAcmPort &port)
+        {
+        }
+
+        /**
+         * @brief 发往主机的缓冲区腾出了空间
+         */
+        virtual void on_space_to_host(CdcAcmPort &port)
+        {
+        }
+
+        virtual void on_line_coding(CdcAcmPort &port, const CdcLineCoding &line_coding)
+        {
+        }
+
+        virtual void on_control_line_state(CdcAcmPort &port, bool dtr, bool rts)
+        {
+        }
+
+        /**
+         * @param duration_ms 0xFFFF 表示一直保持直到下一个 SEND_BREAK(0)
+         */
+        virtual void on_break(CdcAcmPort &port, std::uint16_t duration_ms)
+        {
+        }
+    };
+
+    /**
+     * @brief 虚拟 CDC ACM 串口的字节流，由通信接口和数据接口的 handler 共用
+     *
+     * 主机发来的数据和发往主机的数据各有一个环形缓冲区。
+     * bulk IN URB 在没有数据时暂存，等到 write 写入数据再应答；
+     * 接收缓冲区满时 bulk OUT URB 暂存到 read 腾出空间才应答，以此向主机施加背压。
+     */
+    class CdcAcmPort
+    {
+    public:
+        struct Stats
+        {
+            std::uint64_t bytes_to_host = 0;   // 经 bulk IN 交给主机的字节数
+            std::uint64_t bytes_from_host = 0; // 经 bulk OUT 收到的字节数
+            std::uint64_t immediate_urbs = 0;  // 到达时已有数据、立即应答的 bulk IN URB
+            std::uint64_t waited_urbs = 0;     // 到达时没有数据、等待 write 的 bulk IN URB
+            std::uint64_t throttled_urbs = 0;  // 接收缓冲区满而暂缓应答的 bulk OUT URB
+            std::uint64_t notifications = 0;   // 发出的 SERIAL_STATE 通知
+        };
+
+        explicit CdcAcmPort(std::size_t ring_bytes = 16 * 1024);
+
+        CdcAcmPort(const CdcAcmPort &) = delete;
+        CdcAcmPort &operator=(const CdcAcmPort &) = delete;
+
+        /**
+         * @brief 在导入设备前设置
+         */
+        void set_backend(std::shared_ptr<CdcAcmBackend> backend);
+
+        /**
+         * @brief 发往主机，有等待的 bulk IN URB 时立即应答
+         * @return 实际写入的字节数，缓冲区满时小于 length
+         */
+        std::size_t write(const std::uint8_t *data, std::size_t length);
+
+        /**
+         * @brief 取出主机发来的数据
+         */
+        std::size_t read(std::uint8_t *dst, std::size_t length);
+
+        [[nodiscard]] std::size_t readable() const;
+        [[nodiscard]] std::size_t writable() const;
+
+        /**
+         * @brief 更新 UART 状态，经中断端点通知主机。BREAK 及错误位只通知一次
+         */
+        void set_serial_state(std::uint16_t state);
+
+        [[nodiscard]] CdcLineCoding line_coding() const;
+        [[nodiscard]] std::uint16_t control_line_state() const;
+        [[nodiscard]] Stats stats() const;
+
+    private:
+        friend class CdcAcmVirtualInterfaceHandler;
+        friend class CdcAcmDataVirtualInterfaceHandler;
+
+        struct Ring
+        {
+            std::vector<std::uint8_t> buffer;
+            std::size_t head = 0;
+            std::size_t size = 0;
+
+            [[nodiscard]] std::size_t space() const
+            {
+                return buffer.size() - size;
+            }
+
+            std::size_t push(const std::uint8_t *data, std::size_t length);
+            std::size_t pop(std::uint8_t *dst, std::size_t length);
+            void clear()
+            {
+                head = 0;
+                size = 0;
+            }
+        };
+
+        struct WaitingIn
+        {
+            std::uint32_t seqnum;
+            std::uint32_t length;
+        };
+
+        struct PendingOut
+        {
+            std::uint32_t seqnum;
+            data_type data;
+            // 已经放进接收缓冲区的字节数
+            std::size_t offset = 0;
+        };
+
+        // 以下函数由接口 handler 调用
+        void attach(Session &session);
+        void detach();
+        void handle_bulk_in(std::uint32_t seqnum, std::uint32_t length);
+        void handle_bulk_out(std::uint32_t seqnum, const data_type &data);
+        void handle_notification_in(std::uint32_t seqnum, std::uint32_t length);
+        void handle_unlink(std::uint32_t seqnum);
+        void handle_set_line_coding(const CdcLineCoding &line_coding);
+        void handle_set_control_line_state(std::uint16_t state);
+        void handle_send_break(std::uint16_t duration_ms);
+
+        // 以下函数需要持有 mutex
+        void deliver_to_host();
+        void send_serial_state(std::uint32_t seqnum);
+        void accept_pending_out();
+        void ack_out(std::uint32_t seqnum, std::size_t length);
+
+        mutable std::mutex mutex;
+        Session *session = nullptr;
+        std::shared_ptr<CdcAcmBackend> backend;
+        // 通知中的 wIndex，由通信接口的 handler 设置
+        std::uint8_t comm_interface = 0;
+
+        Ring to_host;
+        Ring from_host;
+        std::deque<WaitingIn> waiting_in;
+        std::deque<PendingOut> pending_out;
+        std::deque<std::uint32_t> waiting_notifications;
+
+        CdcLineCoding line_coding_{};
+        std::uint16_t control_line_state_ = 0;
+        std::uint16_t serial_state = 0;
+        bool serial_state_dirty = false;
+
+        Stats stats_{};
+    };
+
+    /**
+     * @brief 把主机发来的数据原样发回去，用于测试吞吐和延迟
+     */
+    class LoopbackCdcAcmBackend : public CdcAcmBackend
+    {
+    public:
+        void on_data_from_host(CdcAcmPort &port) override
+        {
+            pump(port);
+        }
+
+        void on_space_to_host(CdcAcmPort &port) override
+        {
+            pump(port);
+        }
+
+        void on_control_line_state(CdcAcmPort &port, bool dtr, bool rts) override
+        {
+            // 终端打开串口时置 DTR，回环的另一端视为立即就绪
+            port.set_serial_state(dtr ? cdc::SERIAL_STATE_DCD | cdc::SERIAL_STATE_DSR : 0);
+        }
+
+    private:
+        void pump(CdcAcmPort &port)
+        {
+            // 两个方向的回调可能同时到达，串行化以免数据乱序
+            std::lock_guard lock(mutex);
+            std::array<std::uint8_t, 512> buffer{};
+            while (true)
+            {
+                auto n = port.read(buffer.data(), std::min(buffer.size(), port.writable()));
+                if (n == 0)
+                {
+                    break;
+                }
+                port.write(buffer.data(), n);
+            }
+        }
+
+        std::mutex mutex;
+    };
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <memory>
+
+#include "VirtualInterfaceHandler.h"
+#include "CdcAcmPort.h"
+
+namespace usbipdcpp
+{
+    /**
+     * @brief 虚拟 CDC ACM 串口的通信接口，class/subclass/protocol 为 0x02/0x02/0x01，
+     * 带一个中断 IN 端点用来发送 SERIAL_STATE 通知。
+     *
+     * 数据接口（CdcAcmDataVirtualInterfaceHandler）必须紧跟在通信接口之后，
+     * 两者共用同一个 CdcAcmPort。设备只有这一个功能时设备类设为 0x02，不需要 IAD。
+     */
+    class CdcAcmVirtualInterfaceHandler : public VirtualInterfaceHandler
+    {
+    public:
+        /**
+         * @param interface_number 本接口在配置中的编号，数据接口的编号为它加 1
+         */
+        CdcAcmVirtualInterfaceHandler(UsbInterface &handle_interface, StringPool &string_pool,
+                                      std::shared_ptr<CdcAcmPort> port, std::uint8_t interface_number = 0);
+
+        void handle_interrupt_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                       std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
+                                       const data_type &out_data,
+                                       std::error_code &ec) override;
+        void handle_non_standard_request_type_control_urb(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                                          std::uint32_t transfer_flags,
+                                                          std::uint32_t transfer_buffer_length,
+                                                          const SetupPacket &setup_packet,
+                                                          const data_type &out_data, std::error_code &ec) override;
+        void handle_unlink_seqnum(std::uint32_t seqnum) override;
+        void on_new_connection(Session &current_session, error_code &ec) override;
+        void on_disconnection(error_code &ec) override;
+
+        void request_clear_feature(std::uint16_t feature_selector, std::uint32_t *p_status) override
+        {
+        }
+        void request_endpoint_clear_feature(std::uint16_t feature_selector, std::uint8_t ep_address,
+                                            std::uint32_t *p_status) override
+        {
+        }
+        std::uint8_t request_get_interface(std::uint32_t *p_status) override
+        {
+            return 0;
+        }
+        void request_set_interface(std::uint16_t alternate_setting, std::uint32_t *p_status) override
+        {
+        }
+        std::uint16_t request_get_status(std::uint32_t *p_status) override
+        {
+            return 0;
+        }
+        std::uint16_t request_endpoint_get_status(std::uint8_t ep_address, std::uint32_t *p_status) override
+        {
+            return 0;
+        }
+        void request_set_feature(std::uint16_t feature_selector, std::uint32_t *p_status) override
+        {
+        }
+        void request_endpoint_set_feature(std::uint16_t feature_selector, std::uint8_t ep_address,
+                                          std::uint32_t *p_status) override
+        {
+        }
+
+        /**
+         * @brief Header、Call Management、ACM、Union 四个功能描述符
+         */
+        [[nodiscard]] data_type get_class_specific_descriptor() override;
+
+        [[nodiscard]] const std::shared_ptr<CdcAcmPort> &get_port() const
+        {
+            return port;
+        }
+
+    private:
+        std::shared_ptr<CdcAcmPort> port;
+        std::uint8_t interface_number;
+    };
+
+    /**
+     * @brief 虚拟 CDC ACM 串口的数据接口，class 为 0x0A，带一个 bulk IN 和一个 bulk OUT 端点
+     */
+    class CdcAcmDataVirtualInterfaceHandler : public VirtualInterfaceHandler
+    {
+    public:
+        CdcAcmDataVirtualInterfaceHandler(UsbInterface &handle_interface, StringPool &string_pool,
+                                          std::shared_ptr<CdcAcmPort> port) :
+            VirtualInterfaceHandler(handle_interface, string_pool), port(std::move(port))
+        {
+        }
+
+        void handle_bulk_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                  std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
+                                  const data_type &out_data,
+                                  error_code &ec) override;
+        void handle_unlink_seqnum(std::uint32_t seqnum) override;
+        void on_new_connection(Session &current_session, error_code &ec) override;
+        void on_disconnection(error_code &ec) override;
+
+        void request_clear_feature(std::uint16_t feature_selector, std::uint32_t *p_status) override
+        {
+        }
+        void request_endpoint_clear_feature(std::uint16_t feature_selector, std::uint8_t ep_address,
+                                            std::uint32_t *p_status) override
+        {
+        }
+        std::uint8_t request_get_interface(std::uint32_t *p_status) override
+        {
+            return 0;
+        }
+        void request_set_interface(std::uint16_t alternate_setting, std::uint32_t *p_status) override
+        {
+        }
+        std::uint16_t request_get_status(std::uint32_t *p_status) override
+        {
+            return 0;
+        }
+        std::uint16_t request_endpoint_get_status(std::uint8_t ep_address, std::uint32_t *p_status) override
+        {
+            return 0;
+        }
+        void request_set_feature(std::uint16_t feature_selector, std::uint32_t *p_status) override
+        {
+        }
+        void request_endpoint_set_feature(std::uint16_t feature_selector, std::uint8_t ep_address,
+                                          std::uint32_t *p_status) override
+        {
+        }
+
+        [[nodiscard]] data_type get_class_specific_descriptor() override
+        {
+            return {};
+        }
+
+    private:
+        std::shared_ptr<CdcAcmPort> port;
+    };
+}
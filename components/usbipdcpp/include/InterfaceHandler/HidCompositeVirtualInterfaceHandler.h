@@ -0,0 +1,184 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "HidVirtualInterfaceHandler.h"
+
+namespace usbipdcpp
+{
+    /**
+     * @brief 组合 HID 中的一个成员，例如直通键盘的一个 HID 接口
+     *
+     * report id 都是成员自己的编号，没有 report id 的成员为 0，数据中也不带 report id。
+     */
+    class HidReportSource
+    {
+    public:
+        /**
+         * @brief 收到一份输入报告，可能在任意线程调用
+         */
+        using ReportSink = std::function<void(const std::uint8_t *data, std::size_t length)>;
+
+        virtual ~HidReportSource() = default;
+
+        [[nodiscard]] virtual std::string name() const = 0;
+        [[nodiscard]] virtual const data_type &report_descriptor() const = 0;
+
+        /**
+         * @brief 客户端导入组合设备时调用，之后把输入报告交给 sink
+         */
+        virtual void start(ReportSink sink) = 0;
+
+        /**
+         * @brief 客户端断开时调用，返回后不能再调用 sink
+         */
+        virtual void stop() = 0;
+
+        /**
+         * @brief 转发 GET_REPORT，返回 URB 状态
+         */
+        virtual std::uint32_t get_report(std::uint8_t type, std::uint8_t report_id, std::uint16_t length,
+                                         data_type &data) = 0;
+
+        /**
+         * @brief 转发 SET_REPORT，例如键盘的 LED 输出报告，返回 URB 状态
+         */
+        virtual std::uint32_t set_report(std::uint8_t type, std::uint8_t report_id, const data_type &data) = 0;
+    };
+
+    /**
+     * @brief 把多个 HID 接口合成一个 HID 接口导出，一个会话就能带上整张桌子的键盘、鼠标和手柄。
+     *
+     * 各成员的报告描述符依次拼接，report id 重新编号：
+     * 成员自己有 report id 的按出现顺序换成新的编号，没有的在每个顶层集合开头插入一个新的 report id。
+     * 输入报告按同样的映射改写第一个字节或在前面加上编号，GET_REPORT、SET_REPORT 按编号转发给对应的成员。
+     * SET_IDLE 直接成功，成员在启动时各自设为只在变化时发送报告。
+     */
+    class HidCompositeVirtualInterfaceHandler : public HidVirtualInterfaceHandler
+    {
+    public:
+        struct MemberStats
+        {
+            std::string name;
+            std::uint8_t first_report_id = 0; // 分配给该成员的第一个组合 report id
+            std::uint8_t report_ids = 0;      // 分配给该成员的组合 report id 个数
+            std::uint64_t reports = 0;        // 转发给客户端的输入报告
+            std::uint64_t unknown_ids = 0;    // report id 不在描述符中而丢弃的输入报告
+        };
+
+        /**
+         * @brief 拼接后的报告描述符和 report id 映射
+         */
+        struct MergedDescriptor
+        {
+            struct Route
+            {
+                std::int16_t member = -1; // -1 表示该组合 report id 没有分配
+                std::uint8_t report_id = 0;
+            };
+            struct Member
+            {
+                bool uses_report_ids = false;
+                // 成员 report id 到组合 report id，0 表示没有
+                std::array<std::uint8_t, 256> to_composite{};
+            };
+
+            data_type descriptor;
+            std::array<Route, 256> routes{};
+            std::vector<Member> members;
+        };
+
+        /**
+         * @brief 拼接报告描述符，描述符无法解析或 report id 超过 255 个时返回空
+         */
+        static std::optional<MergedDescriptor> merge_report_descriptors(const std::vector<const data_type *> &descriptors);
+
+        /**
+         * @brief 描述符无法合并时 usable() 返回 false，不能导出
+         */
+        HidCompositeVirtualInterfaceHandler(UsbInterface &handle_interface, StringPool &string_pool,
+                                            std::vector<std::unique_ptr<HidReportSource>> &&sources);
+        ~HidCompositeVirtualInterfaceHandler() override;
+
+        [[nodiscard]] bool usable() const
+        {
+            return merged.has_value();
+        }
+
+        [[nodiscard]] std::vector<MemberStats> member_stats() const;
+
+        void on_new_connection(Session &current_session, error_code &ec) override;
+        void on_disconnection(error_code &ec) override;
+
+        void handle_non_hid_request_type_control_urb(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                                     std::uint32_t transfer_flags,
+                                                     std::uint32_t transfer_buffer_length,
+                                                     const SetupPacket &setup_packet,
+                                                     const data_type &out_data, std::error_code &ec) override;
+
+        data_type get_report_descriptor() override;
+        std::uint16_t get_report_descriptor_size() override;
+
+        data_type request_get_report(std::uint8_t type, std::uint8_t report_id, std::uint16_t length,
+                                     std::uint32_t *p_status) override;
+        void request_set_report(std::uint8_t type, std::uint8_t report_id, std::uint16_t length,
+                                const data_type &data, std::uint32_t *p_status) override;
+        void request_set_idle(std::uint8_t speed, std::uint32_t *p_status) override
+        {
+        }
+
+        void request_clear_feature(std::uint16_t feature_selector, std::uint32_t *p_status) override
+        {
+        }
+        void request_endpoint_clear_feature(std::uint16_t feature_selector, std::uint8_t ep_address,
+                                            std::uint32_t *p_status) override
+        {
+        }
+        std::uint8_t request_get_interface(std::uint32_t *p_status) override
+        {
+            return 0;
+        }
+        void request_set_interface(std::uint16_t alternate_setting, std::uint32_t *p_status) override
+        {
+        }
+        std::uint16_t request_get_status(std::uint32_t *p_status) override
+        {
+            return 0;
+        }
+        std::uint16_t request_endpoint_get_status(std::uint8_t ep_address, std::uint32_t *p_status) override
+        {
+            return 0;
+        }
+        void request_set_feature(std::uint16_t feature_selector, std::uint32_t *p_status) override
+        {
+        }
+        void request_endpoint_set_feature(std::uint16_t feature_selector, std::uint8_t ep_address,
+                                          std::uint32_t *p_status) override
+        {
+        }
+
+    private:
+        struct MemberCounters
+        {
+            std::atomic<std::uint64_t> reports = 0;
+            std::atomic<std::uint64_t> unknown_ids = 0;
+        };
+
+        void on_member_report(std::size_t member, const std::uint8_t *data, std::size_t length);
+        /**
+         * @brief 找到组合 report id 对应的成员，没有时返回空
+         */
+        [[nodiscard]] const MergedDescriptor::Route *find_route(std::uint8_t report_id) const;
+
+        // 构造后不再改变
+        const std::vector<std::unique_ptr<HidReportSource>> sources;
+        const std::optional<MergedDescriptor> merged;
+        std::unique_ptr<MemberCounters[]> counters;
+    };
+}
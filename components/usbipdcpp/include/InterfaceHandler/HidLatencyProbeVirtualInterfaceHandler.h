@@ -0,0 +1,119 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "HidVirtualInterfaceHandler.h"
+
+namespace usbipdcpp
+{
+    /**
+     * @brief 测量端到端输入延迟的厂商自定义 HID 接口，按固定间隔通过 push_report 发送输入报告。
+     *
+     * 输入报告 64 字节、没有 report ID，多字节字段都是小端：
+     *   [0, 4)   序号，从 0 开始，每份报告加 1，客户端据此发现丢失的报告
+     *   [4, 12)  生成报告时服务端单调时钟的微秒数
+     *   [12, 20) 最近一次输出报告中客户端写入的时间戳，没有收到过时为 0
+     *   [20, 28) 收到那次输出报告时服务端单调时钟的微秒数
+     *   [28, 32) 发送间隔，微秒
+     * 输出报告 8 字节，是客户端的时间戳，设备在之后的输入报告中原样带回，
+     * 客户端用它像 NTP 一样估计两边时钟的偏差，从而算出单向延迟。
+     */
+    class HidLatencyProbeVirtualInterfaceHandler : public HidVirtualInterfaceHandler
+    {
+    public:
+        static constexpr std::size_t INPUT_REPORT_SIZE = 64;
+        static constexpr std::size_t OUTPUT_REPORT_SIZE = 8;
+
+        struct Config
+        {
+            std::uint32_t interval_us = 1000;
+            // Queue 模式下每份报告都会送到，丢失只可能发生在暂存队列满的时候
+            ReportMode report_mode = ReportMode::Queue;
+        };
+
+        HidLatencyProbeVirtualInterfaceHandler(UsbInterface &handle_interface, StringPool &string_pool,
+                                               const Config &config);
+        ~HidLatencyProbeVirtualInterfaceHandler() override;
+
+        void on_new_connection(Session &current_session, error_code &ec) override;
+        void on_disconnection(error_code &ec) override;
+
+        void handle_non_hid_request_type_control_urb(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                                     std::uint32_t transfer_flags,
+                                                     std::uint32_t transfer_buffer_length,
+                                                     const SetupPacket &setup_packet,
+                                                     const data_type &out_data, std::error_code &ec) override;
+
+        data_type get_report_descriptor() override;
+        std::uint16_t get_report_descriptor_size() override;
+
+        data_type request_get_report(std::uint8_t type, std::uint8_t report_id, std::uint16_t length,
+                                     std::uint32_t *p_status) override;
+        void request_set_report(std::uint8_t type, std::uint8_t report_id, std::uint16_t length,
+                                const data_type &data, std::uint32_t *p_status) override;
+
+        void request_clear_feature(std::uint16_t feature_selector, std::uint32_t *p_status) override
+        {
+        }
+        void request_endpoint_clear_feature(std::uint16_t feature_selector, std::uint8_t ep_address,
+                                            std::uint32_t *p_status) override
+        {
+        }
+        std::uint8_t request_get_interface(std::uint32_t *p_status) override
+        {
+            return 0;
+        }
+        void request_set_interface(std::uint16_t alternate_setting, std::uint32_t *p_status) override
+        {
+        }
+        std::uint16_t request_get_status(std::uint32_t *p_status) override
+        {
+            return 0;
+        }
+        std::uint16_t request_endpoint_get_status(std::uint8_t ep_address, std::uint32_t *p_status) override
+        {
+            return 0;
+        }
+        void request_set_feature(std::uint16_t feature_selector, std::uint32_t *p_status) override
+        {
+        }
+        void request_endpoint_set_feature(std::uint16_t feature_selector, std::uint8_t ep_address,
+                                          std::uint32_t *p_status) override
+        {
+        }
+
+        /**
+         * @brief 下一份报告的序号，也就是本次连接以来生成的报告数
+         */
+        [[nodiscard]] std::uint32_t next_sequence() const
+        {
+            return sequence.load(std::memory_order_relaxed);
+        }
+
+    private:
+        /**
+         * @brief 服务端单调时钟，微秒
+         */
+        static std::uint64_t now_us();
+
+        data_type make_report(std::uint32_t seq);
+        void generate_loop();
+
+        const Config config;
+
+        std::atomic<std::uint32_t> sequence = 0;
+        // 客户端时间戳和收到它时的服务端时间，两个一起读写
+        std::mutex echo_mutex;
+        std::uint64_t echo_host_us = 0;
+        std::uint64_t echo_server_us = 0;
+
+        std::mutex generate_mutex;
+        std::condition_variable generate_cv;
+        bool connected = false;
+        bool generate_stop = false;
+        std::thread generate_thread;
+    };
+}
@@ -1,6 +1,11 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
 #include "protocol.h"
+#include "BoundedMpscQueue.h"
 #include "VirtualInterfaceHandler.h"
 #include "SetupPacket.h"
 #include "constant.h"
@@ -10,6 +15,9 @@ namespace usbipdcpp
     /**
      * @brief Notice: handle get_descriptor request in handle_non_standard_control_urb,
      * and return descriptor by calling get_report_descriptor.
+     *
+     * 输入报告用 push_report 发送：中断 IN URB 到达时如果没有报告就暂存起来，
+     * 报告和 URB 谁后到谁负责把两者配对应答，两边都不加锁。
      */
     class HidVirtualInterfaceHandler : public VirtualInterfaceHandler
     {
@@ -18,6 +26,54 @@ namespace usbipdcpp
         {
         }
 
+        ~HidVirtualInterfaceHandler() override
+        {
+            delete latest_report.load();
+        }
+
+        enum class ReportMode
+        {
+            Queue,    // 报告按顺序排队，队列满时丢弃新的报告
+            Coalesce, // 只保留最新的一份，适合手柄、绝对坐标设备等每份报告都是完整状态的设备
+        };
+
+        struct ReportStats
+        {
+            std::uint64_t pushed = 0;        // push_report 收到的报告
+            std::uint64_t delivered = 0;     // 应答给客户端的报告
+            std::uint64_t merged = 0;        // Coalesce 模式下被新报告覆盖的报告
+            std::uint64_t dropped = 0;       // 未连接或队列满而丢弃的报告
+            std::uint64_t waited_urbs = 0;   // 配对时没有报告、URB 留在队列中等待的次数
+            std::uint64_t rejected_urbs = 0; // 暂存队列满而以 EPIPE 应答的 URB
+        };
+
+        static constexpr std::size_t PENDING_REPORT_CAPACITY = 32;
+        static constexpr std::size_t PENDING_URB_CAPACITY = 16;
+
+        /**
+         * @brief 线程安全，发送一份输入报告，有暂存的中断 IN URB 时在当前线程直接应答
+         * @return 报告被丢弃时返回 false
+         */
+        bool push_report(data_type report);
+
+        /**
+         * @brief 切换模式前暂存的报告仍按原来的方式发出
+         */
+        void set_report_mode(ReportMode mode)
+        {
+            report_mode.store(mode, std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] ReportStats report_stats() const;
+
+        void handle_interrupt_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                       std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
+                                       const data_type &out_data,
+                                       std::error_code &ec) override;
+        void handle_unlink_seqnum(std::uint32_t seqnum) override;
+        void on_new_connection(Session &current_session, error_code &ec) override;
+        void on_disconnection(error_code &ec) override;
+
         void handle_non_standard_request_type_control_urb(std::uint32_t seqnum, const UsbEndpoint &ep,
                                                           std::uint32_t transfer_flags,
                                                           std::uint32_t transfer_buffer_length,
@@ -34,6 +90,11 @@ namespace usbipdcpp
         data_type request_get_descriptor(std::uint8_t type, std::uint8_t language_id,
                                          std::uint16_t descriptor_length, std::uint32_t *p_status) override;
 
+        /**
+         * @brief 报告描述符从 report_descriptor_blob 直接引用发送
+         */
+        descriptor_ptr find_cached_descriptor(std::uint8_t type, std::uint8_t index) override;
+
         [[nodiscard]] data_type get_class_specific_descriptor() override;
 
         virtual data_type get_report_descriptor() = 0;
@@ -71,5 +132,55 @@ namespace usbipdcpp
         virtual data_type request_get_idle(std::uint8_t type, std::uint8_t report_id, std::uint16_t length,
                                            std::uint32_t *p_status);
         virtual void request_set_idle(std::uint8_t speed, std::uint32_t *p_status);
+
+    protected:
+        /**
+         * @brief 第一次请求时调用 get_report_descriptor 生成，之后的请求共享同一份
+         */
+        descriptor_ptr report_descriptor_blob();
+        /**
+         * @brief 报告描述符改变后调用，下一个请求会重新生成
+         */
+        void invalidate_report_descriptor();
+
+    private:
+        struct PendingUrb
+        {
+            std::uint32_t seqnum;
+            std::uint32_t length;
+            bool unlinked = false; // 已经应答了 RET_UNLINK，留在原位，出队时跳过
+        };
+
+        /**
+         * @brief 请求一次配对，已有线程在配对时由它多做一轮，当前线程立即返回
+         */
+        void drain();
+        // 以下函数只在 drain 中调用
+        void drain_once();
+        bool answer_if_unlinked(Session &current_session, const PendingUrb &urb);
+        std::optional<data_type> take_report();
+        void discard_pending();
+
+        std::atomic<descriptor_ptr> report_descriptor;
+
+        std::atomic<ReportMode> report_mode = ReportMode::Queue;
+        BoundedMpscQueue<PendingUrb, PENDING_URB_CAPACITY> pending_urbs;
+        BoundedMpscQueue<data_type, PENDING_REPORT_CAPACITY> pending_reports;
+        // Coalesce 模式下最新的报告，被新报告替换时直接释放
+        std::atomic<data_type *> latest_report = nullptr;
+
+        std::atomic<std::uint32_t> drain_requests = 0;
+        // 配对的线程做完所有请求后通知，断开连接时在上面等待
+        std::mutex drain_idle_mutex;
+        std::condition_variable drain_idle_cv;
+        std::atomic<bool> sweep_requested = false;
+        std::atomic<bool> discard_requested = false;
+
+        std::atomic<std::uint64_t> pushed_reports = 0;
+        std::atomic<std::uint64_t> delivered_reports = 0;
+        std::atomic<std::uint64_t> merged_reports = 0;
+        std::atomic<std::uint64_t> dropped_reports = 0;
+        std::atomic<std::uint64_t> waited_urbs = 0;
+        std::atomic<std::uint64_t> rejected_urbs = 0;
     };
 }
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "VirtualInterfaceHandler.h"
+#include "BlockBackend.h"
+#include "BotProtocol.h"
+
+namespace usbipdcpp
+{
+    /**
+     * @brief Bulk-Only Transport + SCSI 透明命令集的虚拟U盘接口
+     *
+     * 接口需要一个 bulk IN 和一个 bulk OUT 端点，class/subclass/protocol 为 0x08/0x06/0x50。
+     * 每个 LUN 对应一个 BlockBackend，块大小由后端决定。
+     * 后端支持 map 时 READ 的数据直接指向后端内存发送，不经过中间缓冲区。
+     *
+     * BOT 协议本身是串行的：CBW、数据、CSW 依次进行，在 CBW 之前到达的 IN URB 暂存到可以应答为止。
+     */
+    class MassStorageVirtualInterfaceHandler : public VirtualInterfaceHandler
+    {
+    public:
+        struct Lun
+        {
+            std::shared_ptr<BlockBackend> backend;
+            std::string vendor = "usbipcpp";      // INQUIRY 中的厂商，最多 8 个字符
+            std::string product = "Virtual Disk"; // 最多 16 个字符
+            bool removable = true;
+        };
+
+        struct Stats
+        {
+            std::uint64_t commands = 0;
+            std::uint64_t failed_commands = 0;
+            std::uint64_t bytes_read = 0;
+            std::uint64_t bytes_written = 0;
+            std::uint64_t mapped_reads = 0; // 直接从后端内存发送的 IN URB
+            std::uint64_t copied_reads = 0; // 需要先读到缓冲区的 IN URB
+        };
+
+        MassStorageVirtualInterfaceHandler(UsbInterface &handle_interface, StringPool &string_pool,
+                                           std::vector<Lun> luns);
+
+        void handle_bulk_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                  std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
+                                  const data_type &out_data,
+                                  error_code &ec) override;
+        void handle_non_standard_request_type_control_urb(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                                          std::uint32_t transfer_flags,
+                                                          std::uint32_t transfer_buffer_length,
+                                                          const SetupPacket &setup_packet,
+                                                          const data_type &out_data, std::error_code &ec) override;
+        void handle_unlink_seqnum(std::uint32_t seqnum) override;
+        void on_new_connection(Session &current_session, error_code &ec) override;
+        void on_disconnection(error_code &ec) override;
+
+        void request_clear_feature(std::uint16_t feature_selector, std::uint32_t *p_status) override
+        {
+        }
+        void request_endpoint_clear_feature(std::uint16_t feature_selector, std::uint8_t ep_address,
+                                            std::uint32_t *p_status) override
+        {
+            // CLEAR_FEATURE(ENDPOINT_HALT)，端点不会真的停止，直接成功
+        }
+        std::uint8_t request_get_interface(std::uint32_t *p_status) override
+        {
+            return 0;
+        }
+        void request_set_interface(std::uint16_t alternate_setting, std::uint32_t *p_status) override
+        {
+        }
+        std::uint16_t request_get_status(std::uint32_t *p_status) override
+        {
+            return 0;
+        }
+        std::uint16_t request_endpoint_get_status(std::uint8_t ep_address, std::uint32_t *p_status) override
+        {
+            return 0;
+        }
+        void request_set_feature(std::uint16_t feature_selector, std::uint32_t *p_status) override
+        {
+        }
+        void request_endpoint_set_feature(std::uint16_t feature_selector, std::uint8_t ep_address,
+                                          std::uint32_t *p_status) override
+        {
+        }
+
+        [[nodiscard]] data_type get_class_specific_descriptor() override
+        {
+            return {};
+        }
+
+        [[nodiscard]] Stats stats() const;
+
+    private:
+        enum class Phase
+        {
+            Command,
+            DataIn,
+            DataOut,
+            Status,
+        };
+
+        struct Sense
+        {
+            std::uint8_t key = bot::scsi::SENSE_KEY_NO_SENSE;
+            std::uint8_t asc = 0;
+            std::uint8_t ascq = 0;
+        };
+
+        struct PendingIn
+        {
+            std::uint32_t seqnum;
+            std::uint32_t length;
+        };
+
+        // 以下函数需要持有 mutex
+        void handle_command(Session &current_session, std::uint32_t seqnum, const data_type &out_data);
+        void execute(const bot::CommandBlockWrapper &cbw);
+        void execute_read(std::uint64_t lba, std::uint32_t blocks);
+        void execute_write(std::uint64_t lba, std::uint32_t blocks);
+        void fail(std::uint8_t sense_key, std::uint8_t asc);
+        void respond(data_type &&data);
+        void handle_data_out(Session &current_session, std::uint32_t seqnum, const data_type &out_data);
+        void answer_in(Session &current_session, std::uint32_t seqnum, std::uint32_t length);
+        void answer_pending_in(Session &current_session);
+        void reset();
+
+        std::vector<Lun> luns;
+        std::vector<Sense> senses;
+
+        mutable std::mutex mutex;
+        Phase phase = Phase::Command;
+        bot::CommandBlockWrapper current_cbw{};
+        std::uint8_t csw_status = bot::CSW_STATUS_PASSED;
+        // 数据阶段已经传输的字节数
+        std::uint32_t transferred = 0;
+        // 数据阶段能提供或接收的字节数，不超过 dCBWDataTransferLength
+        std::uint32_t data_length = 0;
+        // 命令本身的数据方向，和主机在 CBW 中声明的方向不一致时是 phase error
+        bool device_to_host = false;
+        // 非读写命令的应答数据
+        data_type response;
+        // READ/WRITE 时在后端中的当前偏移，block_io 为 false 时不使用
+        bool block_io = false;
+        std::uint64_t io_offset = 0;
+        std::deque<PendingIn> pending_in;
+
+        Stats stats_{};
+    };
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include "VirtualInterfaceHandler.h"
+#include "device.h"
+#include "protocol.h"
+
+namespace usbipdcpp
+{
+    /**
+     * @brief 仿照 Linux gadget zero 的 source/sink 厂商接口，用来单独测试网络和协议路径的开销
+     *
+     * bulk IN 端点立即返回固定模式的数据，数据直接指向共享的静态模式缓冲区，不做任何复制；
+     * bulk OUT 端点丢弃或校验收到的数据；中断 OUT 收到的数据由中断 IN 原样返回。
+     * 设置 service_time_us 时每个 URB 都推迟这么久再应答，用来模拟设备的处理时间，不阻塞其它 URB。
+     */
+    class SourceSinkVirtualInterfaceHandler : public VirtualInterfaceHandler
+    {
+    public:
+        enum class Pattern
+        {
+            Zero,  // 全 0
+            Mod63, // 第 i 个字节为 (i % 端点最大包长) % 63，和 usbtest 的 pattern=1 相同
+        };
+
+        struct Config
+        {
+            Pattern pattern = Pattern::Zero;
+            bool verify_out = true;
+            std::uint32_t service_time_us = 0;
+        };
+
+        struct EndpointStats
+        {
+            std::uint8_t address = 0;
+            std::uint64_t urbs = 0;
+            std::uint64_t bytes = 0;
+            std::uint64_t errors = 0; // OUT 校验失败
+            // 以下两项是自上次 sample_stats 以来的速率
+            double mb_per_s = 0;
+            double urbs_per_s = 0;
+        };
+
+        SourceSinkVirtualInterfaceHandler(UsbInterface &handle_interface, StringPool &string_pool,
+                                          const Config &config);
+        ~SourceSinkVirtualInterfaceHandler() override;
+
+        void handle_bulk_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                  std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
+                                  const data_type &out_data,
+                                  error_code &ec) override;
+        void handle_interrupt_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                       std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
+                                       const data_type &out_data,
+                                       std::error_code &ec) override;
+        void handle_unlink_seqnum(std::uint32_t seqnum) override;
+        void on_new_connection(Session &current_session, error_code &ec) override;
+        void on_disconnection(error_code &ec) override;
+
+        void request_clear_feature(std::uint16_t feature_selector, std::uint32_t *p_status) override
+        {
+        }
+        void request_endpoint_clear_feature(std::uint16_t feature_selector, std::uint8_t ep_address,
+                                            std::uint32_t *p_status) override
+        {
+        }
+        std::uint8_t request_get_interface(std::uint32_t *p_status) override
+        {
+            return 0;
+        }
+        void request_set_interface(std::uint16_t alternate_setting, std::uint32_t *p_status) override
+        {
+        }
+        std::uint16_t request_get_status(std::uint32_t *p_status) override
+        {
+            return 0;
+        }
+        std::uint16_t request_endpoint_get_status(std::uint8_t ep_address, std::uint32_t *p_status) override
+        {
+            return 0;
+        }
+        void request_set_feature(std::uint16_t feature_selector, std::uint32_t *p_status) override
+        {
+        }
+        void request_endpoint_set_feature(std::uint16_t feature_selector, std::uint8_t ep_address,
+                                          std::uint32_t *p_status) override
+        {
+        }
+
+        [[nodiscard]] data_type get_class_specific_descriptor() override
+        {
+            return {};
+        }
+
+        /**
+         * @brief 各端点的累计计数和自上次调用以来的速率，只包含用过的端点
+         */
+        std::vector<EndpointStats> sample_stats();
+
+    private:
+        struct Counters
+        {
+            std::atomic<std::uint64_t> urbs{0};
+            std::atomic<std::uint64_t> bytes{0};
+            std::atomic<std::uint64_t> errors{0};
+        };
+
+        struct Delayed
+        {
+            std::chrono::steady_clock::time_point due;
+            UsbIpResponse::UsbIpRetSubmit ret;
+        };
+
+        struct PendingIn
+        {
+            std::uint32_t seqnum;
+            std::uint32_t length;
+            std::uint8_t address;
+        };
+
+        // 环回中断端点最多缓存的报文数，超过时丢弃最早的
+        static constexpr std::size_t loopback_depth = 32;
+
+        /**
+         * @brief 模式和最大包长相同的端点共用的静态缓冲区，第一次使用时生成
+         */
+        static std::shared_ptr<const data_type> pattern_buffer(Pattern pattern, std::uint16_t max_packet_size);
+
+        [[nodiscard]] bool verify(const data_type &data, std::uint16_t max_packet_size) const;
+        void count(std::uint8_t ep_address, std::size_t bytes);
+        void complete(UsbIpResponse::UsbIpRetSubmit &&ret);
+        void delay_loop();
+
+        const Config config;
+
+        // 各 bulk IN 端点返回的数据，构造时按端点的最大包长取好
+        std::array<std::shared_ptr<const data_type>, UsbDevice::route_count> in_patterns;
+
+        std::array<Counters, UsbDevice::route_count> counters;
+        std::mutex sample_mutex;
+        std::array<std::pair<std::uint64_t, std::uint64_t>, UsbDevice::route_count> last_sample{};
+        std::chrono::steady_clock::time_point last_sample_time = std::chrono::steady_clock::now();
+
+        std::mutex loopback_mutex;
+        std::deque<data_type> loopback_data;
+        std::deque<PendingIn> loopback_waiting;
+
+        // service_time_us 不为 0 时使用
+        std::mutex delay_mutex;
+        std::condition_variable delay_cv;
+        std::deque<Delayed> delayed;
+        bool delay_stop = false;
+        std::thread delay_thread;
+    };
+}
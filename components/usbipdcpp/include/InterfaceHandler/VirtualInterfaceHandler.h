@@ -11,7 +11,7 @@ namespace usbipdcpp
         explicit VirtualInterfaceHandler(UsbInterface &handle_interface, StringPool &string_pool) : InterfaceHandlerBase(handle_interface), string_pool(string_pool)
         {
 
-            string_interface = string_pool.new_string(L"Usbipdcpp Virtual Interface");
+            string_interface = string_pool.new_string(u"Usbipdcpp Virtual Interface");
         }
 
         void handle_bulk_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
@@ -52,6 +52,15 @@ namespace usbipdcpp
          */
         void on_disconnection(error_code &ec) override;
 
+        /**
+         * @brief 收到 CMD_UNLINK 时调用。暂存了 URB、稍后才应答的接口需要在这里检查并应答 RET_UNLINK，
+         * 默认什么都不做
+         * @param seqnum 被unlink的包的seqnum
+         */
+        virtual void handle_unlink_seqnum(std::uint32_t seqnum)
+        {
+        }
+
         virtual void request_clear_feature(std::uint16_t feature_selector, std::uint32_t *p_status) = 0;
         virtual void request_endpoint_clear_feature(std::uint16_t feature_selector, std::uint8_t ep_address,
                                                     std::uint32_t *p_status) = 0;
@@ -74,6 +83,15 @@ namespace usbipdcpp
         virtual data_type request_get_descriptor(std::uint8_t type, std::uint8_t language_id,
                                                  std::uint16_t descriptor_length, std::uint32_t *p_status);
 
+        /**
+         * @brief 生成后不再修改、可以直接引用发送的接口描述符，GET_DESCRIPTOR 先查这里，找不到再调用 request_get_descriptor
+         * @return 默认返回空
+         */
+        virtual descriptor_ptr find_cached_descriptor(std::uint8_t type, std::uint8_t index)
+        {
+            return nullptr;
+        }
+
         virtual void request_set_feature(std::uint16_t feature_selector, std::uint32_t *p_status) = 0;
         virtual void request_endpoint_set_feature(std::uint16_t feature_selector, std::uint8_t ep_address,
                                                   std::uint32_t *p_status) = 0;
@@ -96,9 +114,9 @@ namespace usbipdcpp
             return string_interface;
         }
 
-        [[nodiscard]] virtual std::wstring get_string_interface() const
+        [[nodiscard]] virtual std::u16string get_string_interface() const
         {
-            return string_pool.get_string(string_interface).value_or(L"");
+            return string_pool.get_string(string_interface).value_or(u"");
         }
 
     protected:
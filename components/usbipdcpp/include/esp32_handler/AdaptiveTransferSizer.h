@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <vector>
+
+#include "NetworkPerformanceAdapter.h"
+
+/**
+ * @brief 按端点统计 bulk IN 实际返回的长度，估计按需分配能节省的 DMA 内存
+ *
+ * 客户端经常以很大的长度读取只会返回几十字节的端点。每个 IN 端点统计最近一个窗口内的
+ * 最大实际长度（向上取到 2 的幂），和请求长度比较得出按需分配可以省下的字节数。
+ *
+ * 只统计，不改变分配大小：分配被填满时设备还有数据，事后再提交补读的 transfer 时，
+ * 客户端在同一端点上排队的其他 URB 可能已经先提交，会读走剩余的数据，流式协议的数据会被切断和交错。
+ * IN 始终按请求长度（向上取整到 max_packet_size）分配，只在超过 MAX_TRANSFER_SIZE 时拆分。
+ */
+namespace usbipdcpp
+{
+    class AdaptiveTransferSizer
+    {
+    public:
+        // 单个 transfer 的上限，CONFIG_USB_HOST_BULK_TRANSFER_MAX_SIZE 默认可能较小，此处为安全回退
+        static constexpr std::uint32_t MAX_TRANSFER_SIZE = 64 * 1024;
+        // 每学习这么多次完成更新一次端点的分配大小
+        static constexpr std::uint32_t LEARN_WINDOW = 64;
+
+        struct Stats
+        {
+            std::uint64_t in_transfers = 0;
+            std::uint64_t oversized = 0;         // 请求长度超过学习到的大小的次数
+            std::uint64_t bytes_requested = 0;   // 按请求长度分配的字节数
+            std::uint64_t bytes_learned = 0;     // 按学习到的大小分配时需要的字节数
+            std::uint32_t suggested_request_size = 0;
+        };
+
+        struct EndpointStats
+        {
+            std::uint8_t address;
+            std::uint32_t learned_size; // 0 表示还没有学习到
+        };
+
+        /**
+         * @brief 提交 IN transfer 前调用，记录按请求长度和按学习到的大小分配的差距
+         * @param requested 已向上取整到 max_packet_size 的请求长度
+         */
+        void on_in_submitted(std::uint8_t ep_address, std::uint32_t requested, std::uint16_t max_packet_size);
+
+        /**
+         * @brief IN 传输完成，在完成处理线程调用
+         */
+        void on_in_complete(std::uint8_t ep_address, std::uint32_t actual);
+
+        /**
+         * @brief 以下向 NetworkPerformanceAdapter 提供吞吐量和往返时间，往返时间抽样记录
+         */
+        void on_urb_submitted(std::uint32_t seqnum);
+        void on_urb_completed(std::uint32_t seqnum, std::size_t bytes);
+
+        [[nodiscard]] Stats stats() const;
+        [[nodiscard]] std::vector<EndpointStats> endpoint_stats() const;
+
+    private:
+        struct EndpointState
+        {
+            std::atomic<std::uint32_t> learned{0};
+            std::atomic<std::uint32_t> window_max{0};
+            std::atomic<std::uint32_t> samples{0};
+        };
+
+        static constexpr std::uint32_t RTT_SAMPLE_MASK = 0x0F;
+        static constexpr std::int64_t THROUGHPUT_WINDOW_US = 200 * 1000;
+
+        std::array<EndpointState, 16> in_endpoints_{};
+
+        NetworkPerformanceAdapter network_;
+
+        std::atomic<std::size_t> window_bytes_{0};
+        std::atomic<std::int64_t> window_start_{0};
+
+        std::atomic<std::uint64_t> in_transfers_{0};
+        std::atomic<std::uint64_t> oversized_{0};
+        std::atomic<std::uint64_t> bytes_requested_{0};
+        std::atomic<std::uint64_t> bytes_learned_{0};
+    };
+}
@@ -0,0 +1,341 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <optional>
+
+/**
+ * @brief USB Mass Storage Bulk-Only Transport (BOT) 与常用 SCSI 命令的解析工具
+ *
+ * 只做无状态的 CBW/CSW 编解码和 CDB 中 LBA 范围的提取，
+ * 状态机由使用者（Esp32DeviceHandler、MassStorageVirtualInterfaceHandler）自行维护
+ */
+namespace usbipdcpp::bot
+{
+    // ============ BOT 常量 ============
+
+    constexpr std::uint8_t INTERFACE_CLASS_MASS_STORAGE = 0x08;
+    constexpr std::uint8_t INTERFACE_SUBCLASS_SCSI = 0x06;
+    constexpr std::uint8_t INTERFACE_PROTOCOL_BOT = 0x50;
+
+    // Bulk-Only Mass Storage Reset 类请求
+    constexpr std::uint8_t REQUEST_BULK_ONLY_RESET = 0xFF;
+    constexpr std::uint8_t REQUEST_GET_MAX_LUN = 0xFE;
+
+    constexpr std::uint32_t CBW_SIGNATURE = 0x43425355; // "USBC"
+    constexpr std::uint32_t CSW_SIGNATURE = 0x53425355; // "USBS"
+    constexpr std::size_t CBW_LENGTH = 31;
+    constexpr std::size_t CSW_LENGTH = 13;
+
+    constexpr std::uint8_t CSW_STATUS_PASSED = 0x00;
+    constexpr std::uint8_t CSW_STATUS_FAILED = 0x01;
+    constexpr std::uint8_t CSW_STATUS_PHASE_ERROR = 0x02;
+
+    constexpr std::size_t MAX_LUN_COUNT = 16;
+
+    // ============ SCSI 操作码 ============
+
+    namespace scsi
+    {
+        constexpr std::uint8_t TEST_UNIT_READY = 0x00;
+        constexpr std::uint8_t REQUEST_SENSE = 0x03;
+        constexpr std::uint8_t FORMAT_UNIT = 0x04;
+        constexpr std::uint8_t READ_6 = 0x08;
+        constexpr std::uint8_t WRITE_6 = 0x0A;
+        constexpr std::uint8_t INQUIRY = 0x12;
+        constexpr std::uint8_t MODE_SELECT_6 = 0x15;
+        constexpr std::uint8_t MODE_SENSE_6 = 0x1A;
+        constexpr std::uint8_t START_STOP_UNIT = 0x1B;
+        constexpr std::uint8_t PREVENT_ALLOW_MEDIUM_REMOVAL = 0x1E;
+        constexpr std::uint8_t READ_FORMAT_CAPACITIES = 0x23;
+        constexpr std::uint8_t READ_CAPACITY_10 = 0x25;
+        constexpr std::uint8_t READ_10 = 0x28;
+        constexpr std::uint8_t WRITE_10 = 0x2A;
+        constexpr std::uint8_t WRITE_AND_VERIFY_10 = 0x2E;
+        constexpr std::uint8_t VERIFY_10 = 0x2F;
+        constexpr std::uint8_t SYNCHRONIZE_CACHE_10 = 0x35;
+        constexpr std::uint8_t MODE_SELECT_10 = 0x55;
+        constexpr std::uint8_t MODE_SENSE_10 = 0x5A;
+        constexpr std::uint8_t READ_16 = 0x88;
+        constexpr std::uint8_t WRITE_16 = 0x8A;
+        constexpr std::uint8_t SYNCHRONIZE_CACHE_16 = 0x91;
+        constexpr std::uint8_t SERVICE_ACTION_IN_16 = 0x9E;
+        constexpr std::uint8_t READ_12 = 0xA8;
+        constexpr std::uint8_t WRITE_12 = 0xAA;
+
+        // SERVICE ACTION IN(16) 的服务动作
+        constexpr std::uint8_t SAI_READ_CAPACITY_16 = 0x10;
+
+        // WRITE(10) 等命令 CDB 第 1 字节中的 FUA 位
+        constexpr std::uint8_t CDB_FUA = 0x08;
+
+        // 固定格式 sense 数据
+        constexpr std::size_t FIXED_SENSE_LENGTH = 18;
+        constexpr std::uint8_t SENSE_RESPONSE_CURRENT = 0x70;
+        constexpr std::uint8_t SENSE_RESPONSE_DEFERRED = 0x71;
+        constexpr std::uint8_t SENSE_KEY_NO_SENSE = 0x00;
+        constexpr std::uint8_t SENSE_KEY_MEDIUM_ERROR = 0x03;
+        constexpr std::uint8_t SENSE_KEY_ILLEGAL_REQUEST = 0x05;
+        constexpr std::uint8_t SENSE_KEY_DATA_PROTECT = 0x07;
+        constexpr std::uint8_t ASC_WRITE_ERROR = 0x0C;
+        constexpr std::uint8_t ASC_UNRECOVERED_READ_ERROR = 0x11;
+        constexpr std::uint8_t ASC_INVALID_COMMAND_OPERATION_CODE = 0x20;
+        constexpr std::uint8_t ASC_LBA_OUT_OF_RANGE = 0x21;
+        constexpr std::uint8_t ASC_INVALID_FIELD_IN_CDB = 0x24;
+        constexpr std::uint8_t ASC_LOGICAL_UNIT_NOT_SUPPORTED = 0x25;
+        constexpr std::uint8_t ASC_WRITE_PROTECTED = 0x27;
+    }
+
+    // ============ 字节序工具（SCSI 使用大端，BOT 包头使用小端） ============
+
+    inline std::uint32_t load_le32(const std::uint8_t *p)
+    {
+        return static_cast<std::uint32_t>(p[0]) |
+               (static_cast<std::uint32_t>(p[1]) << 8) |
+               (static_cast<std::uint32_t>(p[2]) << 16) |
+               (static_cast<std::uint32_t>(p[3]) << 24);
+    }
+
+    inline void store_le32(std::uint8_t *p, std::uint32_t v)
+    {
+        p[0] = static_cast<std::uint8_t>(v);
+        p[1] = static_cast<std::uint8_t>(v >> 8);
+        p[2] = static_cast<std::uint8_t>(v >> 16);
+        p[3] = static_cast<std::uint8_t>(v >> 24);
+    }
+
+    inline std::uint16_t load_be16(const std::uint8_t *p)
+    {
+        return static_cast<std::uint16_t>((p[0] << 8) | p[1]);
+    }
+
+    inline std::uint32_t load_be32(const std::uint8_t *p)
+    {
+        return (static_cast<std::uint32_t>(p[0]) << 24) |
+               (static_cast<std::uint32_t>(p[1]) << 16) |
+               (static_cast<std::uint32_t>(p[2]) << 8) |
+               static_cast<std::uint32_t>(p[3]);
+    }
+
+    inline std::uint64_t load_be64(const std::uint8_t *p)
+    {
+        return (static_cast<std::uint64_t>(load_be32(p)) << 32) | load_be32(p + 4);
+    }
+
+    inline void store_be16(std::uint8_t *p, std::uint16_t v)
+    {
+        p[0] = static_cast<std::uint8_t>(v >> 8);
+        p[1] = static_cast<std::uint8_t>(v);
+    }
+
+    inline void store_be32(std::uint8_t *p, std::uint32_t v)
+    {
+        p[0] = static_cast<std::uint8_t>(v >> 24);
+        p[1] = static_cast<std::uint8_t>(v >> 16);
+        p[2] = static_cast<std::uint8_t>(v >> 8);
+        p[3] = static_cast<std::uint8_t>(v);
+    }
+
+    inline void store_be64(std::uint8_t *p, std::uint64_t v)
+    {
+        store_be32(p, static_cast<std::uint32_t>(v >> 32));
+        store_be32(p + 4, static_cast<std::uint32_t>(v));
+    }
+
+    // ============ BOT 包结构 ============
+
+    /**
+     * @brief Command Block Wrapper，主机经 bulk OUT 发送的 31 字节命令包
+     */
+    struct CommandBlockWrapper
+    {
+        std::uint32_t tag = 0;
+        std::uint32_t data_transfer_length = 0;
+        bool data_in = false;
+        std::uint8_t lun = 0;
+        std::uint8_t cb_length = 0;
+        std::array<std::uint8_t, 16> cb{};
+
+        [[nodiscard]] std::uint8_t opcode() const
+        {
+            return cb[0];
+        }
+
+        [[nodiscard]] std::array<std::uint8_t, CBW_LENGTH> to_bytes() const
+        {
+            std::array<std::uint8_t, CBW_LENGTH> result{};
+            store_le32(result.data(), CBW_SIGNATURE);
+            store_le32(result.data() + 4, tag);
+            store_le32(result.data() + 8, data_transfer_length);
+            result[12] = data_in ? 0x80 : 0x00;
+            result[13] = lun & 0x0F;
+            result[14] = cb_length & 0x1F;
+            for (std::size_t i = 0; i < cb.size(); i++)
+            {
+                result[15 + i] = cb[i];
+            }
+            return result;
+        }
+
+        /**
+         * @brief 解析 CBW，长度或签名不对时返回空
+         */
+        static std::optional<CommandBlockWrapper> parse(const std::uint8_t *data, std::size_t length)
+        {
+            if (length != CBW_LENGTH || load_le32(data) != CBW_SIGNATURE)
+            {
+                return std::nullopt;
+            }
+            CommandBlockWrapper cbw;
+            cbw.tag = load_le32(data + 4);
+            cbw.data_transfer_length = load_le32(data + 8);
+            cbw.data_in = (data[12] & 0x80) != 0;
+            cbw.lun = data[13] & 0x0F;
+            cbw.cb_length = data[14] & 0x1F;
+            if (cbw.cb_length == 0 || cbw.cb_length > cbw.cb.size())
+            {
+                return std::nullopt;
+            }
+            for (std::size_t i = 0; i < cbw.cb.size(); i++)
+            {
+                cbw.cb[i] = data[15 + i];
+            }
+            return cbw;
+        }
+    };
+
+    /**
+     * @brief Command Status Wrapper，设备经 bulk IN 返回的 13 字节状态包
+     */
+    struct CommandStatusWrapper
+    {
+        std::uint32_t tag = 0;
+        std::uint32_t data_residue = 0;
+        std::uint8_t status = CSW_STATUS_PASSED;
+
+        [[nodiscard]] std::array<std::uint8_t, CSW_LENGTH> to_bytes() const
+        {
+            std::array<std::uint8_t, CSW_LENGTH> result{};
+            store_le32(result.data(), CSW_SIGNATURE);
+            store_le32(result.data() + 4, tag);
+            store_le32(result.data() + 8, data_residue);
+            result[12] = status;
+            return result;
+        }
+
+        static std::optional<CommandStatusWrapper> parse(const std::uint8_t *data, std::size_t length)
+        {
+            if (length < CSW_LENGTH || load_le32(data) != CSW_SIGNATURE)
+            {
+                return std::nullopt;
+            }
+            return CommandStatusWrapper{
+                .tag = load_le32(data + 4),
+                .data_residue = load_le32(data + 8),
+                .status = data[12]};
+        }
+    };
+
+    /**
+     * @brief CDB 中描述的一段连续逻辑块
+     */
+    struct BlockRange
+    {
+        std::uint64_t lba = 0;
+        std::uint32_t blocks = 0;
+    };
+
+    /**
+     * @brief 从 READ(10)/READ(12)/READ(16) 的 CDB 中取出读取范围
+     */
+    inline std::optional<BlockRange> parse_read_range(const std::array<std::uint8_t, 16> &cb)
+    {
+        switch (cb[0])
+        {
+        case scsi::READ_10:
+            return BlockRange{load_be32(&cb[2]), load_be16(&cb[7])};
+        case scsi::READ_12:
+            return BlockRange{load_be32(&cb[2]), load_be32(&cb[6])};
+        case scsi::READ_16:
+            return BlockRange{load_be64(&cb[2]), load_be32(&cb[10])};
+        default:
+            return std::nullopt;
+        }
+    }
+
+    /**
+     * @brief 从 WRITE(6)/WRITE(10)/WRITE(12)/WRITE(16)/WRITE AND VERIFY(10) 的 CDB 中取出写入范围
+     */
+    inline std::optional<BlockRange> parse_write_range(const std::array<std::uint8_t, 16> &cb)
+    {
+        switch (cb[0])
+        {
+        case scsi::WRITE_6:
+        {
+            std::uint64_t lba = (static_cast<std::uint64_t>(cb[1] & 0x1F) << 16) | (cb[2] << 8) | cb[3];
+            // WRITE(6) 中传输长度为 0 表示 256 块
+            std::uint32_t blocks = cb[4] == 0 ? 256 : cb[4];
+            return BlockRange{lba, blocks};
+        }
+        case scsi::WRITE_10:
+        case scsi::WRITE_AND_VERIFY_10:
+            return BlockRange{load_be32(&cb[2]), load_be16(&cb[7])};
+        case scsi::WRITE_12:
+            return BlockRange{load_be32(&cb[2]), load_be32(&cb[6])};
+        case scsi::WRITE_16:
+            return BlockRange{load_be64(&cb[2]), load_be32(&cb[10])};
+        default:
+            return std::nullopt;
+        }
+    }
+
+    /**
+     * @brief 构造固定格式的 sense 数据
+     */
+    inline std::array<std::uint8_t, scsi::FIXED_SENSE_LENGTH> make_fixed_sense(std::uint8_t response_code,
+                                                                              std::uint8_t sense_key,
+                                                                              std::uint8_t asc,
+                                                                              std::uint8_t ascq)
+    {
+        std::array<std::uint8_t, scsi::FIXED_SENSE_LENGTH> sense{};
+        sense[0] = response_code;
+        sense[2] = sense_key & 0x0F;
+        sense[7] = scsi::FIXED_SENSE_LENGTH - 8; // additional sense length
+        sense[12] = asc;
+        sense[13] = ascq;
+        return sense;
+    }
+
+    inline bool is_read_capacity(const std::array<std::uint8_t, 16> &cb)
+    {
+        return cb[0] == scsi::READ_CAPACITY_10 ||
+               (cb[0] == scsi::SERVICE_ACTION_IN_16 && (cb[1] & 0x1F) == scsi::SAI_READ_CAPACITY_16);
+    }
+
+    /**
+     * @brief 从 READ CAPACITY(10)/(16) 的返回数据中取出块大小，数据不足时返回 0
+     */
+    inline std::uint32_t parse_capacity_block_size(std::uint8_t opcode, const std::uint8_t *data, std::size_t length)
+    {
+        if (opcode == scsi::READ_CAPACITY_10 && length >= 8)
+        {
+            return load_be32(data + 4);
+        }
+        if (opcode == scsi::SERVICE_ACTION_IN_16 && length >= 12)
+        {
+            return load_be32(data + 8);
+        }
+        return 0;
+    }
+
+    inline bool is_bot_interface(std::uint8_t interface_class, std::uint8_t interface_subclass,
+                                 std::uint8_t interface_protocol)
+    {
+        return interface_class == INTERFACE_CLASS_MASS_STORAGE &&
+               interface_protocol == INTERFACE_PROTOCOL_BOT &&
+               // 部分U盘报告 subclass 为 0x05(SFF-8070i)/0x02(ATAPI)，数据命令格式与 SCSI 透明命令集一致
+               (interface_subclass == INTERFACE_SUBCLASS_SCSI || interface_subclass == 0x05 ||
+                interface_subclass == 0x02);
+    }
+}
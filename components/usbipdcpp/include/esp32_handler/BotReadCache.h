@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <mutex>
+
+#include "BotProtocol.h"
+
+/**
+ * @brief BOT 大容量存储设备的扇区读缓存
+ *
+ * - 按 (LUN, LBA) 索引，以逻辑块为单位缓存，LRU 淘汰
+ * - 数据区和索引（哈希桶 + 双向链表）都放在 PSRAM 中，内部 RAM 只占用本对象本身
+ * - 块大小由 READ CAPACITY 的返回值得到，第一次得到块大小时才分配空间
+ */
+namespace usbipdcpp
+{
+    class BotReadCache
+    {
+    public:
+        struct Stats
+        {
+            std::uint64_t hits = 0;          // 命中的 READ 命令数
+            std::uint64_t misses = 0;        // 未命中的 READ 命令数
+            std::uint64_t bytes_saved = 0;   // 直接从缓存返回、没有经过 USB 的字节数
+            std::uint64_t evictions = 0;     // 因容量不足被淘汰的块数
+            std::uint64_t invalidations = 0; // 因写入或介质变化被作废的块数
+            std::size_t cached_blocks = 0;
+            std::size_t capacity_blocks = 0;
+
+            [[nodiscard]] double hit_ratio() const
+            {
+                auto total = hits + misses;
+                return total ? static_cast<double>(hits) / static_cast<double>(total) : 0.0;
+            }
+        };
+
+        explicit BotReadCache(std::size_t capacity_bytes);
+        ~BotReadCache();
+
+        BotReadCache(const BotReadCache &) = delete;
+        BotReadCache &operator=(const BotReadCache &) = delete;
+
+        /**
+         * @brief 记录 LUN 的块大小，块大小变化视为更换了介质，清空该 LUN
+         */
+        void set_block_size(std::uint8_t lun, std::uint32_t block_size);
+
+        /**
+         * @brief 返回可以缓存的 LUN 的块大小，不可缓存时返回 0
+         */
+        [[nodiscard]] std::uint32_t block_size(std::uint8_t lun) const;
+
+        /**
+         * @brief 查询整个范围是否都在缓存中，同时统计命中/未命中并刷新 LRU
+         */
+        bool lookup(std::uint8_t lun, std::uint64_t lba, std::uint32_t blocks);
+
+        /**
+         * @brief 从以 lba 开始的读取中偏移 byte_offset 处拷贝 length 字节
+         * @return 有块已经不在缓存中时返回 false
+         */
+        bool copy_out(std::uint8_t lun, std::uint64_t lba, std::size_t byte_offset,
+                      std::uint8_t *dst, std::size_t length);
+
+        /**
+         * @brief 用设备返回的数据填充缓存，只缓存完全落在数据内的块
+         * @param byte_offset 这段数据在以 lba 开始的读取中的偏移
+         */
+        void fill(std::uint8_t lun, std::uint64_t lba, std::size_t byte_offset,
+                  const std::uint8_t *src, std::size_t length);
+
+        void invalidate(std::uint8_t lun, std::uint64_t lba, std::uint32_t blocks);
+        void invalidate_lun(std::uint8_t lun);
+        void clear();
+
+        [[nodiscard]] Stats stats() const;
+
+        [[nodiscard]] bool usable() const
+        {
+            return !allocation_failed_;
+        }
+
+    private:
+        static constexpr std::int32_t NIL = -1;
+
+        struct Slot
+        {
+            std::uint64_t key;
+            std::int32_t lru_prev;
+            std::int32_t lru_next;
+            std::int32_t hash_next;
+            bool used;
+        };
+
+        static std::uint64_t make_key(std::uint8_t lun, std::uint64_t lba)
+        {
+            return (lba << 4) | (lun & 0x0F);
+        }
+
+        bool ensure_arena(std::uint32_t block_size);
+        void release_arena();
+
+        std::size_t bucket_of(std::uint64_t key) const;
+        std::int32_t find_slot(std::uint64_t key) const;
+        std::int32_t acquire_slot();
+        void unlink_hash(std::int32_t slot);
+        void unlink_lru(std::int32_t slot);
+        void push_lru_front(std::int32_t slot);
+        void drop_slot(std::int32_t slot);
+        std::uint8_t *slot_data(std::int32_t slot) const;
+
+        const std::size_t capacity_bytes_;
+
+        mutable std::mutex mutex_;
+
+        std::array<std::uint32_t, bot::MAX_LUN_COUNT> lun_block_size_{};
+
+        std::uint32_t arena_block_size_ = 0;
+        std::size_t slot_count_ = 0;
+        std::size_t bucket_count_ = 0;
+
+        // 以下三块内存都位于 PSRAM
+        std::uint8_t *data_ = nullptr;
+        Slot *slots_ = nullptr;
+        std::int32_t *buckets_ = nullptr;
+
+        std::int32_t lru_head_ = NIL;
+        std::int32_t lru_tail_ = NIL;
+        std::int32_t free_head_ = NIL;
+        std::size_t used_count_ = 0;
+
+        bool allocation_failed_ = false;
+
+        Stats stats_{};
+    };
+}
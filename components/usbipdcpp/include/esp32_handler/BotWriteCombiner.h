@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+
+/**
+ * @brief BOT 大容量存储设备的写合并缓冲区
+ *
+ * - 把 LBA 首尾相接的多条 WRITE(10) 的数据依次追加到 PSRAM 中的连续缓冲区
+ * - 本类只负责记账，什么时候下发、怎样下发由 Esp32DeviceHandler 决定
+ * - 不加锁，调用者负责串行化
+ */
+namespace usbipdcpp
+{
+    class BotWriteCombiner
+    {
+    public:
+        struct Stats
+        {
+            std::uint64_t commands_combined = 0; // 被缓冲的 WRITE 命令数
+            std::uint64_t flushes = 0;           // 合并后实际下发给设备的写入次数
+            std::uint64_t bytes_flushed = 0;
+            std::uint64_t flush_errors = 0;
+
+            [[nodiscard]] double commands_per_flush() const
+            {
+                return flushes ? static_cast<double>(commands_combined) / static_cast<double>(flushes) : 0.0;
+            }
+        };
+
+        // 合并后作为一条 WRITE(10) 下发，传输长度字段只有 16 位
+        static constexpr std::uint32_t MAX_COMBINED_BLOCKS = 0xFFFF;
+
+        explicit BotWriteCombiner(std::size_t capacity_bytes);
+        ~BotWriteCombiner();
+
+        BotWriteCombiner(const BotWriteCombiner &) = delete;
+        BotWriteCombiner &operator=(const BotWriteCombiner &) = delete;
+
+        [[nodiscard]] bool usable() const
+        {
+            return buffer_ != nullptr;
+        }
+
+        /**
+         * @brief 这条写命令能否接在当前缓冲内容之后（缓冲为空时只检查容量和块数）
+         */
+        [[nodiscard]] bool can_append(std::uint8_t lun, std::uint32_t lba, std::uint32_t blocks,
+                                      std::uint32_t block_size) const;
+
+        /**
+         * @brief 开始缓冲一条写命令，调用前需 can_append() 为真
+         */
+        void begin_command(std::uint8_t lun, std::uint32_t lba, std::uint32_t blocks, std::uint32_t block_size);
+
+        /**
+         * @brief 追加当前命令的数据 OUT 阶段的数据，超出命令长度的部分丢弃
+         */
+        void append(const std::uint8_t *data, std::size_t length);
+
+        /**
+         * @brief 当前命令的数据阶段已完整结束
+         */
+        void commit_command();
+
+        /**
+         * @brief 丢弃未完成的当前命令（Bulk-Only Reset 等）
+         */
+        void abort_command();
+
+        /**
+         * @brief 下发完成（无论成功与否）后清空缓冲区
+         */
+        void reset();
+
+        void record_flush(bool success);
+
+        [[nodiscard]] bool empty() const
+        {
+            return committed_bytes_ == 0;
+        }
+
+        [[nodiscard]] bool full() const
+        {
+            return committed_bytes_ >= capacity_bytes_ || committed_blocks() >= MAX_COMBINED_BLOCKS;
+        }
+
+        [[nodiscard]] std::uint8_t lun() const
+        {
+            return lun_;
+        }
+
+        [[nodiscard]] std::uint32_t lba() const
+        {
+            return lba_;
+        }
+
+        [[nodiscard]] std::uint32_t committed_blocks() const
+        {
+            return block_size_ ? static_cast<std::uint32_t>(committed_bytes_ / block_size_) : 0;
+        }
+
+        [[nodiscard]] std::uint32_t block_size() const
+        {
+            return block_size_;
+        }
+
+        [[nodiscard]] const std::uint8_t *data() const
+        {
+            return buffer_;
+        }
+
+        [[nodiscard]] std::size_t committed_bytes() const
+        {
+            return committed_bytes_;
+        }
+
+        [[nodiscard]] std::chrono::steady_clock::time_point last_append() const
+        {
+            return last_append_;
+        }
+
+        [[nodiscard]] const Stats &stats() const
+        {
+            return stats_;
+        }
+
+    private:
+        const std::size_t capacity_bytes_;
+        std::uint8_t *buffer_ = nullptr;
+
+        std::uint8_t lun_ = 0;
+        std::uint32_t lba_ = 0;
+        std::uint32_t block_size_ = 0;
+
+        // 已完整收到数据的命令所占字节数
+        std::size_t committed_bytes_ = 0;
+        // 当前命令的结束位置和已收到的位置
+        std::size_t command_end_ = 0;
+        std::size_t write_pos_ = 0;
+
+        std::chrono::steady_clock::time_point last_append_{};
+
+        Stats stats_{};
+    };
+}
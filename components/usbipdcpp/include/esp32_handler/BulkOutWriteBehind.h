@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+/**
+ * @brief bulk OUT 的提前应答（write-behind）
+ *
+ * 打印机、串口发送等只写的端点上，数据提交给 USB 主机后立即以
+ * actual_length == transfer_buffer_length 应答客户端，客户端不必等待
+ * USB 传输和网络往返就能发出下一个 OUT。
+ *
+ * 每个端点提前应答、尚未真正完成的传输数不超过 max_depth，超出时按普通方式
+ * 提交并等待真实完成再应答，借此向客户端施加背压。提前应答的传输如果失败，
+ * 错误会在该端点的下一个 URB 上报告，之前已经应答的数据视为丢失。
+ */
+namespace usbipdcpp
+{
+    class BulkOutWriteBehind
+    {
+    public:
+        struct Stats
+        {
+            std::uint64_t early_acks = 0;      // 提前应答的 URB
+            std::uint64_t throttled = 0;       // 队列已满，按普通方式等待完成的 URB
+            std::uint64_t deferred_errors = 0; // 提前应答后传输失败的次数
+            std::uint64_t reported_errors = 0; // 在后续 URB 上报告出去的错误
+        };
+
+        /**
+         * @param endpoint_mask 第 n 位对应 OUT 端点 n
+         * @param max_depth 每个端点最多提前应答的在途传输数
+         */
+        BulkOutWriteBehind(std::uint16_t endpoint_mask, std::uint8_t max_depth);
+
+        [[nodiscard]] bool enabled(std::uint8_t ep_address) const
+        {
+            return (ep_address & 0x80) == 0 && (endpoint_mask_ & (1u << (ep_address & 0x0F))) != 0;
+        }
+
+        /**
+         * @brief 取出该端点上尚未报告的错误并清除
+         * @return 0 表示没有，否则为 URB 状态
+         */
+        std::uint32_t take_error(std::uint8_t ep_address);
+
+        /**
+         * @brief 占用一个提前应答的名额，队列已满时返回 false
+         */
+        bool try_acquire(std::uint8_t ep_address);
+
+        /**
+         * @brief 提交失败，归还名额
+         */
+        void release(std::uint8_t ep_address);
+
+        /**
+         * @brief 提前应答的传输最终完成，在完成处理线程调用
+         * @param status URB 状态，非 0 时记录下来，等下一个 URB 报告
+         */
+        void on_complete(std::uint8_t ep_address, std::uint32_t status);
+
+        /**
+         * @brief 等待所有端点上提前应答的传输完成
+         * @return 超时仍有传输在途时返回 false
+         */
+        bool wait_drained(std::chrono::milliseconds timeout);
+
+        /**
+         * @brief 新的客户端连接，丢弃上一次会话遗留的错误
+         */
+        void reset_errors();
+
+        [[nodiscard]] Stats stats() const;
+
+    private:
+        struct EndpointState
+        {
+            std::atomic<std::uint32_t> in_flight{0};
+            std::atomic<std::uint32_t> pending_error{0};
+        };
+
+        std::uint16_t endpoint_mask_;
+        std::uint32_t max_depth_;
+        std::array<EndpointState, 16> endpoints_{};
+
+        std::atomic<std::uint32_t> total_in_flight_{0};
+        std::mutex drain_mutex_;
+        std::condition_variable drain_cv_;
+
+        std::atomic<std::uint64_t> early_acks_{0};
+        std::atomic<std::uint64_t> throttled_{0};
+        std::atomic<std::uint64_t> deferred_errors_{0};
+        std::atomic<std::uint64_t> reported_errors_{0};
+    };
+}
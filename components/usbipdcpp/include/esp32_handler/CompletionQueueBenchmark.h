@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <string>
+
+/**
+ * @brief 比较应答从完成线程交给会话发送协程的两种方式
+ *
+ * - channel：原来的做法，派发到会话的 strand 上再 async_send 进 asio::experimental::channel
+ * - completion_queue：CompletionQueue 无锁入队，发送协程睡眠时才派发一次唤醒，醒来后成批取出
+ *
+ * 生产者线程按 CompletionWorker 的配置创建，消费者按 Session 的配置运行在单独的 io_context 上，
+ * 和真实会话的线程分布一致。应答不经过网络，只测入队的开销和从入队到发送协程取出的延迟。
+ */
+namespace usbipdcpp
+{
+    class CompletionQueueBenchmark
+    {
+    public:
+        struct Config
+        {
+            std::uint8_t producers = 2;
+            std::uint32_t messages_per_producer = 20000;
+            std::uint32_t burst = 8; // 每入队这么多个应答后睡眠一个 tick，模拟成批完成的 URB，0 表示连续入队
+        };
+
+        struct Result
+        {
+            const char *name = "";
+            std::uint64_t messages = 0;
+            std::uint64_t elapsed_us = 0;
+            // 生产者调用入队函数本身的耗时
+            std::uint64_t enqueue_avg_ns = 0, enqueue_p50_ns = 0, enqueue_p99_ns = 0, enqueue_max_ns = 0;
+            // 开始入队到发送协程取出
+            std::uint64_t latency_avg_us = 0, latency_p50_us = 0, latency_p99_us = 0, latency_max_us = 0;
+            std::uint64_t wakeups = 0;    // 发送协程被唤醒的次数，只统计 completion_queue
+            std::uint64_t overflowed = 0; // 进入溢出队列的应答数，只统计 completion_queue
+        };
+
+        static constexpr std::uint8_t MAX_PRODUCERS = 8;
+
+        /**
+         * @brief 依次测试两种方式并阻塞到结束，不能在 client event 线程或完成处理线程调用
+         * @return [0] 为 channel，[1] 为 completion_queue
+         */
+        static std::array<Result, 2> run(const Config &config);
+
+    private:
+        static Result run_channel(const Config &config);
+        static Result run_completion_queue(const Config &config);
+    };
+}
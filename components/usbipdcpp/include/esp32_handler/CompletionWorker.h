@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <semaphore>
+#include <thread>
+
+#include <usb/usb_host.h>
+
+/**
+ * @brief 单个设备的 USB 传输完成处理线程
+ *
+ * 所有设备的传输回调都在 Esp32Server 的 client_event_thread 中执行，
+ * 一个繁忙的设备会拖慢同一 hub 上其它设备的响应。回调中只把 transfer
+ * 放进本设备的无锁队列，响应的构造和发送在本设备自己的线程中完成。
+ *
+ * - 队列为单生产者单消费者：生产者是 client_event_thread，消费者是本线程
+ * - 同一设备的传输按完成顺序处理，端点上的顺序不变
+ * - 队列满时放进加锁的溢出队列，之后的传输也进入溢出队列，直到本线程把它取空，
+ *   本线程总是先取完无锁队列再取溢出队列，因此传输不会乱序，也不会在回调中处理
+ */
+namespace usbipdcpp
+{
+    class CompletionWorker
+    {
+    public:
+        using Handler = void (*)(usb_transfer_t *trx);
+
+        struct Stats
+        {
+            std::uint64_t completions = 0;     // 在本线程处理的传输数
+            std::uint64_t overflowed = 0;      // 队列满，进入溢出队列的传输数
+            std::uint64_t busy_us = 0;         // 处理传输占用的 CPU 时间
+            std::uint64_t max_queue_delay_us = 0;
+            std::size_t peak_depth = 0;
+        };
+
+        /**
+         * @param capacity 队列长度，会向上取整到 2 的幂
+         */
+        CompletionWorker(Handler handler, std::size_t capacity);
+        ~CompletionWorker();
+
+        CompletionWorker(const CompletionWorker &) = delete;
+        CompletionWorker &operator=(const CompletionWorker &) = delete;
+
+        /**
+         * @brief 在 client_event_thread 中调用，把完成的传输交给本线程
+         * @return false 表示本线程已经停止，调用者需要自己处理
+         */
+        bool post(usb_transfer_t *trx);
+
+        [[nodiscard]] Stats stats() const;
+
+    private:
+        struct Slot
+        {
+            usb_transfer_t *trx;
+            std::int64_t enqueue_time;
+        };
+
+        void run();
+        void process(const Slot &slot);
+
+        const Handler handler_;
+        const std::size_t mask_;
+        std::unique_ptr<Slot[]> slots_;
+
+        // head_ 只由消费者写，tail_ 只由生产者写
+        std::atomic<std::size_t> head_{0};
+        std::atomic<std::size_t> tail_{0};
+
+        // 溢出队列不为空时生产者不再写无锁队列
+        std::mutex overflow_mutex_;
+        std::deque<Slot> overflow_;
+        std::atomic<bool> has_overflow_{false};
+
+        std::counting_semaphore<> pending_{0};
+        std::atomic<bool> stop_{false};
+        std::thread thread_;
+
+        std::atomic<std::uint64_t> completions_{0};
+        std::atomic<std::uint64_t> overflowed_{0};
+        std::atomic<std::uint64_t> busy_us_{0};
+        std::atomic<std::uint64_t> max_queue_delay_us_{0};
+        std::atomic<std::size_t> peak_depth_{0};
+    };
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+#include <vector>
+#include <mutex>
+
+#include "interface.h"
+
+namespace usbipdcpp
+{
+    /**
+     * @brief 单个直通设备的可选优化开关，绑定设备时根据 VID/PID/接口类决定
+     *
+     * 默认全部关闭，保持纯透传行为
+     */
+    struct Esp32DevicePolicy
+    {
+        // BOT 大容量存储读缓存，数据放在 PSRAM
+        bool bot_read_cache = false;
+        std::size_t bot_read_cache_bytes = 2 * 1024 * 1024;
+
+        // BOT 写合并：相邻 WRITE(10) 先在 PSRAM 中缓冲，攒满或超时后合并下发
+        // 命令会在数据落盘前返回成功，写入失败以 deferred error 报告，设备意外断开会丢数据
+        bool bot_write_combine = false;
+        std::size_t bot_write_combine_bytes = 1024 * 1024;
+        std::uint32_t bot_write_combine_flush_ms = 200;
+
+        // 调试器命令/响应接口的投机预取：命令端点 OUT 完成后立即在响应端点上提交 IN
+        bool probe_prefetch = false;
+        std::uint8_t probe_command_ep = 0;        // 0 表示厂商接口上的第一个 bulk OUT
+        std::uint8_t probe_response_ep = 0;       // 0 表示厂商接口上的第一个 bulk IN
+        std::uint32_t probe_prefetch_length = 0;  // 0 表示 16 个最大包长
+        std::uint32_t probe_prefetch_expire_ms = 1000; // 设备迟迟不响应时取消在途的预取，已收到的响应不会过期
+
+        // 串口连续接收：bulk IN 上始终保持多个传输在途，数据进入环形缓冲区，客户端 IN URB 从缓冲区应答
+        bool serial_stream = false;
+        bool serial_stream_vendor = false;         // 同时作用于厂商自定义接口（CH340、CP210x、FTDI），否则只作用于 CDC 数据接口
+        bool serial_stream_packet_framing = false; // FTDI：每个包带 2 字节状态头，只能按包边界切分
+        std::uint8_t serial_stream_transfers = 4;
+        std::uint32_t serial_stream_transfer_size = 512;
+        std::size_t serial_stream_ring_bytes = 16 * 1024;
+
+        // 改写导出的配置描述符中中断端点的 bInterval（毫秒），客户端按更短的周期发出中断 URB
+        // 真实设备的轮询周期不变，0 表示不改写
+        std::uint8_t interrupt_interval_ms = 0;
+        bool interrupt_interval_hid_only = true; // 只改 HID 接口上的中断端点
+
+        // bulk OUT 提前应答：数据提交给 USB 主机后立即应答客户端，传输失败在该端点的下一个 URB 上报告
+        // 第 n 位对应 OUT 端点 n，0 表示不启用。只适合打印机、串口发送等不关心每次写入结果的端点
+        std::uint16_t bulk_out_write_behind_mask = 0;
+        std::uint8_t bulk_out_write_behind_depth = 4; // 每个端点最多提前应答的在途传输数
+    };
+
+    /**
+     * @brief 按 VID/PID/接口类匹配设备策略，按添加顺序匹配，第一条命中的规则生效
+     */
+    class DevicePolicyTable
+    {
+    public:
+        struct Rule
+        {
+            std::uint16_t vendor_id = 0;  // 0 表示任意
+            std::uint16_t product_id = 0; // 0 表示任意
+            // 设备任一接口的 bInterfaceClass 与之相同才匹配，空表示任意
+            std::optional<std::uint8_t> interface_class;
+            Esp32DevicePolicy policy;
+        };
+
+        void add_rule(const Rule &rule);
+        void set_default_policy(const Esp32DevicePolicy &policy);
+        void clear();
+
+        [[nodiscard]] Esp32DevicePolicy resolve(std::uint16_t vendor_id, std::uint16_t product_id,
+                                                const std::vector<UsbInterface> &interfaces) const;
+
+    private:
+        static bool match(const Rule &rule, std::uint16_t vendor_id, std::uint16_t product_id,
+                          const std::vector<UsbInterface> &interfaces);
+
+        mutable std::mutex mutex_;
+        std::vector<Rule> rules_;
+        Esp32DevicePolicy default_policy_;
+    };
+}
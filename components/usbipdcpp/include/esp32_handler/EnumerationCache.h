@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "interface.h"
+
+/**
+ * @brief 设备枚举结果的持久化缓存，按 VID/PID/bcdDevice/序列号索引，保存在 NVS
+ *
+ * 每个条目包含：
+ * - 配置描述符的 CRC，绑定时用它判断缓存是否还适用于这个设备
+ * - 解析好的接口/端点布局和需要声明的接口（声明计划），命中时不再解析配置描述符
+ * - 客户端读过的标准描述符（字符串、HID 报告描述符等），之后的客户端直接从缓存应答
+ *
+ * 命中的条目在后台线程中重新向设备读取一遍描述符，不一致时以设备为准并重新保存。
+ * NVS 写入也在后台线程中完成，不阻塞绑定和 client event 线程。
+ */
+namespace usbipdcpp
+{
+    class Esp32DeviceHandler;
+
+    struct EnumerationKey
+    {
+        std::uint16_t vendor_id = 0;
+        std::uint16_t product_id = 0;
+        std::uint16_t bcd_device = 0;
+        std::string serial;
+
+        [[nodiscard]] std::uint32_t hash() const;
+        bool operator==(const EnumerationKey &other) const = default;
+    };
+
+    class EnumerationCache
+    {
+    public:
+        // NVS 分区只有 24K，和 WiFi 配置等共用，条目数量和大小都要限制
+        static constexpr std::size_t MAX_ENTRIES = 6;
+        static constexpr std::size_t MAX_ENTRY_BYTES = 1536;
+
+        struct InterfaceLayout
+        {
+            std::uint8_t number;
+            std::uint8_t alternate_setting;
+            std::uint8_t interface_class;
+            std::uint8_t interface_subclass;
+            std::uint8_t interface_protocol;
+            std::vector<UsbEndpoint> endpoints;
+        };
+
+        struct DescriptorRecord
+        {
+            std::uint8_t request_type;
+            std::uint16_t value;
+            std::uint16_t index;
+            // 设备返回的长度比请求的短，说明这就是完整的描述符
+            bool complete;
+            std::vector<std::uint8_t> data;
+        };
+
+        struct Entry
+        {
+            EnumerationKey key;
+            std::uint32_t config_crc = 0;
+            std::uint16_t config_length = 0;
+            std::vector<InterfaceLayout> interfaces;
+            std::vector<DescriptorRecord> descriptors;
+
+            // 以下只在内存中
+            bool verified = false;
+            std::size_t served = 0;
+        };
+
+        struct Stats
+        {
+            std::uint64_t hits = 0;
+            std::uint64_t misses = 0;
+            std::uint64_t mismatches = 0; // 有条目但配置描述符变了
+            std::uint64_t descriptors_served = 0;
+            std::uint64_t descriptors_learned = 0;
+            std::uint64_t revalidated = 0;
+            std::uint64_t revalidation_changes = 0;
+            std::uint64_t persist_writes = 0;
+            std::uint64_t persist_errors = 0;
+        };
+
+        EnumerationCache();
+        ~EnumerationCache();
+
+        EnumerationCache(const EnumerationCache &) = delete;
+        EnumerationCache &operator=(const EnumerationCache &) = delete;
+
+        /**
+         * @brief 查找条目，配置描述符的 CRC 或长度不一致时删除旧条目并返回空
+         */
+        std::shared_ptr<Entry> lookup(const EnumerationKey &key, std::uint32_t config_crc,
+                                      std::uint16_t config_length);
+
+        /**
+         * @brief 为新设备创建条目，在后台保存
+         */
+        std::shared_ptr<Entry> create(const EnumerationKey &key, std::uint32_t config_crc,
+                                      std::uint16_t config_length, std::vector<InterfaceLayout> interfaces);
+
+        /**
+         * @brief 缓存中有足够长的描述符时返回要发给客户端的数据
+         */
+        std::optional<std::vector<std::uint8_t>> find_descriptor(Entry &entry, std::uint8_t request_type,
+                                                                 std::uint16_t value, std::uint16_t index,
+                                                                 std::uint16_t length);
+
+        /**
+         * @brief 记录一次透传的 GET_DESCRIPTOR 结果
+         */
+        void learn_descriptor(const std::shared_ptr<Entry> &entry, std::uint8_t request_type, std::uint16_t value,
+                              std::uint16_t index, std::uint16_t requested_length, const std::uint8_t *data,
+                              std::size_t length);
+
+        /**
+         * @brief 在后台重新向设备读取条目中的所有描述符
+         */
+        void revalidate(const std::shared_ptr<Entry> &entry, std::weak_ptr<Esp32DeviceHandler> handler);
+
+        [[nodiscard]] Stats stats() const;
+
+        static bool is_cacheable_request(std::uint8_t request_type, std::uint8_t request);
+
+    private:
+        void worker_main();
+        void post(std::function<void()> job);
+
+        void persist(const std::shared_ptr<Entry> &entry);
+        std::shared_ptr<Entry> load(const EnumerationKey &key);
+        void erase(std::uint32_t hash);
+        void touch_index(std::uint32_t hash);
+
+        static std::vector<std::uint8_t> serialize(const Entry &entry);
+        static std::shared_ptr<Entry> deserialize(const std::vector<std::uint8_t> &blob);
+        static std::size_t serialized_size(const Entry &entry);
+
+        // 保护条目内容和统计，持有期间不做 NVS 读写
+        mutable std::mutex mutex_;
+        Stats stats_{};
+
+        // NVS 中保存的条目，最近使用的在前，只有后台线程访问
+        std::vector<std::uint32_t> index_;
+        bool index_loaded_ = false;
+
+        std::mutex jobs_mutex_;
+        std::condition_variable jobs_cv_;
+        std::deque<std::function<void()>> jobs_;
+        bool stop_ = false;
+        std::thread worker_;
+    };
+}
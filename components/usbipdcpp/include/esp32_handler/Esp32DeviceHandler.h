@@ -5,6 +5,13 @@
 #include <atomic>
 #include <chrono>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <tuple>
+#include <condition_variable>
+#include <utility>
+#include <vector>
 
 #include <asio.hpp>
 #include <usb/usb_host.h>
@@ -13,6 +20,18 @@
 #include "SetupPacket.h"
 #include "tools.h"
 #include "ConcurrentTransferTracker.h"
+#include "BotReadCache.h"
+#include "CompletionWorker.h"
+#include "BotWriteCombiner.h"
+#include "ProbePrefetcher.h"
+#include "SerialRxStream.h"
+#include "EnumerationCache.h"
+#include "AdaptiveTransferSizer.h"
+#include "InterruptIntervalOverride.h"
+#include "LatencyHistogram.h"
+#include "BulkOutWriteBehind.h"
+#include "UsbThroughputProbe.h"
+#include "DevicePolicy.h"
 #include "esp_timer.h"
 
 namespace usbipdcpp
@@ -20,6 +39,11 @@ namespace usbipdcpp
     class Esp32DeviceHandler : public DeviceHandlerBase
     {
         friend class Esp32Server;
+        friend class ProbePrefetcher;
+        friend class SerialRxStream;
+        friend class EnumerationCache;
+        friend class UsbThroughputProbe;
+        friend class Esp32HidReportSource;
 
     public:
         Esp32DeviceHandler(UsbDevice &handle_device, usb_device_handle_t native_handle,
@@ -31,6 +55,66 @@ namespace usbipdcpp
         void on_disconnection(error_code &ec) override;
         void handle_unlink_seqnum(std::uint32_t seqnum) override;
 
+        /**
+         * @brief 应用绑定时解析出的设备策略，必须在设备导出前调用
+         */
+        void apply_policy(const Esp32DevicePolicy &policy);
+
+        /**
+         * @brief 读缓存统计，未启用读缓存时返回空
+         */
+        [[nodiscard]] std::optional<BotReadCache::Stats> bot_read_cache_stats() const;
+
+        /**
+         * @brief 写合并统计，未启用写合并时返回空
+         */
+        [[nodiscard]] std::optional<BotWriteCombiner::Stats> bot_write_combine_stats();
+
+        /**
+         * @brief 本设备完成处理线程的统计，设备还没有被导入过时返回空
+         */
+        [[nodiscard]] std::optional<CompletionWorker::Stats> completion_stats() const;
+
+        /**
+         * @brief 调试器预取统计，未启用预取时返回空
+         */
+        [[nodiscard]] std::optional<ProbePrefetcher::Stats> probe_prefetch_stats() const;
+
+        /**
+         * @brief 各串口接收端点的统计，未启用时为空
+         */
+        [[nodiscard]] std::vector<std::pair<std::uint8_t, SerialRxStream::Stats>> serial_stream_stats() const;
+
+        /**
+         * @brief 关联枚举缓存条目，之后客户端的 GET_DESCRIPTOR 优先从缓存应答，透传的结果写回缓存
+         */
+        void attach_enumeration_cache(EnumerationCache &cache, std::shared_ptr<EnumerationCache::Entry> entry);
+
+        /**
+         * @brief bulk 传输大小自适应的统计
+         */
+        [[nodiscard]] AdaptiveTransferSizer::Stats transfer_sizer_stats() const;
+
+        /**
+         * @brief 中断 IN 端点的延迟统计
+         */
+        struct InterruptLatencyStats
+        {
+            std::uint8_t address;
+            std::uint8_t exported_interval; // 客户端看到的 bInterval
+            std::uint64_t urbs;
+            // 上一个 URB 应答后客户端隔多久发来下一个，受导出的 bInterval 影响
+            std::uint64_t client_gap_avg_us, client_gap_p50_us, client_gap_p99_us;
+            // URB 到达到设备返回数据
+            std::uint64_t turnaround_p50_us, turnaround_p99_us;
+        };
+        [[nodiscard]] std::vector<InterruptLatencyStats> interrupt_latency_stats() const;
+
+        /**
+         * @brief bulk OUT 提前应答统计，未启用时返回空
+         */
+        [[nodiscard]] std::optional<BulkOutWriteBehind::Stats> write_behind_stats() const;
+
     protected:
         void handle_control_urb(std::uint32_t seqnum, const UsbEndpoint &ep,
                                 std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
@@ -71,6 +155,16 @@ namespace usbipdcpp
          */
         esp_err_t sync_control_transfer(const SetupPacket &setup_packet) const;
 
+        /**
+         * @brief 同步控制 IN 传输并取回数据，不能在 client event 线程调用
+         */
+        esp_err_t sync_control_in(const SetupPacket &setup_packet, std::vector<std::uint8_t> &data);
+
+        /**
+         * @brief 同步控制 OUT 传输并带上数据阶段，不能在 client event 线程调用
+         */
+        esp_err_t sync_control_out(const SetupPacket &setup_packet, const std::vector<std::uint8_t> &data);
+
         esp_err_t tweak_clear_halt_cmd(const SetupPacket &setup_packet);
         esp_err_t tweak_set_interface_cmd(const SetupPacket &setup_packet);
         esp_err_t tweak_set_configuration_cmd(const SetupPacket &setup_packet);
@@ -88,6 +182,26 @@ namespace usbipdcpp
         static int trxstat2error(usb_transfer_status_t trxstat);
         static usb_transfer_status_t error2trxstat(int e);
 
+        /**
+         * @brief BOT 数据/状态阶段的 IN 传输完成后需要做的处理
+         */
+        struct BotTransferHook
+        {
+            enum class Kind : std::uint8_t
+            {
+                None,
+                FillCache,    // READ 数据阶段，用返回的数据填充读缓存
+                ReadCapacity, // READ CAPACITY 数据阶段，记录块大小
+                Status        // CSW，命令失败时作废该 LUN 的缓存
+            };
+            Kind kind = Kind::None;
+            std::uint8_t lun = 0;
+            std::uint8_t opcode = 0;
+            std::uint64_t lba = 0;
+            std::size_t byte_offset = 0;       // 本次传输在整个数据阶段中的偏移
+            std::uint32_t expected_length = 0; // 只有收满这么多字节才填充缓存
+        };
+
         struct esp32_callback_args
         {
             Esp32DeviceHandler &handler;
@@ -99,9 +213,19 @@ namespace usbipdcpp
 
             uint64_t recv_time;   // 收到网络请求的时间
             uint64_t submit_time; // USB传输提交的时间
+
+            BotTransferHook bot_hook{};
+            bool probe_response = false; // 调试器响应端点上透传的 IN，完成后通知预取器
+            bool learn_descriptor = false; // 透传的 GET_DESCRIPTOR，完成后写入枚举缓存
+            SetupPacket setup{};
+            bool write_behind = false;     // OUT 已经提前应答，完成时只记录错误
         };
 
+        /**
+         * @brief 传输完成回调，在 client_event_thread 中执行，只把传输转交给本设备的完成处理线程
+         */
         static void transfer_callback(usb_transfer_t *trx);
+        static void process_completion(usb_transfer_t *trx);
 
         static const char *TAG;
 
@@ -119,6 +243,8 @@ namespace usbipdcpp
         // 内存监控
         void check_and_clean_memory();
         std::chrono::steady_clock::time_point last_memory_check;
+        // 不同端点的URB可以并发分发，只让其中一个线程做检查
+        std::mutex memory_check_mutex_;
 
         // 最大并发传输数限制，通过 concurrent_transfer_count
         std::atomic<size_t> concurrent_transfer_count{0};
@@ -126,5 +252,165 @@ namespace usbipdcpp
         // 统计零拷贝传输次数
         std::atomic<uint32_t> zero_copy_count{0};
         std::atomic<uint32_t> total_transfer_count{0};
+
+        /**
+         * @brief 跟踪 BOT 的 CBW -> 数据 -> CSW 三个阶段
+         *
+         * Linux usb-storage 每次只有一条命令在执行，因此单个状态即可
+         */
+        struct BotSnoopState
+        {
+            enum class Phase : std::uint8_t
+            {
+                Idle,
+                Data,
+                Status
+            };
+            // 本条命令在本地应答、不经过设备的方式
+            enum class Local : std::uint8_t
+            {
+                None,
+                CachedRead,    // READ 完全由读缓存应答
+                CombinedWrite, // WRITE 数据进入写合并缓冲区
+                Failed,        // 报告之前合并写入的失败，CSW 返回 Command Failed
+                Sense          // 用合并写入失败的 sense 数据应答 REQUEST SENSE
+            };
+            Phase phase = Phase::Idle;
+            Local local = Local::None;
+            bool data_in = false;
+            bool read_capacity = false;
+            std::uint8_t lun = 0;
+            std::uint8_t opcode = 0;
+            std::uint32_t tag = 0;
+            std::uint64_t lba = 0;
+            std::uint32_t blocks = 0;
+            std::uint32_t data_length = 0;
+            std::uint32_t data_done = 0;
+        };
+
+        /**
+         * @brief 监听 BOT 接口上的 bulk 传输
+         * @return true 表示已在本地应答，不需要再提交给设备
+         */
+        bool bot_intercept_bulk(std::uint32_t seqnum, const UsbEndpoint &ep, UsbInterface &interface,
+                                std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
+                                const data_type &out_data, BotTransferHook &hook);
+        void on_bot_in_complete(const BotTransferHook &hook, const std::uint8_t *data, std::size_t length);
+        void reset_bot_state();
+
+        [[nodiscard]] bool bot_snoop_enabled() const
+        {
+            return bot_read_cache_ || bot_write_combiner_;
+        }
+
+        void bot_ack_out(std::uint32_t seqnum, std::size_t length);
+        void bot_fail_command();
+
+        /**
+         * @brief 把写合并缓冲区中的数据作为一条 WRITE(10) 下发
+         * @param lock 持有 bot_mutex_，和设备通信期间释放，返回前重新加锁
+         * @return 失败时记录待报告的错误并返回 false
+         */
+        bool bot_flush_writes(std::unique_lock<std::mutex> &lock);
+        bool bot_device_write(std::uint8_t lun, std::uint32_t lba, std::uint32_t blocks,
+                              const std::uint8_t *data, std::size_t length);
+        void bot_clear_halt(std::uint8_t ep_address);
+        void bot_reset_recovery();
+        void bot_flush_thread_main();
+
+        /**
+         * @brief 同步 bulk 传输，只用于服务器自己发起的 BOT 命令，不能在 client event 线程调用
+         *
+         * 超时后取消端点上的传输，取消后仍然没有回调时放弃这个 transfer，由回调释放，返回 ESP_ERR_TIMEOUT
+         */
+        esp_err_t sync_bulk_transfer(std::uint8_t ep_address, std::uint8_t *buffer, std::size_t length,
+                                     std::size_t &actual_length, usb_transfer_status_t &status);
+
+        Esp32DevicePolicy policy_{};
+        std::unique_ptr<BotReadCache> bot_read_cache_;
+        std::unique_ptr<BotWriteCombiner> bot_write_combiner_;
+        std::mutex bot_mutex_;
+        BotSnoopState bot_state_{};
+
+        // 由 READ CAPACITY 得到的各 LUN 块大小，在 client event 线程写入
+        std::array<std::atomic<std::uint32_t>, bot::MAX_LUN_COUNT> bot_block_size_{};
+
+        // 合并写入失败后待报告给主机的错误
+        struct BotPendingError
+        {
+            std::uint8_t lun = 0;
+            std::uint8_t response_code = bot::scsi::SENSE_RESPONSE_DEFERRED;
+            bool reported = false; // 已经有命令以 Command Failed 结束，等待 REQUEST SENSE
+        };
+        std::optional<BotPendingError> bot_pending_error_;
+
+        std::uint8_t bot_interface_number_ = 0;
+        std::uint8_t bot_in_ep_ = 0;
+        std::uint8_t bot_out_ep_ = 0;
+        std::uint16_t bot_in_max_packet_size_ = 64;
+        std::uint32_t bot_internal_tag_ = 0xE5000000;
+
+        std::thread bot_flush_thread_;
+        std::condition_variable bot_flush_cv_;
+        bool bot_flush_thread_stop_ = false;
+        bool bot_flush_requested_ = false; // 下次醒来立即下发，不等超时
+        bool bot_flushing_ = false;        // 正在和设备通信，缓冲区不能修改
+
+        // 必须等写合并缓冲区下发后才能处理的 CBW，下发线程处理完缓冲区后重新提交
+        struct BotDeferredUrb
+        {
+            std::uint32_t seqnum = 0;
+            const UsbEndpoint *ep = nullptr;
+            UsbInterface *interface = nullptr;
+            std::uint32_t transfer_flags = 0;
+            std::uint32_t transfer_buffer_length = 0;
+            data_type out_data;
+        };
+        std::optional<BotDeferredUrb> bot_deferred_;
+
+        std::unique_ptr<ProbePrefetcher> probe_prefetcher_;
+
+        // 绑定时创建，之后只读
+        std::vector<std::unique_ptr<SerialRxStream>> serial_streams_;
+        [[nodiscard]] SerialRxStream *find_serial_stream(std::uint8_t ep_address) const;
+
+        AdaptiveTransferSizer transfer_sizer_;
+
+        std::unique_ptr<InterruptIntervalOverride> interval_override_;
+
+        // 绑定时创建，之后只读
+        std::unique_ptr<BulkOutWriteBehind> write_behind_;
+
+        /**
+         * @brief 应答 URB：吞吐测试期间交给探针，否则交给会话，两者都没有时丢弃
+         */
+        void submit_ret_submit(UsbIpResponse::UsbIpRetSubmit &&response);
+        std::tuple<bool, std::uint32_t> get_unlink_seqnum(std::uint32_t seqnum);
+
+        // 运行吞吐测试时不为空，写入时持有独占锁，应答时持有共享锁，保证探针析构后不再被访问
+        std::atomic<UsbThroughputProbe *> throughput_probe_ = nullptr;
+        std::shared_mutex throughput_probe_mutex_;
+
+        void start_completion_worker();
+
+        struct InterruptEndpointLatency
+        {
+            std::uint8_t address = 0;
+            std::uint8_t exported_interval = 0;
+            std::atomic<std::int64_t> last_completion{0};
+            LatencyHistogram client_gap;
+            LatencyHistogram turnaround;
+        };
+        // 绑定时为每个中断 IN 端点创建，之后只读
+        std::vector<std::unique_ptr<InterruptEndpointLatency>> interrupt_latency_;
+        [[nodiscard]] InterruptEndpointLatency *find_interrupt_latency(std::uint8_t ep_address) const;
+
+        // 绑定时关联，之后只读
+        EnumerationCache *enumeration_cache_ = nullptr;
+        std::shared_ptr<EnumerationCache::Entry> enumeration_entry_;
+
+        // 第一次导入时创建，必须最后析构，析构时会处理完队列中剩余的传输
+        std::unique_ptr<CompletionWorker> completion_worker_;
+        std::uint64_t last_completion_busy_us_ = 0;
     };
 }
\ No newline at end of file
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <usb/usb_host.h>
+
+#include "HidCompositeVirtualInterfaceHandler.h"
+
+/**
+ * @brief 直通设备的一个 HID 接口，作为组合 HID 的成员
+ *
+ * 中断 IN 端点上始终保持两个传输在途，收到的报告直接交给组合设备，
+ * 不经过 Esp32DeviceHandler 的 URB 路径，也不占用它的会话。
+ * 每个传输的长度是端点的最大包长，报告不能超过最大包长。
+ * 输出报告和特征报告通过控制端点同步转发。
+ */
+namespace usbipdcpp
+{
+    class Esp32DeviceHandler;
+
+    class Esp32HidReportSource : public HidReportSource
+    {
+    public:
+        static constexpr std::size_t TRANSFER_COUNT = 2;
+
+        /**
+         * @brief 读取接口的报告描述符并申请传输，不能在 client event 线程调用
+         * @param device 由 Esp32DeviceHandler 处理的直通设备，成员存在期间不能被客户端导入
+         * @param interface_number 接口号，也就是在 device->interfaces 中的下标
+         * @return 不是带中断 IN 端点的 HID 接口或读取失败时返回空
+         */
+        static std::unique_ptr<Esp32HidReportSource> create(std::shared_ptr<UsbDevice> device,
+                                                            std::uint8_t interface_number);
+        ~Esp32HidReportSource() override;
+
+        Esp32HidReportSource(const Esp32HidReportSource &) = delete;
+        Esp32HidReportSource &operator=(const Esp32HidReportSource &) = delete;
+
+        [[nodiscard]] std::string name() const override;
+        [[nodiscard]] const data_type &report_descriptor() const override
+        {
+            return report_descriptor_;
+        }
+
+        void start(ReportSink sink) override;
+        void stop() override;
+
+        std::uint32_t get_report(std::uint8_t type, std::uint8_t report_id, std::uint16_t length,
+                                 data_type &data) override;
+        std::uint32_t set_report(std::uint8_t type, std::uint8_t report_id, const data_type &data) override;
+
+    private:
+        Esp32HidReportSource(std::shared_ptr<UsbDevice> device, Esp32DeviceHandler &handler,
+                             std::uint8_t interface_number, std::uint8_t ep_address, std::uint16_t max_packet_size,
+                             data_type &&report_descriptor);
+
+        static void transfer_callback(usb_transfer_t *trx);
+        /**
+         * @brief 从配置描述符中的 HID 描述符读出报告描述符的长度，找不到时返回 0
+         */
+        static std::uint16_t report_descriptor_length(Esp32DeviceHandler &handler, std::uint8_t interface_number);
+
+        // 需要持有 mutex_
+        bool submit(usb_transfer_t *trx);
+
+        // 持有设备，保证 handler_ 在成员析构前有效
+        const std::shared_ptr<UsbDevice> device_;
+        Esp32DeviceHandler &handler_;
+        const std::uint8_t interface_number_;
+        const std::uint8_t ep_address_;
+        const data_type report_descriptor_;
+
+        std::mutex mutex_;
+        std::condition_variable idle_cv_;
+        std::vector<usb_transfer_t *> transfers_;
+        std::vector<usb_transfer_t *> idle_;
+        bool running_ = false;
+        ReportSink sink_;
+    };
+}
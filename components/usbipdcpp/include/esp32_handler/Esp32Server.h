@@ -8,6 +8,10 @@
 
 
 #include "Server.h"
+#include "DevicePolicy.h"
+#include "EnumerationCache.h"
+#include "HidCompositeDevice.h"
+#include "UsbThroughputProbe.h"
 
 namespace usbipdcpp
 {
@@ -22,13 +26,47 @@ namespace usbipdcpp
         void start(asio::ip::tcp::endpoint& ep) override;
         void stop() override;
 
+        /**
+         * @brief 设备策略表，需在设备插入前配置，绑定设备时按 VID/PID/接口类解析
+         */
+        DevicePolicyTable &device_policies()
+        {
+            return device_policies_;
+        }
+
+        /**
+         * @brief 对一个没有被导入的设备运行本地吞吐测试，阻塞到测试结束，期间客户端不能导入该设备
+         */
+        UsbThroughputProbe::Result run_throughput_probe(const std::string &busid,
+                                                        const UsbThroughputProbe::Config &config);
+
+        struct HidAggregateResult
+        {
+            std::string error; // 为空表示成功
+            std::shared_ptr<UsbDevice> device;
+        };
+
+        /**
+         * @brief 把几个直通设备的全部 HID 接口合成一个虚拟 HID 设备导出，客户端只需导入一次。
+         * 原设备留在正在使用的设备中，不能再单独导入。不能在 client event 线程调用
+         */
+        HidAggregateResult aggregate_hid_devices(const std::vector<std::string> &busids, StringPool &string_pool,
+                                                 const HidCompositeDeviceConfig &config);
+
         ~Esp32Server() override;
 
     protected:
         void on_session_exit() override;
+        void before_session_thread_create() override;
+        void on_session_thread_start() override;
+        void on_session_thread_exit() override;
         void if_is_esp32_then_mark_removed(std::shared_ptr<AbstDeviceHandler> handler);
         void remove_gone_device(usb_device_handle_t dev);
 
+        static std::string read_serial_number(const usb_device_info_t &dev_info);
+        static std::vector<EnumerationCache::InterfaceLayout> parse_interface_layout(
+            const usb_config_desc_t *active_config_desc);
+
         static void client_event_callback(const usb_host_client_event_msg_t* event_msg, void* arg);
 
         std::atomic<bool> should_exit_client_event_thread = false;
@@ -40,6 +78,9 @@ namespace usbipdcpp
         std::shared_mutex all_host_devices_mutex;
         usb_host_client_handle_t host_client_handle;
 
+        DevicePolicyTable device_policies_;
+        EnumerationCache enumeration_cache_;
+
         static const char* TAG;
     };
 }
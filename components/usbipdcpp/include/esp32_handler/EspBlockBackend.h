@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+#include <esp_partition.h>
+
+#include "BlockBackend.h"
+
+namespace usbipdcpp
+{
+    /**
+     * @brief 放在内存中的虚拟磁盘，有 PSRAM 时优先放在 PSRAM，断电后内容丢失
+     */
+    class RamDiskBlockBackend : public BlockBackend
+    {
+    public:
+        RamDiskBlockBackend(std::uint32_t block_size, std::uint64_t block_count);
+        ~RamDiskBlockBackend() override;
+
+        RamDiskBlockBackend(const RamDiskBlockBackend &) = delete;
+        RamDiskBlockBackend &operator=(const RamDiskBlockBackend &) = delete;
+
+        /**
+         * @brief 分配失败时为 false，此时容量为 0
+         */
+        [[nodiscard]] bool valid() const
+        {
+            return data_ != nullptr;
+        }
+
+        [[nodiscard]] std::uint32_t block_size() const override
+        {
+            return block_size_;
+        }
+        [[nodiscard]] std::uint64_t block_count() const override
+        {
+            return block_count_;
+        }
+
+        [[nodiscard]] const std::uint8_t *map(std::uint64_t offset, std::size_t length) override
+        {
+            return data_ + offset;
+        }
+        bool read(std::uint64_t offset, std::uint8_t *dst, std::size_t length) override;
+        bool write(std::uint64_t offset, const std::uint8_t *src, std::size_t length) override;
+
+    private:
+        std::uint32_t block_size_;
+        std::uint64_t block_count_ = 0;
+        std::uint8_t *data_ = nullptr;
+    };
+
+    /**
+     * @brief 以一个 flash 数据分区作为虚拟磁盘
+     *
+     * 读取通过 esp_partition_mmap 映射到地址空间，READ 直接从映射发送；映射失败时退回 esp_partition_read。
+     * flash 只能按 4 KiB 扇区擦除，不满一个扇区的写入先读出整个扇区放在缓冲区中合并，
+     * 写到扇区末尾、写到别的扇区、读到这个扇区或 flush 时才擦写一次。
+     * 块大小建议用 4096，主机按扇区写入时不需要额外的读。
+     */
+    class PartitionBlockBackend : public BlockBackend
+    {
+    public:
+        PartitionBlockBackend(const esp_partition_t *partition, std::uint32_t block_size, bool read_only);
+        ~PartitionBlockBackend() override;
+
+        PartitionBlockBackend(const PartitionBlockBackend &) = delete;
+        PartitionBlockBackend &operator=(const PartitionBlockBackend &) = delete;
+
+        [[nodiscard]] bool valid() const
+        {
+            return block_count_ > 0;
+        }
+
+        [[nodiscard]] std::uint32_t block_size() const override
+        {
+            return block_size_;
+        }
+        [[nodiscard]] std::uint64_t block_count() const override
+        {
+            return block_count_;
+        }
+        [[nodiscard]] bool read_only() const override
+        {
+            return read_only_;
+        }
+
+        [[nodiscard]] const std::uint8_t *map(std::uint64_t offset, std::size_t length) override;
+        bool read(std::uint64_t offset, std::uint8_t *dst, std::size_t length) override;
+        bool write(std::uint64_t offset, const std::uint8_t *src, std::size_t length) override;
+        bool flush() override;
+
+    private:
+        bool program_sector(std::uint64_t sector_base, const std::uint8_t *data);
+        /**
+         * @brief 缓冲区中的扇区有未写入的修改时擦写它，和 [offset, offset + length) 不重叠时不处理
+         */
+        bool commit_sector(std::uint64_t offset, std::uint64_t length);
+
+        const esp_partition_t *partition_;
+        std::uint32_t block_size_;
+        std::uint64_t block_count_ = 0;
+        bool read_only_;
+        const std::uint8_t *mapped_ = nullptr;
+        esp_partition_mmap_handle_t mmap_handle_{};
+        // 不满一个扇区的写入用的读改写缓冲区，sector_dirty_ 时保存 buffered_sector_ 处扇区的最新内容
+        std::uint8_t *sector_buffer_ = nullptr;
+        std::uint64_t buffered_sector_ = 0;
+        bool sector_dirty_ = false;
+    };
+}
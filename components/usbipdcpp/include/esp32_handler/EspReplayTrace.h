@@ -0,0 +1,14 @@
+#pragma once
+
+#include <memory>
+
+#include "ReplayTrace.h"
+
+namespace usbipdcpp
+{
+    /**
+     * @brief 从数据分区读取文本格式的回放文件，文本在第一个 0x00 或 0xFF（擦除后的 flash）处结束。
+     * 可以用 parttool.py write_partition 把转换好的文件写进分区。找不到分区或格式错误时返回空
+     */
+    std::shared_ptr<const ReplayTrace> load_replay_trace_from_partition(const char *label);
+}
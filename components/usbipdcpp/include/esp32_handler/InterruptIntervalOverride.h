@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "interface.h"
+#include "SetupPacket.h"
+
+/**
+ * @brief 改写导出给客户端的中断端点 bInterval
+ *
+ * 客户端按配置描述符中的 bInterval 安排中断 URB，设备声明 10 ms 时每次读取都先等上 10 ms。
+ * 这里只改客户端看到的描述符，ESP32 对真实设备的轮询周期不变。
+ * ESP32-S3 的主机只支持全速和低速设备，bInterval 的单位都是毫秒。
+ */
+namespace usbipdcpp
+{
+    class InterruptIntervalOverride
+    {
+    public:
+        static constexpr std::uint8_t HID_CLASS = 0x03;
+
+        /**
+         * @param interval_ms 新的 bInterval，只会缩短，不会延长
+         * @param hid_only 只改 HID 接口上的中断端点
+         */
+        InterruptIntervalOverride(std::uint8_t interval_ms, bool hid_only);
+
+        [[nodiscard]] std::uint8_t interval_ms() const
+        {
+            return interval_ms_;
+        }
+
+        /**
+         * @brief 是否是读取配置描述符的请求
+         */
+        static bool is_config_descriptor_request(const SetupPacket &setup);
+
+        /**
+         * @brief 就地改写一段配置描述符，可以是不完整的前缀
+         * @return 改写的端点数量
+         */
+        std::size_t rewrite(std::uint8_t *data, std::size_t length) const;
+
+        /**
+         * @brief 同步修改导出设备的端点信息
+         */
+        void apply(std::vector<UsbInterface> &interfaces) const;
+
+    private:
+        [[nodiscard]] bool should_rewrite(std::uint8_t interface_class, std::uint8_t attributes,
+                                          std::uint8_t interval) const;
+
+        std::uint8_t interval_ms_;
+        bool hid_only_;
+    };
+}
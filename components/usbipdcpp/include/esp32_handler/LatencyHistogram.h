@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <atomic>
+#include <algorithm>
+#include <bit>
+
+/**
+ * @brief 以 2 的幂为桶宽的微秒级延迟直方图，记录无锁，可以在任意线程调用
+ *
+ * 百分位数返回所在桶的上界，精度为 2 倍，足够用来比较优化前后的差别
+ */
+namespace usbipdcpp
+{
+    class LatencyHistogram
+    {
+    public:
+        // 第 i 个桶记录 [2^(i-1), 2^i) 微秒，最后一个桶包含所有更大的值
+        static constexpr std::size_t BUCKET_COUNT = 26;
+
+        void record(std::uint64_t us)
+        {
+            auto bucket = std::min<std::size_t>(std::bit_width(us), BUCKET_COUNT - 1);
+            buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+            count_.fetch_add(1, std::memory_order_relaxed);
+            sum_us_.fetch_add(us, std::memory_order_relaxed);
+            auto max = max_us_.load(std::memory_order_relaxed);
+            while (us > max && !max_us_.compare_exchange_weak(max, us, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        [[nodiscard]] std::uint64_t count() const
+        {
+            return count_.load(std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] std::uint64_t max_us() const
+        {
+            return max_us_.load(std::memory_order_relaxed);
+        }
+
+        [[nodiscard]] std::uint64_t average_us() const
+        {
+            auto n = count();
+            return n ? sum_us_.load(std::memory_order_relaxed) / n : 0;
+        }
+
+        /**
+         * @param percent 0 到 100
+         */
+        [[nodiscard]] std::uint64_t percentile_us(double percent) const
+        {
+            auto n = count();
+            if (n == 0)
+            {
+                return 0;
+            }
+            auto target = static_cast<std::uint64_t>(static_cast<double>(n) * percent / 100.0);
+            std::uint64_t seen = 0;
+            for (std::size_t i = 0; i < BUCKET_COUNT; i++)
+            {
+                seen += buckets_[i].load(std::memory_order_relaxed);
+                if (seen > target)
+                {
+                    return i == 0 ? 0 : std::min(std::uint64_t{1} << i, max_us());
+                }
+            }
+            return max_us();
+        }
+
+        void reset()
+        {
+            for (auto &bucket : buckets_)
+            {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+            count_.store(0, std::memory_order_relaxed);
+            sum_us_.store(0, std::memory_order_relaxed);
+            max_us_.store(0, std::memory_order_relaxed);
+        }
+
+    private:
+        std::array<std::atomic<std::uint32_t>, BUCKET_COUNT> buckets_{};
+        std::atomic<std::uint64_t> count_{0};
+        std::atomic<std::uint64_t> sum_us_{0};
+        std::atomic<std::uint64_t> max_us_{0};
+    };
+}
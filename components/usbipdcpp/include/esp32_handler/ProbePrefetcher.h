@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include <usb/usb_host.h>
+
+/**
+ * @brief 调试器（ST-Link / J-Link 等）命令/响应式 bulk 接口的投机预取
+ *
+ * 命令端点上的 OUT 完成后立即在响应端点上提交一个 IN，
+ * 客户端的 IN URB 到达时直接用这个 IN 的结果应答，省掉一次网络往返。
+ *
+ * 同一端点上的 IN 按顺序完成，预取的 IN 拿到的总是设备接下来发出的数据，
+ * 因此即使客户端这次并不读响应，语义也与直接透传一致。
+ */
+namespace usbipdcpp
+{
+    class Esp32DeviceHandler;
+
+    class ProbePrefetcher
+    {
+    public:
+        struct Stats
+        {
+            std::uint64_t armed = 0;         // 提交的预取次数
+            std::uint64_t hits = 0;          // 客户端 IN 到达时预取已完成
+            std::uint64_t late_hits = 0;     // 客户端 IN 到达时预取仍在进行，直接接管
+            std::uint64_t misses = 0;        // 没有可用的预取，按普通方式提交
+            std::uint64_t expired = 0;       // 设备迟迟不响应，在途的预取被取消
+            std::uint64_t continuations = 0; // 响应比预取长度长，需要补读剩余部分
+            std::uint64_t splits = 0;        // 响应比客户端请求的长度长，剩余部分留给下一个 IN
+
+            [[nodiscard]] double hit_ratio() const
+            {
+                auto total = hits + late_hits + misses;
+                return total ? static_cast<double>(hits + late_hits) / static_cast<double>(total) : 0.0;
+            }
+        };
+
+        /**
+         * @param prefetch_length 预取 IN 的长度，会向上取整到 max_packet_size 的整数倍
+         * @param expire_ms 预取等待设备响应的最长时间，超过后取消，0 表示一直等待。已完成的结果一直保留到下一个 IN
+         */
+        ProbePrefetcher(Esp32DeviceHandler &handler, std::uint8_t command_ep, std::uint8_t response_ep,
+                        std::uint16_t max_packet_size, std::uint32_t prefetch_length, std::uint32_t expire_ms);
+        ~ProbePrefetcher();
+
+        ProbePrefetcher(const ProbePrefetcher &) = delete;
+        ProbePrefetcher &operator=(const ProbePrefetcher &) = delete;
+
+        [[nodiscard]] std::uint8_t command_ep() const
+        {
+            return command_ep_;
+        }
+
+        [[nodiscard]] std::uint8_t response_ep() const
+        {
+            return response_ep_;
+        }
+
+        /**
+         * @brief 客户端在响应端点上的 IN URB 到达
+         * @return true 表示已由预取接管，调用者不需要再提交传输
+         */
+        bool claim(std::uint32_t seqnum, std::uint32_t length);
+
+        /**
+         * @brief 命令端点上的 OUT 完成，在 client event 线程调用
+         */
+        void on_command_complete();
+
+        // 透传的客户端 IN 在途时不能预取，否则会抢走它的数据
+        void on_client_in_submitted();
+        void on_client_in_completed();
+
+        /**
+         * @brief 断开连接时丢弃已完成但未被读取的预取结果
+         */
+        void discard();
+
+        /**
+         * @brief 取消等待设备超过 expire_ms 的预取，由设备的定期检查调用
+         */
+        void expire_pending();
+
+        [[nodiscard]] Stats stats() const;
+
+    private:
+        struct Waiting
+        {
+            std::uint32_t seqnum;
+            std::uint32_t length;
+        };
+
+        /**
+         * @brief 传输回调通过它找到预取器
+         *
+         * 回调执行期间一直持有 mutex，析构函数取消端点上的传输后在这里等待回调。
+         * 等不到时（例如在 client event 线程中析构）把 self 置空，之后的回调只释放传输，由最后一个回调释放它
+         */
+        struct CallbackAnchor
+        {
+            std::mutex mutex;
+            std::condition_variable cv;
+            ProbePrefetcher *self;
+            std::atomic<std::size_t> pending{0}; // 已提交还没回调的传输数
+        };
+
+        // 已经收到但还没有应答给客户端的数据，下一个 IN 从这里取
+        struct Buffered
+        {
+            std::shared_ptr<usb_transfer_t> transfer;
+            std::uint32_t offset;
+            std::uint32_t actual;
+            bool ended; // 以短包结束，设备的这次响应没有更多数据
+        };
+
+        struct ContinuationContext
+        {
+            CallbackAnchor *anchor;
+            std::uint32_t seqnum;
+            std::uint32_t length;
+            std::shared_ptr<std::vector<std::uint8_t>> buffer;
+        };
+
+        static void prefetch_callback(usb_transfer_t *trx);
+        static void continuation_callback(usb_transfer_t *trx);
+        static void finish_callback(CallbackAnchor *anchor, std::unique_lock<std::mutex> &lock);
+
+        // 以下函数需要持有 mutex_
+        bool arm();
+        void serve(std::uint32_t seqnum, std::uint32_t length, usb_transfer_t *trx);
+        void serve_buffered(std::uint32_t seqnum, std::uint32_t length);
+        void continue_read(std::uint32_t seqnum, std::uint32_t length, const std::uint8_t *prefix,
+                           std::size_t prefix_length);
+
+        Esp32DeviceHandler &handler_;
+        const std::uint8_t command_ep_;
+        const std::uint8_t response_ep_;
+        const std::uint16_t max_packet_size_;
+        const std::uint32_t prefetch_length_;
+        const std::chrono::milliseconds expire_;
+
+        std::unique_ptr<CallbackAnchor> anchor_;
+
+        // 加锁顺序为 anchor_->mutex 在前
+        mutable std::mutex mutex_;
+
+        // 在途或已完成的预取
+        usb_transfer_t *transfer_ = nullptr;
+        bool completed_ = false;
+        std::chrono::steady_clock::time_point armed_time_{};
+        bool expiring_ = false;
+        bool truncated_ = false; // 预取被取消前已经收到部分数据，结尾不是短包
+        std::optional<Waiting> waiting_;
+        std::optional<Buffered> buffered_;
+
+        std::size_t client_in_flight_ = 0;
+        bool continuation_in_flight_ = false;
+
+        Stats stats_{};
+    };
+}
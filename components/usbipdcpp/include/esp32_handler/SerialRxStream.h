@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include <usb/usb_host.h>
+
+/**
+ * @brief USB 串口（CDC ACM、CH340、CP210x、FTDI）bulk IN 端点的连续接收
+ *
+ * 透传时只有客户端的 IN URB 在途时才会从设备取数据，
+ * 网络延迟期间设备 FIFO 会溢出。这里在端点上始终保持多个 IN 传输在途，
+ * 收到的数据先写入环形缓冲区，客户端的 IN URB 到达时直接从缓冲区应答。
+ *
+ * 第一个客户端 IN URB 到达时开始接收，断开连接时停止。
+ */
+namespace usbipdcpp
+{
+    class Esp32DeviceHandler;
+
+    class SerialRxStream
+    {
+    public:
+        struct Stats
+        {
+            std::uint64_t bytes_received = 0;  // 从设备收到的字节数
+            std::uint64_t bytes_delivered = 0; // 交给客户端的字节数
+            std::uint64_t overflow_bytes = 0;  // 缓冲区满而丢弃的字节数
+            std::uint64_t overflow_events = 0;
+            std::uint64_t immediate_urbs = 0;  // 到达时缓冲区已有数据，立即应答的 URB
+            std::uint64_t waited_urbs = 0;     // 到达时缓冲区为空，等待数据的 URB
+            std::size_t peak_fill = 0;         // 缓冲区最高占用
+            std::size_t capacity = 0;
+        };
+
+        /**
+         * @param packet_framing FTDI 芯片每个包都以 2 字节的状态开头，
+         *        此时只能在包边界上切分数据，并合并只有状态没有数据的包
+         */
+        SerialRxStream(Esp32DeviceHandler &handler, std::uint8_t ep_address, std::uint16_t max_packet_size,
+                       std::size_t transfer_count, std::uint32_t transfer_size, std::size_t ring_bytes,
+                       bool packet_framing);
+        ~SerialRxStream();
+
+        SerialRxStream(const SerialRxStream &) = delete;
+        SerialRxStream &operator=(const SerialRxStream &) = delete;
+
+        [[nodiscard]] bool usable() const
+        {
+            return ring_ != nullptr && !transfers_.empty();
+        }
+
+        [[nodiscard]] std::uint8_t ep_address() const
+        {
+            return ep_address_;
+        }
+
+        /**
+         * @brief 客户端在本端点上的 IN URB，总是由本类负责应答
+         */
+        void claim(std::uint32_t seqnum, std::uint32_t length);
+
+        /**
+         * @brief 处理 CMD_UNLINK
+         * @return true 表示这个 URB 在本类中等待数据，已经应答了 RET_UNLINK
+         */
+        bool unlink(std::uint32_t seqnum);
+
+        /**
+         * @brief 断开连接时丢弃缓冲的数据和等待中的 URB，在途传输完成后不再重新提交
+         */
+        void stop();
+
+        [[nodiscard]] Stats stats() const;
+
+    private:
+        struct Waiting
+        {
+            std::uint32_t seqnum;
+            std::uint32_t length;
+        };
+
+        static void transfer_callback(usb_transfer_t *trx);
+
+        // 以下函数需要持有 mutex_
+        void arm();
+        bool submit(usb_transfer_t *trx);
+        void push(const std::uint8_t *data, std::size_t length);
+        std::size_t next_chunk(std::uint32_t length) const;
+        void pop(std::uint8_t *dst, std::size_t length);
+        void deliver(std::uint32_t seqnum, std::uint32_t length);
+        void drain_waiting();
+
+        Esp32DeviceHandler &handler_;
+        const std::uint8_t ep_address_;
+        const std::uint16_t max_packet_size_;
+        const bool packet_framing_;
+
+        mutable std::mutex mutex_;
+
+        std::vector<usb_transfer_t *> transfers_;
+        std::vector<usb_transfer_t *> idle_;
+        bool running_ = false;
+        // 端点 STALL 等错误，缓冲区取空后报告给客户端，直到下一个 URB 重新开始接收
+        int fault_status_ = 0;
+
+        std::uint8_t *ring_ = nullptr;
+        std::size_t capacity_ = 0;
+        std::size_t head_ = 0;
+        std::size_t size_ = 0;
+        // packet_framing_ 时缓冲区中每次传输收到的数据长度
+        std::deque<std::size_t> records_;
+
+        std::deque<Waiting> waiting_;
+
+        Stats stats_{};
+    };
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include <esp_err.h>
+#include <esp_pthread.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+/**
+ * @brief 服务器创建的所有任务的核心、优先级和栈大小
+ *
+ * 所有任务都从当前方案中取配置，不再各自写死。方案可以在运行时切换并保存到 NVS：
+ * - 之后创建的任务（完成处理线程等）直接使用新方案
+ * - 已经注册的常驻任务立即应用新的优先级，核心绑定需要重启后生效
+ */
+namespace usbipdcpp
+{
+    enum class TaskRole : std::uint8_t
+    {
+        MainWorker,       // main_worker，初始化和状态打印
+        UsbHostEvent,     // usb_host_event，usb_host_lib_handle_events
+        ClientEvent,      // Esp32Server 的 client_event_thread
+        NetworkIo,        // Server 的 network_io_thread，只负责 accept
+        Session,          // 会话执行器线程，所有会话共用，收发 USB/IP 报文
+        CompletionWorker, // 每个设备一个完成处理线程
+        BotFlush,         // BOT 写合并的后台下发线程
+        EnumCache,        // 枚举缓存的 NVS 写入和后台校验
+        Count
+    };
+
+    struct TaskPlacement
+    {
+        const char *name;
+        int core; // TaskTopology::NO_AFFINITY 表示不绑定核心
+        std::uint32_t stack_size;
+        std::uint8_t priority;
+    };
+
+    struct TaskTopologyProfile
+    {
+        const char *name;
+        const char *description;
+        std::array<TaskPlacement, static_cast<std::size_t>(TaskRole::Count)> tasks;
+
+        [[nodiscard]] const TaskPlacement &operator[](TaskRole role) const
+        {
+            return tasks[static_cast<std::size_t>(role)];
+        }
+    };
+
+    class TaskTopology
+    {
+    public:
+        static constexpr int NO_AFFINITY = -1;
+
+        static TaskTopology &instance();
+
+        /**
+         * @brief 内置方案，第一个为默认方案
+         */
+        static std::span<const TaskTopologyProfile> builtin_profiles();
+
+        /**
+         * @brief 按名字切换到内置方案
+         * @return 没有这个名字的方案时返回 false
+         */
+        bool select(std::string_view name);
+
+        [[nodiscard]] const TaskTopologyProfile &current() const;
+
+        [[nodiscard]] TaskPlacement placement(TaskRole role) const;
+
+        [[nodiscard]] esp_pthread_cfg_t pthread_config(TaskRole role) const;
+
+        /**
+         * @brief 按方案创建 FreeRTOS 任务并登记，切换方案时会更新它的优先级
+         */
+        BaseType_t create_task(TaskRole role, TaskFunction_t func, void *arg, TaskHandle_t *handle);
+
+        /**
+         * @brief 之后在当前线程中创建的 std::thread 都使用 role 的配置
+         */
+        void apply_to_current_thread(TaskRole role) const;
+
+        /**
+         * @brief 登记常驻任务，切换方案时更新它的优先级
+         */
+        void register_task(TaskRole role, TaskHandle_t handle);
+        void unregister_task(TaskHandle_t handle);
+
+        /**
+         * @brief 从 NVS 读取上次保存的方案，没有保存过时保持默认方案
+         */
+        esp_err_t load_from_nvs();
+        esp_err_t save_to_nvs() const;
+
+        void log_current() const;
+
+        /**
+         * @brief 作用域内在当前线程创建的 std::thread 使用 role 的配置，离开作用域后恢复默认
+         */
+        class ScopedThreadConfig
+        {
+        public:
+            explicit ScopedThreadConfig(TaskRole role);
+            ~ScopedThreadConfig();
+
+            ScopedThreadConfig(const ScopedThreadConfig &) = delete;
+            ScopedThreadConfig &operator=(const ScopedThreadConfig &) = delete;
+        };
+
+    private:
+        TaskTopology() = default;
+
+        void apply_priorities();
+
+        struct RegisteredTask
+        {
+            TaskRole role;
+            TaskHandle_t handle;
+        };
+
+        mutable std::mutex mutex_;
+        const TaskTopologyProfile *current_ = nullptr;
+        std::vector<RegisteredTask> registered_;
+    };
+}
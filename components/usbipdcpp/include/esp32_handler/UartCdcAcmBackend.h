@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+#include <driver/uart.h>
+
+#include "CdcAcmPort.h"
+
+/**
+ * @brief 把虚拟 CDC ACM 串口接到 ESP32 的一个 UART 上
+ *
+ * 主机设置的波特率、数据位、校验和停止位直接应用到 UART。
+ * 两个方向各由一个线程搬运数据，发往 UART 的写入可能阻塞，不能放在网络线程里。
+ */
+namespace usbipdcpp
+{
+    class UartCdcAcmBackend : public CdcAcmBackend
+    {
+    public:
+        /**
+         * @param buffer_bytes UART 驱动的收发缓冲区大小，必须大于硬件 FIFO
+         */
+        UartCdcAcmBackend(uart_port_t uart, int tx_pin, int rx_pin, std::size_t buffer_bytes = 2048);
+        ~UartCdcAcmBackend() override;
+
+        UartCdcAcmBackend(const UartCdcAcmBackend &) = delete;
+        UartCdcAcmBackend &operator=(const UartCdcAcmBackend &) = delete;
+
+        [[nodiscard]] bool usable() const
+        {
+            return installed_;
+        }
+
+        void start(CdcAcmPort &port) override;
+        void stop() override;
+        void on_data_from_host(CdcAcmPort &port) override;
+        void on_line_coding(CdcAcmPort &port, const CdcLineCoding &line_coding) override;
+        void on_break(CdcAcmPort &port, std::uint16_t duration_ms) override;
+
+    private:
+        void rx_loop(CdcAcmPort &port);
+        void tx_loop(CdcAcmPort &port);
+
+        const uart_port_t uart_;
+        bool installed_ = false;
+        std::uint32_t baud_rate_ = 115200;
+
+        std::atomic<bool> running_ = false;
+        std::thread rx_thread_;
+        std::thread tx_thread_;
+
+        std::mutex tx_mutex_;
+        std::condition_variable tx_cv_;
+        bool tx_pending_ = false;
+    };
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <array>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+#include "protocol.h"
+#include "LatencyHistogram.h"
+
+/**
+ * @brief 不经过网络，在本地对直通设备的一个 bulk 端点做吞吐测试
+ *
+ * 传输通过 Esp32DeviceHandler::handle_bulk_transfer 提交，走和客户端 URB 完全相同的
+ * 分配、拆分、并发限制和完成处理路径，只是应答交给探针而不是会话。
+ * 测得的速度就是 USB 主机这一侧的上限，与客户端实测的差距来自网络。
+ *
+ * OUT 方向写入的是固定的填充数据，只应该对 loopback 或 source/sink 之类的测试设备使用。
+ * 设备不能同时被客户端导入。
+ */
+namespace usbipdcpp
+{
+    class Esp32DeviceHandler;
+
+    class UsbThroughputProbe
+    {
+    public:
+        struct Config
+        {
+            std::uint8_t ep_address = 0;
+            std::uint32_t transfer_size = 16 * 1024;
+            std::uint32_t duration_ms = 5000;
+            std::uint8_t queue_depth = 4; // 同时在途的 URB 数
+            std::uint32_t stall_timeout_ms = 2000; // 这么久没有任何完成视为端点卡住
+        };
+
+        struct Result
+        {
+            std::string error; // 为空表示测试正常结束
+            std::uint64_t transfers = 0;
+            std::uint64_t failed = 0;
+            std::uint64_t bytes = 0;
+            std::uint64_t elapsed_us = 0;
+            double mb_per_s = 0.0;
+            // 提交 URB 到收到应答
+            std::uint64_t latency_avg_us = 0, latency_p50_us = 0, latency_p90_us = 0, latency_p99_us = 0,
+                          latency_max_us = 0;
+            // 提交和完成处理占用的 CPU 时间占测试时长的比例，不含中断和 USB 主机库本身
+            double cpu_percent = 0.0;
+        };
+
+        static constexpr std::uint8_t MAX_QUEUE_DEPTH = 32;
+
+        /**
+         * @brief 阻塞运行一次测试，不能在 client event 线程或完成处理线程调用
+         */
+        static Result run(Esp32DeviceHandler &handler, const Config &config);
+
+        /**
+         * @brief 在完成处理线程或提交线程中调用，接收本应发给会话的应答
+         */
+        void on_response(const UsbIpResponse::UsbIpRetSubmit &response);
+
+    private:
+        explicit UsbThroughputProbe(const Config &config);
+
+        Config config_;
+        LatencyHistogram latency_;
+        std::array<std::int64_t, 64> submit_times_{};
+
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::uint32_t in_flight_ = 0;
+        std::uint64_t completed_ = 0;
+        std::uint64_t failed_ = 0;
+        std::uint64_t bytes_ = 0;
+    };
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace usbipdcpp {
+    /**
+     * @brief 定长的多生产者单消费者无锁队列
+     *
+     * 每个槽带一个序号，生产者用 CAS 抢占写入位置，写完再发布序号，队列满时 try_push 直接返回 false。
+     * front 和 try_pop 只能由同一时刻唯一的消费者调用。
+     * @tparam Capacity 必须是 2 的幂
+     */
+    template<typename T, std::size_t Capacity>
+    class BoundedMpscQueue {
+        static_assert(std::has_single_bit(Capacity), "Capacity必须是2的幂");
+
+    public:
+        BoundedMpscQueue() {
+            for (std::size_t i = 0; i < Capacity; i++) {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        BoundedMpscQueue(const BoundedMpscQueue &) = delete;
+        BoundedMpscQueue &operator=(const BoundedMpscQueue &) = delete;
+
+        /**
+         * @brief 任意线程调用
+         * @return 队列满时返回 false，value 保持不变
+         */
+        bool try_push(T &&value) {
+            auto pos = tail.load(std::memory_order_relaxed);
+            while (true) {
+                auto &cell = cells[pos & (Capacity - 1)];
+                auto seq = cell.sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+                if (diff == 0) {
+                    if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                        cell.value = std::move(value);
+                        cell.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0) {
+                    // 消费者还没有取走上一轮的值
+                    return false;
+                }
+                else {
+                    pos = tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        bool try_push(const T &value) {
+            T copy = value;
+            return try_push(std::move(copy));
+        }
+
+        /**
+         * @brief 只能由消费者调用，队首的值还没发布时返回空指针
+         */
+        T *front() {
+            auto &cell = cells[head & (Capacity - 1)];
+            if (cell.sequence.load(std::memory_order_acquire) != head + 1) {
+                return nullptr;
+            }
+            return &cell.value;
+        }
+
+        /**
+         * @brief 只能由消费者调用
+         */
+        std::optional<T> try_pop() {
+            auto value = front();
+            if (!value) {
+                return std::nullopt;
+            }
+            std::optional<T> ret{std::move(*value)};
+            cells[head & (Capacity - 1)].sequence.store(head + Capacity, std::memory_order_release);
+            head++;
+            return ret;
+        }
+
+        /**
+         * @brief 只能由消费者调用，从队首开始依次访问已经发布的值，遇到还没写完的槽为止。
+         * 可以原地修改这些值，不改变它们在队列中的顺序
+         */
+        template<typename F>
+        void for_each_published(F &&f) {
+            for (auto pos = head;; pos++) {
+                auto &cell = cells[pos & (Capacity - 1)];
+                if (cell.sequence.load(std::memory_order_acquire) != pos + 1) {
+                    return;
+                }
+                f(cell.value);
+            }
+        }
+
+        /**
+         * @brief 只能由消费者调用，包括已经抢占位置但还没写完的槽
+         */
+        [[nodiscard]] std::size_t size_approx() const {
+            return tail.load(std::memory_order_acquire) - head;
+        }
+
+        static constexpr std::size_t capacity() {
+            return Capacity;
+        }
+
+    private:
+        struct Cell {
+            std::atomic<std::size_t> sequence;
+            T value{};
+        };
+
+        std::array<Cell, Capacity> cells;
+        alignas(64) std::atomic<std::size_t> tail{0};
+        alignas(64) std::size_t head = 0;
+    };
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "BoundedMpscQueue.h"
+#include "protocol.h"
+
+namespace usbipdcpp
+{
+    /**
+     * @brief 从 USB 完成回调等任意线程交给会话发送协程的应答队列，多生产者单消费者
+     *
+     * 平时走定长的无锁队列，入队不加锁也不分配内存。无锁队列满时退回到加锁的溢出队列，应答不会丢弃。
+     * 同一个生产者入队的应答严格按入队顺序取出，同一端点上的 RET_SUBMIT 不会乱序。
+     * 消费者准备睡眠前调用 prepare_wait 清掉唤醒标志，之后第一个入队的生产者负责唤醒它，
+     * 消费者醒着的时候入队不需要任何通知，一批应答只唤醒一次。
+     */
+    class CompletionQueue
+    {
+    public:
+        static constexpr std::size_t CAPACITY = 256;
+
+        CompletionQueue() = default;
+        CompletionQueue(const CompletionQueue &) = delete;
+        CompletionQueue &operator=(const CompletionQueue &) = delete;
+
+        /**
+         * @brief 任意线程调用
+         * @return true 表示消费者可能在睡眠，调用者需要唤醒它。队列已关闭时丢弃应答并返回 false
+         */
+        bool push(UsbIpResponse::RetVariant &&response);
+
+        /**
+         * @brief 只能由消费者调用，按入队顺序取出最多 max 个应答追加到 out
+         * @return 取出的个数
+         */
+        std::size_t pop_batch(std::vector<UsbIpResponse::RetVariant> &out, std::size_t max);
+
+        /**
+         * @brief 只能由消费者调用，睡眠前调用
+         * @return false 表示清掉唤醒标志时又有应答入队，不能睡眠
+         */
+        bool prepare_wait();
+
+        /**
+         * @brief 之后入队的应答直接丢弃，已经在队列中的应答随队列析构
+         */
+        void close()
+        {
+            closed_.store(true, std::memory_order_release);
+        }
+
+        [[nodiscard]] bool closed() const
+        {
+            return closed_.load(std::memory_order_acquire);
+        }
+
+        /**
+         * @brief 因为无锁队列满而进入溢出队列的应答数
+         */
+        [[nodiscard]] std::uint64_t overflow_count() const
+        {
+            return overflow_count_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        BoundedMpscQueue<UsbIpResponse::RetVariant, CAPACITY> ring;
+
+        // 溢出队列不为空时新的应答也放进溢出队列，消费者取空无锁队列后才取溢出队列
+        std::mutex overflow_mutex;
+        std::deque<UsbIpResponse::RetVariant> overflow;
+        std::atomic_bool has_overflow = false;
+        // 只有消费者访问。消费者一次把溢出队列整个换出来，生产者马上就能回到无锁队列
+        std::deque<UsbIpResponse::RetVariant> spilled;
+
+        // 消费者上次睡眠后是否已经有生产者负责唤醒
+        std::atomic_bool wakeup_pending = false;
+        std::atomic_bool closed_ = false;
+        std::atomic<std::uint64_t> overflow_count_{0};
+    };
+}
@@ -6,7 +6,10 @@
 #include <memory>
 #include <list>
 #include <thread>
+#include <optional>
 
+#include <asio/io_context.hpp>
+#include <asio/executor_work_guard.hpp>
 #include <asio/ip/tcp.hpp>
 
 #include "device.h"
@@ -69,9 +72,35 @@ namespace usbipdcpp
 
         void register_session_exit_callback(std::function<void()> &&callback);
 
+        /**
+         * @brief 设置会话执行器的线程数，所有会话共用这些线程。需在start前调用
+         * @param count 0表示每个核心一个线程
+         */
+        void set_session_thread_count(std::size_t count)
+        {
+            session_thread_count = count;
+        }
+
     protected:
         asio::awaitable<void> do_accept(asio::ip::tcp::acceptor &acceptor);
 
+        /**
+         * @brief 在 start 中、创建会话执行器线程之前调用，平台可以在这里设置会话线程的属性
+         */
+        virtual void before_session_thread_create()
+        {
+        }
+
+        /**
+         * @brief 在每个会话执行器线程和设备回调线程开始运行和退出前调用
+         */
+        virtual void on_session_thread_start()
+        {
+        }
+        virtual void on_session_thread_exit()
+        {
+        }
+
         bool is_device_using(const std::string &busid);
 
         void try_moving_device_to_available(const std::string &busid);
@@ -96,6 +125,17 @@ namespace usbipdcpp
         // 所有网络通信请运行在下面这个线程，网络通信不可运行在其他线程中
         std::thread network_io_thread;
 
+        // 所有会话共用的io_context，每个会话在上面有自己的strand，会话再多也只占用固定的几个线程
+        asio::io_context session_io_context;
+        std::optional<asio::executor_work_guard<asio::io_context::executor_type>> session_work_guard;
+        std::vector<std::thread> session_threads;
+        std::size_t session_thread_count = 0;
+
+        // 设备的连接和断开回调可能长时间阻塞，在这个线程上执行，不占用会话执行器。所有设备共用，回调依次执行
+        asio::io_context device_hook_io_context;
+        std::optional<asio::executor_work_guard<asio::io_context::executor_type>> device_hook_work_guard;
+        std::thread device_hook_thread;
+
         std::list<std::function<void()>> session_exit_callbacks;
         std::shared_mutex exit_callbacks_mutex;
 
@@ -5,15 +5,18 @@
 #include <shared_mutex>
 #include <tuple>
 #include <chrono>
-#include <thread>
+#include <functional>
 
+#include <asio/io_context.hpp>
+#include <asio/strand.hpp>
 #include <asio/ip/tcp.hpp>
 #include <asio/awaitable.hpp>
-#include <asio/experimental/channel.hpp>
+#include <asio/steady_timer.hpp>
 #include <unordered_map>
 #include <shared_mutex>
 #include "protocol.h"
 #include "type.h"
+#include "CompletionQueue.h"
 #include "esp_timer.h"
 
 namespace usbipdcpp
@@ -22,7 +25,8 @@ namespace usbipdcpp
 
     /**
      * @brief 自行处理生命周期，一个连接创建一个Session，创建完服务器就对Session脱离管控了。
-     * 请确保Session存活的时候Server未被析构，不然是未定义行为
+     * 请确保Session存活的时候Server未被析构，不然是未定义行为。
+     * Session不再独占线程，而是运行在Server的会话执行器上，socket、发送唤醒定时器和会话的协程都在自己的strand上执行
      */
     class Session : public std::enable_shared_from_this<Session>
     {
@@ -47,7 +51,7 @@ namespace usbipdcpp
         void remove_seqnum_unlink(std::uint32_t seqnum);
 
         /**
-         * @brief 推荐使用这个函数。该函数异步，不阻塞。内部直接向asio context提交任务，因此不用加锁。内部线程安全。
+         * @brief 推荐使用这个函数。该函数异步，不阻塞。内部把任务派发到会话的strand上，因此不用加锁。内部线程安全。
          * 请确保每个urb都需要提交返回的包
          * @param unlink
          */
@@ -55,13 +59,13 @@ namespace usbipdcpp
                                                              std::uint32_t seqnum);
 
         /**
-         * @brief 该函数异步，不阻塞。内部直接向asio context提交任务，因此不用加锁。内部线程安全。调用完别忘记调用remove_seqnum_unlink。
+         * @brief 该函数异步，不阻塞。内部把任务派发到会话的strand上，因此不用加锁。内部线程安全。调用完别忘记调用remove_seqnum_unlink。
          * 请确保每个urb都需要提交返回的包
          * @param unlink
          */
         void submit_ret_unlink(UsbIpResponse::UsbIpRetUnlink &&unlink);
         /**
-         * @brief 该函数异步，不阻塞。内部直接向asio context提交任务，因此不用加锁。内部线程安全。
+         * @brief 该函数异步，不阻塞。内部把任务派发到会话的strand上，因此不用加锁。内部线程安全。
          * 请确保每个urb都需要提交返回的包
          * @param submit
          */
@@ -74,7 +78,7 @@ namespace usbipdcpp
         asio::awaitable<void> receiver_single(usbipdcpp::error_code &receiver_ec);
 
         /**
-         * @brief 新建Session时由Server调用
+         * @brief 新建Session时由Server调用，在strand上启动会话协程，结束后自动从Server中删除自身
          */
         void run();
 
@@ -86,10 +90,26 @@ namespace usbipdcpp
          */
         void immediately_stop();
 
-        using transfer_channel_type = asio::experimental::channel<void(asio::error_code, UsbIpResponse::RetVariant)>;
+        /**
+         * @brief 任意线程调用，把返回包放入completion_queue，发送协程睡眠时在strand上唤醒它
+         */
+        void queue_response(UsbIpResponse::RetVariant &&response, std::uint32_t seqnum);
+
+        /**
+         * @brief 只能在strand上调用，关闭completion_queue并唤醒发送协程
+         */
+        void close_completion_queue();
 
-        static constexpr std::size_t transfer_channel_size = 2048;
-        std::unique_ptr<transfer_channel_type> transfer_channel = nullptr;
+        // 发送协程一次从队列中取出的最多应答数
+        static constexpr std::size_t sender_batch_size = 16;
+        // 导入设备后才创建，之后直到Session析构都不会释放，生产者线程可以一直访问
+        std::unique_ptr<CompletionQueue> completion_queue = nullptr;
+
+        /**
+         * @brief 在Server的设备回调线程上执行设备的连接或断开回调，执行完后回到strand上继续。
+         * 回调可以阻塞，不会占用其他会话共用的执行器线程
+         */
+        asio::awaitable<void> run_device_hook(std::function<void()> hook);
 
         asio::awaitable<void> transfer_loop(usbipdcpp::error_code &transferring_ec);
 
@@ -113,11 +133,11 @@ namespace usbipdcpp
         std::shared_mutex unlink_map_mutex;
 
         Server &server;
-        asio::io_context session_io_context{};
+        // 会话的所有异步操作都在这个strand上串行执行
+        asio::strand<asio::io_context::executor_type> strand;
         asio::ip::tcp::socket socket;
-
-        // 这个线程结束后自动析构this
-        std::thread run_thread;
+        // 发送协程在上面睡眠，cancel即唤醒
+        asio::steady_timer sender_wakeup;
 
         // 延迟统计相关
         std::unordered_map<std::uint32_t, int64_t> recv_timestamps_;
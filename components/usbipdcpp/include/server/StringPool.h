@@ -1,41 +1,149 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <bit>
+#include <memory>
 #include <optional>
-#include <shared_mutex>
-#include <map>
+#include <string>
+#include <string_view>
+#include <system_error>
 
 #include <spdlog/spdlog.h>
 
+#include "type.h"
+#include "constant.h"
+
 namespace usbipdcpp {
+    /**
+     * @brief 字符串描述符表
+     *
+     * 每个字符串在加入时就编码成完整的 UTF-16LE 字符串描述符（bLength、bDescriptorType 加字符），
+     * GET_DESCRIPTOR(STRING) 直接返回共享的只读描述符，不再逐次转换和复制。
+     * 索引用位图分配，读取不加锁；被替换或删除的描述符在最后一个读者释放后才会销毁。
+     * 索引 0 是语言 ID 表，不在这里分配。
+     */
     class StringPool {
     public:
-        std::uint8_t new_string(const std::wstring &str) {
-            std::lock_guard lock(string_pool_mutex);
-            for (std::uint8_t index = 1; index < std::numeric_limits<std::uint8_t>::max(); index++) {
-                if (!string_pool.contains(index)) {
-                    string_pool[index] = str;
-                    return index;
-                }
+        // bLength 只有一个字节，去掉 2 字节的头最多放 126 个 UTF-16 码元
+        static constexpr std::size_t max_string_units = (0xFF - 2) / 2;
+
+        std::uint8_t new_string(std::u16string_view str) {
+            auto index = allocate_index();
+            descriptors[index].store(encode(str), std::memory_order_release);
+            return index;
+        }
+
+        std::uint8_t new_string(std::wstring_view str) {
+            return new_string(std::u16string_view(to_utf16(str)));
+        }
+
+        /**
+         * @brief 保持索引不变替换内容，索引无效时返回 false
+         */
+        bool replace_string(std::uint8_t index, std::u16string_view str) {
+            if (!contains(index)) {
+                return false;
             }
-            SPDLOG_CRITICAL("字符串池用完了");
-            throw std::system_error(std::make_error_code(std::errc::no_buffer_space));
+            descriptors[index].store(encode(str), std::memory_order_release);
+            return true;
         }
 
-        std::optional<std::wstring> get_string(std::uint8_t index) {
-            std::shared_lock lock(string_pool_mutex);
-            if (!string_pool.contains(index)) {
+        bool replace_string(std::uint8_t index, std::wstring_view str) {
+            return replace_string(index, std::u16string_view(to_utf16(str)));
+        }
+
+        /**
+         * @brief 取得编码好的字符串描述符，索引无效时返回空指针
+         */
+        [[nodiscard]] descriptor_ptr get_descriptor(std::uint8_t index) const {
+            return descriptors[index].load(std::memory_order_acquire);
+        }
+
+        [[nodiscard]] bool contains(std::uint8_t index) const {
+            return index != 0 && (used[index / 64].load(std::memory_order_acquire) & bit_of(index)) != 0;
+        }
+
+        /**
+         * @brief 从描述符解码回字符串，只用于日志等非热路径
+         */
+        [[nodiscard]] std::optional<std::u16string> get_string(std::uint8_t index) const {
+            auto desc = get_descriptor(index);
+            if (!desc) {
                 return std::nullopt;
             }
-            return string_pool[index];
+            std::u16string str;
+            str.reserve((desc->size() - 2) / 2);
+            for (std::size_t i = 2; i + 1 < desc->size(); i += 2) {
+                str.push_back(static_cast<char16_t>((*desc)[i] | ((*desc)[i + 1] << 8)));
+            }
+            return str;
         }
 
         void remove_string(std::uint8_t index) {
-            std::lock_guard lock(string_pool_mutex);
-            string_pool.erase(index);
+            if (index == 0) {
+                return;
+            }
+            descriptors[index].store(nullptr, std::memory_order_release);
+            used[index / 64].fetch_and(~bit_of(index), std::memory_order_acq_rel);
         }
 
     private:
-        std::map<std::uint8_t, std::wstring> string_pool;
-        std::shared_mutex string_pool_mutex;
+        static constexpr std::uint64_t bit_of(std::uint8_t index) {
+            return std::uint64_t{1} << (index % 64);
+        }
+
+        std::uint8_t allocate_index() {
+            for (std::size_t word = 0; word < used.size(); word++) {
+                auto current = used[word].load(std::memory_order_relaxed);
+                while (~current != 0) {
+                    auto bit = std::countr_zero(~current);
+                    if (used[word].compare_exchange_weak(current, current | (std::uint64_t{1} << bit),
+                                                         std::memory_order_acq_rel)) {
+                        return static_cast<std::uint8_t>(word * 64 + bit);
+                    }
+                }
+            }
+            SPDLOG_CRITICAL("字符串池用完了");
+            throw std::system_error(std::make_error_code(std::errc::no_buffer_space));
+        }
+
+        static descriptor_ptr encode(std::u16string_view str) {
+            if (str.size() > max_string_units) {
+                SPDLOG_WARN("字符串超过 {} 个 UTF-16 码元，已截断", max_string_units);
+                str = str.substr(0, max_string_units);
+            }
+            auto desc = std::make_shared<data_type>();
+            desc->reserve(2 + str.size() * 2);
+            desc->push_back(static_cast<std::uint8_t>(2 + str.size() * 2));
+            desc->push_back(static_cast<std::uint8_t>(DescriptorType::String));
+            for (auto c: str) {
+                desc->push_back(static_cast<std::uint8_t>(c));
+                desc->push_back(static_cast<std::uint8_t>(c >> 8));
+            }
+            return desc;
+        }
+
+        static std::u16string to_utf16(std::wstring_view str) {
+            std::u16string result;
+            result.reserve(str.size());
+            for (auto c: str) {
+                auto code_point = static_cast<std::uint32_t>(c);
+                if constexpr (sizeof(wchar_t) > 2) {
+                    if (code_point > 0xFFFF) {
+                        code_point -= 0x10000;
+                        result.push_back(static_cast<char16_t>(0xD800 + (code_point >> 10)));
+                        result.push_back(static_cast<char16_t>(0xDC00 + (code_point & 0x3FF)));
+                        continue;
+                    }
+                }
+                result.push_back(static_cast<char16_t>(code_point));
+            }
+            return result;
+        }
+
+        // 第 0 位对应语言 ID 表，一开始就占用
+        std::array<std::atomic<std::uint64_t>, 4> used{1, 0, 0, 0};
+        std::array<std::atomic<descriptor_ptr>, 256> descriptors{};
     };
 }
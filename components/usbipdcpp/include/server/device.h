@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <filesystem>
 #include <variant>
 
@@ -26,6 +27,27 @@ namespace usbipdcpp {
         using AllCmdVariant = std::variant<OpReqDevlist, OpReqImport, UsbIpCmdSubmit, UsbIpCmdUnlink>;
     }
 
+    struct UsbEndpointRoute;
+
+    using UsbUrbEntry = void (*)(AbstDeviceHandler &handler, const UsbEndpointRoute &route,
+                                 std::uint32_t seqnum, std::uint32_t transfer_flags,
+                                 std::uint32_t transfer_buffer_length, const SetupPacket &setup_packet,
+                                 const data_type &out_data,
+                                 const std::vector<UsbIpIsoPacketDescriptor> &iso_packet_descriptors,
+                                 error_code &ec);
+
+    /**
+     * @brief 端点路由表的一项，导入设备时建立，之后每个URB只需按端点地址取一次下标
+     */
+    struct UsbEndpointRoute {
+        const UsbEndpoint *endpoint = nullptr;
+        // 端点0不属于任何接口，为空
+        UsbInterface *interface = nullptr;
+        EndpointAttributes transfer_type = EndpointAttributes::Control;
+        // 为空表示设备没有这个端点
+        UsbUrbEntry entry = nullptr;
+    };
+
     struct UsbDevice {
         std::filesystem::path path{};
         std::string busid{};
@@ -48,6 +70,10 @@ namespace usbipdcpp {
 
         std::shared_ptr<AbstDeviceHandler> handler;
 
+        // 按端点地址索引，IN 端点放在后 16 项
+        static constexpr std::size_t route_count = 32;
+        std::array<UsbEndpointRoute, route_count> routes{};
+
         template<typename T, typename... Args>
         std::shared_ptr<T> with_handler(Args &&... args) {
             auto new_handler = std::make_shared<T>(*this, std::forward<Args>(args)...);
@@ -82,20 +108,34 @@ namespace usbipdcpp {
 
         std::optional<std::pair<UsbEndpoint, std::optional<UsbInterface>>> find_ep(std::uint8_t ep);
 
-        void handle_urb(const UsbIpCommand::UsbIpCmdSubmit &cmd,
-                        std::uint32_t seqnum, const UsbEndpoint &ep,
-                        std::optional<UsbInterface> &interface, std::uint32_t transfer_buffer_length,
-                        const SetupPacket &setup_packet, const std::vector<std::uint8_t> &out_data,
+        static constexpr std::size_t route_index(std::uint8_t ep) {
+            return (ep & 0x0F) | ((ep & 0x80) >> 3);
+        }
+
+        /**
+         * @brief 根据当前的接口和端点建立路由表，导入时调用。
+         * 路由表保存指向 interfaces 和 ep0 的指针，传输期间不能再修改 interfaces 的结构
+         */
+        void build_routes();
+
+        [[nodiscard]] const UsbEndpointRoute &route(std::uint8_t ep) const {
+            return routes[route_index(ep)];
+        }
+
+        void handle_urb(const UsbEndpointRoute &route, std::uint32_t seqnum,
+                        std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
+                        const SetupPacket &setup_packet, const data_type &out_data,
                         const std::vector<UsbIpIsoPacketDescriptor> &iso_packet_descriptors, std::error_code &ec);
         /**
-         * @brief 新的客户端连接时会调这个函数，可以阻塞
+         * @brief 新的客户端连接时会调这个函数，在Server的设备回调线程上执行，可以阻塞。
+         * 所有设备共用这个线程，阻塞会推迟其他设备的连接和断开，但不影响会话的收发
          * @param session
          * @param ec 发生的ec
          */
         void on_new_connection(Session& session, error_code &ec);
         /**
          * @brief 当发生错误等情况需要完全终止传输时会调用这个函数。被调用后禁止再提交消息和使用Session对象
-         * 可以阻塞，处理所有需要处理的事务
+         * 在Server的设备回调线程上执行，可以阻塞，处理所有需要处理的事务
          */
         void on_disconnection(error_code &ec);
         /**
@@ -279,10 +279,13 @@ namespace usbipdcpp
             std::uint32_t number_of_packets;
             std::uint32_t error_count;
 
-            // 两种数据持有方式
+            // 三种数据持有方式
             std::shared_ptr<data_type> transfer_buffer;
             UsbTransferPtr usb_transfer;
             std::size_t data_offset;
+            // 直接指向外部内存（如虚拟U盘的映射），data_owner 保证发送完成前这块内存有效
+            std::shared_ptr<const void> data_owner;
+            const std::uint8_t *data_view = nullptr;
             std::vector<UsbIpIsoPacketDescriptor> iso_packet_descriptor;
 
             [[nodiscard]] data_type to_bytes() const;
@@ -319,10 +322,20 @@ namespace usbipdcpp
                 std::size_t data_offset,
                 const std::vector<UsbIpIsoPacketDescriptor> &iso_packet_descriptor);
 
+            // 零拷贝版本，发送 data 开始的 length 字节，不支持等时传输
+            static UsbIpRetSubmit create_ret_submit_view(
+                std::uint32_t seqnum,
+                std::uint32_t status,
+                std::shared_ptr<const void> owner,
+                const std::uint8_t *data,
+                std::uint32_t length);
+
             static UsbIpRetSubmit create_ret_submit_ok_without_data(std::uint32_t seqnum);
             static UsbIpRetSubmit create_ret_submit_with_status_and_no_data(std::uint32_t seqnum, std::uint32_t status);
             static UsbIpRetSubmit create_ret_submit_with_status_and_no_iso(std::uint32_t seqnum, std::uint32_t status,
                                                                            const data_type &transfer_buffer);
+            static UsbIpRetSubmit create_ret_submit_with_status_and_no_iso(std::uint32_t seqnum, std::uint32_t status,
+                                                                           data_type &&transfer_buffer);
             static UsbIpRetSubmit create_ret_submit_epipe_no_iso(std::uint32_t seqnum,
                                                                  const data_type &transfer_buffer);
             static UsbIpRetSubmit create_ret_submit_epipe_without_data(std::uint32_t seqnum);
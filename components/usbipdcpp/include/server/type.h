@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cstdint>
+#include <algorithm>
+#include <memory>
 #include <vector>
 #include <ranges>
 #include <string>
@@ -12,6 +14,21 @@ namespace usbipdcpp
     using error_code = std::error_code;
     using data_type = std::vector<std::uint8_t>;
 
+    // 生成后不再修改的描述符，多个请求共享同一份
+    using descriptor_ptr = std::shared_ptr<const data_type>;
+
+    /**
+     * @brief 按请求的长度截取描述符，desc 为空时返回空
+     */
+    inline data_type slice_descriptor(const descriptor_ptr &desc, std::size_t length)
+    {
+        if (!desc)
+        {
+            return {};
+        }
+        return data_type(desc->begin(), desc->begin() + std::min(length, desc->size()));
+    }
+
     template <std::size_t N>
     using array_data_type = std::array<std::uint8_t, N>;
 
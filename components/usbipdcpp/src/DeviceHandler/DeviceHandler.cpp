@@ -16,51 +16,89 @@ AbstDeviceHandler::AbstDeviceHandler(AbstDeviceHandler &&other) noexcept : handl
 }
 
 void AbstDeviceHandler::dispatch_urb(
-    const UsbIpCommand::UsbIpCmdSubmit &cmd,
+    const UsbEndpointRoute &route,
     std::uint32_t seqnum,
-    const UsbEndpoint &ep,
-    std::optional<UsbInterface> &interface,
     std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
-    const SetupPacket &setup_packet, const std::vector<std::uint8_t> &out_data,
+    const SetupPacket &setup_packet, const data_type &out_data,
     const std::vector<UsbIpIsoPacketDescriptor> &iso_packet_descriptors,
     usbipdcpp::error_code &ec)
 {
-    std::lock_guard lock(self_mutex);
-    if (ep.attributes == static_cast<std::uint8_t>(EndpointAttributes::Control))
-    {
-        SPDLOG_DEBUG("处理控制传输，setup包为{}\n{}", get_every_byte(setup_packet.to_bytes()), setup_packet.to_string());
-        handle_control_urb(seqnum, ep, transfer_flags, transfer_buffer_length, setup_packet, out_data, ec);
-    }
-    else if (interface.has_value())
+    std::lock_guard lock(dispatch_mutex(route));
+    route.entry(*this, route, seqnum, transfer_flags, transfer_buffer_length, setup_packet, out_data,
+                iso_packet_descriptors, ec);
+}
+
+std::mutex &AbstDeviceHandler::dispatch_mutex(const UsbEndpointRoute &route)
+{
+    if (route.transfer_type == EndpointAttributes::Control)
     {
-        auto &intf = interface.value();
-        if (ep.attributes == static_cast<std::uint8_t>(EndpointAttributes::Bulk))
-        {
-            SPDLOG_DEBUG("处理块传输");
-            handle_bulk_transfer(seqnum, ep, intf, transfer_flags, transfer_buffer_length, out_data, ec);
-        }
-        else if (ep.attributes == static_cast<std::uint8_t>(EndpointAttributes::Interrupt))
-        {
-            SPDLOG_DEBUG("处理中断传输");
-            handle_interrupt_transfer(seqnum, ep, intf, transfer_flags, transfer_buffer_length, out_data, ec);
-        }
-        else if (ep.attributes == static_cast<std::uint8_t>(EndpointAttributes::Isochronous))
-        {
-            SPDLOG_DEBUG("处理等时传输");
-            handle_isochronous_transfer(seqnum, ep, intf, transfer_flags, transfer_buffer_length, out_data,
-                                        iso_packet_descriptors, ec);
-        }
-        else
-        {
-            SPDLOG_DEBUG("端口{:02x}的未知传输类型：{}", ep.address, ep.attributes);
-            ec = make_error_code(ErrorType::INVALID_ARG);
-        }
+        return endpoint_mutexes[UsbDevice::route_index(route.endpoint->address & 0x0F)];
     }
-    else
+    return endpoint_mutexes[UsbDevice::route_index(route.endpoint->address)];
+}
+
+UsbUrbEntry AbstDeviceHandler::route_entry(EndpointAttributes transfer_type)
+{
+    switch (transfer_type)
     {
-        SPDLOG_ERROR("非控制传输却不存在目标接口");
-        ec = make_error_code(ErrorType::INTERNAL_ERROR);
+    case EndpointAttributes::Control:
+        return &AbstDeviceHandler::route_control;
+    case EndpointAttributes::Bulk:
+        return &AbstDeviceHandler::route_bulk;
+    case EndpointAttributes::Interrupt:
+        return &AbstDeviceHandler::route_interrupt;
+    case EndpointAttributes::Isochronous:
+        return &AbstDeviceHandler::route_isochronous;
     }
+    return nullptr;
+}
+
+void AbstDeviceHandler::route_control(AbstDeviceHandler &handler, const UsbEndpointRoute &route,
+                                      std::uint32_t seqnum, std::uint32_t transfer_flags,
+                                      std::uint32_t transfer_buffer_length, const SetupPacket &setup_packet,
+                                      const data_type &out_data,
+                                      const std::vector<UsbIpIsoPacketDescriptor> &iso_packet_descriptors,
+                                      error_code &ec)
+{
+    SPDLOG_DEBUG("处理控制传输，setup包为{}\n{}", get_every_byte(setup_packet.to_bytes()), setup_packet.to_string());
+    handler.handle_control_urb(seqnum, *route.endpoint, transfer_flags, transfer_buffer_length, setup_packet,
+                               out_data, ec);
+}
+
+void AbstDeviceHandler::route_bulk(AbstDeviceHandler &handler, const UsbEndpointRoute &route,
+                                   std::uint32_t seqnum, std::uint32_t transfer_flags,
+                                   std::uint32_t transfer_buffer_length, const SetupPacket &setup_packet,
+                                   const data_type &out_data,
+                                   const std::vector<UsbIpIsoPacketDescriptor> &iso_packet_descriptors,
+                                   error_code &ec)
+{
+    SPDLOG_DEBUG("处理块传输");
+    handler.handle_bulk_transfer(seqnum, *route.endpoint, *route.interface, transfer_flags, transfer_buffer_length,
+                                 out_data, ec);
+}
+
+void AbstDeviceHandler::route_interrupt(AbstDeviceHandler &handler, const UsbEndpointRoute &route,
+                                        std::uint32_t seqnum, std::uint32_t transfer_flags,
+                                        std::uint32_t transfer_buffer_length, const SetupPacket &setup_packet,
+                                        const data_type &out_data,
+                                        const std::vector<UsbIpIsoPacketDescriptor> &iso_packet_descriptors,
+                                        error_code &ec)
+{
+    SPDLOG_DEBUG("处理中断传输");
+    handler.handle_interrupt_transfer(seqnum, *route.endpoint, *route.interface, transfer_flags,
+                                      transfer_buffer_length, out_data, ec);
+}
+
+void AbstDeviceHandler::route_isochronous(AbstDeviceHandler &handler, const UsbEndpointRoute &route,
+                                          std::uint32_t seqnum, std::uint32_t transfer_flags,
+                                          std::uint32_t transfer_buffer_length, const SetupPacket &setup_packet,
+                                          const data_type &out_data,
+                                          const std::vector<UsbIpIsoPacketDescriptor> &iso_packet_descriptors,
+                                          error_code &ec)
+{
+    SPDLOG_DEBUG("处理等时传输");
+    handler.handle_isochronous_transfer(seqnum, *route.endpoint, *route.interface, transfer_flags,
+                                        transfer_buffer_length, out_data, iso_packet_descriptors, ec);
 }
 
 void AbstDeviceHandler::on_new_connection(Session &current_session, error_code &ec)
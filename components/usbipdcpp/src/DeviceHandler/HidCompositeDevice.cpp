@@ -0,0 +1,51 @@
+#include "HidCompositeDevice.h"
+
+#include "SimpleVirtualDeviceHandler.h"
+
+using namespace usbipdcpp;
+
+std::shared_ptr<UsbDevice> usbipdcpp::make_hid_composite_device(StringPool &string_pool,
+                                                                std::vector<std::unique_ptr<HidReportSource>> &&sources,
+                                                                const HidCompositeDeviceConfig &config)
+{
+    std::vector<UsbInterface> interfaces;
+    interfaces.push_back(UsbInterface{
+        .interface_class = static_cast<std::uint8_t>(ClassCode::HID),
+        .interface_subclass = 0x00,
+        .interface_protocol = 0x00,
+        .endpoints = {
+            UsbEndpoint{
+                .address = 0x81,
+                .attributes = static_cast<std::uint8_t>(EndpointAttributes::Interrupt),
+                .max_packet_size = config.max_packet_size,
+                .interval = config.interval}},
+        .handler = {}});
+
+    auto device = std::make_shared<UsbDevice>(UsbDevice{
+        .path = "/usbipdcpp/virtual/" + config.busid,
+        .busid = config.busid,
+        .bus_num = 2,
+        .dev_num = 3,
+        .speed = static_cast<std::uint32_t>(config.speed),
+        .vendor_id = 0x1209,
+        .product_id = 0x0002,
+        .device_bcd = Version{1, 0, 0},
+        .device_class = static_cast<std::uint8_t>(ClassCode::SeeInterface),
+        .device_subclass = 0x00,
+        .device_protocol = 0x00,
+        .configuration_value = 1,
+        .num_configurations = 1,
+        .interfaces = std::move(interfaces),
+        .ep0_in = UsbEndpoint::get_default_ep0_in(),
+        .ep0_out = UsbEndpoint::get_default_ep0_out(),
+        .handler = {}});
+    // 接口 handler 引用 interfaces 中的元素，之后不能再改变 interfaces
+    auto handler = device->interfaces[0].with_handler<HidCompositeVirtualInterfaceHandler>(string_pool,
+                                                                                            std::move(sources));
+    if (!handler->usable())
+    {
+        return nullptr;
+    }
+    device->with_handler<SimpleVirtualDeviceHandler>(string_pool);
+    return device;
+}
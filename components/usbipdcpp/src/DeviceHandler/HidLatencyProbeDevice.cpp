@@ -0,0 +1,45 @@
+#include "HidLatencyProbeDevice.h"
+
+#include "SimpleVirtualDeviceHandler.h"
+
+using namespace usbipdcpp;
+
+std::shared_ptr<UsbDevice> usbipdcpp::make_hid_latency_probe_device(StringPool &string_pool,
+                                                                    const HidLatencyProbeDeviceConfig &config)
+{
+    std::vector<UsbInterface> interfaces;
+    interfaces.push_back(UsbInterface{
+        .interface_class = static_cast<std::uint8_t>(ClassCode::HID),
+        .interface_subclass = 0x00,
+        .interface_protocol = 0x00,
+        .endpoints = {
+            UsbEndpoint{
+                .address = 0x81,
+                .attributes = static_cast<std::uint8_t>(EndpointAttributes::Interrupt),
+                .max_packet_size = HidLatencyProbeVirtualInterfaceHandler::INPUT_REPORT_SIZE,
+                .interval = config.interval}},
+        .handler = {}});
+
+    auto device = std::make_shared<UsbDevice>(UsbDevice{
+        .path = "/usbipdcpp/virtual/" + config.busid,
+        .busid = config.busid,
+        .bus_num = 2,
+        .dev_num = 2,
+        .speed = static_cast<std::uint32_t>(config.speed),
+        .vendor_id = 0x1209,
+        .product_id = 0x0001,
+        .device_bcd = Version{1, 0, 0},
+        .device_class = static_cast<std::uint8_t>(ClassCode::SeeInterface),
+        .device_subclass = 0x00,
+        .device_protocol = 0x00,
+        .configuration_value = 1,
+        .num_configurations = 1,
+        .interfaces = std::move(interfaces),
+        .ep0_in = UsbEndpoint::get_default_ep0_in(),
+        .ep0_out = UsbEndpoint::get_default_ep0_out(),
+        .handler = {}});
+    // 接口 handler 引用 interfaces 中的元素，之后不能再改变 interfaces
+    device->interfaces[0].with_handler<HidLatencyProbeVirtualInterfaceHandler>(string_pool, config.interface);
+    device->with_handler<SimpleVirtualDeviceHandler>(string_pool);
+    return device;
+}
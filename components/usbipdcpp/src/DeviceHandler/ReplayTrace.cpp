@@ -0,0 +1,278 @@
+#include "ReplayTrace.h"
+
+#include <algorithm>
+#include <charconv>
+
+#include <spdlog/spdlog.h>
+
+#include "endpoint.h"
+#include "interface.h"
+
+using namespace usbipdcpp;
+
+namespace
+{
+    std::vector<std::string_view> split_fields(std::string_view line)
+    {
+        std::vector<std::string_view> fields;
+        std::size_t pos = 0;
+        while (pos < line.size())
+        {
+            auto start = line.find_first_not_of(" \t\r", pos);
+            if (start == std::string_view::npos)
+            {
+                break;
+            }
+            auto end = line.find_first_of(" \t\r", start);
+            if (end == std::string_view::npos)
+            {
+                end = line.size();
+            }
+            fields.push_back(line.substr(start, end - start));
+            pos = end;
+        }
+        return fields;
+    }
+
+    template <typename T>
+    std::optional<T> parse_number(std::string_view field, int base = 10)
+    {
+        T value{};
+        auto [ptr, ec] = std::from_chars(field.data(), field.data() + field.size(), value, base);
+        if (ec != std::errc{} || ptr != field.data() + field.size())
+        {
+            return std::nullopt;
+        }
+        return value;
+    }
+
+    std::optional<data_type> parse_hex(std::string_view field)
+    {
+        if (field == "-")
+        {
+            return data_type{};
+        }
+        if (field.size() % 2 != 0)
+        {
+            return std::nullopt;
+        }
+        data_type data(field.size() / 2);
+        for (std::size_t i = 0; i < data.size(); i++)
+        {
+            auto byte = parse_number<std::uint8_t>(field.substr(i * 2, 2), 16);
+            if (!byte)
+            {
+                return std::nullopt;
+            }
+            data[i] = *byte;
+        }
+        return data;
+    }
+
+    std::uint16_t read_u16_le(const data_type &data, std::size_t offset)
+    {
+        return static_cast<std::uint16_t>(data[offset] | (data[offset + 1] << 8));
+    }
+}
+
+std::optional<ReplayTrace> ReplayTrace::parse(std::string_view text)
+{
+    ReplayTrace trace;
+    bool header_seen = false;
+    std::size_t line_number = 0;
+    while (!text.empty())
+    {
+        auto newline = text.find('\n');
+        auto line = text.substr(0, newline);
+        text = newline == std::string_view::npos ? std::string_view{} : text.substr(newline + 1);
+        line_number++;
+
+        auto fields = split_fields(line);
+        if (fields.empty() || fields[0].starts_with('#'))
+        {
+            continue;
+        }
+        auto fail = [&]()
+        {
+            SPDLOG_ERROR("回放文件第 {} 行格式错误: {}", line_number, line);
+            return std::nullopt;
+        };
+
+        auto kind = fields[0];
+        if (!header_seen)
+        {
+            if (kind != "usbipdcpp-replay" || fields.size() < 2 || fields[1] != "1")
+            {
+                SPDLOG_ERROR("不是版本 1 的回放文件");
+                return std::nullopt;
+            }
+            header_seen = true;
+            continue;
+        }
+
+        if (kind == "speed" && fields.size() == 2)
+        {
+            auto speed = parse_number<std::uint32_t>(fields[1]);
+            if (!speed)
+            {
+                return fail();
+            }
+            trace.speed = static_cast<UsbSpeed>(*speed);
+        }
+        else if ((kind == "device" || kind == "config") && fields.size() == 2)
+        {
+            auto data = parse_hex(fields[1]);
+            if (!data)
+            {
+                return fail();
+            }
+            (kind == "device" ? trace.device_descriptor : trace.configuration_descriptor) = std::move(*data);
+        }
+        else if (fields.size() == 5 && (kind == "c" || kind == "i" || kind == "o"))
+        {
+            Response response;
+            auto status = parse_number<std::int32_t>(fields[2]);
+            auto service_us = parse_number<std::uint32_t>(fields[3]);
+            if (!status || !service_us)
+            {
+                return fail();
+            }
+            response.status = *status;
+            response.service_us = *service_us;
+
+            if (kind == "c")
+            {
+                auto setup = parse_hex(fields[1]);
+                auto data = parse_hex(fields[4]);
+                if (!setup || setup->size() != 8 || !data)
+                {
+                    return fail();
+                }
+                response.data = std::move(*data);
+                response.actual_length = static_cast<std::uint32_t>(response.data.size());
+                ControlExchange exchange{.setup = {}, .response = std::move(response)};
+                std::ranges::copy(*setup, exchange.setup.begin());
+                trace.control.push_back(std::move(exchange));
+                continue;
+            }
+
+            auto ep = parse_number<std::uint8_t>(fields[1], 16);
+            if (!ep || (*ep & 0x7F) == 0 || ((*ep & 0x80) != 0) != (kind == "i"))
+            {
+                return fail();
+            }
+            if (kind == "i")
+            {
+                auto data = parse_hex(fields[4]);
+                if (!data)
+                {
+                    return fail();
+                }
+                response.data = std::move(*data);
+                response.actual_length = static_cast<std::uint32_t>(response.data.size());
+            }
+            else
+            {
+                auto actual_length = parse_number<std::uint32_t>(fields[4]);
+                if (!actual_length)
+                {
+                    return fail();
+                }
+                response.actual_length = *actual_length;
+            }
+            trace.endpoints[*ep].push_back(std::move(response));
+        }
+        else
+        {
+            return fail();
+        }
+    }
+
+    if (!header_seen)
+    {
+        SPDLOG_ERROR("回放文件是空的");
+        return std::nullopt;
+    }
+    if (trace.device_descriptor.size() < 18 || trace.configuration_descriptor.size() < 9)
+    {
+        SPDLOG_ERROR("回放文件缺少设备描述符或配置描述符");
+        return std::nullopt;
+    }
+    return trace;
+}
+
+std::shared_ptr<UsbDevice> ReplayTrace::make_device(const std::string &busid) const
+{
+    if (device_descriptor.size() < 18 || configuration_descriptor.size() < 9)
+    {
+        return nullptr;
+    }
+    const auto &dev = device_descriptor;
+    const auto &config = configuration_descriptor;
+
+    // 按 bInterfaceNumber 合并备用设置，接口在配置中的顺序就是编号顺序
+    std::map<std::uint8_t, UsbInterface> interfaces;
+    UsbInterface *current = nullptr;
+    std::size_t offset = 0;
+    while (offset + 2 <= config.size())
+    {
+        auto length = config[offset];
+        auto type = config[offset + 1];
+        if (length < 2 || offset + length > config.size())
+        {
+            SPDLOG_WARN("配置描述符在偏移 {} 处长度无效，忽略后面的部分", offset);
+            break;
+        }
+        if (type == static_cast<std::uint8_t>(DescriptorType::Interface) && length >= 9)
+        {
+            auto number = config[offset + 2];
+            auto [it, inserted] = interfaces.try_emplace(number, UsbInterface{
+                                                                     .interface_class = config[offset + 5],
+                                                                     .interface_subclass = config[offset + 6],
+                                                                     .interface_protocol = config[offset + 7],
+                                                                     .endpoints = {},
+                                                                     .handler = {}});
+            current = &it->second;
+        }
+        else if (type == static_cast<std::uint8_t>(DescriptorType::Endpoint) && length >= 7 && current)
+        {
+            UsbEndpoint ep{
+                .address = config[offset + 2],
+                .attributes = config[offset + 3],
+                .max_packet_size = read_u16_le(config, offset + 4),
+                .interval = config[offset + 6]};
+            if (std::ranges::none_of(current->endpoints, [&](const UsbEndpoint &existing)
+                                     { return existing.address == ep.address; }))
+            {
+                current->endpoints.push_back(ep);
+            }
+        }
+        offset += length;
+    }
+
+    std::vector<UsbInterface> interface_list;
+    for (auto &[number, intf] : interfaces)
+    {
+        interface_list.push_back(std::move(intf));
+    }
+
+    auto ep0_max_packet_size = static_cast<std::uint16_t>(dev[7]);
+    return std::make_shared<UsbDevice>(UsbDevice{
+        .path = "/usbipdcpp/replay/" + busid,
+        .busid = busid,
+        .bus_num = 3,
+        .dev_num = 1,
+        .speed = static_cast<std::uint32_t>(speed),
+        .vendor_id = read_u16_le(dev, 8),
+        .product_id = read_u16_le(dev, 10),
+        .device_bcd = Version{read_u16_le(dev, 12)},
+        .device_class = dev[4],
+        .device_subclass = dev[5],
+        .device_protocol = dev[6],
+        .configuration_value = config[5],
+        .num_configurations = dev[17],
+        .interfaces = std::move(interface_list),
+        .ep0_in = UsbEndpoint::get_ep0_in(ep0_max_packet_size),
+        .ep0_out = UsbEndpoint::get_ep0_out(ep0_max_packet_size),
+        .handler = {}});
+}
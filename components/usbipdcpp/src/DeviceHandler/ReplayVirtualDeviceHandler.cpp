@@ -0,0 +1,344 @@
+#include "ReplayVirtualDeviceHandler.h"
+
+#include "constant.h"
+#include "endpoint.h"
+#include "SetupPacket.h"
+#include "Session.h"
+
+using namespace usbipdcpp;
+
+namespace
+{
+    constexpr std::array<std::uint8_t, 4> cbw_signature = {'U', 'S', 'B', 'C'};
+    constexpr std::array<std::uint8_t, 4> csw_signature = {'U', 'S', 'B', 'S'};
+    constexpr std::size_t cbw_length = 31;
+    constexpr std::size_t csw_length = 13;
+
+    bool has_signature(const data_type &data, const std::array<std::uint8_t, 4> &signature)
+    {
+        return std::equal(signature.begin(), signature.end(), data.begin());
+    }
+}
+
+ReplayVirtualDeviceHandler::ReplayVirtualDeviceHandler(UsbDevice &handle_device,
+                                                       std::shared_ptr<const ReplayTrace> trace,
+                                                       const Config &config) :
+    DeviceHandlerBase(handle_device), trace(std::move(trace)), config(config)
+{
+    for (std::size_t i = 0; i < this->trace->control.size(); i++)
+    {
+        control_index[control_key(this->trace->control[i].setup)].push_back(i);
+    }
+    if (config.timing != Timing::Zero)
+    {
+        delay_thread = std::thread([this]()
+                                   { delay_loop(); });
+    }
+}
+
+ReplayVirtualDeviceHandler::~ReplayVirtualDeviceHandler()
+{
+    {
+        std::lock_guard lock(delay_mutex);
+        delay_stop = true;
+    }
+    delay_cv.notify_all();
+    if (delay_thread.joinable())
+    {
+        delay_thread.join();
+    }
+}
+
+void ReplayVirtualDeviceHandler::on_new_connection(Session &current_session, error_code &ec)
+{
+    // 每次连接都从录制的开头回放
+    control_cursors.clear();
+    endpoint_cursors.fill(0);
+    last_cbw_tag = 0;
+    {
+        std::lock_guard lock(delay_mutex);
+        last_due.fill({});
+    }
+    session = &current_session;
+}
+
+void ReplayVirtualDeviceHandler::on_disconnection(error_code &ec)
+{
+    std::lock_guard lock(delay_mutex);
+    session = nullptr;
+    delayed.clear();
+}
+
+ReplayVirtualDeviceHandler::Stats ReplayVirtualDeviceHandler::stats() const
+{
+    return Stats{
+        .replayed = replayed.load(std::memory_order_relaxed),
+        .unmatched_control = unmatched_control.load(std::memory_order_relaxed),
+        .length_mismatches = length_mismatches.load(std::memory_order_relaxed),
+        .wrapped = wrapped.load(std::memory_order_relaxed)};
+}
+
+void ReplayVirtualDeviceHandler::handle_control_urb(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                                    std::uint32_t transfer_flags,
+                                                    std::uint32_t transfer_buffer_length,
+                                                    const SetupPacket &setup_packet, const data_type &out_data,
+                                                    std::error_code &ec)
+{
+    auto is_in = (setup_packet.request_type & 0x80) != 0;
+    auto key = control_key(setup_packet);
+    if (auto it = control_index.find(key); it != control_index.end())
+    {
+        auto &cursor = control_cursors[key];
+        if (cursor >= it->second.size())
+        {
+            cursor = 0;
+            wrapped.fetch_add(1, std::memory_order_relaxed);
+        }
+        const auto &response = trace->control[it->second[cursor++]].response;
+        replayed.fetch_add(1, std::memory_order_relaxed);
+        reply(ep.address, response.service_us,
+              is_in ? make_in_reply(seqnum, response, transfer_buffer_length)
+                    : make_out_reply(seqnum, response, out_data));
+        return;
+    }
+
+    // 录制时没出现过的请求，常见的标准请求按默认方式应答
+    auto type = static_cast<RequestType>(setup_packet.calc_request_type());
+    auto request = static_cast<StandardRequest>(setup_packet.request);
+    if (type == RequestType::Standard)
+    {
+        if (!is_in && (request == StandardRequest::SetAddress || request == StandardRequest::SetConfiguration ||
+                       request == StandardRequest::SetInterface || request == StandardRequest::ClearFeature ||
+                       request == StandardRequest::SetFeature))
+        {
+            reply(ep.address, 0, UsbIpResponse::UsbIpRetSubmit::create_ret_submit_ok_without_data(seqnum));
+            return;
+        }
+        if (is_in && request == StandardRequest::GetDescriptor)
+        {
+            auto descriptor_type = static_cast<DescriptorType>(setup_packet.value >> 8);
+            const data_type *descriptor = nullptr;
+            if (descriptor_type == DescriptorType::Device)
+            {
+                descriptor = &trace->device_descriptor;
+            }
+            else if (descriptor_type == DescriptorType::Configuration)
+            {
+                descriptor = &trace->configuration_descriptor;
+            }
+            if (descriptor)
+            {
+                data_type data(descriptor->begin(),
+                               descriptor->begin() + std::min<std::size_t>(descriptor->size(), setup_packet.length));
+                reply(ep.address, 0,
+                      UsbIpResponse::UsbIpRetSubmit::create_ret_submit_with_status_and_no_iso(
+                          seqnum, static_cast<std::uint32_t>(UrbStatusType::StatusOK), std::move(data)));
+                return;
+            }
+        }
+    }
+    unmatched_control.fetch_add(1, std::memory_order_relaxed);
+    SPDLOG_WARN("录制中没有这个控制请求: {}", get_every_byte(setup_packet.to_bytes()));
+    reply(ep.address, 0, UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
+}
+
+void ReplayVirtualDeviceHandler::handle_bulk_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                                      UsbInterface &interface, std::uint32_t transfer_flags,
+                                                      std::uint32_t transfer_buffer_length,
+                                                      const data_type &out_data, std::error_code &ec)
+{
+    handle_endpoint_transfer(seqnum, ep, transfer_buffer_length, out_data);
+}
+
+void ReplayVirtualDeviceHandler::handle_interrupt_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                                           UsbInterface &interface, std::uint32_t transfer_flags,
+                                                           std::uint32_t transfer_buffer_length,
+                                                           const data_type &out_data, std::error_code &ec)
+{
+    handle_endpoint_transfer(seqnum, ep, transfer_buffer_length, out_data);
+}
+
+void ReplayVirtualDeviceHandler::handle_isochronous_transfer(
+    std::uint32_t seqnum, const UsbEndpoint &ep, UsbInterface &interface, std::uint32_t transfer_flags,
+    std::uint32_t transfer_buffer_length, const data_type &out_data,
+    const std::vector<UsbIpIsoPacketDescriptor> &iso_packet_descriptors, std::error_code &ec)
+{
+    SPDLOG_WARN("回放不支持同步传输，端点 {:02x}", ep.address);
+    reply(ep.address, 0, UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
+}
+
+std::uint64_t ReplayVirtualDeviceHandler::control_key(const SetupPacket &setup_packet)
+{
+    return control_key(setup_packet.to_bytes());
+}
+
+std::uint64_t ReplayVirtualDeviceHandler::control_key(const array_data_type<8> &setup)
+{
+    std::uint64_t key = 0;
+    for (std::size_t i = 0; i < 6; i++)
+    {
+        key |= static_cast<std::uint64_t>(setup[i]) << (8 * i);
+    }
+    return key;
+}
+
+void ReplayVirtualDeviceHandler::handle_endpoint_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                                          std::uint32_t transfer_buffer_length,
+                                                          const data_type &out_data)
+{
+    auto it = trace->endpoints.find(ep.address);
+    if (it == trace->endpoints.end() || it->second.empty())
+    {
+        SPDLOG_WARN("录制中没有端点 {:02x} 的传输", ep.address);
+        reply(ep.address, 0, UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
+        return;
+    }
+    auto &cursor = endpoint_cursors[UsbDevice::route_index(ep.address)];
+    if (cursor >= it->second.size())
+    {
+        cursor = 0;
+        wrapped.fetch_add(1, std::memory_order_relaxed);
+    }
+    const auto &response = it->second[cursor++];
+    replayed.fetch_add(1, std::memory_order_relaxed);
+    reply(ep.address, response.service_us,
+          ep.is_in() ? make_in_reply(seqnum, response, transfer_buffer_length)
+                     : make_out_reply(seqnum, response, out_data));
+}
+
+UsbIpResponse::UsbIpRetSubmit ReplayVirtualDeviceHandler::make_in_reply(std::uint32_t seqnum,
+                                                                        const ReplayTrace::Response &response,
+                                                                        std::uint32_t transfer_buffer_length)
+{
+    auto status = static_cast<std::uint32_t>(response.status);
+    auto length = std::min<std::size_t>(response.data.size(), transfer_buffer_length);
+    if (length != response.data.size())
+    {
+        length_mismatches.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (config.fix_bot_tags && response.data.size() == csw_length && has_signature(response.data, csw_signature))
+    {
+        auto data = response.data;
+        auto tag = last_cbw_tag.load(std::memory_order_relaxed);
+        for (std::size_t i = 0; i < 4; i++)
+        {
+            data[4 + i] = static_cast<std::uint8_t>(tag >> (8 * i));
+        }
+        data.resize(length);
+        return UsbIpResponse::UsbIpRetSubmit::create_ret_submit_with_status_and_no_iso(seqnum, status,
+                                                                                        std::move(data));
+    }
+    // 录制文件在回放期间不会改变，直接引用其中的数据
+    return UsbIpResponse::UsbIpRetSubmit::create_ret_submit_view(seqnum, status, trace, response.data.data(),
+                                                                 static_cast<std::uint32_t>(length));
+}
+
+UsbIpResponse::UsbIpRetSubmit ReplayVirtualDeviceHandler::make_out_reply(std::uint32_t seqnum,
+                                                                         const ReplayTrace::Response &response,
+                                                                         const data_type &out_data)
+{
+    if (config.fix_bot_tags && out_data.size() == cbw_length && has_signature(out_data, cbw_signature))
+    {
+        std::uint32_t tag = 0;
+        for (std::size_t i = 0; i < 4; i++)
+        {
+            tag |= static_cast<std::uint32_t>(out_data[4 + i]) << (8 * i);
+        }
+        last_cbw_tag.store(tag, std::memory_order_relaxed);
+    }
+    if (out_data.size() != response.actual_length)
+    {
+        length_mismatches.fetch_add(1, std::memory_order_relaxed);
+    }
+    auto ret = UsbIpResponse::UsbIpRetSubmit::create_ret_submit_ok_without_data(seqnum);
+    ret.status = static_cast<std::uint32_t>(response.status);
+    // 成功时主机发多少就收多少，失败时按录制的长度
+    ret.actual_length = static_cast<std::uint32_t>(
+        response.status == 0 ? out_data.size() : std::min<std::size_t>(response.actual_length, out_data.size()));
+    return ret;
+}
+
+void ReplayVirtualDeviceHandler::reply(std::uint8_t ep_address, std::uint32_t service_us,
+                                       UsbIpResponse::UsbIpRetSubmit &&ret)
+{
+    std::chrono::microseconds delay{0};
+    if (config.timing == Timing::Recorded)
+    {
+        delay = std::chrono::microseconds(service_us);
+    }
+    else if (config.timing == Timing::Scaled)
+    {
+        delay = std::chrono::microseconds(static_cast<std::int64_t>(service_us * config.scale));
+    }
+
+    std::unique_lock lock(delay_mutex);
+    auto current_session = session.load();
+    if (!current_session)
+    {
+        return;
+    }
+    auto now = clock::now();
+    auto &last = last_due[UsbDevice::route_index(ep_address)];
+    if (delay.count() == 0 && last <= now)
+    {
+        lock.unlock();
+        current_session->submit_ret_submit(std::move(ret));
+        return;
+    }
+    // 同一端点的应答不能被后面处理时间短的 URB 超过
+    auto due = std::max(now + delay, last);
+    last = due;
+    delayed.emplace(due, std::move(ret));
+    lock.unlock();
+    delay_cv.notify_one();
+}
+
+void ReplayVirtualDeviceHandler::delay_loop()
+{
+    std::unique_lock lock(delay_mutex);
+    while (!delay_stop)
+    {
+        if (delayed.empty())
+        {
+            delay_cv.wait(lock);
+            continue;
+        }
+        auto due = delayed.begin()->first;
+        if (clock::now() < due)
+        {
+            delay_cv.wait_until(lock, due);
+            continue;
+        }
+        auto ret = std::move(delayed.begin()->second);
+        delayed.erase(delayed.begin());
+        auto current_session = session.load();
+        if (!current_session)
+        {
+            continue;
+        }
+        auto seqnum = ret.header.seqnum;
+        auto unlink_found = current_session->get_unlink_seqnum(seqnum);
+        if (std::get<0>(unlink_found))
+        {
+            current_session->submit_ret_unlink_and_then_remove_seqnum_unlink(
+                UsbIpResponse::UsbIpRetUnlink::create_ret_unlink(
+                    std::get<1>(unlink_found),
+                    static_cast<std::uint32_t>(UrbStatusType::StatusECONNRESET)),
+                seqnum);
+            continue;
+        }
+        current_session->submit_ret_submit(std::move(ret));
+    }
+}
+
+std::shared_ptr<UsbDevice> usbipdcpp::make_replay_device(std::shared_ptr<const ReplayTrace> trace,
+                                                         const ReplayDeviceConfig &config)
+{
+    auto device = trace->make_device(config.busid);
+    if (!device)
+    {
+        return nullptr;
+    }
+    device->with_handler<ReplayVirtualDeviceHandler>(std::move(trace), config.handler);
+    return device;
+}
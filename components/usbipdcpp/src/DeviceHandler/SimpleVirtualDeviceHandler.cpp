@@ -0,0 +1,25 @@
+#include "SimpleVirtualDeviceHandler.h"
+
+#include "Session.h"
+
+using namespace usbipdcpp;
+
+void SimpleVirtualDeviceHandler::handle_non_standard_request_type_control_urb(
+    std::uint32_t seqnum, const UsbEndpoint &ep, std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
+    const SetupPacket &setup_packet, const data_type &out_data, std::error_code &ec)
+{
+    SPDLOG_WARN("虚拟设备不支持发给设备的非标准请求 0x{:02x}", setup_packet.request);
+    session.load()->submit_ret_submit(
+        UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
+}
+
+void SimpleVirtualDeviceHandler::request_set_configuration(std::uint16_t configuration_value,
+                                                           std::uint32_t *p_status)
+{
+    // 只有一个配置，0 表示回到地址状态
+    if (configuration_value != 0 && configuration_value != handle_device.configuration_value)
+    {
+        SPDLOG_WARN("虚拟设备不存在配置 {}", configuration_value);
+        *p_status = static_cast<std::uint32_t>(UrbStatusType::StatusEPIPE);
+    }
+}
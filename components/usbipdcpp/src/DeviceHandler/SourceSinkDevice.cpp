@@ -0,0 +1,71 @@
+#include "SourceSinkDevice.h"
+
+#include <algorithm>
+
+#include "SimpleVirtualDeviceHandler.h"
+
+using namespace usbipdcpp;
+
+std::shared_ptr<UsbDevice> usbipdcpp::make_source_sink_device(StringPool &string_pool,
+                                                              const SourceSinkDeviceConfig &config)
+{
+    std::vector<UsbEndpoint> endpoints = {
+        UsbEndpoint{
+            .address = 0x81,
+            .attributes = static_cast<std::uint8_t>(EndpointAttributes::Bulk),
+            .max_packet_size = config.max_packet_size,
+            .interval = 0},
+        UsbEndpoint{
+            .address = 0x01,
+            .attributes = static_cast<std::uint8_t>(EndpointAttributes::Bulk),
+            .max_packet_size = config.max_packet_size,
+            .interval = 0},
+    };
+    if (config.interrupt_loopback)
+    {
+        // 高速设备的 bInterval 以 2^(n-1) 个微帧计，4 为 1ms
+        auto interval = static_cast<std::uint8_t>(config.speed == UsbSpeed::High ? 4 : 1);
+        auto max_packet_size = std::min<std::uint16_t>(config.max_packet_size, 64);
+        endpoints.push_back(UsbEndpoint{
+            .address = 0x82,
+            .attributes = static_cast<std::uint8_t>(EndpointAttributes::Interrupt),
+            .max_packet_size = max_packet_size,
+            .interval = interval});
+        endpoints.push_back(UsbEndpoint{
+            .address = 0x02,
+            .attributes = static_cast<std::uint8_t>(EndpointAttributes::Interrupt),
+            .max_packet_size = max_packet_size,
+            .interval = interval});
+    }
+
+    std::vector<UsbInterface> interfaces;
+    interfaces.push_back(UsbInterface{
+        .interface_class = static_cast<std::uint8_t>(ClassCode::VendorSpecific),
+        .interface_subclass = 0x00,
+        .interface_protocol = 0x00,
+        .endpoints = std::move(endpoints),
+        .handler = {}});
+
+    auto device = std::make_shared<UsbDevice>(UsbDevice{
+        .path = "/usbipdcpp/virtual/" + config.busid,
+        .busid = config.busid,
+        .bus_num = 2,
+        .dev_num = 1,
+        .speed = static_cast<std::uint32_t>(config.speed),
+        .vendor_id = 0x0525,
+        .product_id = 0xa4a0,
+        .device_bcd = Version{1, 0, 0},
+        .device_class = static_cast<std::uint8_t>(ClassCode::VendorSpecific),
+        .device_subclass = 0x00,
+        .device_protocol = 0x00,
+        .configuration_value = 1,
+        .num_configurations = 1,
+        .interfaces = std::move(interfaces),
+        .ep0_in = UsbEndpoint::get_default_ep0_in(),
+        .ep0_out = UsbEndpoint::get_default_ep0_out(),
+        .handler = {}});
+    // 接口 handler 引用 interfaces 中的元素，之后不能再改变 interfaces
+    device->interfaces[0].with_handler<SourceSinkVirtualInterfaceHandler>(string_pool, config.interface);
+    device->with_handler<SimpleVirtualDeviceHandler>(string_pool);
+    return device;
+}
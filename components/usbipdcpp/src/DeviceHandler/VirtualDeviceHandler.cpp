@@ -6,23 +6,32 @@
 
 using namespace usbipdcpp;
 
-void VirtualDeviceHandler::dispatch_urb(const UsbIpCommand::UsbIpCmdSubmit &cmd, std::uint32_t seqnum,
-                                        const UsbEndpoint &ep, std::optional<UsbInterface> &interface,
+void VirtualDeviceHandler::dispatch_urb(const UsbEndpointRoute &route, std::uint32_t seqnum,
                                         std::uint32_t transfer_flags,
                                         std::uint32_t transfer_buffer_length, const SetupPacket &setup_packet,
                                         const data_type &out_data,
                                         const std::vector<UsbIpIsoPacketDescriptor> &iso_packet_descriptors,
                                         usbipdcpp::error_code &ec)
 {
-    // if (se)
-    DeviceHandlerBase::dispatch_urb(cmd, seqnum, ep, interface, transfer_flags, transfer_buffer_length, setup_packet,
-                                    out_data, iso_packet_descriptors,
-                                    ec);
+    if (route.transfer_type == EndpointAttributes::Control)
+    {
+        std::unique_lock lock(control_dispatch_mutex);
+        route.entry(*this, route, seqnum, transfer_flags, transfer_buffer_length, setup_packet, out_data,
+                    iso_packet_descriptors, ec);
+        return;
+    }
+    auto interface_index = static_cast<std::size_t>(route.interface - handle_device.interfaces.data());
+    std::shared_lock control_lock(control_dispatch_mutex);
+    std::lock_guard lock(interface_dispatch_mutexes[interface_index % interface_dispatch_mutexes.size()]);
+    route.entry(*this, route, seqnum, transfer_flags, transfer_buffer_length, setup_packet, out_data,
+                iso_packet_descriptors, ec);
 }
 
 void VirtualDeviceHandler::on_new_connection(Session &current_session, error_code &ec)
 {
     session = &current_session;
+    // 接口 handler 可能在构造之后才注册，每次导入后的第一个请求重新生成一次描述符
+    invalidate_descriptors();
     for (auto &intf : handle_device.interfaces)
     {
         if (intf.handler)
@@ -52,6 +61,17 @@ void VirtualDeviceHandler::on_disconnection(error_code &ec)
     }
 }
 
+void VirtualDeviceHandler::handle_unlink_seqnum(std::uint32_t seqnum)
+{
+    for (auto &intf : handle_device.interfaces)
+    {
+        if (intf.handler)
+        {
+            intf.handler->handle_unlink_seqnum(seqnum);
+        }
+    }
+}
+
 void VirtualDeviceHandler::change_device_ep0_max_size_by_speed()
 {
     auto speed = static_cast<UsbSpeed>(handle_device.speed);
@@ -176,6 +196,15 @@ void VirtualDeviceHandler::handle_control_urb(
                     case StandardRequest::GetDescriptor:
                     {
                         SPDLOG_TRACE("设备GetDescriptor");
+                        if (auto desc = find_cached_descriptor(setup_packet.value >> 8, setup_packet.value))
+                        {
+                            auto length = std::min<std::size_t>(setup_packet.length, desc->size());
+                            auto data = desc->data();
+                            session.load()->submit_ret_submit(
+                                UsbIpResponse::UsbIpRetSubmit::create_ret_submit_view(
+                                    seqnum, status, std::move(desc), data, static_cast<std::uint32_t>(length)));
+                            return;
+                        }
                         result = request_get_descriptor(setup_packet.value >> 8, setup_packet.value,
                                                         setup_packet.length, &status);
                         if (setup_packet.length < result.size())
@@ -198,7 +227,7 @@ void VirtualDeviceHandler::handle_control_urb(
                     }
                     session.load()->submit_ret_submit(
                         UsbIpResponse::UsbIpRetSubmit::create_ret_submit_with_status_and_no_iso(
-                            seqnum, status, result));
+                            seqnum, status, std::move(result)));
                 }
                 break;
             }
@@ -265,6 +294,16 @@ void VirtualDeviceHandler::handle_control_urb(
                         case StandardRequest::GetDescriptor:
                         {
                             SPDLOG_TRACE("接口request_get_descriptor");
+                            if (auto desc = handler->find_cached_descriptor(setup_packet.value >> 8,
+                                                                            setup_packet.value & 0x00FF))
+                            {
+                                auto length = std::min<std::size_t>(setup_packet.length, desc->size());
+                                auto data = desc->data();
+                                session.load()->submit_ret_submit(
+                                    UsbIpResponse::UsbIpRetSubmit::create_ret_submit_view(
+                                        seqnum, status, std::move(desc), data, static_cast<std::uint32_t>(length)));
+                                return;
+                            }
                             result = handler->request_get_descriptor(
                                 setup_packet.value >> 8, setup_packet.value & 0x00FF,
                                 setup_packet.length, &status);
@@ -283,7 +322,7 @@ void VirtualDeviceHandler::handle_control_urb(
                         }
                         session.load()->submit_ret_submit(
                             UsbIpResponse::UsbIpRetSubmit::create_ret_submit_with_status_and_no_iso(
-                                seqnum, status, result));
+                                seqnum, status, std::move(result)));
                     }
                 }
                 else
@@ -696,12 +735,30 @@ void VirtualDeviceHandler::request_set_interface(std::uint16_t alternate_setting
     }
 }
 
-data_type VirtualDeviceHandler::get_device_descriptor(std::uint16_t language_id, std::uint16_t descriptor_length,
-                                                      std::uint32_t *p_status)
+std::shared_ptr<const VirtualDeviceHandler::DescriptorSet> VirtualDeviceHandler::descriptor_set()
+{
+    auto set = descriptors.load(std::memory_order_acquire);
+    if (!set)
+    {
+        // 并发的第一次请求可能各自生成一份，内容相同，留下哪一份都可以
+        set = build_descriptor_set();
+        descriptors.store(set, std::memory_order_release);
+    }
+    return set;
+}
+
+void VirtualDeviceHandler::invalidate_descriptors()
+{
+    descriptors.store(nullptr, std::memory_order_release);
+}
+
+std::shared_ptr<const VirtualDeviceHandler::DescriptorSet> VirtualDeviceHandler::build_descriptor_set()
 {
     std::shared_lock lock(data_mutex);
+    auto set = std::make_shared<DescriptorSet>();
+
     std::uint16_t version_bcd = usb_version;
-    data_type desc = {
+    set->device = std::make_shared<const data_type>(data_type{
         0x12,                                              // bLength
         static_cast<std::uint8_t>(DescriptorType::Device), // bDescriptorType: Device
         static_cast<std::uint8_t>(version_bcd),            // bcdUSB: USB 2.0
@@ -719,36 +776,28 @@ data_type VirtualDeviceHandler::get_device_descriptor(std::uint16_t language_id,
         string_manufacturer_value, // iManufacturer
         string_product_value,      // iProduct
         string_serial_value,       // iSerial
-        handle_device.num_configurations};
-
-    if (descriptor_length < desc.size())
-    {
-        desc.resize(descriptor_length);
-    }
-    return desc;
-}
+        handle_device.num_configurations});
 
-data_type VirtualDeviceHandler::get_bos_descriptor(std::uint16_t language_id, std::uint16_t descriptor_length,
-                                                   std::uint32_t *p_status)
-{
-    std::shared_lock lock(data_mutex);
-    data_type desc = {
+    set->bos = std::make_shared<const data_type>(data_type{
         0x05,                                           // bLength
         static_cast<std::uint8_t>(DescriptorType::BOS), // bDescriptorType: BOS
         0x05, 0x00,                                     // wTotalLength
         0x00                                            // bNumCapabilities
-    };
-    if (descriptor_length < desc.size())
-    {
-        desc.resize(descriptor_length);
-    }
-    return desc;
-}
+    });
+
+    set->device_qualifier = std::make_shared<const data_type>(data_type{
+        0x0A,
+        static_cast<std::uint8_t>(DescriptorType::DeviceQualifier),
+        usb_version.minor,
+        usb_version.major,
+        handle_device.device_class,
+        handle_device.device_subclass,
+        handle_device.device_protocol,
+        static_cast<std::uint8_t>(handle_device.ep0_in.max_packet_size),
+        handle_device.num_configurations,
+        0x00,
+    });
 
-data_type VirtualDeviceHandler::get_configuration_descriptor(
-    std::uint16_t language_id, std::uint16_t descriptor_length, std::uint32_t *p_status)
-{
-    std::shared_lock lock(data_mutex);
     data_type desc = {
         0x09,                                                     // bLength
         static_cast<std::uint8_t>(DescriptorType::Configuration), // bDescriptorType: Configuration
@@ -792,48 +841,67 @@ data_type VirtualDeviceHandler::get_configuration_descriptor(
     }
     desc[2] = static_cast<std::uint8_t>(desc.size());
     desc[3] = static_cast<std::uint8_t>(desc.size() >> 8);
-    if (descriptor_length < desc.size())
+    set->configuration = std::make_shared<const data_type>(std::move(desc));
+
+    return set;
+}
+
+descriptor_ptr VirtualDeviceHandler::find_cached_descriptor(std::uint8_t type, std::uint8_t index)
+{
+    switch (static_cast<DescriptorType>(type))
     {
-        desc.resize(descriptor_length);
+    case DescriptorType::Device:
+        return descriptor_set()->device;
+    case DescriptorType::Configuration:
+        return descriptor_set()->configuration;
+    case DescriptorType::BOS:
+        return descriptor_set()->bos;
+    case DescriptorType::DeviceQualifier:
+        return descriptor_set()->device_qualifier;
+    case DescriptorType::String:
+    {
+        if (index == 0)
+        {
+            // language ids
+            static const descriptor_ptr language_ids = std::make_shared<const data_type>(data_type{
+                4,
+                static_cast<std::uint8_t>(DescriptorType::String),
+                0x09,
+                0x04});
+            return language_ids;
+        }
+        // 描述符在加入字符串池时已经编码好
+        return string_pool.get_descriptor(index);
+    }
+    default:
+        return nullptr;
     }
-    return desc;
+}
+
+data_type VirtualDeviceHandler::get_device_descriptor(std::uint16_t language_id, std::uint16_t descriptor_length,
+                                                      std::uint32_t *p_status)
+{
+    return slice_descriptor(descriptor_set()->device, descriptor_length);
+}
+
+data_type VirtualDeviceHandler::get_bos_descriptor(std::uint16_t language_id, std::uint16_t descriptor_length,
+                                                   std::uint32_t *p_status)
+{
+    return slice_descriptor(descriptor_set()->bos, descriptor_length);
+}
+
+data_type VirtualDeviceHandler::get_configuration_descriptor(
+    std::uint16_t language_id, std::uint16_t descriptor_length, std::uint32_t *p_status)
+{
+    return slice_descriptor(descriptor_set()->configuration, descriptor_length);
 }
 
 data_type VirtualDeviceHandler::get_string_descriptor(std::uint8_t language_id, std::uint16_t descriptor_length,
                                                       std::uint32_t *p_status)
 {
-    std::shared_lock lock(data_mutex);
-    if (language_id == 0)
-    {
-        // language ids
-        data_type desc = {
-            4,
-            static_cast<std::uint8_t>(DescriptorType::String),
-            0x09,
-            0x04};
-        if (descriptor_length < desc.size())
-        {
-            desc.resize(descriptor_length);
-        }
-        return desc;
-    }
-    else if (auto string_ret = string_pool.get_string(language_id))
+    if (auto string_desc = find_cached_descriptor(static_cast<std::uint8_t>(DescriptorType::String), language_id))
     {
-        auto &string = string_ret.value();
-        data_type desc = {
-            static_cast<std::uint8_t>((string.size() + 1) * 2),
-            static_cast<std::uint8_t>(DescriptorType::String),
-        };
-        for (auto &i : string)
-        {
-            desc.push_back(static_cast<std::uint8_t>(i));
-            desc.push_back(static_cast<std::uint8_t>(i >> 8));
-        }
-        if (descriptor_length < desc.size())
-        {
-            desc.resize(descriptor_length);
-        }
-        return desc;
+        return slice_descriptor(string_desc, descriptor_length);
     }
     else
     {
@@ -847,24 +915,7 @@ data_type VirtualDeviceHandler::get_device_qualifier_descriptor(std::uint8_t lan
                                                                 std::uint16_t descriptor_length,
                                                                 std::uint32_t *p_status)
 {
-    std::shared_lock lock(data_mutex);
-    data_type desc = {
-        0x0A,
-        static_cast<std::uint8_t>(DescriptorType::DeviceQualifier),
-        usb_version.minor,
-        usb_version.major,
-        handle_device.device_class,
-        handle_device.device_subclass,
-        handle_device.device_protocol,
-        static_cast<std::uint8_t>(handle_device.ep0_in.max_packet_size),
-        handle_device.num_configurations,
-        0x00,
-    };
-    if (descriptor_length < desc.size())
-    {
-        desc.resize(descriptor_length);
-    }
-    return desc;
+    return slice_descriptor(descriptor_set()->device_qualifier, descriptor_length);
 }
 
 data_type VirtualDeviceHandler::get_custom_descriptor(std::uint8_t type, std::uint8_t language_id,
@@ -0,0 +1,292 @@
+#include "AsyncVirtualInterfaceHandler.h"
+
+#include <algorithm>
+#include <future>
+
+#include <asio/bind_cancellation_slot.hpp>
+#include <asio/co_spawn.hpp>
+#include <asio/post.hpp>
+
+#include "constant.h"
+#include "Session.h"
+
+using namespace usbipdcpp;
+
+AsyncVirtualInterfaceHandler::AsyncVirtualInterfaceHandler(UsbInterface &handle_interface, StringPool &string_pool,
+                                                           std::size_t max_in_flight_per_endpoint) :
+    VirtualInterfaceHandler(handle_interface, string_pool),
+    max_in_flight_per_endpoint(std::max<std::size_t>(max_in_flight_per_endpoint, 1)),
+    work_guard(asio::make_work_guard(io_context))
+{
+    executor_thread = std::thread([this]()
+                                  { io_context.run(); });
+}
+
+AsyncVirtualInterfaceHandler::~AsyncVirtualInterfaceHandler()
+{
+    shutdown();
+}
+
+void AsyncVirtualInterfaceHandler::handle_bulk_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                                        std::uint32_t transfer_flags,
+                                                        std::uint32_t transfer_buffer_length,
+                                                        const data_type &out_data, error_code &ec)
+{
+    asio::post(io_context, [this, urb = AsyncUrb{seqnum, ep, transfer_flags, transfer_buffer_length, out_data, {}}]() mutable
+               { enqueue(UrbKind::Bulk, std::move(urb)); });
+}
+
+void AsyncVirtualInterfaceHandler::handle_interrupt_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                                             std::uint32_t transfer_flags,
+                                                             std::uint32_t transfer_buffer_length,
+                                                             const data_type &out_data, std::error_code &ec)
+{
+    asio::post(io_context, [this, urb = AsyncUrb{seqnum, ep, transfer_flags, transfer_buffer_length, out_data, {}}]() mutable
+               { enqueue(UrbKind::Interrupt, std::move(urb)); });
+}
+
+void AsyncVirtualInterfaceHandler::handle_non_standard_request_type_control_urb(
+    std::uint32_t seqnum, const UsbEndpoint &ep, std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
+    const SetupPacket &setup_packet, const data_type &out_data, std::error_code &ec)
+{
+    asio::post(io_context,
+               [this, urb = AsyncUrb{seqnum, ep, transfer_flags, transfer_buffer_length, out_data, setup_packet}]() mutable
+               { enqueue(UrbKind::Control, std::move(urb)); });
+}
+
+void AsyncVirtualInterfaceHandler::handle_unlink_seqnum(std::uint32_t seqnum)
+{
+    asio::post(io_context, [this, seqnum]()
+               { unlink(seqnum); });
+}
+
+void AsyncVirtualInterfaceHandler::on_new_connection(Session &current_session, error_code &ec)
+{
+    run_on_executor_and_wait([this, &current_session]()
+                             { session = &current_session; });
+}
+
+void AsyncVirtualInterfaceHandler::on_disconnection(error_code &ec)
+{
+    run_on_executor_and_wait([this]()
+                             {
+        session = nullptr;
+        generation++;
+        cancel_all(); });
+}
+
+AsyncVirtualInterfaceHandler::ret_submit_awaitable AsyncVirtualInterfaceHandler::async_bulk_transfer(AsyncUrb urb)
+{
+    SPDLOG_WARN("没有实现 bulk 协程，端点 {:02x}", urb.ep.address);
+    co_return UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(urb.seqnum);
+}
+
+AsyncVirtualInterfaceHandler::ret_submit_awaitable AsyncVirtualInterfaceHandler::async_interrupt_transfer(AsyncUrb urb)
+{
+    SPDLOG_WARN("没有实现中断协程，端点 {:02x}", urb.ep.address);
+    co_return UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(urb.seqnum);
+}
+
+AsyncVirtualInterfaceHandler::ret_submit_awaitable AsyncVirtualInterfaceHandler::async_control_transfer(AsyncUrb urb)
+{
+    SPDLOG_WARN("没有实现控制请求协程，请求 0x{:02x}", urb.setup.request);
+    co_return UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(urb.seqnum);
+}
+
+void AsyncVirtualInterfaceHandler::shutdown()
+{
+    if (!executor_thread.joinable())
+    {
+        return;
+    }
+    run_on_executor_and_wait([this]()
+                             {
+        session = nullptr;
+        generation++;
+        cancel_all(); });
+    // 被取消的协程跑完收尾后 run 才会返回，不响应取消的异步操作会拖慢这里
+    work_guard.reset();
+    executor_thread.join();
+}
+
+void AsyncVirtualInterfaceHandler::enqueue(UrbKind kind, AsyncUrb &&urb)
+{
+    if (!session.load())
+    {
+        return;
+    }
+    auto &queue = endpoints[UsbDevice::route_index(urb.ep.address)];
+    if (queue.in_flight >= max_in_flight_per_endpoint)
+    {
+        queue.waiting.push_back(QueuedUrb{kind, std::move(urb)});
+        return;
+    }
+    start(kind, std::move(urb));
+}
+
+void AsyncVirtualInterfaceHandler::start(UrbKind kind, AsyncUrb &&urb)
+{
+    auto route = UsbDevice::route_index(urb.ep.address);
+    auto seqnum = urb.seqnum;
+    endpoints[route].in_flight++;
+    // unordered_map 的元素地址不会因为插入而改变，取消信号可以一直绑定到协程结束
+    auto &running_urb = running.try_emplace(seqnum).first->second;
+    asio::co_spawn(io_context, run_hook(kind, std::move(urb)),
+                   asio::bind_cancellation_slot(
+                       running_urb.cancel.slot(),
+                       [this, route, seqnum, started_generation = generation](
+                           std::exception_ptr, std::optional<UsbIpResponse::UsbIpRetSubmit> ret)
+                       {
+                           // run_hook 自己捕获了异常
+                           finish(route, seqnum, started_generation, std::move(ret));
+                       }));
+}
+
+asio::awaitable<std::optional<UsbIpResponse::UsbIpRetSubmit>> AsyncVirtualInterfaceHandler::run_hook(UrbKind kind,
+                                                                                                       AsyncUrb urb)
+{
+    auto seqnum = urb.seqnum;
+    try
+    {
+        switch (kind)
+        {
+        case UrbKind::Bulk:
+            co_return co_await async_bulk_transfer(std::move(urb));
+        case UrbKind::Interrupt:
+            co_return co_await async_interrupt_transfer(std::move(urb));
+        case UrbKind::Control:
+            co_return co_await async_control_transfer(std::move(urb));
+        }
+    }
+    catch (const std::system_error &e)
+    {
+        // 被 unlink 或断开取消时是 operation_aborted，不算错误
+        if (e.code() != asio::error::operation_aborted)
+        {
+            SPDLOG_WARN("seq={} 的协程出错: {}", seqnum, e.what());
+        }
+    }
+    catch (const std::exception &e)
+    {
+        SPDLOG_ERROR("seq={} 的协程抛出异常: {}", seqnum, e.what());
+    }
+    co_return std::nullopt;
+}
+
+void AsyncVirtualInterfaceHandler::finish(std::size_t route, std::uint32_t seqnum, std::uint64_t started_generation,
+                                          std::optional<UsbIpResponse::UsbIpRetSubmit> &&ret)
+{
+    if (auto it = running.find(seqnum); it != running.end())
+    {
+        it->second.done = true;
+    }
+    // 现在还在协程的收尾过程中，协程的取消状态就放在取消信号里，等它完全退出后再删除
+    asio::post(io_context, [this, seqnum]()
+               { running.erase(seqnum); });
+
+    auto current_session = session.load();
+    if (current_session && started_generation == generation)
+    {
+        auto unlink_found = current_session->get_unlink_seqnum(seqnum);
+        if (std::get<0>(unlink_found))
+        {
+            current_session->submit_ret_unlink_and_then_remove_seqnum_unlink(
+                UsbIpResponse::UsbIpRetUnlink::create_ret_unlink(
+                    std::get<1>(unlink_found),
+                    static_cast<std::uint32_t>(UrbStatusType::StatusECONNRESET)),
+                seqnum);
+        }
+        else if (ret)
+        {
+            current_session->submit_ret_submit(std::move(*ret));
+        }
+        else
+        {
+            current_session->submit_ret_submit(
+                UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
+        }
+    }
+
+    auto &queue = endpoints[route];
+    queue.in_flight--;
+    if (!queue.waiting.empty() && queue.in_flight < max_in_flight_per_endpoint)
+    {
+        auto next = std::move(queue.waiting.front());
+        queue.waiting.pop_front();
+        start(next.kind, std::move(next.urb));
+    }
+}
+
+void AsyncVirtualInterfaceHandler::unlink(std::uint32_t seqnum)
+{
+    auto current_session = session.load();
+    if (!current_session)
+    {
+        return;
+    }
+    for (auto &queue : endpoints)
+    {
+        auto it = std::ranges::find_if(queue.waiting, [seqnum](const QueuedUrb &queued)
+                                       { return queued.urb.seqnum == seqnum; });
+        if (it == queue.waiting.end())
+        {
+            continue;
+        }
+        queue.waiting.erase(it);
+        auto unlink_found = current_session->get_unlink_seqnum(seqnum);
+        if (std::get<0>(unlink_found))
+        {
+            current_session->submit_ret_unlink_and_then_remove_seqnum_unlink(
+                UsbIpResponse::UsbIpRetUnlink::create_ret_unlink(
+                    std::get<1>(unlink_found),
+                    static_cast<std::uint32_t>(UrbStatusType::StatusECONNRESET)),
+                seqnum);
+        }
+        return;
+    }
+    if (auto it = running.find(seqnum); it != running.end() && !it->second.done)
+    {
+        // 协程结束时由 finish 应答 RET_UNLINK
+        it->second.cancel.emit(asio::cancellation_type::terminal);
+    }
+}
+
+void AsyncVirtualInterfaceHandler::cancel_all()
+{
+    for (auto &queue : endpoints)
+    {
+        queue.waiting.clear();
+    }
+    // emit 时协程可能同步结束，先取出要取消的 seqnum
+    std::vector<std::uint32_t> seqnums;
+    for (const auto &[seqnum, running_urb] : running)
+    {
+        if (!running_urb.done)
+        {
+            seqnums.push_back(seqnum);
+        }
+    }
+    for (auto seqnum : seqnums)
+    {
+        if (auto it = running.find(seqnum); it != running.end() && !it->second.done)
+        {
+            it->second.cancel.emit(asio::cancellation_type::terminal);
+        }
+    }
+}
+
+template<typename F>
+void AsyncVirtualInterfaceHandler::run_on_executor_and_wait(F &&f)
+{
+    if (!executor_thread.joinable() || io_context.get_executor().running_in_this_thread())
+    {
+        f();
+        return;
+    }
+    std::promise<void> done;
+    asio::post(io_context, [&f, &done]()
+               {
+        f();
+        done.set_value(); });
+    done.get_future().wait();
+}
@@ -0,0 +1,394 @@
+#include "CdcAcmPort.h"
+
+#include <cstring>
+
+#include <spdlog/spdlog.h>
+
+#include "constant.h"
+#include "protocol.h"
+#include "Session.h"
+
+using namespace usbipdcpp;
+
+std::size_t CdcAcmPort::Ring::push(const std::uint8_t *data, std::size_t length)
+{
+    auto n = std::min(length, space());
+    if (n == 0)
+    {
+        return 0;
+    }
+    auto tail = (head + size) % buffer.size();
+    auto first = std::min(n, buffer.size() - tail);
+    std::memcpy(buffer.data() + tail, data, first);
+    std::memcpy(buffer.data(), data + first, n - first);
+    size += n;
+    return n;
+}
+
+std::size_t CdcAcmPort::Ring::pop(std::uint8_t *dst, std::size_t length)
+{
+    auto n = std::min(length, size);
+    if (n == 0)
+    {
+        return 0;
+    }
+    auto first = std::min(n, buffer.size() - head);
+    std::memcpy(dst, buffer.data() + head, first);
+    std::memcpy(dst + first, buffer.data(), n - first);
+    head = (head + n) % buffer.size();
+    size -= n;
+    return n;
+}
+
+CdcAcmPort::CdcAcmPort(std::size_t ring_bytes)
+{
+    to_host.buffer.resize(ring_bytes);
+    from_host.buffer.resize(ring_bytes);
+}
+
+void CdcAcmPort::set_backend(std::shared_ptr<CdcAcmBackend> new_backend)
+{
+    std::lock_guard lock(mutex);
+    backend = std::move(new_backend);
+}
+
+std::size_t CdcAcmPort::write(const std::uint8_t *data, std::size_t length)
+{
+    std::lock_guard lock(mutex);
+    auto n = to_host.push(data, length);
+    deliver_to_host();
+    return n;
+}
+
+std::size_t CdcAcmPort::read(std::uint8_t *dst, std::size_t length)
+{
+    std::lock_guard lock(mutex);
+    auto n = from_host.pop(dst, length);
+    if (n > 0)
+    {
+        accept_pending_out();
+    }
+    return n;
+}
+
+std::size_t CdcAcmPort::readable() const
+{
+    std::lock_guard lock(mutex);
+    return from_host.size;
+}
+
+std::size_t CdcAcmPort::writable() const
+{
+    std::lock_guard lock(mutex);
+    return to_host.space();
+}
+
+void CdcAcmPort::set_serial_state(std::uint16_t state)
+{
+    std::lock_guard lock(mutex);
+    if (state == serial_state && !serial_state_dirty)
+    {
+        return;
+    }
+    serial_state = state;
+    serial_state_dirty = true;
+    if (!waiting_notifications.empty())
+    {
+        auto seqnum = waiting_notifications.front();
+        waiting_notifications.pop_front();
+        send_serial_state(seqnum);
+    }
+}
+
+CdcLineCoding CdcAcmPort::line_coding() const
+{
+    std::lock_guard lock(mutex);
+    return line_coding_;
+}
+
+std::uint16_t CdcAcmPort::control_line_state() const
+{
+    std::lock_guard lock(mutex);
+    return control_line_state_;
+}
+
+CdcAcmPort::Stats CdcAcmPort::stats() const
+{
+    std::lock_guard lock(mutex);
+    return stats_;
+}
+
+void CdcAcmPort::attach(Session &current_session)
+{
+    std::shared_ptr<CdcAcmBackend> current_backend;
+    {
+        std::lock_guard lock(mutex);
+        // 通信接口和数据接口都会调用，只处理第一次
+        if (session == &current_session)
+        {
+            return;
+        }
+        session = &current_session;
+        to_host.clear();
+        from_host.clear();
+        line_coding_ = {};
+        control_line_state_ = 0;
+        // 连接后第一个中断 IN URB 就报告当前状态
+        serial_state_dirty = true;
+        current_backend = backend;
+    }
+    if (current_backend)
+    {
+        current_backend->start(*this);
+    }
+}
+
+void CdcAcmPort::detach()
+{
+    std::shared_ptr<CdcAcmBackend> current_backend;
+    {
+        std::lock_guard lock(mutex);
+        if (!session)
+        {
+            return;
+        }
+        session = nullptr;
+        waiting_in.clear();
+        pending_out.clear();
+        waiting_notifications.clear();
+        current_backend = backend;
+    }
+    if (current_backend)
+    {
+        current_backend->stop();
+    }
+}
+
+void CdcAcmPort::handle_bulk_in(std::uint32_t seqnum, std::uint32_t length)
+{
+    std::shared_ptr<CdcAcmBackend> current_backend;
+    {
+        std::lock_guard lock(mutex);
+        if (!session)
+        {
+            return;
+        }
+        if (waiting_in.empty() && to_host.size > 0)
+        {
+            stats_.immediate_urbs++;
+        }
+        else
+        {
+            stats_.waited_urbs++;
+        }
+        waiting_in.push_back({seqnum, length});
+        auto before = to_host.size;
+        deliver_to_host();
+        if (to_host.size != before)
+        {
+            current_backend = backend;
+        }
+    }
+    if (current_backend)
+    {
+        current_backend->on_space_to_host(*this);
+    }
+}
+
+void CdcAcmPort::handle_bulk_out(std::uint32_t seqnum, const data_type &data)
+{
+    std::shared_ptr<CdcAcmBackend> current_backend;
+    {
+        std::lock_guard lock(mutex);
+        if (!session)
+        {
+            return;
+        }
+        pending_out.push_back({seqnum, data});
+        auto before = from_host.size;
+        accept_pending_out();
+        if (!pending_out.empty())
+        {
+            stats_.throttled_urbs++;
+        }
+        if (from_host.size != before)
+        {
+            current_backend = backend;
+        }
+    }
+    if (current_backend)
+    {
+        current_backend->on_data_from_host(*this);
+    }
+}
+
+void CdcAcmPort::handle_notification_in(std::uint32_t seqnum, std::uint32_t length)
+{
+    std::lock_guard lock(mutex);
+    if (!session)
+    {
+        return;
+    }
+    if (serial_state_dirty && length >= cdc::SERIAL_STATE_NOTIFICATION_LENGTH)
+    {
+        send_serial_state(seqnum);
+        return;
+    }
+    waiting_notifications.push_back(seqnum);
+}
+
+void CdcAcmPort::handle_unlink(std::uint32_t seqnum)
+{
+    std::lock_guard lock(mutex);
+    if (!session)
+    {
+        return;
+    }
+    auto in = std::ranges::find_if(waiting_in, [seqnum](const WaitingIn &urb)
+                                   { return urb.seqnum == seqnum; });
+    auto out = std::ranges::find_if(pending_out, [seqnum](const PendingOut &urb)
+                                    { return urb.seqnum == seqnum; });
+    auto notification = std::ranges::find(waiting_notifications, seqnum);
+    if (in != waiting_in.end())
+    {
+        waiting_in.erase(in);
+    }
+    else if (out != pending_out.end())
+    {
+        // 已经放进接收缓冲区的部分不再撤回
+        pending_out.erase(out);
+    }
+    else if (notification != waiting_notifications.end())
+    {
+        waiting_notifications.erase(notification);
+    }
+    else
+    {
+        return;
+    }
+
+    auto unlink_found = session->get_unlink_seqnum(seqnum);
+    if (std::get<0>(unlink_found))
+    {
+        session->submit_ret_unlink_and_then_remove_seqnum_unlink(
+            UsbIpResponse::UsbIpRetUnlink::create_ret_unlink(
+                std::get<1>(unlink_found),
+                static_cast<std::uint32_t>(UrbStatusType::StatusECONNRESET)),
+            seqnum);
+    }
+}
+
+void CdcAcmPort::handle_set_line_coding(const CdcLineCoding &new_line_coding)
+{
+    std::shared_ptr<CdcAcmBackend> current_backend;
+    {
+        std::lock_guard lock(mutex);
+        line_coding_ = new_line_coding;
+        current_backend = backend;
+    }
+    SPDLOG_DEBUG("CDC ACM: {} 波特，{} 数据位，校验 {}，停止位 {}", new_line_coding.baud_rate,
+                 new_line_coding.data_bits, new_line_coding.parity, new_line_coding.stop_bits);
+    if (current_backend)
+    {
+        current_backend->on_line_coding(*this, new_line_coding);
+    }
+}
+
+void CdcAcmPort::handle_set_control_line_state(std::uint16_t state)
+{
+    std::shared_ptr<CdcAcmBackend> current_backend;
+    {
+        std::lock_guard lock(mutex);
+        control_line_state_ = state;
+        current_backend = backend;
+    }
+    if (current_backend)
+    {
+        current_backend->on_control_line_state(*this, (state & cdc::CONTROL_LINE_DTR) != 0,
+                                               (state & cdc::CONTROL_LINE_RTS) != 0);
+    }
+}
+
+void CdcAcmPort::handle_send_break(std::uint16_t duration_ms)
+{
+    std::shared_ptr<CdcAcmBackend> current_backend;
+    {
+        std::lock_guard lock(mutex);
+        current_backend = backend;
+    }
+    if (current_backend)
+    {
+        current_backend->on_break(*this, duration_ms);
+    }
+}
+
+void CdcAcmPort::deliver_to_host()
+{
+    while (session && !waiting_in.empty() && to_host.size > 0)
+    {
+        auto urb = waiting_in.front();
+        waiting_in.pop_front();
+
+        auto unlink_found = session->get_unlink_seqnum(urb.seqnum);
+        if (std::get<0>(unlink_found))
+        {
+            // 数据留给下一个 URB
+            session->submit_ret_unlink_and_then_remove_seqnum_unlink(
+                UsbIpResponse::UsbIpRetUnlink::create_ret_unlink(
+                    std::get<1>(unlink_found),
+                    static_cast<std::uint32_t>(UrbStatusType::StatusECONNRESET)),
+                urb.seqnum);
+            continue;
+        }
+
+        data_type data(std::min<std::size_t>(urb.length, to_host.size));
+        to_host.pop(data.data(), data.size());
+        stats_.bytes_to_host += data.size();
+        session->submit_ret_submit(
+            UsbIpResponse::UsbIpRetSubmit::create_ret_submit_with_status_and_no_iso(
+                urb.seqnum, static_cast<std::uint32_t>(UrbStatusType::StatusOK), std::move(data)));
+    }
+}
+
+void CdcAcmPort::send_serial_state(std::uint32_t seqnum)
+{
+    data_type notification = {
+        0xA1, // bmRequestType: class, interface, IN
+        cdc::NOTIFICATION_SERIAL_STATE,
+        0x00, 0x00, // wValue
+        comm_interface, 0x00, // wIndex
+        0x02, 0x00, // wLength
+        static_cast<std::uint8_t>(serial_state),
+        static_cast<std::uint8_t>(serial_state >> 8),
+    };
+    serial_state &= ~cdc::SERIAL_STATE_ONE_SHOT_MASK;
+    serial_state_dirty = false;
+    stats_.notifications++;
+    session->submit_ret_submit(
+        UsbIpResponse::UsbIpRetSubmit::create_ret_submit_with_status_and_no_iso(
+            seqnum, static_cast<std::uint32_t>(UrbStatusType::StatusOK), std::move(notification)));
+}
+
+void CdcAcmPort::accept_pending_out()
+{
+    while (session && !pending_out.empty())
+    {
+        auto &urb = pending_out.front();
+        auto n = from_host.push(urb.data.data() + urb.offset, urb.data.size() - urb.offset);
+        urb.offset += n;
+        stats_.bytes_from_host += n;
+        if (urb.offset < urb.data.size())
+        {
+            break;
+        }
+        ack_out(urb.seqnum, urb.data.size());
+        pending_out.pop_front();
+    }
+}
+
+void CdcAcmPort::ack_out(std::uint32_t seqnum, std::size_t length)
+{
+    auto ret = UsbIpResponse::UsbIpRetSubmit::create_ret_submit_ok_without_data(seqnum);
+    ret.actual_length = static_cast<std::uint32_t>(length);
+    session->submit_ret_submit(std::move(ret));
+}
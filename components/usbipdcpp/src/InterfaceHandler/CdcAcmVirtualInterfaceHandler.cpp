@@ -0,0 +1,154 @@
+#include "CdcAcmVirtualInterfaceHandler.h"
+
+#include "constant.h"
+#include "endpoint.h"
+#include "Session.h"
+
+using namespace usbipdcpp;
+
+CdcAcmVirtualInterfaceHandler::CdcAcmVirtualInterfaceHandler(UsbInterface &handle_interface,
+                                                             StringPool &string_pool,
+                                                             std::shared_ptr<CdcAcmPort> port,
+                                                             std::uint8_t interface_number) :
+    VirtualInterfaceHandler(handle_interface, string_pool), port(std::move(port)),
+    interface_number(interface_number)
+{
+    std::lock_guard lock(this->port->mutex);
+    this->port->comm_interface = interface_number;
+}
+
+void CdcAcmVirtualInterfaceHandler::handle_interrupt_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                                              std::uint32_t transfer_flags,
+                                                              std::uint32_t transfer_buffer_length,
+                                                              const data_type &out_data, std::error_code &ec)
+{
+    if (!ep.is_in())
+    {
+        VirtualInterfaceHandler::handle_interrupt_transfer(seqnum, ep, transfer_flags, transfer_buffer_length,
+                                                           out_data, ec);
+        return;
+    }
+    port->handle_notification_in(seqnum, transfer_buffer_length);
+}
+
+void CdcAcmVirtualInterfaceHandler::handle_non_standard_request_type_control_urb(
+    std::uint32_t seqnum, const UsbEndpoint &ep, std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
+    const SetupPacket &setup_packet, const data_type &out_data, std::error_code &ec)
+{
+    auto type = static_cast<RequestType>(setup_packet.calc_request_type());
+    if (type != RequestType::Class)
+    {
+        VirtualInterfaceHandler::handle_non_standard_request_type_control_urb(seqnum, ep, transfer_flags,
+                                                                              transfer_buffer_length, setup_packet,
+                                                                              out_data, ec);
+        return;
+    }
+
+    auto status = static_cast<std::uint32_t>(UrbStatusType::StatusOK);
+    data_type result;
+    switch (setup_packet.request)
+    {
+    case cdc::REQUEST_SET_LINE_CODING:
+    {
+        auto line_coding = CdcLineCoding::parse(out_data);
+        if (!line_coding)
+        {
+            SPDLOG_WARN("SET_LINE_CODING 的数据长度 {} 不对", out_data.size());
+            status = static_cast<std::uint32_t>(UrbStatusType::StatusEPIPE);
+            break;
+        }
+        port->handle_set_line_coding(*line_coding);
+        break;
+    }
+    case cdc::REQUEST_GET_LINE_CODING:
+    {
+        result = port->line_coding().to_bytes();
+        if (setup_packet.length < result.size())
+        {
+            result.resize(setup_packet.length);
+        }
+        break;
+    }
+    case cdc::REQUEST_SET_CONTROL_LINE_STATE:
+    {
+        port->handle_set_control_line_state(setup_packet.value);
+        break;
+    }
+    case cdc::REQUEST_SEND_BREAK:
+    {
+        port->handle_send_break(setup_packet.value);
+        break;
+    }
+    default:
+    {
+        SPDLOG_WARN("不支持的 CDC 请求 0x{:02x}", setup_packet.request);
+        status = static_cast<std::uint32_t>(UrbStatusType::StatusEPIPE);
+    }
+    }
+    session.load()->submit_ret_submit(
+        UsbIpResponse::UsbIpRetSubmit::create_ret_submit_with_status_and_no_iso(seqnum, status, std::move(result)));
+}
+
+void CdcAcmVirtualInterfaceHandler::handle_unlink_seqnum(std::uint32_t seqnum)
+{
+    port->handle_unlink(seqnum);
+}
+
+void CdcAcmVirtualInterfaceHandler::on_new_connection(Session &current_session, error_code &ec)
+{
+    session = &current_session;
+    port->attach(current_session);
+}
+
+void CdcAcmVirtualInterfaceHandler::on_disconnection(error_code &ec)
+{
+    session = nullptr;
+    port->detach();
+}
+
+data_type CdcAcmVirtualInterfaceHandler::get_class_specific_descriptor()
+{
+    auto data_interface = static_cast<std::uint8_t>(interface_number + 1);
+    return {
+        // Header Functional Descriptor, bcdCDC 1.10
+        0x05, 0x24, 0x00, 0x10, 0x01,
+        // Call Management Functional Descriptor，设备自己不处理呼叫管理
+        0x05, 0x24, 0x01, 0x00, data_interface,
+        // ACM Functional Descriptor：支持 line coding、serial state 和 SEND_BREAK
+        0x04, 0x24, 0x02, 0x06,
+        // Union Functional Descriptor
+        0x05, 0x24, 0x06, interface_number, data_interface,
+    };
+}
+
+void CdcAcmDataVirtualInterfaceHandler::handle_bulk_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                                             std::uint32_t transfer_flags,
+                                                             std::uint32_t transfer_buffer_length,
+                                                             const data_type &out_data, error_code &ec)
+{
+    if (ep.is_in())
+    {
+        port->handle_bulk_in(seqnum, transfer_buffer_length);
+    }
+    else
+    {
+        port->handle_bulk_out(seqnum, out_data);
+    }
+}
+
+void CdcAcmDataVirtualInterfaceHandler::handle_unlink_seqnum(std::uint32_t seqnum)
+{
+    port->handle_unlink(seqnum);
+}
+
+void CdcAcmDataVirtualInterfaceHandler::on_new_connection(Session &current_session, error_code &ec)
+{
+    session = &current_session;
+    port->attach(current_session);
+}
+
+void CdcAcmDataVirtualInterfaceHandler::on_disconnection(error_code &ec)
+{
+    session = nullptr;
+    port->detach();
+}
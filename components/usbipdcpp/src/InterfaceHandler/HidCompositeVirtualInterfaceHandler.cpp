@@ -0,0 +1,377 @@
+#include "HidCompositeVirtualInterfaceHandler.h"
+
+#include "Session.h"
+
+using namespace usbipdcpp;
+
+namespace
+{
+    // 短条目前缀字节去掉长度位后的值
+    constexpr std::uint8_t ITEM_REPORT_ID = 0x84;
+    constexpr std::uint8_t ITEM_COLLECTION = 0xA0;
+    constexpr std::uint8_t ITEM_END_COLLECTION = 0xC0;
+    constexpr std::uint8_t ITEM_LONG = 0xFE;
+
+    /**
+     * @brief 条目的总长度，越界时返回 0
+     */
+    std::size_t item_size(const data_type &descriptor, std::size_t pos)
+    {
+        auto prefix = descriptor[pos];
+        std::size_t size;
+        if (prefix == ITEM_LONG)
+        {
+            if (pos + 1 >= descriptor.size())
+            {
+                return 0;
+            }
+            size = 3 + descriptor[pos + 1];
+        }
+        else
+        {
+            auto data_size = prefix & 0x03;
+            size = 1 + (data_size == 3 ? 4 : data_size);
+        }
+        return pos + size <= descriptor.size() ? size : 0;
+    }
+
+    bool uses_report_ids(const data_type &descriptor)
+    {
+        for (std::size_t pos = 0; pos < descriptor.size();)
+        {
+            auto size = item_size(descriptor, pos);
+            if (size == 0)
+            {
+                return false;
+            }
+            if ((descriptor[pos] & 0xFC) == ITEM_REPORT_ID)
+            {
+                return true;
+            }
+            pos += size;
+        }
+        return false;
+    }
+
+    // 拼接在前一个成员之后时，成员可能依赖这些全局条目的默认值 0，先恢复它们
+    const data_type reset_global_items = {
+        0x15, 0x00, // Logical Minimum (0)
+        0x35, 0x00, // Physical Minimum (0)
+        0x45, 0x00, // Physical Maximum (0)
+        0x55, 0x00, // Unit Exponent (0)
+        0x65, 0x00, // Unit (None)
+    };
+}
+
+std::optional<HidCompositeVirtualInterfaceHandler::MergedDescriptor>
+HidCompositeVirtualInterfaceHandler::merge_report_descriptors(const std::vector<const data_type *> &descriptors)
+{
+    MergedDescriptor merged;
+    std::uint16_t next_id = 1;
+    auto allocate = [&](std::size_t member, std::uint8_t original) -> std::uint8_t
+    {
+        auto &to_composite = merged.members[member].to_composite;
+        if (to_composite[original] != 0)
+        {
+            return to_composite[original];
+        }
+        if (next_id > 255)
+        {
+            return 0;
+        }
+        auto id = static_cast<std::uint8_t>(next_id++);
+        to_composite[original] = id;
+        merged.routes[id] = {.member = static_cast<std::int16_t>(member), .report_id = original};
+        return id;
+    };
+
+    for (std::size_t member = 0; member < descriptors.size(); member++)
+    {
+        const auto &descriptor = *descriptors[member];
+        merged.members.emplace_back();
+        merged.members[member].uses_report_ids = uses_report_ids(descriptor);
+        if (member != 0)
+        {
+            merged.descriptor.insert(merged.descriptor.end(), reset_global_items.begin(), reset_global_items.end());
+        }
+
+        std::uint8_t own_id = 0;
+        if (!merged.members[member].uses_report_ids)
+        {
+            own_id = allocate(member, 0);
+            if (own_id == 0)
+            {
+                SPDLOG_ERROR("组合 HID: report id 超过 255 个");
+                return std::nullopt;
+            }
+        }
+
+        int depth = 0;
+        bool id_inserted = false;
+        for (std::size_t pos = 0; pos < descriptor.size();)
+        {
+            auto size = item_size(descriptor, pos);
+            if (size == 0)
+            {
+                SPDLOG_ERROR("组合 HID: 第 {} 个成员的报告描述符在偏移 {} 处截断", member, pos);
+                return std::nullopt;
+            }
+            auto tag = static_cast<std::uint8_t>(descriptor[pos] & 0xFC);
+            if (descriptor[pos] != ITEM_LONG && tag == ITEM_REPORT_ID)
+            {
+                if (size < 2)
+                {
+                    SPDLOG_ERROR("组合 HID: 第 {} 个成员的 Report ID 条目没有数据", member);
+                    return std::nullopt;
+                }
+                auto id = allocate(member, descriptor[pos + 1]);
+                if (id == 0)
+                {
+                    SPDLOG_ERROR("组合 HID: report id 超过 255 个");
+                    return std::nullopt;
+                }
+                merged.descriptor.push_back(0x85);
+                merged.descriptor.push_back(id);
+                pos += size;
+                continue;
+            }
+
+            merged.descriptor.insert(merged.descriptor.end(), descriptor.begin() + static_cast<std::ptrdiff_t>(pos),
+                                     descriptor.begin() + static_cast<std::ptrdiff_t>(pos + size));
+            if (descriptor[pos] != ITEM_LONG && tag == ITEM_COLLECTION)
+            {
+                if (depth == 0 && own_id != 0)
+                {
+                    // 没有 report id 的设备只有一个顶层集合，它的所有报告都用同一个编号
+                    merged.descriptor.push_back(0x85);
+                    merged.descriptor.push_back(own_id);
+                    id_inserted = true;
+                }
+                depth++;
+            }
+            else if (descriptor[pos] != ITEM_LONG && tag == ITEM_END_COLLECTION && depth > 0)
+            {
+                depth--;
+            }
+            pos += size;
+        }
+
+        if (own_id != 0 && !id_inserted)
+        {
+            SPDLOG_ERROR("组合 HID: 第 {} 个成员的报告描述符没有顶层集合", member);
+            return std::nullopt;
+        }
+    }
+    if (merged.descriptor.size() > 0xFFFF)
+    {
+        SPDLOG_ERROR("组合 HID: 报告描述符长度 {} 超出范围", merged.descriptor.size());
+        return std::nullopt;
+    }
+    return merged;
+}
+
+namespace
+{
+    std::vector<const data_type *> collect_descriptors(const std::vector<std::unique_ptr<HidReportSource>> &sources)
+    {
+        std::vector<const data_type *> descriptors;
+        for (const auto &source : sources)
+        {
+            descriptors.push_back(&source->report_descriptor());
+        }
+        return descriptors;
+    }
+}
+
+HidCompositeVirtualInterfaceHandler::HidCompositeVirtualInterfaceHandler(
+    UsbInterface &handle_interface, StringPool &string_pool,
+    std::vector<std::unique_ptr<HidReportSource>> &&sources) :
+    HidVirtualInterfaceHandler(handle_interface, string_pool), sources(std::move(sources)),
+    merged(merge_report_descriptors(collect_descriptors(this->sources))),
+    counters(std::make_unique<MemberCounters[]>(this->sources.size()))
+{
+    if (merged)
+    {
+        SPDLOG_INFO("组合 HID: {} 个成员，报告描述符 {} 字节", this->sources.size(), merged->descriptor.size());
+    }
+}
+
+HidCompositeVirtualInterfaceHandler::~HidCompositeVirtualInterfaceHandler()
+{
+    for (const auto &source : sources)
+    {
+        source->stop();
+    }
+}
+
+std::vector<HidCompositeVirtualInterfaceHandler::MemberStats> HidCompositeVirtualInterfaceHandler::member_stats() const
+{
+    std::vector<MemberStats> stats;
+    for (std::size_t i = 0; i < sources.size(); i++)
+    {
+        MemberStats member{
+            .name = sources[i]->name(),
+            .first_report_id = 0,
+            .report_ids = 0,
+            .reports = counters[i].reports.load(std::memory_order_relaxed),
+            .unknown_ids = counters[i].unknown_ids.load(std::memory_order_relaxed)};
+        if (merged)
+        {
+            for (std::size_t id = 1; id < merged->routes.size(); id++)
+            {
+                if (merged->routes[id].member == static_cast<std::int16_t>(i))
+                {
+                    if (member.report_ids == 0)
+                    {
+                        member.first_report_id = static_cast<std::uint8_t>(id);
+                    }
+                    member.report_ids++;
+                }
+            }
+        }
+        stats.push_back(std::move(member));
+    }
+    return stats;
+}
+
+void HidCompositeVirtualInterfaceHandler::on_new_connection(Session &current_session, error_code &ec)
+{
+    HidVirtualInterfaceHandler::on_new_connection(current_session, ec);
+    if (!merged)
+    {
+        return;
+    }
+    for (std::size_t i = 0; i < sources.size(); i++)
+    {
+        sources[i]->start([this, i](const std::uint8_t *data, std::size_t length)
+                          { on_member_report(i, data, length); });
+    }
+}
+
+void HidCompositeVirtualInterfaceHandler::on_disconnection(error_code &ec)
+{
+    for (const auto &source : sources)
+    {
+        source->stop();
+    }
+    HidVirtualInterfaceHandler::on_disconnection(ec);
+}
+
+void HidCompositeVirtualInterfaceHandler::on_member_report(std::size_t member, const std::uint8_t *data,
+                                                           std::size_t length)
+{
+    if (length == 0)
+    {
+        return;
+    }
+    const auto &mapping = merged->members[member];
+    data_type report;
+    if (mapping.uses_report_ids)
+    {
+        auto id = mapping.to_composite[data[0]];
+        if (id == 0)
+        {
+            counters[member].unknown_ids.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        report.assign(data, data + length);
+        report[0] = id;
+    }
+    else
+    {
+        report.reserve(length + 1);
+        report.push_back(mapping.to_composite[0]);
+        report.insert(report.end(), data, data + length);
+    }
+    if (push_report(std::move(report)))
+    {
+        counters[member].reports.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+const HidCompositeVirtualInterfaceHandler::MergedDescriptor::Route *
+HidCompositeVirtualInterfaceHandler::find_route(std::uint8_t report_id) const
+{
+    if (!merged || merged->routes[report_id].member < 0)
+    {
+        return nullptr;
+    }
+    return &merged->routes[report_id];
+}
+
+void HidCompositeVirtualInterfaceHandler::handle_non_hid_request_type_control_urb(
+    std::uint32_t seqnum, const UsbEndpoint &ep, std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
+    const SetupPacket &setup_packet, const data_type &out_data, std::error_code &ec)
+{
+    SPDLOG_WARN("组合 HID 不支持的请求 0x{:02x}", setup_packet.request);
+    session.load()->submit_ret_submit(UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
+}
+
+data_type HidCompositeVirtualInterfaceHandler::get_report_descriptor()
+{
+    return merged ? merged->descriptor : data_type{};
+}
+
+std::uint16_t HidCompositeVirtualInterfaceHandler::get_report_descriptor_size()
+{
+    return merged ? static_cast<std::uint16_t>(merged->descriptor.size()) : 0;
+}
+
+data_type HidCompositeVirtualInterfaceHandler::request_get_report(std::uint8_t type, std::uint8_t report_id,
+                                                                  std::uint16_t length, std::uint32_t *p_status)
+{
+    auto route = find_route(report_id);
+    if (!route || length == 0)
+    {
+        *p_status = static_cast<std::uint32_t>(UrbStatusType::StatusEPIPE);
+        return {};
+    }
+    const auto &member = merged->members[route->member];
+    data_type data;
+    // 成员没有 report id 时返回的数据不带编号，少要一个字节
+    auto member_length = static_cast<std::uint16_t>(member.uses_report_ids ? length : length - 1);
+    *p_status = sources[route->member]->get_report(type, route->report_id, member_length, data);
+    if (*p_status != static_cast<std::uint32_t>(UrbStatusType::StatusOK))
+    {
+        return {};
+    }
+    if (member.uses_report_ids)
+    {
+        if (data.empty())
+        {
+            *p_status = static_cast<std::uint32_t>(UrbStatusType::StatusEPIPE);
+            return {};
+        }
+        data[0] = report_id;
+    }
+    else
+    {
+        data.insert(data.begin(), report_id);
+    }
+    return data;
+}
+
+void HidCompositeVirtualInterfaceHandler::request_set_report(std::uint8_t type, std::uint8_t report_id,
+                                                             std::uint16_t length, const data_type &data,
+                                                             std::uint32_t *p_status)
+{
+    auto route = find_route(report_id);
+    // 组合设备使用 report id，数据的第一个字节就是编号
+    if (!route || data.empty() || data[0] != report_id)
+    {
+        SPDLOG_WARN("组合 HID: 无效的 SET_REPORT，report id {}，长度 {}", report_id, data.size());
+        *p_status = static_cast<std::uint32_t>(UrbStatusType::StatusEPIPE);
+        return;
+    }
+    data_type member_data;
+    if (merged->members[route->member].uses_report_ids)
+    {
+        member_data = data;
+        member_data[0] = route->report_id;
+    }
+    else
+    {
+        member_data.assign(data.begin() + 1, data.end());
+    }
+    *p_status = sources[route->member]->set_report(type, route->report_id, member_data);
+}
@@ -0,0 +1,191 @@
+#include "HidLatencyProbeVirtualInterfaceHandler.h"
+
+#include "Session.h"
+
+using namespace usbipdcpp;
+
+namespace
+{
+    void put_le(data_type &report, std::size_t offset, std::uint64_t value, std::size_t size)
+    {
+        for (std::size_t i = 0; i < size; i++)
+        {
+            report[offset + i] = static_cast<std::uint8_t>(value >> (8 * i));
+        }
+    }
+
+    std::uint64_t get_le(const data_type &report, std::size_t offset, std::size_t size)
+    {
+        std::uint64_t value = 0;
+        for (std::size_t i = 0; i < size; i++)
+        {
+            value |= static_cast<std::uint64_t>(report[offset + i]) << (8 * i);
+        }
+        return value;
+    }
+
+    // 厂商自定义用途页，一个 64 字节的输入报告和一个 8 字节的输出报告
+    const data_type latency_probe_report_descriptor = {
+        0x06, 0x00, 0xFF, // Usage Page (Vendor Defined 0xFF00)
+        0x09, 0x01,       // Usage (0x01)
+        0xA1, 0x01,       // Collection (Application)
+        0x15, 0x00,       //   Logical Minimum (0)
+        0x26, 0xFF, 0x00, //   Logical Maximum (255)
+        0x75, 0x08,       //   Report Size (8)
+        0x09, 0x02,       //   Usage (0x02)
+        0x95, static_cast<std::uint8_t>(HidLatencyProbeVirtualInterfaceHandler::INPUT_REPORT_SIZE),
+        0x81, 0x02, //   Input (Data,Var,Abs)
+        0x09, 0x03, //   Usage (0x03)
+        0x95, static_cast<std::uint8_t>(HidLatencyProbeVirtualInterfaceHandler::OUTPUT_REPORT_SIZE),
+        0x91, 0x02, //   Output (Data,Var,Abs)
+        0xC0,       // End Collection
+    };
+}
+
+HidLatencyProbeVirtualInterfaceHandler::HidLatencyProbeVirtualInterfaceHandler(UsbInterface &handle_interface,
+                                                                               StringPool &string_pool,
+                                                                               const Config &config) :
+    HidVirtualInterfaceHandler(handle_interface, string_pool), config(config)
+{
+    set_report_mode(config.report_mode);
+    generate_thread = std::thread([this]()
+                                  { generate_loop(); });
+}
+
+HidLatencyProbeVirtualInterfaceHandler::~HidLatencyProbeVirtualInterfaceHandler()
+{
+    {
+        std::lock_guard lock(generate_mutex);
+        generate_stop = true;
+    }
+    generate_cv.notify_all();
+    if (generate_thread.joinable())
+    {
+        generate_thread.join();
+    }
+}
+
+void HidLatencyProbeVirtualInterfaceHandler::on_new_connection(Session &current_session, error_code &ec)
+{
+    HidVirtualInterfaceHandler::on_new_connection(current_session, ec);
+    sequence.store(0, std::memory_order_relaxed);
+    {
+        std::lock_guard lock(echo_mutex);
+        echo_host_us = 0;
+        echo_server_us = 0;
+    }
+    {
+        std::lock_guard lock(generate_mutex);
+        connected = true;
+    }
+    generate_cv.notify_all();
+}
+
+void HidLatencyProbeVirtualInterfaceHandler::on_disconnection(error_code &ec)
+{
+    {
+        std::lock_guard lock(generate_mutex);
+        connected = false;
+    }
+    generate_cv.notify_all();
+    HidVirtualInterfaceHandler::on_disconnection(ec);
+}
+
+void HidLatencyProbeVirtualInterfaceHandler::handle_non_hid_request_type_control_urb(
+    std::uint32_t seqnum, const UsbEndpoint &ep, std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
+    const SetupPacket &setup_packet, const data_type &out_data, std::error_code &ec)
+{
+    SPDLOG_WARN("延迟测试 HID 不支持的请求 0x{:02x}", setup_packet.request);
+    session.load()->submit_ret_submit(UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
+}
+
+data_type HidLatencyProbeVirtualInterfaceHandler::get_report_descriptor()
+{
+    return latency_probe_report_descriptor;
+}
+
+std::uint16_t HidLatencyProbeVirtualInterfaceHandler::get_report_descriptor_size()
+{
+    return static_cast<std::uint16_t>(latency_probe_report_descriptor.size());
+}
+
+data_type HidLatencyProbeVirtualInterfaceHandler::request_get_report(std::uint8_t type, std::uint8_t report_id,
+                                                                     std::uint16_t length, std::uint32_t *p_status)
+{
+    if (type != static_cast<std::uint8_t>(HIDReportType::Input))
+    {
+        *p_status = static_cast<std::uint32_t>(UrbStatusType::StatusEPIPE);
+        return {};
+    }
+    // 不占用序号，客户端按序号统计丢失时不会受影响
+    return make_report(sequence.load(std::memory_order_relaxed));
+}
+
+void HidLatencyProbeVirtualInterfaceHandler::request_set_report(std::uint8_t type, std::uint8_t report_id,
+                                                                std::uint16_t length, const data_type &data,
+                                                                std::uint32_t *p_status)
+{
+    auto received = now_us();
+    if (type != static_cast<std::uint8_t>(HIDReportType::Output) || data.size() < OUTPUT_REPORT_SIZE)
+    {
+        SPDLOG_WARN("延迟测试 HID 收到无效的报告，类型 {}，长度 {}", type, data.size());
+        *p_status = static_cast<std::uint32_t>(UrbStatusType::StatusEPIPE);
+        return;
+    }
+    std::lock_guard lock(echo_mutex);
+    echo_host_us = get_le(data, 0, 8);
+    echo_server_us = received;
+}
+
+std::uint64_t HidLatencyProbeVirtualInterfaceHandler::now_us()
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                          std::chrono::steady_clock::now().time_since_epoch())
+                                          .count());
+}
+
+data_type HidLatencyProbeVirtualInterfaceHandler::make_report(std::uint32_t seq)
+{
+    data_type report(INPUT_REPORT_SIZE, 0);
+    put_le(report, 0, seq, 4);
+    {
+        std::lock_guard lock(echo_mutex);
+        put_le(report, 12, echo_host_us, 8);
+        put_le(report, 20, echo_server_us, 8);
+    }
+    put_le(report, 28, config.interval_us, 4);
+    // 时间戳最后写，尽量贴近交给 push_report 的时刻
+    put_le(report, 4, now_us(), 8);
+    return report;
+}
+
+void HidLatencyProbeVirtualInterfaceHandler::generate_loop()
+{
+    const auto interval = std::chrono::microseconds(config.interval_us);
+    auto next = std::chrono::steady_clock::now();
+    std::unique_lock lock(generate_mutex);
+    while (!generate_stop)
+    {
+        if (!connected)
+        {
+            generate_cv.wait(lock);
+            next = std::chrono::steady_clock::now();
+            continue;
+        }
+        next += interval;
+        if (generate_cv.wait_until(lock, next, [this]()
+                                   { return generate_stop || !connected; }))
+        {
+            continue;
+        }
+        // 落后时不补发，补发的一串报告会被当成延迟
+        auto now = std::chrono::steady_clock::now();
+        if (now > next + interval)
+        {
+            next = now;
+        }
+        lock.unlock();
+        push_report(make_report(sequence.fetch_add(1, std::memory_order_relaxed)));
+        lock.lock();
+    }
+}
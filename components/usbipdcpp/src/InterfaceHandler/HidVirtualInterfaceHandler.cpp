@@ -1,6 +1,9 @@
 #include "HidVirtualInterfaceHandler.h"
 
+#include <memory>
+
 #include "constant.h"
+#include "endpoint.h"
 #include "Session.h"
 
 void usbipdcpp::HidVirtualInterfaceHandler::handle_non_standard_request_type_control_urb(
@@ -98,20 +101,37 @@ void usbipdcpp::HidVirtualInterfaceHandler::handle_non_standard_request_type_con
 usbipdcpp::data_type usbipdcpp::HidVirtualInterfaceHandler::request_get_descriptor(std::uint8_t type,
                                                                                    std::uint8_t language_id, std::uint16_t descriptor_length, std::uint32_t *p_status)
 {
+    // 报告描述符由 find_cached_descriptor 提供，不会走到这里
     auto hid_type = static_cast<HidDescriptorType>(type);
-    switch (hid_type)
-    {
-    case HidDescriptorType::Report:
+    SPDLOG_ERROR("Unimplement descriptor type: {:x}", static_cast<std::uint32_t>(hid_type));
+    *p_status = static_cast<std::uint32_t>(UrbStatusType::StatusEPIPE);
+    return {};
+}
+
+usbipdcpp::descriptor_ptr usbipdcpp::HidVirtualInterfaceHandler::find_cached_descriptor(std::uint8_t type,
+                                                                                        std::uint8_t index)
+{
+    if (static_cast<HidDescriptorType>(type) == HidDescriptorType::Report)
     {
-        return get_report_descriptor();
+        return report_descriptor_blob();
     }
-    default:
+    return nullptr;
+}
+
+usbipdcpp::descriptor_ptr usbipdcpp::HidVirtualInterfaceHandler::report_descriptor_blob()
+{
+    auto desc = report_descriptor.load(std::memory_order_acquire);
+    if (!desc)
     {
-        SPDLOG_ERROR("Unimplement descriptor type: {:x}", static_cast<std::uint32_t>(hid_type));
-        *p_status = static_cast<std::uint32_t>(UrbStatusType::StatusEPIPE);
-        return {};
-    }
+        desc = std::make_shared<const data_type>(get_report_descriptor());
+        report_descriptor.store(desc, std::memory_order_release);
     }
+    return desc;
+}
+
+void usbipdcpp::HidVirtualInterfaceHandler::invalidate_report_descriptor()
+{
+    report_descriptor.store(nullptr, std::memory_order_release);
 }
 
 usbipdcpp::data_type usbipdcpp::HidVirtualInterfaceHandler::get_class_specific_descriptor()
@@ -143,3 +163,197 @@ void usbipdcpp::HidVirtualInterfaceHandler::request_set_idle(std::uint8_t speed,
 {
     *p_status = static_cast<std::uint32_t>(UrbStatusType::StatusEPIPE);
 }
+
+bool usbipdcpp::HidVirtualInterfaceHandler::push_report(data_type report)
+{
+    pushed_reports.fetch_add(1, std::memory_order_relaxed);
+    if (!session.load())
+    {
+        dropped_reports.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    if (report_mode.load(std::memory_order_relaxed) == ReportMode::Coalesce)
+    {
+        std::unique_ptr<data_type> old{
+            latest_report.exchange(new data_type(std::move(report)), std::memory_order_acq_rel)};
+        if (old)
+        {
+            merged_reports.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    else if (!pending_reports.try_push(std::move(report)))
+    {
+        dropped_reports.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    drain();
+    return true;
+}
+
+usbipdcpp::HidVirtualInterfaceHandler::ReportStats usbipdcpp::HidVirtualInterfaceHandler::report_stats() const
+{
+    return ReportStats{
+        .pushed = pushed_reports.load(std::memory_order_relaxed),
+        .delivered = delivered_reports.load(std::memory_order_relaxed),
+        .merged = merged_reports.load(std::memory_order_relaxed),
+        .dropped = dropped_reports.load(std::memory_order_relaxed),
+        .waited_urbs = waited_urbs.load(std::memory_order_relaxed),
+        .rejected_urbs = rejected_urbs.load(std::memory_order_relaxed)};
+}
+
+void usbipdcpp::HidVirtualInterfaceHandler::handle_interrupt_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                                                      std::uint32_t transfer_flags,
+                                                                      std::uint32_t transfer_buffer_length,
+                                                                      const data_type &out_data,
+                                                                      std::error_code &ec)
+{
+    if (!ep.is_in())
+    {
+        VirtualInterfaceHandler::handle_interrupt_transfer(seqnum, ep, transfer_flags, transfer_buffer_length,
+                                                           out_data, ec);
+        return;
+    }
+    if (!pending_urbs.try_push(PendingUrb{seqnum, transfer_buffer_length}))
+    {
+        SPDLOG_WARN("HID接口暂存的中断IN URB已满，seq={}", seqnum);
+        rejected_urbs.fetch_add(1, std::memory_order_relaxed);
+        session.load()->submit_ret_submit(
+            UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
+        return;
+    }
+    drain();
+}
+
+void usbipdcpp::HidVirtualInterfaceHandler::handle_unlink_seqnum(std::uint32_t seqnum)
+{
+    // 不知道是否在这里暂存，让配对的线程过一遍暂存的 URB
+    sweep_requested.store(true, std::memory_order_release);
+    drain();
+}
+
+void usbipdcpp::HidVirtualInterfaceHandler::on_new_connection(Session &current_session, error_code &ec)
+{
+    session = &current_session;
+    // 上次连接遗留的报告不发给新的客户端
+    discard_requested.store(true, std::memory_order_release);
+    drain();
+}
+
+void usbipdcpp::HidVirtualInterfaceHandler::on_disconnection(error_code &ec)
+{
+    session = nullptr;
+    discard_requested.store(true, std::memory_order_release);
+    drain();
+    // 其他线程可能还拿着旧的 session 在配对，等它做完
+    std::unique_lock lock(drain_idle_mutex);
+    drain_idle_cv.wait(lock, [this]()
+                       { return drain_requests.load(std::memory_order_acquire) == 0; });
+}
+
+void usbipdcpp::HidVirtualInterfaceHandler::drain()
+{
+    if (drain_requests.fetch_add(1, std::memory_order_acq_rel) != 0)
+    {
+        return;
+    }
+    std::uint32_t handled;
+    do
+    {
+        handled = drain_requests.load(std::memory_order_acquire);
+        drain_once();
+    } while (drain_requests.fetch_sub(handled, std::memory_order_acq_rel) != handled);
+    // 加锁后再通知，等待的线程检查完条件还没睡下时不会错过
+    {
+        std::lock_guard lock(drain_idle_mutex);
+    }
+    drain_idle_cv.notify_all();
+}
+
+void usbipdcpp::HidVirtualInterfaceHandler::drain_once()
+{
+    if (discard_requested.exchange(false, std::memory_order_acq_rel))
+    {
+        discard_pending();
+    }
+    auto current_session = session.load();
+    if (!current_session)
+    {
+        return;
+    }
+
+    if (sweep_requested.exchange(false, std::memory_order_acq_rel))
+    {
+        // 被 unlink 的 URB 立即应答 RET_UNLINK 并原地标记，不改变其余 URB 的顺序
+        pending_urbs.for_each_published([&](PendingUrb &urb)
+                                        {
+            if (!urb.unlinked && answer_if_unlinked(*current_session, urb)) {
+                urb.unlinked = true;
+            } });
+    }
+
+    while (auto front = pending_urbs.front())
+    {
+        auto urb = *front;
+        if (urb.unlinked || answer_if_unlinked(*current_session, urb))
+        {
+            pending_urbs.try_pop();
+            continue;
+        }
+        auto report = take_report();
+        if (!report)
+        {
+            waited_urbs.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+        pending_urbs.try_pop();
+        if (report->size() > urb.length)
+        {
+            report->resize(urb.length);
+        }
+        current_session->submit_ret_submit(
+            UsbIpResponse::UsbIpRetSubmit::create_ret_submit_with_status_and_no_iso(
+                urb.seqnum, static_cast<std::uint32_t>(UrbStatusType::StatusOK), std::move(*report)));
+        delivered_reports.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool usbipdcpp::HidVirtualInterfaceHandler::answer_if_unlinked(Session &current_session, const PendingUrb &urb)
+{
+    auto unlink_found = current_session.get_unlink_seqnum(urb.seqnum);
+    if (!std::get<0>(unlink_found))
+    {
+        return false;
+    }
+    current_session.submit_ret_unlink_and_then_remove_seqnum_unlink(
+        UsbIpResponse::UsbIpRetUnlink::create_ret_unlink(
+            std::get<1>(unlink_found),
+            static_cast<std::uint32_t>(UrbStatusType::StatusECONNRESET)),
+        urb.seqnum);
+    return true;
+}
+
+std::optional<usbipdcpp::data_type> usbipdcpp::HidVirtualInterfaceHandler::take_report()
+{
+    // 先发切换到 Coalesce 之前排队的报告
+    if (auto report = pending_reports.try_pop())
+    {
+        return report;
+    }
+    std::unique_ptr<data_type> latest{latest_report.exchange(nullptr, std::memory_order_acq_rel)};
+    if (latest)
+    {
+        return std::move(*latest);
+    }
+    return std::nullopt;
+}
+
+void usbipdcpp::HidVirtualInterfaceHandler::discard_pending()
+{
+    while (pending_urbs.try_pop())
+    {
+    }
+    while (pending_reports.try_pop())
+    {
+    }
+    delete latest_report.exchange(nullptr, std::memory_order_acq_rel);
+}
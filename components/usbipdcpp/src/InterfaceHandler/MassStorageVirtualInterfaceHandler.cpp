@@ -0,0 +1,542 @@
+#include "MassStorageVirtualInterfaceHandler.h"
+
+#include <algorithm>
+#include <string_view>
+#include <system_error>
+
+#include "constant.h"
+#include "endpoint.h"
+#include "Session.h"
+
+using namespace usbipdcpp;
+
+MassStorageVirtualInterfaceHandler::MassStorageVirtualInterfaceHandler(UsbInterface &handle_interface,
+                                                                       StringPool &string_pool,
+                                                                       std::vector<Lun> luns) :
+    VirtualInterfaceHandler(handle_interface, string_pool), luns(std::move(luns))
+{
+    if (this->luns.empty() || this->luns.size() > bot::MAX_LUN_COUNT)
+    {
+        SPDLOG_CRITICAL("LUN 数量必须在 1 到 {} 之间", bot::MAX_LUN_COUNT);
+        throw std::system_error(std::make_error_code(std::errc::invalid_argument));
+    }
+    for (const auto &lun: this->luns)
+    {
+        if (!lun.backend || lun.backend->block_count() == 0 || lun.backend->block_size() == 0)
+        {
+            SPDLOG_CRITICAL("LUN 的后端为空或容量为 0");
+            throw std::system_error(std::make_error_code(std::errc::invalid_argument));
+        }
+    }
+    senses.resize(this->luns.size());
+}
+
+void MassStorageVirtualInterfaceHandler::handle_bulk_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                                              std::uint32_t transfer_flags,
+                                                              std::uint32_t transfer_buffer_length,
+                                                              const data_type &out_data, error_code &ec)
+{
+    auto current_session = session.load();
+    if (!current_session)
+    {
+        return;
+    }
+    std::lock_guard lock(mutex);
+    if (!ep.is_in())
+    {
+        switch (phase)
+        {
+        case Phase::Command:
+            handle_command(*current_session, seqnum, out_data);
+            break;
+        case Phase::DataOut:
+            handle_data_out(*current_session, seqnum, out_data);
+            break;
+        default:
+            SPDLOG_WARN("BOT 不在命令或数据输出阶段，拒绝 bulk OUT");
+            current_session->submit_ret_submit(
+                UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
+            return;
+        }
+        answer_pending_in(*current_session);
+        return;
+    }
+
+    // 前面还有暂存的 URB 时要排在它们后面，保持主机提交的顺序
+    if ((phase == Phase::DataIn || phase == Phase::Status) && pending_in.empty())
+    {
+        answer_in(*current_session, seqnum, transfer_buffer_length);
+    }
+    else
+    {
+        pending_in.push_back(PendingIn{seqnum, transfer_buffer_length});
+    }
+}
+
+void MassStorageVirtualInterfaceHandler::handle_non_standard_request_type_control_urb(
+    std::uint32_t seqnum, const UsbEndpoint &ep, std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
+    const SetupPacket &setup_packet, const data_type &out_data, std::error_code &ec)
+{
+    auto type = static_cast<RequestType>(setup_packet.calc_request_type());
+    if (type == RequestType::Class && setup_packet.request == bot::REQUEST_GET_MAX_LUN && !setup_packet.is_out())
+    {
+        data_type result;
+        if (setup_packet.length > 0)
+        {
+            result.push_back(static_cast<std::uint8_t>(luns.size() - 1));
+        }
+        session.load()->submit_ret_submit(
+            UsbIpResponse::UsbIpRetSubmit::create_ret_submit_with_status_and_no_iso(
+                seqnum, static_cast<std::uint32_t>(UrbStatusType::StatusOK), std::move(result)));
+        return;
+    }
+    if (type == RequestType::Class && setup_packet.request == bot::REQUEST_BULK_ONLY_RESET && setup_packet.is_out())
+    {
+        SPDLOG_INFO("Bulk-Only Mass Storage Reset");
+        {
+            std::lock_guard lock(mutex);
+            reset();
+        }
+        session.load()->submit_ret_submit(
+            UsbIpResponse::UsbIpRetSubmit::create_ret_submit_ok_without_data(seqnum));
+        return;
+    }
+    VirtualInterfaceHandler::handle_non_standard_request_type_control_urb(seqnum, ep, transfer_flags,
+                                                                          transfer_buffer_length, setup_packet,
+                                                                          out_data, ec);
+}
+
+void MassStorageVirtualInterfaceHandler::handle_unlink_seqnum(std::uint32_t seqnum)
+{
+    auto current_session = session.load();
+    if (!current_session)
+    {
+        return;
+    }
+    std::lock_guard lock(mutex);
+    auto it = std::ranges::find_if(pending_in, [seqnum](const PendingIn &urb)
+                                   { return urb.seqnum == seqnum; });
+    if (it == pending_in.end())
+    {
+        return;
+    }
+    pending_in.erase(it);
+    auto unlink_found = current_session->get_unlink_seqnum(seqnum);
+    if (std::get<0>(unlink_found))
+    {
+        current_session->submit_ret_unlink_and_then_remove_seqnum_unlink(
+            UsbIpResponse::UsbIpRetUnlink::create_ret_unlink(
+                std::get<1>(unlink_found),
+                static_cast<std::uint32_t>(UrbStatusType::StatusECONNRESET)),
+            seqnum);
+    }
+}
+
+void MassStorageVirtualInterfaceHandler::on_new_connection(Session &current_session, error_code &ec)
+{
+    std::lock_guard lock(mutex);
+    session = &current_session;
+    reset();
+    pending_in.clear();
+    std::ranges::fill(senses, Sense{});
+}
+
+void MassStorageVirtualInterfaceHandler::on_disconnection(error_code &ec)
+{
+    std::lock_guard lock(mutex);
+    session = nullptr;
+    reset();
+    pending_in.clear();
+    for (auto &lun: luns)
+    {
+        lun.backend->flush();
+    }
+}
+
+MassStorageVirtualInterfaceHandler::Stats MassStorageVirtualInterfaceHandler::stats() const
+{
+    std::lock_guard lock(mutex);
+    return stats_;
+}
+
+void MassStorageVirtualInterfaceHandler::handle_command(Session &current_session, std::uint32_t seqnum,
+                                                        const data_type &out_data)
+{
+    auto cbw = bot::CommandBlockWrapper::parse(out_data.data(), out_data.size());
+    if (!cbw)
+    {
+        SPDLOG_WARN("收到无效的 CBW，长度 {}", out_data.size());
+        current_session.submit_ret_submit(
+            UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
+        return;
+    }
+    // CBW 的 OUT 先应答，之后的数据阶段和 CSW 才有意义
+    auto ret = UsbIpResponse::UsbIpRetSubmit::create_ret_submit_ok_without_data(seqnum);
+    ret.actual_length = static_cast<std::uint32_t>(out_data.size());
+    current_session.submit_ret_submit(std::move(ret));
+    execute(*cbw);
+}
+
+void MassStorageVirtualInterfaceHandler::execute(const bot::CommandBlockWrapper &cbw)
+{
+    current_cbw = cbw;
+    csw_status = bot::CSW_STATUS_PASSED;
+    transferred = 0;
+    data_length = 0;
+    device_to_host = cbw.data_in;
+    response.clear();
+    block_io = false;
+    io_offset = 0;
+    stats_.commands++;
+
+    const auto &cb = cbw.cb;
+    if (cbw.lun >= luns.size())
+    {
+        // 不存在的 LUN 没有地方保存 sense，直接失败
+        SPDLOG_WARN("命令 0x{:02x} 发给了不存在的 LUN {}", cb[0], cbw.lun);
+        csw_status = bot::CSW_STATUS_FAILED;
+    }
+    else
+    {
+        auto &lun = luns[cbw.lun];
+        auto &backend = *lun.backend;
+        auto last_lba = backend.block_count() - 1;
+        switch (cb[0])
+        {
+        case bot::scsi::TEST_UNIT_READY:
+        case bot::scsi::START_STOP_UNIT:
+        case bot::scsi::PREVENT_ALLOW_MEDIUM_REMOVAL:
+        case bot::scsi::VERIFY_10:
+            break;
+        case bot::scsi::SYNCHRONIZE_CACHE_10:
+        case bot::scsi::SYNCHRONIZE_CACHE_16:
+        {
+            if (!backend.flush())
+            {
+                fail(bot::scsi::SENSE_KEY_MEDIUM_ERROR, bot::scsi::ASC_WRITE_ERROR);
+            }
+            break;
+        }
+        case bot::scsi::REQUEST_SENSE:
+        {
+            auto &sense = senses[cbw.lun];
+            auto data = bot::make_fixed_sense(bot::scsi::SENSE_RESPONSE_CURRENT, sense.key, sense.asc, sense.ascq);
+            sense = {};
+            respond(data_type(data.begin(), data.end()));
+            break;
+        }
+        case bot::scsi::INQUIRY:
+        {
+            if (cb[1] & 0x01)
+            {
+                // 不提供 VPD 页
+                fail(bot::scsi::SENSE_KEY_ILLEGAL_REQUEST, bot::scsi::ASC_INVALID_FIELD_IN_CDB);
+                break;
+            }
+            data_type data(36, ' ');
+            data[0] = 0x00; // direct access block device
+            data[1] = lun.removable ? 0x80 : 0x00;
+            data[2] = 0x04; // SPC-2
+            data[3] = 0x02;
+            data[4] = static_cast<std::uint8_t>(data.size() - 5);
+            data[5] = data[6] = data[7] = 0;
+            std::copy_n(lun.vendor.begin(), std::min<std::size_t>(lun.vendor.size(), 8), data.begin() + 8);
+            std::copy_n(lun.product.begin(), std::min<std::size_t>(lun.product.size(), 16), data.begin() + 16);
+            std::ranges::copy(std::string_view("1.00"), data.begin() + 32);
+            respond(std::move(data));
+            break;
+        }
+        case bot::scsi::MODE_SENSE_6:
+        {
+            // 只有头部，没有 mode page，写保护放在 device-specific parameter 中
+            respond(data_type{3, 0, static_cast<std::uint8_t>(backend.read_only() ? 0x80 : 0x00), 0});
+            break;
+        }
+        case bot::scsi::MODE_SENSE_10:
+        {
+            respond(data_type{0, 6, 0, static_cast<std::uint8_t>(backend.read_only() ? 0x80 : 0x00), 0, 0, 0, 0});
+            break;
+        }
+        case bot::scsi::READ_FORMAT_CAPACITIES:
+        {
+            data_type data(12, 0);
+            data[3] = 8;
+            bot::store_be32(&data[4], static_cast<std::uint32_t>(std::min<std::uint64_t>(backend.block_count(),
+                                                                                          0xFFFFFFFF)));
+            // descriptor type 0x02：已格式化，后 3 字节是块大小
+            bot::store_be32(&data[8], (0x02u << 24) | (backend.block_size() & 0xFFFFFF));
+            respond(std::move(data));
+            break;
+        }
+        case bot::scsi::READ_CAPACITY_10:
+        {
+            data_type data(8, 0);
+            // 超过 32 位时返回 0xFFFFFFFF，主机会改用 READ CAPACITY(16)
+            bot::store_be32(&data[0], static_cast<std::uint32_t>(std::min<std::uint64_t>(last_lba, 0xFFFFFFFF)));
+            bot::store_be32(&data[4], backend.block_size());
+            respond(std::move(data));
+            break;
+        }
+        case bot::scsi::SERVICE_ACTION_IN_16:
+        {
+            if ((cb[1] & 0x1F) != bot::scsi::SAI_READ_CAPACITY_16)
+            {
+                fail(bot::scsi::SENSE_KEY_ILLEGAL_REQUEST, bot::scsi::ASC_INVALID_COMMAND_OPERATION_CODE);
+                break;
+            }
+            data_type data(32, 0);
+            bot::store_be64(&data[0], last_lba);
+            bot::store_be32(&data[8], backend.block_size());
+            respond(std::move(data));
+            break;
+        }
+        case bot::scsi::READ_6:
+        {
+            std::uint64_t lba = (static_cast<std::uint64_t>(cb[1] & 0x1F) << 16) | (cb[2] << 8) | cb[3];
+            // READ(6) 中传输长度为 0 表示 256 块
+            execute_read(lba, cb[4] == 0 ? 256 : cb[4]);
+            break;
+        }
+        case bot::scsi::READ_10:
+        case bot::scsi::READ_12:
+        case bot::scsi::READ_16:
+        {
+            auto range = bot::parse_read_range(cb);
+            execute_read(range->lba, range->blocks);
+            break;
+        }
+        case bot::scsi::WRITE_6:
+        case bot::scsi::WRITE_10:
+        case bot::scsi::WRITE_12:
+        case bot::scsi::WRITE_16:
+        case bot::scsi::WRITE_AND_VERIFY_10:
+        {
+            auto range = bot::parse_write_range(cb);
+            execute_write(range->lba, range->blocks);
+            break;
+        }
+        default:
+        {
+            SPDLOG_DEBUG("不支持的 SCSI 命令 0x{:02x}", cb[0]);
+            fail(bot::scsi::SENSE_KEY_ILLEGAL_REQUEST, bot::scsi::ASC_INVALID_COMMAND_OPERATION_CODE);
+        }
+        }
+    }
+
+    // 设备要传的方向和主机声明的不一致，或者主机不准备数据阶段而设备有数据（BOT 6.7 中的 case 2/3/8/10）
+    if (data_length > 0 && (cbw.data_transfer_length == 0 || device_to_host != cbw.data_in))
+    {
+        SPDLOG_WARN("命令 0x{:02x} 的数据方向或长度和 CBW 不一致", cb[0]);
+        csw_status = bot::CSW_STATUS_PHASE_ERROR;
+        data_length = 0;
+        block_io = false;
+    }
+    data_length = std::min(data_length, cbw.data_transfer_length);
+    if (csw_status != bot::CSW_STATUS_PASSED)
+    {
+        stats_.failed_commands++;
+    }
+
+    if (cbw.data_transfer_length == 0)
+    {
+        phase = Phase::Status;
+    }
+    else
+    {
+        // 设备没有数据可给时仍然按主机的方向走完数据阶段，由 residue 告诉主机实际长度
+        phase = cbw.data_in ? Phase::DataIn : Phase::DataOut;
+    }
+}
+
+void MassStorageVirtualInterfaceHandler::execute_read(std::uint64_t lba, std::uint32_t blocks)
+{
+    auto &backend = *luns[current_cbw.lun].backend;
+    if (lba > backend.block_count() || blocks > backend.block_count() - lba)
+    {
+        fail(bot::scsi::SENSE_KEY_ILLEGAL_REQUEST, bot::scsi::ASC_LBA_OUT_OF_RANGE);
+        return;
+    }
+    device_to_host = true;
+    block_io = true;
+    io_offset = lba * backend.block_size();
+    data_length = static_cast<std::uint32_t>(
+        std::min<std::uint64_t>(static_cast<std::uint64_t>(blocks) * backend.block_size(), 0xFFFFFFFF));
+}
+
+void MassStorageVirtualInterfaceHandler::execute_write(std::uint64_t lba, std::uint32_t blocks)
+{
+    auto &backend = *luns[current_cbw.lun].backend;
+    device_to_host = false;
+    if (backend.read_only())
+    {
+        fail(bot::scsi::SENSE_KEY_DATA_PROTECT, bot::scsi::ASC_WRITE_PROTECTED);
+        return;
+    }
+    if (lba > backend.block_count() || blocks > backend.block_count() - lba)
+    {
+        fail(bot::scsi::SENSE_KEY_ILLEGAL_REQUEST, bot::scsi::ASC_LBA_OUT_OF_RANGE);
+        return;
+    }
+    block_io = true;
+    io_offset = lba * backend.block_size();
+    data_length = static_cast<std::uint32_t>(
+        std::min<std::uint64_t>(static_cast<std::uint64_t>(blocks) * backend.block_size(), 0xFFFFFFFF));
+}
+
+void MassStorageVirtualInterfaceHandler::fail(std::uint8_t sense_key, std::uint8_t asc)
+{
+    csw_status = bot::CSW_STATUS_FAILED;
+    if (current_cbw.lun < senses.size())
+    {
+        senses[current_cbw.lun] = Sense{sense_key, asc, 0};
+    }
+}
+
+void MassStorageVirtualInterfaceHandler::respond(data_type &&data)
+{
+    device_to_host = true;
+    response = std::move(data);
+    data_length = static_cast<std::uint32_t>(response.size());
+}
+
+void MassStorageVirtualInterfaceHandler::handle_data_out(Session &current_session, std::uint32_t seqnum,
+                                                         const data_type &out_data)
+{
+    auto length = static_cast<std::uint32_t>(out_data.size());
+    if (block_io && transferred < data_length)
+    {
+        auto useful = std::min(length, data_length - transferred);
+        auto &backend = *luns[current_cbw.lun].backend;
+        // 命令的数据全部写完后落盘，后端按扇区合并的写入不会留到下一条命令
+        if (backend.write(io_offset, out_data.data(), useful) &&
+            (transferred + useful < data_length || backend.flush()))
+        {
+            io_offset += useful;
+            stats_.bytes_written += useful;
+        }
+        else
+        {
+            SPDLOG_ERROR("LUN {} 在偏移 {} 写入失败", current_cbw.lun, io_offset);
+            fail(bot::scsi::SENSE_KEY_MEDIUM_ERROR, bot::scsi::ASC_WRITE_ERROR);
+            stats_.failed_commands++;
+            // 剩下的数据收下丢掉
+            block_io = false;
+            data_length = transferred;
+        }
+    }
+    // 多出来的数据同样收下丢掉
+    transferred += length;
+
+    auto ret = UsbIpResponse::UsbIpRetSubmit::create_ret_submit_ok_without_data(seqnum);
+    ret.actual_length = length;
+    current_session.submit_ret_submit(std::move(ret));
+
+    if (transferred >= current_cbw.data_transfer_length)
+    {
+        phase = Phase::Status;
+    }
+}
+
+void MassStorageVirtualInterfaceHandler::answer_in(Session &current_session, std::uint32_t seqnum,
+                                                   std::uint32_t length)
+{
+    if (phase == Phase::Status)
+    {
+        bot::CommandStatusWrapper csw{
+            .tag = current_cbw.tag,
+            .data_residue = current_cbw.data_transfer_length - std::min(transferred, data_length),
+            .status = csw_status};
+        auto bytes = csw.to_bytes();
+        current_session.submit_ret_submit(
+            UsbIpResponse::UsbIpRetSubmit::create_ret_submit_with_status_and_no_iso(
+                seqnum, static_cast<std::uint32_t>(UrbStatusType::StatusOK), data_type(bytes.begin(), bytes.end())));
+        phase = Phase::Command;
+        return;
+    }
+
+    auto count = std::min(length, data_length - transferred);
+    if (count > 0 && block_io)
+    {
+        auto &backend = luns[current_cbw.lun].backend;
+        if (auto mapped = backend->map(io_offset, count))
+        {
+            // 直接指向后端内存，后端由 shared_ptr 保证在发送完成前存活
+            current_session.submit_ret_submit(
+                UsbIpResponse::UsbIpRetSubmit::create_ret_submit_view(
+                    seqnum, static_cast<std::uint32_t>(UrbStatusType::StatusOK), backend, mapped, count));
+            stats_.mapped_reads++;
+        }
+        else
+        {
+            data_type buffer(count);
+            if (!backend->read(io_offset, buffer.data(), count))
+            {
+                SPDLOG_ERROR("LUN {} 在偏移 {} 读取失败", current_cbw.lun, io_offset);
+                fail(bot::scsi::SENSE_KEY_MEDIUM_ERROR, bot::scsi::ASC_UNRECOVERED_READ_ERROR);
+                stats_.failed_commands++;
+                block_io = false;
+                data_length = transferred;
+                // 用短包结束数据阶段
+                current_session.submit_ret_submit(
+                    UsbIpResponse::UsbIpRetSubmit::create_ret_submit_ok_without_data(seqnum));
+                phase = Phase::Status;
+                return;
+            }
+            current_session.submit_ret_submit(
+                UsbIpResponse::UsbIpRetSubmit::create_ret_submit_with_status_and_no_iso(
+                    seqnum, static_cast<std::uint32_t>(UrbStatusType::StatusOK), std::move(buffer)));
+            stats_.copied_reads++;
+        }
+        io_offset += count;
+        stats_.bytes_read += count;
+    }
+    else
+    {
+        current_session.submit_ret_submit(
+            UsbIpResponse::UsbIpRetSubmit::create_ret_submit_with_status_and_no_iso(
+                seqnum, static_cast<std::uint32_t>(UrbStatusType::StatusOK),
+                data_type(response.begin() + transferred, response.begin() + transferred + count)));
+    }
+    transferred += count;
+
+    // 短包或者已经传够主机要的长度时数据阶段结束；
+    // 数据刚好在 URB 边界用完但不够主机要的长度时，下一个 IN 用零长度包结束
+    if (count < length || transferred >= current_cbw.data_transfer_length)
+    {
+        phase = Phase::Status;
+    }
+}
+
+void MassStorageVirtualInterfaceHandler::answer_pending_in(Session &current_session)
+{
+    while (!pending_in.empty() && (phase == Phase::DataIn || phase == Phase::Status))
+    {
+        auto urb = pending_in.front();
+        pending_in.pop_front();
+        auto unlink_found = current_session.get_unlink_seqnum(urb.seqnum);
+        if (std::get<0>(unlink_found))
+        {
+            current_session.submit_ret_unlink_and_then_remove_seqnum_unlink(
+                UsbIpResponse::UsbIpRetUnlink::create_ret_unlink(
+                    std::get<1>(unlink_found),
+                    static_cast<std::uint32_t>(UrbStatusType::StatusECONNRESET)),
+                urb.seqnum);
+            continue;
+        }
+        answer_in(current_session, urb.seqnum, urb.length);
+    }
+}
+
+void MassStorageVirtualInterfaceHandler::reset()
+{
+    // 暂存的 IN URB 不动，主机在复位前会先 unlink 它们
+    phase = Phase::Command;
+    current_cbw = {};
+    csw_status = bot::CSW_STATUS_PASSED;
+    transferred = 0;
+    data_length = 0;
+    device_to_host = false;
+    response.clear();
+    block_io = false;
+    io_offset = 0;
+}
@@ -0,0 +1,367 @@
+#include "SourceSinkVirtualInterfaceHandler.h"
+
+#include <algorithm>
+#include <map>
+
+#include "constant.h"
+#include "endpoint.h"
+#include "Session.h"
+
+using namespace usbipdcpp;
+
+namespace
+{
+    // 每个 URB 都从缓冲区开头取数据，不超过这个长度时不需要复制
+    constexpr std::size_t pattern_length = 64 * 1024;
+
+    std::uint8_t pattern_byte(SourceSinkVirtualInterfaceHandler::Pattern pattern, std::size_t index,
+                              std::uint16_t max_packet_size)
+    {
+        if (pattern != SourceSinkVirtualInterfaceHandler::Pattern::Mod63)
+        {
+            return 0;
+        }
+        // 和 usbtest 一样每个包重新从 0 开始，高速端点的高位是每个微帧的事务数
+        auto packet_size = static_cast<std::size_t>(max_packet_size & 0x7FF);
+        auto offset = packet_size ? index % packet_size : index;
+        return static_cast<std::uint8_t>(offset % 63);
+    }
+}
+
+SourceSinkVirtualInterfaceHandler::SourceSinkVirtualInterfaceHandler(UsbInterface &handle_interface,
+                                                                     StringPool &string_pool,
+                                                                     const Config &config) :
+    VirtualInterfaceHandler(handle_interface, string_pool), config(config)
+{
+    for (const auto &ep : handle_interface.endpoints)
+    {
+        if (ep.is_in() && ep.attributes == static_cast<std::uint8_t>(EndpointAttributes::Bulk))
+        {
+            in_patterns[UsbDevice::route_index(ep.address)] = pattern_buffer(config.pattern, ep.max_packet_size);
+        }
+    }
+    if (config.service_time_us > 0)
+    {
+        delay_thread = std::thread([this]()
+                                   { delay_loop(); });
+    }
+}
+
+SourceSinkVirtualInterfaceHandler::~SourceSinkVirtualInterfaceHandler()
+{
+    {
+        std::lock_guard lock(delay_mutex);
+        delay_stop = true;
+    }
+    delay_cv.notify_all();
+    if (delay_thread.joinable())
+    {
+        delay_thread.join();
+    }
+}
+
+void SourceSinkVirtualInterfaceHandler::handle_bulk_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                                             std::uint32_t transfer_flags,
+                                                             std::uint32_t transfer_buffer_length,
+                                                             const data_type &out_data, error_code &ec)
+{
+    if (!ep.is_in())
+    {
+        if (config.verify_out && !verify(out_data, ep.max_packet_size))
+        {
+            counters[UsbDevice::route_index(ep.address)].errors.fetch_add(1, std::memory_order_relaxed);
+            SPDLOG_WARN("端点 {:02x} 收到的数据和模式不一致", ep.address);
+            complete(UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
+            return;
+        }
+        count(ep.address, out_data.size());
+        auto ret = UsbIpResponse::UsbIpRetSubmit::create_ret_submit_ok_without_data(seqnum);
+        ret.actual_length = static_cast<std::uint32_t>(out_data.size());
+        complete(std::move(ret));
+        return;
+    }
+
+    count(ep.address, transfer_buffer_length);
+    const auto &buffer = in_patterns[UsbDevice::route_index(ep.address)];
+    if (buffer && transfer_buffer_length <= buffer->size())
+    {
+        complete(UsbIpResponse::UsbIpRetSubmit::create_ret_submit_view(
+            seqnum, static_cast<std::uint32_t>(UrbStatusType::StatusOK), buffer, buffer->data(),
+            transfer_buffer_length));
+        return;
+    }
+    // 比静态缓冲区还大的 URB 只能临时生成
+    data_type data(transfer_buffer_length);
+    for (std::size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = pattern_byte(config.pattern, i, ep.max_packet_size);
+    }
+    complete(UsbIpResponse::UsbIpRetSubmit::create_ret_submit_with_status_and_no_iso(
+        seqnum, static_cast<std::uint32_t>(UrbStatusType::StatusOK), std::move(data)));
+}
+
+void SourceSinkVirtualInterfaceHandler::handle_interrupt_transfer(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                                                  std::uint32_t transfer_flags,
+                                                                  std::uint32_t transfer_buffer_length,
+                                                                  const data_type &out_data, std::error_code &ec)
+{
+    std::unique_lock lock(loopback_mutex);
+    if (ep.is_in())
+    {
+        if (loopback_data.empty())
+        {
+            loopback_waiting.push_back({seqnum, transfer_buffer_length, ep.address});
+            return;
+        }
+        auto data = std::move(loopback_data.front());
+        loopback_data.pop_front();
+        lock.unlock();
+
+        if (data.size() > transfer_buffer_length)
+        {
+            data.resize(transfer_buffer_length);
+        }
+        count(ep.address, data.size());
+        complete(UsbIpResponse::UsbIpRetSubmit::create_ret_submit_with_status_and_no_iso(
+            seqnum, static_cast<std::uint32_t>(UrbStatusType::StatusOK), std::move(data)));
+        return;
+    }
+
+    count(ep.address, out_data.size());
+    std::optional<PendingIn> waiting;
+    if (!loopback_waiting.empty())
+    {
+        waiting = loopback_waiting.front();
+        loopback_waiting.pop_front();
+    }
+    else
+    {
+        if (loopback_data.size() >= loopback_depth)
+        {
+            loopback_data.pop_front();
+        }
+        loopback_data.push_back(out_data);
+    }
+    lock.unlock();
+
+    auto ret = UsbIpResponse::UsbIpRetSubmit::create_ret_submit_ok_without_data(seqnum);
+    ret.actual_length = static_cast<std::uint32_t>(out_data.size());
+    complete(std::move(ret));
+
+    if (waiting)
+    {
+        auto data = out_data;
+        if (data.size() > waiting->length)
+        {
+            data.resize(waiting->length);
+        }
+        auto current_session = session.load();
+        if (!current_session)
+        {
+            return;
+        }
+        auto unlink_found = current_session->get_unlink_seqnum(waiting->seqnum);
+        if (std::get<0>(unlink_found))
+        {
+            // 等待中的 IN 已经被 unlink，数据放回去给下一个
+            current_session->submit_ret_unlink_and_then_remove_seqnum_unlink(
+                UsbIpResponse::UsbIpRetUnlink::create_ret_unlink(
+                    std::get<1>(unlink_found),
+                    static_cast<std::uint32_t>(UrbStatusType::StatusECONNRESET)),
+                waiting->seqnum);
+            std::lock_guard relock(loopback_mutex);
+            loopback_data.push_front(out_data);
+            return;
+        }
+        count(waiting->address, data.size());
+        complete(UsbIpResponse::UsbIpRetSubmit::create_ret_submit_with_status_and_no_iso(
+            waiting->seqnum, static_cast<std::uint32_t>(UrbStatusType::StatusOK), std::move(data)));
+    }
+}
+
+void SourceSinkVirtualInterfaceHandler::handle_unlink_seqnum(std::uint32_t seqnum)
+{
+    auto current_session = session.load();
+    if (!current_session)
+    {
+        return;
+    }
+    {
+        std::lock_guard lock(loopback_mutex);
+        auto it = std::ranges::find_if(loopback_waiting, [seqnum](const PendingIn &urb)
+                                       { return urb.seqnum == seqnum; });
+        if (it == loopback_waiting.end())
+        {
+            // 推迟应答的 URB 到期时再检查 unlink
+            return;
+        }
+        loopback_waiting.erase(it);
+    }
+    auto unlink_found = current_session->get_unlink_seqnum(seqnum);
+    if (std::get<0>(unlink_found))
+    {
+        current_session->submit_ret_unlink_and_then_remove_seqnum_unlink(
+            UsbIpResponse::UsbIpRetUnlink::create_ret_unlink(
+                std::get<1>(unlink_found),
+                static_cast<std::uint32_t>(UrbStatusType::StatusECONNRESET)),
+            seqnum);
+    }
+}
+
+void SourceSinkVirtualInterfaceHandler::on_new_connection(Session &current_session, error_code &ec)
+{
+    session = &current_session;
+    std::lock_guard lock(loopback_mutex);
+    loopback_data.clear();
+    loopback_waiting.clear();
+}
+
+void SourceSinkVirtualInterfaceHandler::on_disconnection(error_code &ec)
+{
+    {
+        std::lock_guard lock(delay_mutex);
+        session = nullptr;
+        delayed.clear();
+    }
+    std::lock_guard lock(loopback_mutex);
+    loopback_data.clear();
+    loopback_waiting.clear();
+}
+
+std::vector<SourceSinkVirtualInterfaceHandler::EndpointStats> SourceSinkVirtualInterfaceHandler::sample_stats()
+{
+    std::lock_guard lock(sample_mutex);
+    auto now = std::chrono::steady_clock::now();
+    auto elapsed_us = std::max<double>(
+        static_cast<double>(std::chrono::duration_cast<std::chrono::microseconds>(now - last_sample_time).count()),
+        1.0);
+    last_sample_time = now;
+
+    std::vector<EndpointStats> result;
+    for (std::size_t i = 0; i < counters.size(); i++)
+    {
+        auto urbs = counters[i].urbs.load(std::memory_order_relaxed);
+        if (urbs == 0)
+        {
+            continue;
+        }
+        auto bytes = counters[i].bytes.load(std::memory_order_relaxed);
+        auto &[last_urbs, last_bytes] = last_sample[i];
+        result.push_back(EndpointStats{
+            .address = static_cast<std::uint8_t>((i & 0x0F) | ((i & 0x10) << 3)),
+            .urbs = urbs,
+            .bytes = bytes,
+            .errors = counters[i].errors.load(std::memory_order_relaxed),
+            .mb_per_s = static_cast<double>(bytes - last_bytes) / elapsed_us,
+            .urbs_per_s = static_cast<double>(urbs - last_urbs) * 1e6 / elapsed_us});
+        last_urbs = urbs;
+        last_bytes = bytes;
+    }
+    return result;
+}
+
+std::shared_ptr<const data_type> SourceSinkVirtualInterfaceHandler::pattern_buffer(Pattern pattern,
+                                                                                   std::uint16_t max_packet_size)
+{
+    static const auto make = [](Pattern p, std::uint16_t mps)
+    {
+        auto buffer = std::make_shared<data_type>(pattern_length);
+        for (std::size_t i = 0; i < buffer->size(); i++)
+        {
+            (*buffer)[i] = pattern_byte(p, i, mps);
+        }
+        return std::shared_ptr<const data_type>(std::move(buffer));
+    };
+    if (pattern == Pattern::Zero)
+    {
+        static const auto zero = make(Pattern::Zero, 0);
+        return zero;
+    }
+    // 只在构造时调用
+    static std::mutex mod63_mutex;
+    static std::map<std::uint16_t, std::shared_ptr<const data_type>> mod63;
+    std::lock_guard lock(mod63_mutex);
+    auto &buffer = mod63[max_packet_size];
+    if (!buffer)
+    {
+        buffer = make(Pattern::Mod63, max_packet_size);
+    }
+    return buffer;
+}
+
+bool SourceSinkVirtualInterfaceHandler::verify(const data_type &data, std::uint16_t max_packet_size) const
+{
+    for (std::size_t i = 0; i < data.size(); i++)
+    {
+        if (data[i] != pattern_byte(config.pattern, i, max_packet_size))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void SourceSinkVirtualInterfaceHandler::count(std::uint8_t ep_address, std::size_t bytes)
+{
+    auto &counter = counters[UsbDevice::route_index(ep_address)];
+    counter.urbs.fetch_add(1, std::memory_order_relaxed);
+    counter.bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void SourceSinkVirtualInterfaceHandler::complete(UsbIpResponse::UsbIpRetSubmit &&ret)
+{
+    if (config.service_time_us == 0)
+    {
+        if (auto current_session = session.load())
+        {
+            current_session->submit_ret_submit(std::move(ret));
+        }
+        return;
+    }
+    {
+        std::lock_guard lock(delay_mutex);
+        delayed.push_back(Delayed{
+            .due = std::chrono::steady_clock::now() + std::chrono::microseconds(config.service_time_us),
+            .ret = std::move(ret)});
+    }
+    delay_cv.notify_one();
+}
+
+void SourceSinkVirtualInterfaceHandler::delay_loop()
+{
+    std::unique_lock lock(delay_mutex);
+    while (!delay_stop)
+    {
+        if (delayed.empty())
+        {
+            delay_cv.wait(lock);
+            continue;
+        }
+        // 处理时间都相同，到期顺序就是入队顺序
+        auto due = delayed.front().due;
+        if (std::chrono::steady_clock::now() < due)
+        {
+            delay_cv.wait_until(lock, due);
+            continue;
+        }
+        auto ret = std::move(delayed.front().ret);
+        delayed.pop_front();
+        auto current_session = session.load();
+        if (!current_session)
+        {
+            continue;
+        }
+        auto seqnum = ret.header.seqnum;
+        auto unlink_found = current_session->get_unlink_seqnum(seqnum);
+        if (std::get<0>(unlink_found))
+        {
+            current_session->submit_ret_unlink_and_then_remove_seqnum_unlink(
+                UsbIpResponse::UsbIpRetUnlink::create_ret_unlink(
+                    std::get<1>(unlink_found),
+                    static_cast<std::uint32_t>(UrbStatusType::StatusECONNRESET)),
+                seqnum);
+            continue;
+        }
+        current_session->submit_ret_submit(std::move(ret));
+    }
+}
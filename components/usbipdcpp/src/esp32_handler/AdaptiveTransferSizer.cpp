@@ -0,0 +1,116 @@
+#include "AdaptiveTransferSizer.h"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+
+#include <esp_timer.h>
+
+namespace usbipdcpp
+{
+
+    void AdaptiveTransferSizer::on_in_submitted(std::uint8_t ep_address, std::uint32_t requested,
+                                                std::uint16_t max_packet_size)
+    {
+        in_transfers_.fetch_add(1, std::memory_order_relaxed);
+        bytes_requested_.fetch_add(requested, std::memory_order_relaxed);
+
+        auto needed = requested;
+        auto learned = in_endpoints_[ep_address & 0x0F].learned.load(std::memory_order_relaxed);
+        if (learned != 0 && max_packet_size > 0)
+        {
+            auto size = std::max<std::uint32_t>(learned, max_packet_size);
+            size = (size + max_packet_size - 1) / max_packet_size * max_packet_size;
+            if (size < requested)
+            {
+                needed = size;
+                oversized_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        bytes_learned_.fetch_add(needed, std::memory_order_relaxed);
+    }
+
+    void AdaptiveTransferSizer::on_in_complete(std::uint8_t ep_address, std::uint32_t actual)
+    {
+        auto &state = in_endpoints_[ep_address & 0x0F];
+
+        auto learned = state.learned.load(std::memory_order_relaxed);
+        if (learned != 0 && actual > learned)
+        {
+            // 学习到的大小不够用，重新学习
+            state.learned.store(0, std::memory_order_relaxed);
+            state.window_max.store(0, std::memory_order_relaxed);
+            state.samples.store(0, std::memory_order_relaxed);
+            return;
+        }
+
+        if (actual > state.window_max.load(std::memory_order_relaxed))
+        {
+            state.window_max.store(actual, std::memory_order_relaxed);
+        }
+        if (state.samples.fetch_add(1, std::memory_order_relaxed) + 1 >= LEARN_WINDOW)
+        {
+            auto window_max = state.window_max.exchange(0, std::memory_order_relaxed);
+            state.samples.store(0, std::memory_order_relaxed);
+            // 取 2 的幂留出余量
+            state.learned.store(std::bit_ceil(std::max<std::uint32_t>(window_max, 1)), std::memory_order_relaxed);
+        }
+    }
+
+    void AdaptiveTransferSizer::on_urb_submitted(std::uint32_t seqnum)
+    {
+        if ((seqnum & RTT_SAMPLE_MASK) == 0)
+        {
+            network_.record_request_sent(seqnum);
+        }
+    }
+
+    void AdaptiveTransferSizer::on_urb_completed(std::uint32_t seqnum, std::size_t bytes)
+    {
+        if ((seqnum & RTT_SAMPLE_MASK) == 0)
+        {
+            network_.record_request_acked(seqnum);
+        }
+
+        auto now = esp_timer_get_time();
+        window_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+        auto window_start = window_start_.load(std::memory_order_relaxed);
+        if (window_start == 0)
+        {
+            window_start_.compare_exchange_strong(window_start, now, std::memory_order_relaxed);
+            return;
+        }
+        // 队列满时完成处理会退回到 client event 线程，可能有两个线程同时到这里
+        if (now - window_start >= THROUGHPUT_WINDOW_US &&
+            window_start_.compare_exchange_strong(window_start, now, std::memory_order_relaxed))
+        {
+            network_.update_throughput(window_bytes_.exchange(0, std::memory_order_relaxed),
+                                       std::chrono::milliseconds((now - window_start) / 1000));
+        }
+    }
+
+    AdaptiveTransferSizer::Stats AdaptiveTransferSizer::stats() const
+    {
+        return Stats{
+            .in_transfers = in_transfers_.load(std::memory_order_relaxed),
+            .oversized = oversized_.load(std::memory_order_relaxed),
+            .bytes_requested = bytes_requested_.load(std::memory_order_relaxed),
+            .bytes_learned = bytes_learned_.load(std::memory_order_relaxed),
+            .suggested_request_size = network_.get_suggested_request_size()};
+    }
+
+    std::vector<AdaptiveTransferSizer::EndpointStats> AdaptiveTransferSizer::endpoint_stats() const
+    {
+        std::vector<EndpointStats> result;
+        for (std::size_t i = 1; i < in_endpoints_.size(); i++)
+        {
+            auto learned = in_endpoints_[i].learned.load(std::memory_order_relaxed);
+            if (learned != 0)
+            {
+                result.push_back({static_cast<std::uint8_t>(0x80 | i), learned});
+            }
+        }
+        return result;
+    }
+
+} // namespace usbipdcpp
@@ -0,0 +1,414 @@
+#include "BotReadCache.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+#include <esp_heap_caps.h>
+#include <spdlog/spdlog.h>
+
+namespace usbipdcpp
+{
+
+    BotReadCache::BotReadCache(std::size_t capacity_bytes) : capacity_bytes_(capacity_bytes)
+    {
+    }
+
+    BotReadCache::~BotReadCache()
+    {
+        release_arena();
+    }
+
+    void BotReadCache::set_block_size(std::uint8_t lun, std::uint32_t block_size)
+    {
+        std::lock_guard lock(mutex_);
+        lun &= 0x0F;
+        if (lun_block_size_[lun] == block_size)
+        {
+            return;
+        }
+        SPDLOG_INFO("BOT读缓存: LUN {} 块大小 {} -> {}", lun, lun_block_size_[lun], block_size);
+        lun_block_size_[lun] = block_size;
+
+        if (slots_)
+        {
+            for (std::size_t i = 0; i < slot_count_; i++)
+            {
+                if (slots_[i].used && (slots_[i].key & 0x0F) == lun)
+                {
+                    drop_slot(static_cast<std::int32_t>(i));
+                    stats_.invalidations++;
+                }
+            }
+        }
+        if (block_size != 0)
+        {
+            ensure_arena(block_size);
+        }
+    }
+
+    std::uint32_t BotReadCache::block_size(std::uint8_t lun) const
+    {
+        std::lock_guard lock(mutex_);
+        auto size = lun_block_size_[lun & 0x0F];
+        // 只缓存和数据区块大小一致的 LUN
+        return (size != 0 && size == arena_block_size_) ? size : 0;
+    }
+
+    bool BotReadCache::lookup(std::uint8_t lun, std::uint64_t lba, std::uint32_t blocks)
+    {
+        std::lock_guard lock(mutex_);
+        if (!slots_ || blocks == 0 || blocks > slot_count_ || lun_block_size_[lun & 0x0F] != arena_block_size_)
+        {
+            stats_.misses++;
+            return false;
+        }
+        for (std::uint32_t i = 0; i < blocks; i++)
+        {
+            if (find_slot(make_key(lun, lba + i)) == NIL)
+            {
+                stats_.misses++;
+                return false;
+            }
+        }
+        // 全部命中后再刷新 LRU，避免部分命中时把无用的块提到前面
+        for (std::uint32_t i = 0; i < blocks; i++)
+        {
+            auto slot = find_slot(make_key(lun, lba + i));
+            unlink_lru(slot);
+            push_lru_front(slot);
+        }
+        stats_.hits++;
+        return true;
+    }
+
+    bool BotReadCache::copy_out(std::uint8_t lun, std::uint64_t lba, std::size_t byte_offset,
+                                std::uint8_t *dst, std::size_t length)
+    {
+        std::lock_guard lock(mutex_);
+        if (!slots_)
+        {
+            return false;
+        }
+        std::size_t copied = 0;
+        while (copied < length)
+        {
+            auto pos = byte_offset + copied;
+            auto block_index = pos / arena_block_size_;
+            auto in_block = pos % arena_block_size_;
+            auto slot = find_slot(make_key(lun, lba + block_index));
+            if (slot == NIL)
+            {
+                return false;
+            }
+            auto n = std::min<std::size_t>(arena_block_size_ - in_block, length - copied);
+            std::memcpy(dst + copied, slot_data(slot) + in_block, n);
+            copied += n;
+        }
+        stats_.bytes_saved += length;
+        return true;
+    }
+
+    void BotReadCache::fill(std::uint8_t lun, std::uint64_t lba, std::size_t byte_offset,
+                            const std::uint8_t *src, std::size_t length)
+    {
+        std::lock_guard lock(mutex_);
+        if (!slots_ || lun_block_size_[lun & 0x0F] != arena_block_size_)
+        {
+            return;
+        }
+        // 只处理完全包含在这段数据中的块
+        auto first_block = (byte_offset + arena_block_size_ - 1) / arena_block_size_;
+        auto end_block = (byte_offset + length) / arena_block_size_;
+        for (auto block = first_block; block < end_block; block++)
+        {
+            auto key = make_key(lun, lba + block);
+            auto slot = find_slot(key);
+            if (slot == NIL)
+            {
+                slot = acquire_slot();
+                if (slot == NIL)
+                {
+                    return;
+                }
+                slots_[slot].key = key;
+                slots_[slot].used = true;
+                auto bucket = bucket_of(key);
+                slots_[slot].hash_next = buckets_[bucket];
+                buckets_[bucket] = slot;
+                used_count_++;
+            }
+            else
+            {
+                unlink_lru(slot);
+            }
+            push_lru_front(slot);
+            std::memcpy(slot_data(slot), src + (block * arena_block_size_ - byte_offset), arena_block_size_);
+        }
+    }
+
+    void BotReadCache::invalidate(std::uint8_t lun, std::uint64_t lba, std::uint32_t blocks)
+    {
+        std::lock_guard lock(mutex_);
+        if (!slots_)
+        {
+            return;
+        }
+        if (blocks > used_count_)
+        {
+            // 范围比缓存还大时直接扫描一遍，避免逐块查哈希
+            for (std::size_t i = 0; i < slot_count_; i++)
+            {
+                auto key = slots_[i].key;
+                auto slot_lba = key >> 4;
+                if (slots_[i].used && (key & 0x0F) == (lun & 0x0F) && slot_lba >= lba && slot_lba - lba < blocks)
+                {
+                    drop_slot(static_cast<std::int32_t>(i));
+                    stats_.invalidations++;
+                }
+            }
+            return;
+        }
+        for (std::uint32_t i = 0; i < blocks; i++)
+        {
+            auto slot = find_slot(make_key(lun, lba + i));
+            if (slot != NIL)
+            {
+                drop_slot(slot);
+                stats_.invalidations++;
+            }
+        }
+    }
+
+    void BotReadCache::invalidate_lun(std::uint8_t lun)
+    {
+        std::lock_guard lock(mutex_);
+        if (!slots_)
+        {
+            return;
+        }
+        for (std::size_t i = 0; i < slot_count_; i++)
+        {
+            if (slots_[i].used && (slots_[i].key & 0x0F) == (lun & 0x0F))
+            {
+                drop_slot(static_cast<std::int32_t>(i));
+                stats_.invalidations++;
+            }
+        }
+    }
+
+    void BotReadCache::clear()
+    {
+        std::lock_guard lock(mutex_);
+        if (!slots_)
+        {
+            return;
+        }
+        stats_.invalidations += used_count_;
+        for (std::size_t i = 0; i < bucket_count_; i++)
+        {
+            buckets_[i] = NIL;
+        }
+        for (std::size_t i = 0; i < slot_count_; i++)
+        {
+            slots_[i].used = false;
+            slots_[i].lru_prev = NIL;
+            slots_[i].hash_next = NIL;
+            slots_[i].lru_next = (i + 1 < slot_count_) ? static_cast<std::int32_t>(i + 1) : NIL;
+        }
+        free_head_ = slot_count_ ? 0 : NIL;
+        lru_head_ = NIL;
+        lru_tail_ = NIL;
+        used_count_ = 0;
+    }
+
+    BotReadCache::Stats BotReadCache::stats() const
+    {
+        std::lock_guard lock(mutex_);
+        auto result = stats_;
+        result.cached_blocks = used_count_;
+        result.capacity_blocks = slot_count_;
+        return result;
+    }
+
+    bool BotReadCache::ensure_arena(std::uint32_t block_size)
+    {
+        if (slots_ || allocation_failed_)
+        {
+            return slots_ != nullptr;
+        }
+        if (block_size == 0 || capacity_bytes_ < block_size)
+        {
+            return false;
+        }
+
+        slot_count_ = capacity_bytes_ / block_size;
+        bucket_count_ = std::bit_ceil(slot_count_);
+
+        auto caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT;
+        data_ = static_cast<std::uint8_t *>(heap_caps_malloc(slot_count_ * block_size, caps));
+        slots_ = static_cast<Slot *>(heap_caps_malloc(slot_count_ * sizeof(Slot), caps));
+        buckets_ = static_cast<std::int32_t *>(heap_caps_malloc(bucket_count_ * sizeof(std::int32_t), caps));
+        if (!data_ || !slots_ || !buckets_)
+        {
+            SPDLOG_ERROR("BOT读缓存: PSRAM 分配 {} 字节失败，读缓存不可用", capacity_bytes_);
+            release_arena();
+            allocation_failed_ = true;
+            return false;
+        }
+
+        arena_block_size_ = block_size;
+        used_count_ = 0;
+        for (std::size_t i = 0; i < bucket_count_; i++)
+        {
+            buckets_[i] = NIL;
+        }
+        for (std::size_t i = 0; i < slot_count_; i++)
+        {
+            slots_[i] = Slot{
+                .key = 0,
+                .lru_prev = NIL,
+                .lru_next = (i + 1 < slot_count_) ? static_cast<std::int32_t>(i + 1) : NIL,
+                .hash_next = NIL,
+                .used = false};
+        }
+        free_head_ = 0;
+        lru_head_ = NIL;
+        lru_tail_ = NIL;
+        SPDLOG_INFO("BOT读缓存: 分配 {} 个 {} 字节的块", slot_count_, block_size);
+        return true;
+    }
+
+    void BotReadCache::release_arena()
+    {
+        heap_caps_free(data_);
+        heap_caps_free(slots_);
+        heap_caps_free(buckets_);
+        data_ = nullptr;
+        slots_ = nullptr;
+        buckets_ = nullptr;
+        slot_count_ = 0;
+        bucket_count_ = 0;
+        used_count_ = 0;
+        arena_block_size_ = 0;
+        lru_head_ = lru_tail_ = free_head_ = NIL;
+    }
+
+    std::size_t BotReadCache::bucket_of(std::uint64_t key) const
+    {
+        // 顺序 LBA 在哈希后需要打散，乘法哈希足够
+        return static_cast<std::size_t>((key * 0x9E3779B97F4A7C15ull) >> 32) & (bucket_count_ - 1);
+    }
+
+    std::int32_t BotReadCache::find_slot(std::uint64_t key) const
+    {
+        for (auto slot = buckets_[bucket_of(key)]; slot != NIL; slot = slots_[slot].hash_next)
+        {
+            if (slots_[slot].key == key)
+            {
+                return slot;
+            }
+        }
+        return NIL;
+    }
+
+    std::int32_t BotReadCache::acquire_slot()
+    {
+        if (free_head_ != NIL)
+        {
+            auto slot = free_head_;
+            free_head_ = slots_[slot].lru_next;
+            slots_[slot].lru_prev = NIL;
+            slots_[slot].lru_next = NIL;
+            return slot;
+        }
+        // 没有空闲块，淘汰最久未使用的块
+        auto victim = lru_tail_;
+        if (victim == NIL)
+        {
+            return NIL;
+        }
+        unlink_hash(victim);
+        unlink_lru(victim);
+        slots_[victim].used = false;
+        used_count_--;
+        stats_.evictions++;
+        return victim;
+    }
+
+    void BotReadCache::unlink_hash(std::int32_t slot)
+    {
+        auto &head = buckets_[bucket_of(slots_[slot].key)];
+        if (head == slot)
+        {
+            head = slots_[slot].hash_next;
+        }
+        else
+        {
+            for (auto prev = head; prev != NIL; prev = slots_[prev].hash_next)
+            {
+                if (slots_[prev].hash_next == slot)
+                {
+                    slots_[prev].hash_next = slots_[slot].hash_next;
+                    break;
+                }
+            }
+        }
+        slots_[slot].hash_next = NIL;
+    }
+
+    void BotReadCache::unlink_lru(std::int32_t slot)
+    {
+        auto prev = slots_[slot].lru_prev;
+        auto next = slots_[slot].lru_next;
+        if (prev != NIL)
+        {
+            slots_[prev].lru_next = next;
+        }
+        else
+        {
+            lru_head_ = next;
+        }
+        if (next != NIL)
+        {
+            slots_[next].lru_prev = prev;
+        }
+        else
+        {
+            lru_tail_ = prev;
+        }
+        slots_[slot].lru_prev = NIL;
+        slots_[slot].lru_next = NIL;
+    }
+
+    void BotReadCache::push_lru_front(std::int32_t slot)
+    {
+        slots_[slot].lru_prev = NIL;
+        slots_[slot].lru_next = lru_head_;
+        if (lru_head_ != NIL)
+        {
+            slots_[lru_head_].lru_prev = slot;
+        }
+        lru_head_ = slot;
+        if (lru_tail_ == NIL)
+        {
+            lru_tail_ = slot;
+        }
+    }
+
+    void BotReadCache::drop_slot(std::int32_t slot)
+    {
+        unlink_hash(slot);
+        unlink_lru(slot);
+        slots_[slot].used = false;
+        slots_[slot].lru_next = free_head_;
+        free_head_ = slot;
+        used_count_--;
+    }
+
+    std::uint8_t *BotReadCache::slot_data(std::int32_t slot) const
+    {
+        return data_ + static_cast<std::size_t>(slot) * arena_block_size_;
+    }
+
+} // namespace usbipdcpp
@@ -0,0 +1,104 @@
+#include "BotWriteCombiner.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <esp_heap_caps.h>
+#include <spdlog/spdlog.h>
+
+namespace usbipdcpp
+{
+
+    BotWriteCombiner::BotWriteCombiner(std::size_t capacity_bytes) : capacity_bytes_(capacity_bytes)
+    {
+        buffer_ = static_cast<std::uint8_t *>(heap_caps_malloc(capacity_bytes_, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+        if (!buffer_)
+        {
+            SPDLOG_ERROR("BOT写合并: PSRAM 分配 {} 字节失败，写合并不可用", capacity_bytes_);
+        }
+    }
+
+    BotWriteCombiner::~BotWriteCombiner()
+    {
+        heap_caps_free(buffer_);
+    }
+
+    bool BotWriteCombiner::can_append(std::uint8_t lun, std::uint32_t lba, std::uint32_t blocks,
+                                      std::uint32_t block_size) const
+    {
+        if (!buffer_ || block_size == 0 || blocks == 0)
+        {
+            return false;
+        }
+        auto bytes = static_cast<std::uint64_t>(blocks) * block_size;
+        if (committed_bytes_ == 0)
+        {
+            return bytes <= capacity_bytes_ && blocks <= MAX_COMBINED_BLOCKS;
+        }
+        return lun == lun_ && block_size == block_size_ &&
+               static_cast<std::uint64_t>(lba_) + committed_blocks() == lba &&
+               committed_bytes_ + bytes <= capacity_bytes_ &&
+               static_cast<std::uint64_t>(committed_blocks()) + blocks <= MAX_COMBINED_BLOCKS;
+    }
+
+    void BotWriteCombiner::begin_command(std::uint8_t lun, std::uint32_t lba, std::uint32_t blocks,
+                                         std::uint32_t block_size)
+    {
+        if (committed_bytes_ == 0)
+        {
+            lun_ = lun;
+            lba_ = lba;
+            block_size_ = block_size;
+        }
+        write_pos_ = committed_bytes_;
+        command_end_ = committed_bytes_ + static_cast<std::size_t>(blocks) * block_size;
+    }
+
+    void BotWriteCombiner::append(const std::uint8_t *data, std::size_t length)
+    {
+        auto n = std::min(length, command_end_ - write_pos_);
+        std::memcpy(buffer_ + write_pos_, data, n);
+        write_pos_ += n;
+        last_append_ = std::chrono::steady_clock::now();
+    }
+
+    void BotWriteCombiner::commit_command()
+    {
+        if (write_pos_ != command_end_)
+        {
+            // 主机没有发完数据，这条命令不能算数
+            SPDLOG_WARN("BOT写合并: 命令数据不完整 {}/{}", write_pos_ - committed_bytes_, command_end_ - committed_bytes_);
+            abort_command();
+            return;
+        }
+        committed_bytes_ = command_end_;
+        stats_.commands_combined++;
+    }
+
+    void BotWriteCombiner::abort_command()
+    {
+        write_pos_ = committed_bytes_;
+        command_end_ = committed_bytes_;
+    }
+
+    void BotWriteCombiner::reset()
+    {
+        committed_bytes_ = 0;
+        command_end_ = 0;
+        write_pos_ = 0;
+    }
+
+    void BotWriteCombiner::record_flush(bool success)
+    {
+        if (success)
+        {
+            stats_.flushes++;
+            stats_.bytes_flushed += committed_bytes_;
+        }
+        else
+        {
+            stats_.flush_errors++;
+        }
+    }
+
+} // namespace usbipdcpp
@@ -0,0 +1,94 @@
+#include "BulkOutWriteBehind.h"
+
+#include <algorithm>
+
+namespace usbipdcpp
+{
+
+    BulkOutWriteBehind::BulkOutWriteBehind(std::uint16_t endpoint_mask, std::uint8_t max_depth)
+        : endpoint_mask_(endpoint_mask), max_depth_(std::max<std::uint8_t>(max_depth, 1))
+    {
+    }
+
+    std::uint32_t BulkOutWriteBehind::take_error(std::uint8_t ep_address)
+    {
+        auto status = endpoints_[ep_address & 0x0F].pending_error.exchange(0, std::memory_order_acq_rel);
+        if (status != 0)
+        {
+            reported_errors_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return status;
+    }
+
+    bool BulkOutWriteBehind::try_acquire(std::uint8_t ep_address)
+    {
+        auto &in_flight = endpoints_[ep_address & 0x0F].in_flight;
+        auto current = in_flight.load(std::memory_order_relaxed);
+        do
+        {
+            if (current >= max_depth_)
+            {
+                throttled_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        } while (!in_flight.compare_exchange_weak(current, current + 1, std::memory_order_relaxed));
+
+        total_in_flight_.fetch_add(1, std::memory_order_relaxed);
+        early_acks_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void BulkOutWriteBehind::release(std::uint8_t ep_address)
+    {
+        endpoints_[ep_address & 0x0F].in_flight.fetch_sub(1, std::memory_order_relaxed);
+        early_acks_.fetch_sub(1, std::memory_order_relaxed);
+        if (total_in_flight_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            std::lock_guard lock(drain_mutex_);
+            drain_cv_.notify_all();
+        }
+    }
+
+    void BulkOutWriteBehind::on_complete(std::uint8_t ep_address, std::uint32_t status)
+    {
+        auto &state = endpoints_[ep_address & 0x0F];
+        if (status != 0)
+        {
+            deferred_errors_.fetch_add(1, std::memory_order_relaxed);
+            // 只保留第一个错误，之后在途的传输通常也会因为同一个原因失败
+            std::uint32_t expected = 0;
+            state.pending_error.compare_exchange_strong(expected, status, std::memory_order_acq_rel);
+        }
+        state.in_flight.fetch_sub(1, std::memory_order_relaxed);
+        if (total_in_flight_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            std::lock_guard lock(drain_mutex_);
+            drain_cv_.notify_all();
+        }
+    }
+
+    bool BulkOutWriteBehind::wait_drained(std::chrono::milliseconds timeout)
+    {
+        std::unique_lock lock(drain_mutex_);
+        return drain_cv_.wait_for(lock, timeout, [this]()
+                                  { return total_in_flight_.load(std::memory_order_acquire) == 0; });
+    }
+
+    void BulkOutWriteBehind::reset_errors()
+    {
+        for (auto &state : endpoints_)
+        {
+            state.pending_error.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    BulkOutWriteBehind::Stats BulkOutWriteBehind::stats() const
+    {
+        return Stats{
+            .early_acks = early_acks_.load(std::memory_order_relaxed),
+            .throttled = throttled_.load(std::memory_order_relaxed),
+            .deferred_errors = deferred_errors_.load(std::memory_order_relaxed),
+            .reported_errors = reported_errors_.load(std::memory_order_relaxed)};
+    }
+
+} // namespace usbipdcpp
@@ -0,0 +1,197 @@
+#include "CompletionQueueBenchmark.h"
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <asio.hpp>
+#include <asio/experimental/channel.hpp>
+#include <esp_cpu.h>
+#include <esp_rom_sys.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <spdlog/spdlog.h>
+
+#include "CompletionQueue.h"
+#include "LatencyHistogram.h"
+#include "TaskTopology.h"
+
+namespace usbipdcpp
+{
+    namespace
+    {
+        using RetVariant = UsbIpResponse::RetVariant;
+
+        // 和原来会话中的 transfer_channel 一样大
+        constexpr std::size_t CHANNEL_SIZE = 2048;
+        constexpr std::size_t BATCH_SIZE = 16;
+
+        std::uint32_t now_stamp()
+        {
+            return static_cast<std::uint32_t>(esp_timer_get_time());
+        }
+
+        struct Recorder
+        {
+            // 这个直方图记录的是纳秒
+            LatencyHistogram enqueue_ns;
+            LatencyHistogram latency_us;
+            std::uint64_t received = 0;
+            std::uint64_t wakeups = 0;
+
+            void on_received(const RetVariant &response)
+            {
+                // 基准测试的应答不会发出去，start_frame 中是开始入队的时间
+                const auto &ret = std::get<UsbIpResponse::UsbIpRetSubmit>(response);
+                latency_us.record(now_stamp() - ret.start_frame);
+                received++;
+            }
+        };
+
+        /**
+         * @brief 按配置启动消费者线程和生产者线程，阻塞到全部取出
+         * @param enqueue 在生产者线程中调用
+         */
+        template <typename Enqueue>
+        CompletionQueueBenchmark::Result drive(const char *name, const CompletionQueueBenchmark::Config &config,
+                                               asio::io_context &io_context, Recorder &recorder, Enqueue &&enqueue)
+        {
+            const auto ticks_per_us = std::max<std::uint32_t>(esp_rom_get_cpu_ticks_per_us(), 1);
+            auto start = esp_timer_get_time();
+
+            std::thread consumer;
+            {
+                TaskTopology::ScopedThreadConfig thread_config(TaskRole::Session);
+                consumer = std::thread([&io_context]()
+                                       { io_context.run(); });
+            }
+            std::vector<std::thread> producers;
+            {
+                TaskTopology::ScopedThreadConfig thread_config(TaskRole::CompletionWorker);
+                for (std::uint8_t p = 0; p < config.producers; p++)
+                {
+                    producers.emplace_back([&, p]()
+                                           {
+                        for (std::uint32_t i = 0; i < config.messages_per_producer; i++) {
+                            auto seqnum = static_cast<std::uint32_t>(p) << 24 | i;
+                            auto ret = UsbIpResponse::UsbIpRetSubmit::create_ret_submit_ok_without_data(seqnum);
+                            ret.start_frame = now_stamp();
+                            RetVariant response{std::move(ret)};
+
+                            // 生产者绑定了核心，周期计数不会在两个核心之间跳
+                            auto begin = esp_cpu_get_cycle_count();
+                            enqueue(std::move(response));
+                            auto cycles = static_cast<std::uint32_t>(esp_cpu_get_cycle_count() - begin);
+                            recorder.enqueue_ns.record(static_cast<std::uint64_t>(cycles) * 1000 / ticks_per_us);
+
+                            if (config.burst && (i + 1) % config.burst == 0) {
+                                vTaskDelay(1);
+                            }
+                        } });
+                }
+            }
+            for (auto &producer : producers)
+            {
+                producer.join();
+            }
+            // 消费者取完全部应答后 io_context 没有任务，run 返回
+            consumer.join();
+
+            CompletionQueueBenchmark::Result result;
+            result.name = name;
+            result.messages = recorder.received;
+            result.elapsed_us = static_cast<std::uint64_t>(esp_timer_get_time() - start);
+            result.enqueue_avg_ns = recorder.enqueue_ns.average_us();
+            result.enqueue_p50_ns = recorder.enqueue_ns.percentile_us(50);
+            result.enqueue_p99_ns = recorder.enqueue_ns.percentile_us(99);
+            result.enqueue_max_ns = recorder.enqueue_ns.max_us();
+            result.latency_avg_us = recorder.latency_us.average_us();
+            result.latency_p50_us = recorder.latency_us.percentile_us(50);
+            result.latency_p99_us = recorder.latency_us.percentile_us(99);
+            result.latency_max_us = recorder.latency_us.max_us();
+            return result;
+        }
+    }
+
+    std::array<CompletionQueueBenchmark::Result, 2> CompletionQueueBenchmark::run(const Config &config)
+    {
+        auto fixed = config;
+        fixed.producers = std::clamp<std::uint8_t>(fixed.producers, 1, MAX_PRODUCERS);
+        fixed.messages_per_producer = std::clamp<std::uint32_t>(fixed.messages_per_producer, 1, 0xFFFFFF);
+        return {run_channel(fixed), run_completion_queue(fixed)};
+    }
+
+    CompletionQueueBenchmark::Result CompletionQueueBenchmark::run_channel(const Config &config)
+    {
+        using channel_type = asio::experimental::channel<void(asio::error_code, RetVariant)>;
+
+        const std::uint64_t total = static_cast<std::uint64_t>(config.producers) * config.messages_per_producer;
+        asio::io_context io_context{1};
+        auto strand = asio::make_strand(io_context);
+        channel_type channel(strand, CHANNEL_SIZE);
+        Recorder recorder;
+
+        asio::co_spawn(strand, [&]() -> asio::awaitable<void>
+                       {
+            while (recorder.received < total) {
+                asio::error_code ec;
+                auto response = co_await channel.async_receive(asio::redirect_error(asio::use_awaitable, ec));
+                if (ec) {
+                    SPDLOG_ERROR("channel async_receive error: {}", ec.message());
+                    break;
+                }
+                recorder.on_received(response);
+            } }, asio::detached);
+
+        return drive("channel", config, io_context, recorder, [&](RetVariant &&response)
+                     {
+            // 和原来的 Session::queue_response 相同
+            asio::dispatch(strand, [&channel, response = std::move(response)]() mutable
+                           { channel.async_send(asio::error_code{}, std::move(response), asio::detached); }); });
+    }
+
+    CompletionQueueBenchmark::Result CompletionQueueBenchmark::run_completion_queue(const Config &config)
+    {
+        const std::uint64_t total = static_cast<std::uint64_t>(config.producers) * config.messages_per_producer;
+        asio::io_context io_context{1};
+        auto strand = asio::make_strand(io_context);
+        asio::steady_timer wakeup(strand);
+        // 队列有几十 KB，不能放在控制台任务的栈上
+        auto queue = std::make_unique<CompletionQueue>();
+        Recorder recorder;
+
+        asio::co_spawn(strand, [&]() -> asio::awaitable<void>
+                       {
+            // 和 Session::sender 相同的取出和睡眠方式
+            std::vector<RetVariant> batch;
+            batch.reserve(BATCH_SIZE);
+            while (recorder.received < total) {
+                batch.clear();
+                if (queue->pop_batch(batch, BATCH_SIZE) == 0) {
+                    if (queue->prepare_wait()) {
+                        wakeup.expires_at(asio::steady_timer::time_point::max());
+                        asio::error_code ec;
+                        co_await wakeup.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+                        recorder.wakeups++;
+                    }
+                    continue;
+                }
+                for (const auto &response : batch) {
+                    recorder.on_received(response);
+                }
+            } }, asio::detached);
+
+        auto result = drive("completion_queue", config, io_context, recorder, [&](RetVariant &&response)
+                            {
+            if (queue->push(std::move(response))) {
+                asio::post(strand, [&wakeup]()
+                           { wakeup.cancel(); });
+            } });
+        result.wakeups = recorder.wakeups;
+        result.overflowed = queue->overflow_count();
+        return result;
+    }
+
+} // namespace usbipdcpp
@@ -0,0 +1,139 @@
+#include "CompletionWorker.h"
+
+#include <algorithm>
+#include <bit>
+
+#include <esp_timer.h>
+#include <spdlog/spdlog.h>
+
+#include "TaskTopology.h"
+
+namespace usbipdcpp
+{
+
+    CompletionWorker::CompletionWorker(Handler handler, std::size_t capacity) : handler_(handler),
+                                                                                mask_(std::bit_ceil(std::max<std::size_t>(capacity, 2)) - 1),
+                                                                                slots_(new Slot[mask_ + 1])
+    {
+        TaskTopology::ScopedThreadConfig thread_config(TaskRole::CompletionWorker);
+        thread_ = std::thread([this]()
+                              { run(); });
+    }
+
+    CompletionWorker::~CompletionWorker()
+    {
+        stop_ = true;
+        pending_.release();
+        if (thread_.joinable())
+        {
+            thread_.join();
+        }
+    }
+
+    bool CompletionWorker::post(usb_transfer_t *trx)
+    {
+        if (stop_.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+
+        auto tail = tail_.load(std::memory_order_relaxed);
+        auto depth = tail - head_.load(std::memory_order_acquire);
+        if (depth <= mask_ && !has_overflow_.load(std::memory_order_acquire))
+        {
+            slots_[tail & mask_] = Slot{trx, esp_timer_get_time()};
+            tail_.store(tail + 1, std::memory_order_release);
+
+            if (depth + 1 > peak_depth_.load(std::memory_order_relaxed))
+            {
+                peak_depth_.store(depth + 1, std::memory_order_relaxed);
+            }
+        }
+        else
+        {
+            std::lock_guard lock(overflow_mutex_);
+            overflow_.push_back(Slot{trx, esp_timer_get_time()});
+            has_overflow_.store(true, std::memory_order_release);
+            overflowed_.fetch_add(1, std::memory_order_relaxed);
+        }
+        pending_.release();
+        return true;
+    }
+
+    CompletionWorker::Stats CompletionWorker::stats() const
+    {
+        return Stats{
+            .completions = completions_.load(std::memory_order_relaxed),
+            .overflowed = overflowed_.load(std::memory_order_relaxed),
+            .busy_us = busy_us_.load(std::memory_order_relaxed),
+            .max_queue_delay_us = max_queue_delay_us_.load(std::memory_order_relaxed),
+            .peak_depth = peak_depth_.load(std::memory_order_relaxed)};
+    }
+
+    void CompletionWorker::process(const Slot &slot)
+    {
+        auto start = esp_timer_get_time();
+        auto delay = static_cast<std::uint64_t>(start - slot.enqueue_time);
+        if (delay > max_queue_delay_us_.load(std::memory_order_relaxed))
+        {
+            max_queue_delay_us_.store(delay, std::memory_order_relaxed);
+        }
+
+        handler_(slot.trx);
+
+        busy_us_.fetch_add(static_cast<std::uint64_t>(esp_timer_get_time() - start), std::memory_order_relaxed);
+        completions_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void CompletionWorker::run()
+    {
+        std::deque<Slot> spilled;
+        auto drain_ring = [this]()
+        {
+            auto head = head_.load(std::memory_order_relaxed);
+            while (head != tail_.load(std::memory_order_acquire))
+            {
+                auto slot = slots_[head & mask_];
+                head_.store(++head, std::memory_order_release);
+                process(slot);
+            }
+        };
+
+        while (true)
+        {
+            pending_.acquire();
+
+            // 一次唤醒处理完所有的传输，多余的信号量计数只会造成一次空转
+            while (true)
+            {
+                drain_ring();
+                if (!has_overflow_.load(std::memory_order_acquire))
+                {
+                    break;
+                }
+                // 溢出期间生产者不再写无锁队列，其中剩下的传输都比溢出队列中的早
+                drain_ring();
+                {
+                    std::lock_guard lock(overflow_mutex_);
+                    spilled.swap(overflow_);
+                    has_overflow_.store(false, std::memory_order_release);
+                }
+                // 之后的传输重新进入无锁队列，要先处理完换出来的这些
+                for (const auto &slot : spilled)
+                {
+                    process(slot);
+                }
+                spilled.clear();
+            }
+
+            if (stop_.load(std::memory_order_acquire) &&
+                head_.load(std::memory_order_relaxed) == tail_.load(std::memory_order_acquire) &&
+                !has_overflow_.load(std::memory_order_acquire))
+            {
+                break;
+            }
+        }
+        SPDLOG_TRACE("completion worker 退出");
+    }
+
+} // namespace usbipdcpp
@@ -0,0 +1,66 @@
+#include "DevicePolicy.h"
+
+#include <algorithm>
+
+#include <spdlog/spdlog.h>
+
+namespace usbipdcpp
+{
+
+    void DevicePolicyTable::add_rule(const Rule &rule)
+    {
+        std::lock_guard lock(mutex_);
+        rules_.push_back(rule);
+    }
+
+    void DevicePolicyTable::set_default_policy(const Esp32DevicePolicy &policy)
+    {
+        std::lock_guard lock(mutex_);
+        default_policy_ = policy;
+    }
+
+    void DevicePolicyTable::clear()
+    {
+        std::lock_guard lock(mutex_);
+        rules_.clear();
+        default_policy_ = {};
+    }
+
+    Esp32DevicePolicy DevicePolicyTable::resolve(std::uint16_t vendor_id, std::uint16_t product_id,
+                                                 const std::vector<UsbInterface> &interfaces) const
+    {
+        std::lock_guard lock(mutex_);
+        for (std::size_t i = 0; i < rules_.size(); i++)
+        {
+            if (match(rules_[i], vendor_id, product_id, interfaces))
+            {
+                SPDLOG_DEBUG("设备 {:04x}:{:04x} 匹配策略规则 {}", vendor_id, product_id, i);
+                return rules_[i].policy;
+            }
+        }
+        return default_policy_;
+    }
+
+    bool DevicePolicyTable::match(const Rule &rule, std::uint16_t vendor_id, std::uint16_t product_id,
+                                  const std::vector<UsbInterface> &interfaces)
+    {
+        if (rule.vendor_id != 0 && rule.vendor_id != vendor_id)
+        {
+            return false;
+        }
+        if (rule.product_id != 0 && rule.product_id != product_id)
+        {
+            return false;
+        }
+        if (rule.interface_class)
+        {
+            return std::any_of(interfaces.begin(), interfaces.end(),
+                               [&](const UsbInterface &intf)
+                               {
+                                   return intf.interface_class == *rule.interface_class;
+                               });
+        }
+        return true;
+    }
+
+} // namespace usbipdcpp
@@ -0,0 +1,634 @@
+#include "EnumerationCache.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include <nvs.h>
+#include <spdlog/spdlog.h>
+
+#include "Esp32DeviceHandler.h"
+#include "SetupPacket.h"
+#include "TaskTopology.h"
+
+namespace usbipdcpp
+{
+    namespace
+    {
+        constexpr const char *NVS_NAMESPACE = "enum_cache";
+        constexpr const char *NVS_INDEX_KEY = "index";
+        constexpr std::uint8_t FORMAT_VERSION = 1;
+        constexpr std::uint8_t REQUEST_GET_DESCRIPTOR = 0x06;
+
+        void entry_key_name(std::uint32_t hash, char (&name)[16])
+        {
+            std::snprintf(name, sizeof(name), "d%08lx", static_cast<unsigned long>(hash));
+        }
+
+        class Writer
+        {
+        public:
+            explicit Writer(std::vector<std::uint8_t> &out) : out_(out)
+            {
+            }
+
+            void u8(std::uint8_t v)
+            {
+                out_.push_back(v);
+            }
+
+            void u16(std::uint16_t v)
+            {
+                out_.push_back(v & 0xFF);
+                out_.push_back(v >> 8);
+            }
+
+            void u32(std::uint32_t v)
+            {
+                u16(v & 0xFFFF);
+                u16(v >> 16);
+            }
+
+            void bytes(const std::uint8_t *data, std::size_t length)
+            {
+                out_.insert(out_.end(), data, data + length);
+            }
+
+        private:
+            std::vector<std::uint8_t> &out_;
+        };
+
+        class Reader
+        {
+        public:
+            explicit Reader(const std::vector<std::uint8_t> &in) : in_(in)
+            {
+            }
+
+            bool u8(std::uint8_t &v)
+            {
+                if (pos_ + 1 > in_.size())
+                {
+                    return false;
+                }
+                v = in_[pos_++];
+                return true;
+            }
+
+            bool u16(std::uint16_t &v)
+            {
+                std::uint8_t lo, hi;
+                if (!u8(lo) || !u8(hi))
+                {
+                    return false;
+                }
+                v = static_cast<std::uint16_t>(lo | (hi << 8));
+                return true;
+            }
+
+            bool u32(std::uint32_t &v)
+            {
+                std::uint16_t lo, hi;
+                if (!u16(lo) || !u16(hi))
+                {
+                    return false;
+                }
+                v = static_cast<std::uint32_t>(lo) | (static_cast<std::uint32_t>(hi) << 16);
+                return true;
+            }
+
+            bool bytes(std::uint8_t *data, std::size_t length)
+            {
+                if (pos_ + length > in_.size())
+                {
+                    return false;
+                }
+                std::memcpy(data, in_.data() + pos_, length);
+                pos_ += length;
+                return true;
+            }
+
+        private:
+            const std::vector<std::uint8_t> &in_;
+            std::size_t pos_ = 0;
+        };
+    }
+
+    std::uint32_t EnumerationKey::hash() const
+    {
+        // FNV-1a
+        std::uint32_t h = 2166136261u;
+        auto mix = [&h](std::uint8_t b)
+        {
+            h ^= b;
+            h *= 16777619u;
+        };
+        mix(vendor_id & 0xFF);
+        mix(vendor_id >> 8);
+        mix(product_id & 0xFF);
+        mix(product_id >> 8);
+        mix(bcd_device & 0xFF);
+        mix(bcd_device >> 8);
+        for (auto c : serial)
+        {
+            mix(static_cast<std::uint8_t>(c));
+        }
+        return h;
+    }
+
+    EnumerationCache::EnumerationCache()
+    {
+        TaskTopology::ScopedThreadConfig thread_config(TaskRole::EnumCache);
+        worker_ = std::thread([this]()
+                              { worker_main(); });
+    }
+
+    EnumerationCache::~EnumerationCache()
+    {
+        {
+            std::lock_guard lock(jobs_mutex_);
+            stop_ = true;
+        }
+        jobs_cv_.notify_all();
+        if (worker_.joinable())
+        {
+            worker_.join();
+        }
+    }
+
+    bool EnumerationCache::is_cacheable_request(std::uint8_t request_type, std::uint8_t request)
+    {
+        // 标准 GET_DESCRIPTOR，接收者为设备或接口（HID 报告描述符）
+        return request == REQUEST_GET_DESCRIPTOR && (request_type == 0x80 || request_type == 0x81);
+    }
+
+    std::shared_ptr<EnumerationCache::Entry> EnumerationCache::lookup(const EnumerationKey &key,
+                                                                      std::uint32_t config_crc,
+                                                                      std::uint16_t config_length)
+    {
+        auto entry = load(key);
+
+        std::lock_guard lock(mutex_);
+        if (!entry)
+        {
+            stats_.misses++;
+            return nullptr;
+        }
+        if (entry->config_crc != config_crc || entry->config_length != config_length)
+        {
+            SPDLOG_INFO("设备 {:04x}:{:04x} 的配置描述符已变化，丢弃枚举缓存", key.vendor_id, key.product_id);
+            stats_.mismatches++;
+            stats_.misses++;
+            auto hash = key.hash();
+            post([this, hash]()
+                 { erase(hash); });
+            return nullptr;
+        }
+        stats_.hits++;
+        return entry;
+    }
+
+    std::shared_ptr<EnumerationCache::Entry> EnumerationCache::create(const EnumerationKey &key,
+                                                                      std::uint32_t config_crc,
+                                                                      std::uint16_t config_length,
+                                                                      std::vector<InterfaceLayout> interfaces)
+    {
+        auto entry = std::make_shared<Entry>();
+        entry->key = key;
+        entry->config_crc = config_crc;
+        entry->config_length = config_length;
+        entry->interfaces = std::move(interfaces);
+        // 刚从设备读出来的，不需要校验
+        entry->verified = true;
+
+        if (serialized_size(*entry) > MAX_ENTRY_BYTES)
+        {
+            SPDLOG_WARN("设备 {:04x}:{:04x} 的接口布局太大，不缓存", key.vendor_id, key.product_id);
+            return nullptr;
+        }
+        post([this, entry]()
+             { persist(entry); });
+        return entry;
+    }
+
+    std::optional<std::vector<std::uint8_t>> EnumerationCache::find_descriptor(Entry &entry,
+                                                                               std::uint8_t request_type,
+                                                                               std::uint16_t value,
+                                                                               std::uint16_t index,
+                                                                               std::uint16_t length)
+    {
+        std::lock_guard lock(mutex_);
+        for (const auto &record : entry.descriptors)
+        {
+            if (record.request_type != request_type || record.value != value || record.index != index)
+            {
+                continue;
+            }
+            if (!record.complete && record.data.size() < length)
+            {
+                // 之前只读了一部分，这次要得更多
+                return std::nullopt;
+            }
+            auto n = std::min<std::size_t>(length, record.data.size());
+            entry.served++;
+            stats_.descriptors_served++;
+            return std::vector<std::uint8_t>(record.data.begin(), record.data.begin() + n);
+        }
+        return std::nullopt;
+    }
+
+    void EnumerationCache::learn_descriptor(const std::shared_ptr<Entry> &entry, std::uint8_t request_type,
+                                            std::uint16_t value, std::uint16_t index,
+                                            std::uint16_t requested_length, const std::uint8_t *data,
+                                            std::size_t length)
+    {
+        {
+            std::lock_guard lock(mutex_);
+            DescriptorRecord record{
+                .request_type = request_type,
+                .value = value,
+                .index = index,
+                .complete = length < requested_length,
+                .data = std::vector<std::uint8_t>(data, data + length)};
+
+            auto it = std::find_if(entry->descriptors.begin(), entry->descriptors.end(),
+                                   [&](const DescriptorRecord &r)
+                                   { return r.request_type == request_type && r.value == value && r.index == index; });
+            if (it != entry->descriptors.end())
+            {
+                if (it->complete || it->data.size() >= length)
+                {
+                    return;
+                }
+                // 只保留最长的一次
+                auto previous = std::move(*it);
+                *it = std::move(record);
+                if (serialized_size(*entry) > MAX_ENTRY_BYTES)
+                {
+                    *it = std::move(previous);
+                    return;
+                }
+            }
+            else
+            {
+                entry->descriptors.push_back(std::move(record));
+                if (serialized_size(*entry) > MAX_ENTRY_BYTES)
+                {
+                    entry->descriptors.pop_back();
+                    return;
+                }
+            }
+            stats_.descriptors_learned++;
+        }
+        post([this, entry]()
+             { persist(entry); });
+    }
+
+    void EnumerationCache::revalidate(const std::shared_ptr<Entry> &entry, std::weak_ptr<Esp32DeviceHandler> handler)
+    {
+        post([this, entry, handler = std::move(handler)]()
+             {
+            std::vector<DescriptorRecord> records;
+            {
+                std::lock_guard lock(mutex_);
+                records = entry->descriptors;
+            }
+
+            bool changed = false;
+            for (auto &record : records)
+            {
+                auto device = handler.lock();
+                if (!device || !device->has_device)
+                {
+                    return;
+                }
+
+                // 完整的描述符多要一些，长度变了也能发现
+                auto length = static_cast<std::uint16_t>(std::min<std::size_t>(
+                    record.complete ? record.data.size() + 64 : record.data.size(), 0xFFFF));
+                SetupPacket setup{
+                    .request_type = record.request_type,
+                    .request = REQUEST_GET_DESCRIPTOR,
+                    .value = record.value,
+                    .index = record.index,
+                    .length = length};
+                std::vector<std::uint8_t> data;
+                if (device->sync_control_in(setup, data) != ESP_OK)
+                {
+                    SPDLOG_WARN("校验枚举缓存时读取描述符 {:04x}/{:04x} 失败", record.value, record.index);
+                    return;
+                }
+                if (data != record.data)
+                {
+                    SPDLOG_INFO("设备 {:04x}:{:04x} 的描述符 {:04x}/{:04x} 已变化，更新枚举缓存",
+                                entry->key.vendor_id, entry->key.product_id, record.value, record.index);
+                    record.data = std::move(data);
+                    record.complete = record.data.size() < length;
+                    changed = true;
+                }
+            }
+
+            {
+                std::lock_guard lock(mutex_);
+                entry->descriptors = std::move(records);
+                entry->verified = true;
+                stats_.revalidated++;
+                if (changed)
+                {
+                    stats_.revalidation_changes++;
+                }
+            }
+            if (changed)
+            {
+                persist(entry);
+            } });
+    }
+
+    EnumerationCache::Stats EnumerationCache::stats() const
+    {
+        std::lock_guard lock(mutex_);
+        return stats_;
+    }
+
+    void EnumerationCache::post(std::function<void()> job)
+    {
+        {
+            std::lock_guard lock(jobs_mutex_);
+            if (stop_)
+            {
+                return;
+            }
+            jobs_.push_back(std::move(job));
+        }
+        jobs_cv_.notify_one();
+    }
+
+    void EnumerationCache::worker_main()
+    {
+        while (true)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock lock(jobs_mutex_);
+                jobs_cv_.wait(lock, [this]()
+                              { return stop_ || !jobs_.empty(); });
+                if (jobs_.empty())
+                {
+                    return;
+                }
+                job = std::move(jobs_.front());
+                jobs_.pop_front();
+            }
+            job();
+        }
+    }
+
+    void EnumerationCache::persist(const std::shared_ptr<Entry> &entry)
+    {
+        std::vector<std::uint8_t> blob;
+        std::uint32_t hash;
+        {
+            std::lock_guard lock(mutex_);
+            blob = serialize(*entry);
+            hash = entry->key.hash();
+        }
+
+        nvs_handle_t handle;
+        auto err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+        if (err == ESP_OK)
+        {
+            char name[16];
+            entry_key_name(hash, name);
+            err = nvs_set_blob(handle, name, blob.data(), blob.size());
+            if (err == ESP_OK)
+            {
+                err = nvs_commit(handle);
+            }
+            nvs_close(handle);
+        }
+
+        if (err == ESP_OK)
+        {
+            touch_index(hash);
+        }
+
+        std::lock_guard lock(mutex_);
+        if (err != ESP_OK)
+        {
+            SPDLOG_WARN("保存枚举缓存失败: {}", esp_err_to_name(err));
+            stats_.persist_errors++;
+            return;
+        }
+        stats_.persist_writes++;
+    }
+
+    std::shared_ptr<EnumerationCache::Entry> EnumerationCache::load(const EnumerationKey &key)
+    {
+        nvs_handle_t handle;
+        if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+        {
+            return nullptr;
+        }
+
+        char name[16];
+        entry_key_name(key.hash(), name);
+        size_t length = 0;
+        std::shared_ptr<Entry> entry;
+        if (nvs_get_blob(handle, name, nullptr, &length) == ESP_OK && length <= MAX_ENTRY_BYTES)
+        {
+            std::vector<std::uint8_t> blob(length);
+            if (nvs_get_blob(handle, name, blob.data(), &length) == ESP_OK)
+            {
+                entry = deserialize(blob);
+            }
+        }
+        nvs_close(handle);
+
+        if (entry && !(entry->key == key))
+        {
+            // 哈希冲突
+            return nullptr;
+        }
+        return entry;
+    }
+
+    void EnumerationCache::erase(std::uint32_t hash)
+    {
+        nvs_handle_t handle;
+        if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+        {
+            return;
+        }
+        char name[16];
+        entry_key_name(hash, name);
+        nvs_erase_key(handle, name);
+        nvs_commit(handle);
+        nvs_close(handle);
+
+        std::erase(index_, hash);
+    }
+
+    void EnumerationCache::touch_index(std::uint32_t hash)
+    {
+        // 只在后台线程调用，不持有 mutex_，NVS 读写期间不阻塞查找和学习描述符
+        nvs_handle_t handle;
+        if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+        {
+            return;
+        }
+
+        if (!index_loaded_)
+        {
+            size_t length = 0;
+            if (nvs_get_blob(handle, NVS_INDEX_KEY, nullptr, &length) == ESP_OK)
+            {
+                index_.resize(length / sizeof(std::uint32_t));
+                nvs_get_blob(handle, NVS_INDEX_KEY, index_.data(), &length);
+            }
+            index_loaded_ = true;
+        }
+
+        std::erase(index_, hash);
+        index_.insert(index_.begin(), hash);
+        while (index_.size() > MAX_ENTRIES)
+        {
+            // 淘汰最久没有用过的设备
+            char name[16];
+            entry_key_name(index_.back(), name);
+            nvs_erase_key(handle, name);
+            index_.pop_back();
+        }
+        nvs_set_blob(handle, NVS_INDEX_KEY, index_.data(), index_.size() * sizeof(std::uint32_t));
+        nvs_commit(handle);
+        nvs_close(handle);
+    }
+
+    std::size_t EnumerationCache::serialized_size(const Entry &entry)
+    {
+        std::size_t size = 2 + 6 + 1 + entry.key.serial.size() + 6 + 1;
+        for (const auto &intf : entry.interfaces)
+        {
+            size += 6 + intf.endpoints.size() * 5;
+        }
+        size += 1;
+        for (const auto &record : entry.descriptors)
+        {
+            size += 8 + record.data.size();
+        }
+        return size;
+    }
+
+    std::vector<std::uint8_t> EnumerationCache::serialize(const Entry &entry)
+    {
+        std::vector<std::uint8_t> blob;
+        blob.reserve(serialized_size(entry));
+        Writer w(blob);
+        w.u8('E');
+        w.u8(FORMAT_VERSION);
+        w.u16(entry.key.vendor_id);
+        w.u16(entry.key.product_id);
+        w.u16(entry.key.bcd_device);
+        w.u8(static_cast<std::uint8_t>(entry.key.serial.size()));
+        w.bytes(reinterpret_cast<const std::uint8_t *>(entry.key.serial.data()), entry.key.serial.size());
+        w.u32(entry.config_crc);
+        w.u16(entry.config_length);
+
+        w.u8(static_cast<std::uint8_t>(entry.interfaces.size()));
+        for (const auto &intf : entry.interfaces)
+        {
+            w.u8(intf.number);
+            w.u8(intf.alternate_setting);
+            w.u8(intf.interface_class);
+            w.u8(intf.interface_subclass);
+            w.u8(intf.interface_protocol);
+            w.u8(static_cast<std::uint8_t>(intf.endpoints.size()));
+            for (const auto &ep : intf.endpoints)
+            {
+                w.u8(ep.address);
+                w.u8(ep.attributes);
+                w.u16(ep.max_packet_size);
+                w.u8(ep.interval);
+            }
+        }
+
+        w.u8(static_cast<std::uint8_t>(entry.descriptors.size()));
+        for (const auto &record : entry.descriptors)
+        {
+            w.u8(record.request_type);
+            w.u16(record.value);
+            w.u16(record.index);
+            w.u8(record.complete ? 1 : 0);
+            w.u16(static_cast<std::uint16_t>(record.data.size()));
+            w.bytes(record.data.data(), record.data.size());
+        }
+        return blob;
+    }
+
+    std::shared_ptr<EnumerationCache::Entry> EnumerationCache::deserialize(const std::vector<std::uint8_t> &blob)
+    {
+        Reader r(blob);
+        auto entry = std::make_shared<Entry>();
+        std::uint8_t magic, version, serial_length, interface_count, descriptor_count;
+        if (!r.u8(magic) || !r.u8(version) || magic != 'E' || version != FORMAT_VERSION)
+        {
+            return nullptr;
+        }
+        if (!r.u16(entry->key.vendor_id) || !r.u16(entry->key.product_id) || !r.u16(entry->key.bcd_device) ||
+            !r.u8(serial_length))
+        {
+            return nullptr;
+        }
+        entry->key.serial.resize(serial_length);
+        if (!r.bytes(reinterpret_cast<std::uint8_t *>(entry->key.serial.data()), serial_length) ||
+            !r.u32(entry->config_crc) || !r.u16(entry->config_length) || !r.u8(interface_count))
+        {
+            return nullptr;
+        }
+
+        for (std::uint8_t i = 0; i < interface_count; i++)
+        {
+            InterfaceLayout intf{};
+            std::uint8_t endpoint_count;
+            if (!r.u8(intf.number) || !r.u8(intf.alternate_setting) || !r.u8(intf.interface_class) ||
+                !r.u8(intf.interface_subclass) || !r.u8(intf.interface_protocol) || !r.u8(endpoint_count))
+            {
+                return nullptr;
+            }
+            for (std::uint8_t j = 0; j < endpoint_count; j++)
+            {
+                UsbEndpoint ep{};
+                if (!r.u8(ep.address) || !r.u8(ep.attributes) || !r.u16(ep.max_packet_size) || !r.u8(ep.interval))
+                {
+                    return nullptr;
+                }
+                intf.endpoints.push_back(ep);
+            }
+            entry->interfaces.push_back(std::move(intf));
+        }
+
+        if (!r.u8(descriptor_count))
+        {
+            return nullptr;
+        }
+        for (std::uint8_t i = 0; i < descriptor_count; i++)
+        {
+            DescriptorRecord record{};
+            std::uint8_t complete;
+            std::uint16_t length;
+            if (!r.u8(record.request_type) || !r.u16(record.value) || !r.u16(record.index) || !r.u8(complete) ||
+                !r.u16(length))
+            {
+                return nullptr;
+            }
+            record.complete = complete != 0;
+            record.data.resize(length);
+            if (!r.bytes(record.data.data(), length))
+            {
+                return nullptr;
+            }
+            entry->descriptors.push_back(std::move(record));
+        }
+        return entry;
+    }
+
+} // namespace usbipdcpp
@@ -8,6 +8,8 @@
 #include "SetupPacket.h"
 #include "constant.h"
 #include "endpoint.h"
+#include "BotProtocol.h"
+#include "TaskTopology.h"
 
 #ifndef USB_SETUP_PACKET_SIZE
 #define USB_SETUP_PACKET_SIZE 8
@@ -23,17 +25,94 @@ usbipdcpp::Esp32DeviceHandler::Esp32DeviceHandler(UsbDevice &handle_device, usb_
 
 usbipdcpp::Esp32DeviceHandler::~Esp32DeviceHandler()
 {
+    if (bot_flush_thread_.joinable())
+    {
+        {
+            std::lock_guard lock(bot_mutex_);
+            bot_flush_thread_stop_ = true;
+        }
+        bot_flush_cv_.notify_all();
+        bot_flush_thread_.join();
+    }
 }
 
 void usbipdcpp::Esp32DeviceHandler::on_new_connection(Session &current_session, error_code &ec)
 {
     session = &current_session;
+    reset_bot_state();
+    if (bot_read_cache_)
+    {
+        // 断开期间设备可能被拔插或更换介质，不复用上一次会话的缓存
+        bot_read_cache_->clear();
+    }
+    start_completion_worker();
+    for (const auto &latency : interrupt_latency_)
+    {
+        // 不把两次会话之间的空档算进客户端间隔
+        latency->last_completion.store(0, std::memory_order_relaxed);
+    }
+    if (write_behind_)
+    {
+        write_behind_->reset_errors();
+    }
+    static std::atomic_bool first_import_logged = false;
+    if (!first_import_logged.exchange(true))
+    {
+        ESP_LOGI(TAG, "上电后第一次导入设备 %s: %lld ms", handle_device.busid.c_str(), esp_timer_get_time() / 1000);
+    }
     all_transfer_should_stop = false;
 }
 
+void usbipdcpp::Esp32DeviceHandler::start_completion_worker()
+{
+    if (!completion_worker_)
+    {
+        completion_worker_ = std::make_unique<CompletionWorker>(process_completion, 64);
+    }
+}
+
+void usbipdcpp::Esp32DeviceHandler::submit_ret_submit(UsbIpResponse::UsbIpRetSubmit &&response)
+{
+    if (throughput_probe_.load(std::memory_order_acquire))
+    {
+        std::shared_lock lock(throughput_probe_mutex_);
+        if (auto *probe = throughput_probe_.load(std::memory_order_acquire))
+        {
+            probe->on_response(response);
+            return;
+        }
+    }
+    if (auto *current = session.load())
+    {
+        current->submit_ret_submit(std::move(response));
+        return;
+    }
+    SPDLOG_WARN("没有会话，丢弃 seq={} 的应答", response.header.seqnum);
+}
+
+std::tuple<bool, std::uint32_t> usbipdcpp::Esp32DeviceHandler::get_unlink_seqnum(std::uint32_t seqnum)
+{
+    auto *current = session.load();
+    if (!current || throughput_probe_.load(std::memory_order_acquire))
+    {
+        // 吞吐测试不会 unlink
+        return {false, 0};
+    }
+    return current->get_unlink_seqnum(seqnum);
+}
+
 void usbipdcpp::Esp32DeviceHandler::on_disconnection(error_code &ec)
 {
+    if (write_behind_ && has_device && !write_behind_->wait_drained(std::chrono::milliseconds(1000)))
+    {
+        // 这些写入已经向客户端报告成功，取消前尽量等它们完成
+        SPDLOG_WARN("设备 {} 仍有提前应答的写入未完成，将被取消", handle_device.busid);
+    }
     all_transfer_should_stop = true;
+    for (const auto &stream : serial_streams_)
+    {
+        stream->stop();
+    }
     if (!has_device)
     {
         SPDLOG_WARN("没有设备，不需要停止传输");
@@ -43,9 +122,306 @@ void usbipdcpp::Esp32DeviceHandler::on_disconnection(error_code &ec)
     cancel_all_transfer();
     spdlog::info("成功取消所有传输");
     transfer_tracker_.clear();
+    reset_bot_state();
+    if (probe_prefetcher_)
+    {
+        probe_prefetcher_->discard();
+    }
+    if (bot_write_combiner_)
+    {
+        // 这些写入已经向主机报告成功，断开前必须落盘。只有下发线程和设备通信，这里交给它并等待完成
+        std::unique_lock lock(bot_mutex_);
+        bot_flush_requested_ = true;
+        bot_flush_cv_.notify_all();
+        bot_flush_cv_.wait(lock, [this]()
+                           { return !bot_flush_requested_ && !bot_flushing_; });
+        bot_pending_error_.reset();
+    }
     session = nullptr;
 }
 
+void usbipdcpp::Esp32DeviceHandler::apply_policy(const Esp32DevicePolicy &policy)
+{
+    policy_ = policy;
+
+    const UsbInterface *bot_interface = nullptr;
+    for (std::size_t i = 0; i < handle_device.interfaces.size(); i++)
+    {
+        const auto &intf = handle_device.interfaces[i];
+        if (bot::is_bot_interface(intf.interface_class, intf.interface_subclass, intf.interface_protocol))
+        {
+            bot_interface = &intf;
+            // bind_host_device 按接口号顺序填充 interfaces
+            bot_interface_number_ = static_cast<std::uint8_t>(i);
+            break;
+        }
+    }
+
+    if (policy.bot_read_cache && bot_interface && policy.bot_read_cache_bytes > 0)
+    {
+        bot_read_cache_ = std::make_unique<BotReadCache>(policy.bot_read_cache_bytes);
+        SPDLOG_INFO("设备 {} 启用BOT读缓存，容量 {} 字节", handle_device.busid, policy.bot_read_cache_bytes);
+    }
+    else
+    {
+        bot_read_cache_.reset();
+    }
+
+    if (policy.bot_write_combine && bot_interface && policy.bot_write_combine_bytes > 0 && !bot_write_combiner_)
+    {
+        for (const auto &ep : bot_interface->endpoints)
+        {
+            if (ep.is_in())
+            {
+                bot_in_ep_ = ep.address;
+                bot_in_max_packet_size_ = ep.max_packet_size ? ep.max_packet_size : 64;
+            }
+            else
+            {
+                bot_out_ep_ = ep.address;
+            }
+        }
+
+        auto combiner = std::make_unique<BotWriteCombiner>(policy.bot_write_combine_bytes);
+        if (combiner->usable() && bot_in_ep_ && bot_out_ep_)
+        {
+            bot_write_combiner_ = std::move(combiner);
+            SPDLOG_INFO("设备 {} 启用BOT写合并，缓冲 {} 字节，超时 {} ms", handle_device.busid,
+                        policy.bot_write_combine_bytes, policy.bot_write_combine_flush_ms);
+
+            TaskTopology::ScopedThreadConfig thread_config(TaskRole::BotFlush);
+            bot_flush_thread_ = std::thread([this]()
+                                            { bot_flush_thread_main(); });
+        }
+    }
+
+    if (policy.probe_prefetch && !probe_prefetcher_)
+    {
+        const UsbEndpoint *command_ep = nullptr;
+        const UsbEndpoint *response_ep = nullptr;
+        for (const auto &intf : handle_device.interfaces)
+        {
+            if (intf.interface_class != 0xFF)
+            {
+                continue;
+            }
+            for (const auto &ep : intf.endpoints)
+            {
+                if ((ep.attributes & 0x03) != static_cast<std::uint8_t>(EndpointAttributes::Bulk))
+                {
+                    continue;
+                }
+                if (ep.is_in() && !response_ep &&
+                    (policy.probe_response_ep == 0 || policy.probe_response_ep == ep.address))
+                {
+                    response_ep = &ep;
+                }
+                else if (!ep.is_in() && !command_ep &&
+                         (policy.probe_command_ep == 0 || policy.probe_command_ep == ep.address))
+                {
+                    command_ep = &ep;
+                }
+            }
+        }
+
+        if (command_ep && response_ep)
+        {
+            auto length = policy.probe_prefetch_length ? policy.probe_prefetch_length
+                                                       : 16u * response_ep->max_packet_size;
+            probe_prefetcher_ = std::make_unique<ProbePrefetcher>(
+                *this, command_ep->address, response_ep->address, response_ep->max_packet_size, length,
+                policy.probe_prefetch_expire_ms);
+            SPDLOG_INFO("设备 {} 启用调试器预取，命令端点 {:02x}，响应端点 {:02x}，预取长度 {}",
+                        handle_device.busid, command_ep->address, response_ep->address, length);
+        }
+        else
+        {
+            SPDLOG_WARN("设备 {} 没有找到调试器的命令/响应端点，不启用预取", handle_device.busid);
+        }
+    }
+
+    if (policy.serial_stream && serial_streams_.empty())
+    {
+        for (const auto &intf : handle_device.interfaces)
+        {
+            // 0x0A: CDC Data
+            if (intf.interface_class != 0x0A && !(policy.serial_stream_vendor && intf.interface_class == 0xFF))
+            {
+                continue;
+            }
+            for (const auto &ep : intf.endpoints)
+            {
+                if (!ep.is_in() ||
+                    (ep.attributes & 0x03) != static_cast<std::uint8_t>(EndpointAttributes::Bulk) ||
+                    find_serial_stream(ep.address))
+                {
+                    continue;
+                }
+                auto stream = std::make_unique<SerialRxStream>(
+                    *this, ep.address, ep.max_packet_size, policy.serial_stream_transfers,
+                    policy.serial_stream_transfer_size, policy.serial_stream_ring_bytes,
+                    policy.serial_stream_packet_framing);
+                if (stream->usable())
+                {
+                    SPDLOG_INFO("设备 {} 端点 {:02x} 启用串口连续接收，缓冲 {} 字节", handle_device.busid, ep.address,
+                                policy.serial_stream_ring_bytes);
+                    serial_streams_.push_back(std::move(stream));
+                }
+            }
+        }
+    }
+
+    if (policy.interrupt_interval_ms != 0)
+    {
+        interval_override_ = std::make_unique<InterruptIntervalOverride>(policy.interrupt_interval_ms,
+                                                                         policy.interrupt_interval_hid_only);
+        interval_override_->apply(handle_device.interfaces);
+        SPDLOG_INFO("设备 {} 导出的中断端点 bInterval 改为 {} ms", handle_device.busid, policy.interrupt_interval_ms);
+    }
+    else
+    {
+        interval_override_.reset();
+    }
+
+    if (policy.bulk_out_write_behind_mask != 0 && !write_behind_)
+    {
+        write_behind_ = std::make_unique<BulkOutWriteBehind>(policy.bulk_out_write_behind_mask,
+                                                             policy.bulk_out_write_behind_depth);
+        SPDLOG_INFO("设备 {} 启用bulk OUT提前应答，端点掩码 {:04x}，深度 {}", handle_device.busid,
+                    policy.bulk_out_write_behind_mask, policy.bulk_out_write_behind_depth);
+    }
+
+    // 不论是否改写都统计，便于比较改写前后的延迟
+    interrupt_latency_.clear();
+    for (const auto &intf : handle_device.interfaces)
+    {
+        for (const auto &ep : intf.endpoints)
+        {
+            if (ep.is_in() && (ep.attributes & 0x03) == 0x03)
+            {
+                auto latency = std::make_unique<InterruptEndpointLatency>();
+                latency->address = ep.address;
+                latency->exported_interval = ep.interval;
+                interrupt_latency_.push_back(std::move(latency));
+            }
+        }
+    }
+}
+
+usbipdcpp::SerialRxStream *usbipdcpp::Esp32DeviceHandler::find_serial_stream(std::uint8_t ep_address) const
+{
+    for (const auto &stream : serial_streams_)
+    {
+        if (stream->ep_address() == ep_address)
+        {
+            return stream.get();
+        }
+    }
+    return nullptr;
+}
+
+std::vector<std::pair<std::uint8_t, usbipdcpp::SerialRxStream::Stats>>
+usbipdcpp::Esp32DeviceHandler::serial_stream_stats() const
+{
+    std::vector<std::pair<std::uint8_t, SerialRxStream::Stats>> result;
+    for (const auto &stream : serial_streams_)
+    {
+        result.emplace_back(stream->ep_address(), stream->stats());
+    }
+    return result;
+}
+
+usbipdcpp::Esp32DeviceHandler::InterruptEndpointLatency *
+usbipdcpp::Esp32DeviceHandler::find_interrupt_latency(std::uint8_t ep_address) const
+{
+    for (const auto &latency : interrupt_latency_)
+    {
+        if (latency->address == ep_address)
+        {
+            return latency.get();
+        }
+    }
+    return nullptr;
+}
+
+std::vector<usbipdcpp::Esp32DeviceHandler::InterruptLatencyStats>
+usbipdcpp::Esp32DeviceHandler::interrupt_latency_stats() const
+{
+    std::vector<InterruptLatencyStats> result;
+    for (const auto &latency : interrupt_latency_)
+    {
+        result.push_back({
+            .address = latency->address,
+            .exported_interval = latency->exported_interval,
+            .urbs = latency->turnaround.count(),
+            .client_gap_avg_us = latency->client_gap.average_us(),
+            .client_gap_p50_us = latency->client_gap.percentile_us(50),
+            .client_gap_p99_us = latency->client_gap.percentile_us(99),
+            .turnaround_p50_us = latency->turnaround.percentile_us(50),
+            .turnaround_p99_us = latency->turnaround.percentile_us(99),
+        });
+    }
+    return result;
+}
+
+usbipdcpp::AdaptiveTransferSizer::Stats usbipdcpp::Esp32DeviceHandler::transfer_sizer_stats() const
+{
+    return transfer_sizer_.stats();
+}
+
+std::optional<usbipdcpp::BulkOutWriteBehind::Stats> usbipdcpp::Esp32DeviceHandler::write_behind_stats() const
+{
+    if (!write_behind_)
+    {
+        return std::nullopt;
+    }
+    return write_behind_->stats();
+}
+
+void usbipdcpp::Esp32DeviceHandler::attach_enumeration_cache(EnumerationCache &cache,
+                                                             std::shared_ptr<EnumerationCache::Entry> entry)
+{
+    enumeration_cache_ = &cache;
+    enumeration_entry_ = std::move(entry);
+}
+
+std::optional<usbipdcpp::BotReadCache::Stats> usbipdcpp::Esp32DeviceHandler::bot_read_cache_stats() const
+{
+    if (!bot_read_cache_)
+    {
+        return std::nullopt;
+    }
+    return bot_read_cache_->stats();
+}
+
+std::optional<usbipdcpp::CompletionWorker::Stats> usbipdcpp::Esp32DeviceHandler::completion_stats() const
+{
+    if (!completion_worker_)
+    {
+        return std::nullopt;
+    }
+    return completion_worker_->stats();
+}
+
+std::optional<usbipdcpp::ProbePrefetcher::Stats> usbipdcpp::Esp32DeviceHandler::probe_prefetch_stats() const
+{
+    if (!probe_prefetcher_)
+    {
+        return std::nullopt;
+    }
+    return probe_prefetcher_->stats();
+}
+
+std::optional<usbipdcpp::BotWriteCombiner::Stats> usbipdcpp::Esp32DeviceHandler::bot_write_combine_stats()
+{
+    if (!bot_write_combiner_)
+    {
+        return std::nullopt;
+    }
+    std::lock_guard lock(bot_mutex_);
+    return bot_write_combiner_->stats();
+}
+
 void usbipdcpp::Esp32DeviceHandler::handle_unlink_seqnum(std::uint32_t seqnum)
 {
     if (!has_device)
@@ -53,6 +429,14 @@ void usbipdcpp::Esp32DeviceHandler::handle_unlink_seqnum(std::uint32_t seqnum)
         // 设备已经没了不可以再取消传输
         return;
     }
+    for (const auto &stream : serial_streams_)
+    {
+        // 串口接收端点上等待数据的 URB 没有对应的 USB 传输，直接应答
+        if (stream->unlink(seqnum))
+        {
+            return;
+        }
+    }
     cancel_all_transfer();
 }
 void usbipdcpp::Esp32DeviceHandler::handle_control_urb(
@@ -74,6 +458,31 @@ void usbipdcpp::Esp32DeviceHandler::handle_control_urb(
                  setup_packet.request_type, setup_packet.request,
                  setup_packet.value, setup_packet.index, setup_packet.length);
 
+    // Bulk-Only Mass Storage Reset：主机放弃当前命令，BOT 状态回到等待 CBW
+    if (bot_snoop_enabled() && (setup_packet.request_type & 0x60) == 0x20 &&
+        setup_packet.request == bot::REQUEST_BULK_ONLY_RESET)
+    {
+        reset_bot_state();
+    }
+
+    bool learn_descriptor = false;
+    if (enumeration_entry_ && EnumerationCache::is_cacheable_request(setup_packet.request_type, setup_packet.request))
+    {
+        if (auto cached = enumeration_cache_->find_descriptor(*enumeration_entry_, setup_packet.request_type,
+                                                              setup_packet.value, setup_packet.index,
+                                                              setup_packet.length))
+        {
+            if (interval_override_ && InterruptIntervalOverride::is_config_descriptor_request(setup_packet))
+            {
+                interval_override_->rewrite(cached->data(), cached->size());
+            }
+            submit_ret_submit(
+                UsbIpResponse::UsbIpRetSubmit::create_ret_submit_ok_with_no_iso(seqnum, *cached));
+            return;
+        }
+        learn_descriptor = true;
+    }
+
     usb_transfer_t *transfer = nullptr;
     auto err = usb_host_transfer_alloc(USB_SETUP_PACKET_SIZE + transfer_buffer_length, 0, &transfer);
     if (err != ESP_OK)
@@ -110,7 +519,9 @@ void usbipdcpp::Esp32DeviceHandler::handle_control_urb(
         .transfer_type = USB_TRANSFER_TYPE_CTRL,
         .is_out = setup_packet.is_out(),
         .original_transfer_buffer_length = transfer_buffer_length,
-        .counted_in_concurrent = false};
+        .counted_in_concurrent = false,
+        .learn_descriptor = learn_descriptor,
+        .setup = setup_packet};
 
     if (!callback_args)
     {
@@ -132,7 +543,7 @@ void usbipdcpp::Esp32DeviceHandler::handle_control_urb(
         SPDLOG_ERROR("无法注册转移，并发数超过限制");
         usb_host_transfer_free(transfer);
         delete callback_args;
-        session.load()->submit_ret_submit(
+        submit_ret_submit(
             UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
         return;
     }
@@ -145,7 +556,7 @@ void usbipdcpp::Esp32DeviceHandler::handle_control_urb(
         usb_host_transfer_free(transfer);
         delete callback_args;
 
-        session.load()->submit_ret_submit(
+        submit_ret_submit(
             UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
     }
 }
@@ -171,12 +582,51 @@ void usbipdcpp::Esp32DeviceHandler::handle_bulk_transfer(
     }
     check_and_clean_memory();
 
+    if (ep.is_in())
+    {
+        if (auto stream = find_serial_stream(ep.address))
+        {
+            stream->claim(seqnum, transfer_buffer_length);
+            return;
+        }
+    }
+
+    const bool probe_response = probe_prefetcher_ && ep.is_in() && ep.address == probe_prefetcher_->response_ep();
+    if (probe_response && probe_prefetcher_->claim(seqnum, transfer_buffer_length))
+    {
+        return;
+    }
+
+    BotTransferHook bot_hook{};
+    if (bot_snoop_enabled() &&
+        bot::is_bot_interface(interface.interface_class, interface.interface_subclass, interface.interface_protocol))
+    {
+        if (bot_intercept_bulk(seqnum, ep, interface, transfer_flags, transfer_buffer_length, out_data, bot_hook))
+        {
+            return;
+        }
+    }
+
     // 使用优化的transfer_tracker_管理并发
     // transfer_tracker_内部自动跟踪并发数，无需手动递增/递减
     bool is_out = !ep.is_in();
 
-    // CONFIG_USB_HOST_BULK_TRANSFER_MAX_SIZE 默认可能较小，此处为安全回退
-    constexpr uint32_t MAX_TRANSFER_SIZE = 64 * 1024;
+    // IN 只在超过单个 transfer 的上限时拆分，内存和网络状况只影响分配大小
+    constexpr uint32_t MAX_TRANSFER_SIZE = AdaptiveTransferSizer::MAX_TRANSFER_SIZE;
+
+    bool write_behind = false;
+    if (is_out && write_behind_ && write_behind_->enabled(ep.address))
+    {
+        if (auto status = write_behind_->take_error(ep.address))
+        {
+            SPDLOG_WARN("端点 {:02x} 上提前应答的写入失败，在 seq={} 上报告", ep.address, seqnum);
+            submit_ret_submit(
+                UsbIpResponse::UsbIpRetSubmit::create_ret_submit_with_status_and_no_data(seqnum, status));
+            return;
+        }
+        // 超过单个 transfer 上限的写入不会完整下发，不能提前报告成功
+        write_behind = transfer_buffer_length <= MAX_TRANSFER_SIZE && write_behind_->try_acquire(ep.address);
+    }
 
     // 请求长度不超过允许的最大值时直接异步提交一个 transfer
     uint32_t adjusted_length = std::min(transfer_buffer_length, MAX_TRANSFER_SIZE);
@@ -191,6 +641,12 @@ void usbipdcpp::Esp32DeviceHandler::handle_bulk_transfer(
         }
     }
 
+    // 始终按请求长度分配：分配被填满后再补读会和同一端点上排队的 URB 交错
+    if (!is_out && transfer_buffer_length <= MAX_TRANSFER_SIZE)
+    {
+        transfer_sizer_.on_in_submitted(ep.address, adjusted_length, ep.max_packet_size);
+    }
+
     // 如果传输请求大于单次最大值，则仍然尽量异步并行提交多个 transfer，此路径应当很少触发
     if (!is_out && transfer_buffer_length > MAX_TRANSFER_SIZE)
     {
@@ -204,7 +660,7 @@ void usbipdcpp::Esp32DeviceHandler::handle_bulk_transfer(
         catch (...)
         {
             SPDLOG_ERROR("无法为aggregated分配内存, size=%u, heap=%d", transfer_buffer_length, esp_get_free_heap_size());
-            session.load()->submit_ret_submit(
+            submit_ret_submit(
                 UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
             return;
         }
@@ -220,6 +676,7 @@ void usbipdcpp::Esp32DeviceHandler::handle_bulk_transfer(
             uint32_t seqnum;
             size_t total_chunks;
             size_t original_length;
+            BotTransferHook bot_hook;
         };
 
         size_t total_chunks = (transfer_buffer_length + MAX_TRANSFER_SIZE - 1) / MAX_TRANSFER_SIZE;
@@ -242,13 +699,13 @@ void usbipdcpp::Esp32DeviceHandler::handle_bulk_transfer(
             if (aerr != ESP_OK)
             {
                 SPDLOG_ERROR("chunk transfer alloc 失败: {}", esp_err_to_name(aerr));
-                session.load()->submit_ret_submit(
+                submit_ret_submit(
                     UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
                 all_chunks_submitted_successfully = false;
                 break;
             }
 
-            auto ctx = new ChunkContext{this, aggregated, offset, this_len, completed.get(), last_status.get(), seqnum, total_chunks, transfer_buffer_length};
+            auto ctx = new ChunkContext{this, aggregated, offset, this_len, completed.get(), last_status.get(), seqnum, total_chunks, transfer_buffer_length, bot_hook};
 
             chunk_tr->device_handle = native_handle;
             chunk_tr->callback = [](usb_transfer_t *trx)
@@ -259,6 +716,14 @@ void usbipdcpp::Esp32DeviceHandler::handle_bulk_transfer(
                     size_t actual = static_cast<size_t>(trx->actual_num_bytes);
                     size_t to_copy = std::min(actual, ctx->length);
                     memcpy(ctx->agg->data() + ctx->offset, trx->data_buffer, to_copy);
+                    if (ctx->bot_hook.kind != BotTransferHook::Kind::None)
+                    {
+                        // 每个 chunk 各自填充自己那一段
+                        auto hook = ctx->bot_hook;
+                        hook.byte_offset += ctx->offset;
+                        hook.expected_length = static_cast<uint32_t>(ctx->length);
+                        ctx->handler->on_bot_in_complete(hook, trx->data_buffer, to_copy);
+                    }
                 }
                 else
                 {
@@ -271,7 +736,7 @@ void usbipdcpp::Esp32DeviceHandler::handle_bulk_transfer(
                     if (ctx->last_status->load() == USB_TRANSFER_STATUS_COMPLETED)
                     {
                         ctx->agg->resize(ctx->original_length);
-                        ctx->handler->session.load()->submit_ret_submit(
+                        ctx->handler->submit_ret_submit(
                             UsbIpResponse::UsbIpRetSubmit::create_ret_submit(
                                 ctx->seqnum,
                                 static_cast<uint32_t>(UrbStatusType::StatusOK),
@@ -282,7 +747,7 @@ void usbipdcpp::Esp32DeviceHandler::handle_bulk_transfer(
                     }
                     else
                     {
-                        ctx->handler->session.load()->submit_ret_submit(
+                        ctx->handler->submit_ret_submit(
                             UsbIpResponse::UsbIpRetSubmit::create_ret_submit(
                                 ctx->seqnum,
                                 trxstat2error(ctx->last_status->load()),
@@ -309,7 +774,7 @@ void usbipdcpp::Esp32DeviceHandler::handle_bulk_transfer(
             {
                 SPDLOG_ERROR("chunk transfer 提交失败: %s", esp_err_to_name(aerr));
                 usb_host_transfer_free(chunk_tr);
-                session.load()->submit_ret_submit(
+                submit_ret_submit(
                     UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
                 all_chunks_submitted_successfully = false;
                 break;
@@ -332,6 +797,10 @@ void usbipdcpp::Esp32DeviceHandler::handle_bulk_transfer(
     if (err != ESP_OK)
     {
         ESP_LOGE(TAG, "无法申请transfer: %s, 大小: %u", esp_err_to_name(err), adjusted_length);
+        if (write_behind)
+        {
+            write_behind_->release(ep.address);
+        }
         ec = make_error_code(ErrorType::TRANSFER_ERROR);
         return;
     }
@@ -344,12 +813,19 @@ void usbipdcpp::Esp32DeviceHandler::handle_bulk_transfer(
         .original_transfer_buffer_length = transfer_buffer_length,
         .counted_in_concurrent = true,
         .recv_time = (uint64_t)esp_timer_get_time(),
-        .submit_time = 0};
+        .submit_time = 0,
+        .bot_hook = bot_hook,
+        .probe_response = probe_response,
+        .write_behind = write_behind};
 
     if (!callback_args)
     {
         ESP_LOGE(TAG, "无法分配callback_args内存");
         usb_host_transfer_free(transfer);
+        if (write_behind)
+        {
+            write_behind_->release(ep.address);
+        }
         ec = make_error_code(ErrorType::TRANSFER_ERROR);
         return;
     }
@@ -377,13 +853,22 @@ void usbipdcpp::Esp32DeviceHandler::handle_bulk_transfer(
         SPDLOG_ERROR("无法注册转移，并发数超过限制");
         usb_host_transfer_free(transfer);
         delete callback_args;
-        session.load()->submit_ret_submit(
+        if (write_behind)
+        {
+            write_behind_->release(ep.address);
+        }
+        submit_ret_submit(
             UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
         return;
     }
 
     concurrent_transfer_count++;
     callback_args->submit_time = esp_timer_get_time();
+    transfer_sizer_.on_urb_submitted(seqnum);
+    if (probe_response)
+    {
+        probe_prefetcher_->on_client_in_submitted();
+    }
 
     err = usb_host_transfer_submit(transfer);
     if (err != ESP_OK)
@@ -393,36 +878,180 @@ void usbipdcpp::Esp32DeviceHandler::handle_bulk_transfer(
         usb_host_transfer_free(transfer);
         delete callback_args;
         concurrent_transfer_count--;
+        if (probe_response)
+        {
+            probe_prefetcher_->on_client_in_completed();
+        }
+        if (write_behind)
+        {
+            write_behind_->release(ep.address);
+        }
 
-        session.load()->submit_ret_submit(
+        submit_ret_submit(
             UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
+        return;
+    }
+
+    if (write_behind)
+    {
+        // 数据已经交给 USB 主机，不等传输完成就应答，之后的失败由 take_error 报告
+        auto response = UsbIpResponse::UsbIpRetSubmit::create_ret_submit_ok_without_data(seqnum);
+        response.actual_length = transfer_buffer_length;
+        submit_ret_submit(std::move(response));
     }
 }
 
 void usbipdcpp::Esp32DeviceHandler::check_and_clean_memory()
 {
+    std::unique_lock lock(memory_check_mutex_, std::try_to_lock);
+    if (!lock.owns_lock())
+    {
+        return;
+    }
     auto now = std::chrono::steady_clock::now();
     if (now - last_memory_check > std::chrono::seconds(30))
     {
+        auto elapsed_us = std::chrono::duration_cast<std::chrono::microseconds>(now - last_memory_check).count();
         last_memory_check = now;
 
+        if (probe_prefetcher_)
+        {
+            probe_prefetcher_->expire_pending();
+        }
+
         int free_heap = esp_get_free_heap_size();
         ESP_LOGI(TAG, "内存状态: 空闲堆=%d, 并发传输=%zu", free_heap, concurrent_transfer_count.load());
 
-        // 如果内存太低，强制清理
-        if (free_heap < 10000)
-        { // 10KB阈值
-            ESP_LOGW(TAG, "内存不足，强制清理");
-            cancel_all_transfer();
-
-            // 清理所有当前的转移
-            transfer_tracker_.clear();
-
-            // 强制垃圾回收
-            // heap_caps_print_heap_info(MALLOC_CAP_DEFAULT);
+        if (auto stats = completion_stats())
+        {
+            auto busy_us = stats->busy_us - last_completion_busy_us_;
+            last_completion_busy_us_ = stats->busy_us;
+            ESP_LOGI(TAG, "设备 %s 完成处理: CPU=%.2f%% (%llu us), 传输=%llu, 溢出=%llu, 最大排队=%llu us, 队列峰值=%zu",
+                     handle_device.busid.c_str(),
+                     elapsed_us > 0 ? static_cast<double>(busy_us) * 100.0 / static_cast<double>(elapsed_us) : 0.0,
+                     static_cast<unsigned long long>(busy_us),
+                     static_cast<unsigned long long>(stats->completions),
+                     static_cast<unsigned long long>(stats->overflowed),
+                     static_cast<unsigned long long>(stats->max_queue_delay_us),
+                     stats->peak_depth);
         }
-    }
-}
+
+        {
+            auto stats = transfer_sizer_.stats();
+            ESP_LOGI(TAG, "bulk IN 分配: 超出实际长度=%llu/%llu, 可节省=%llu字节, 建议请求大小=%lu",
+                     static_cast<unsigned long long>(stats.oversized),
+                     static_cast<unsigned long long>(stats.in_transfers),
+                     static_cast<unsigned long long>(stats.bytes_requested - stats.bytes_learned),
+                     static_cast<unsigned long>(stats.suggested_request_size));
+            for (const auto &ep : transfer_sizer_.endpoint_stats())
+            {
+                ESP_LOGI(TAG, "  端点 %02x 实际最长 %lu 字节", ep.address, static_cast<unsigned long>(ep.learned_size));
+            }
+        }
+
+        for (const auto &stats : interrupt_latency_stats())
+        {
+            if (stats.urbs == 0)
+            {
+                continue;
+            }
+            ESP_LOGI(TAG, "中断 IN %02x (bInterval=%u): URB=%llu, 客户端间隔 平均=%llu p50=%llu p99=%llu us, 设备返回 p50=%llu p99=%llu us",
+                     stats.address, stats.exported_interval,
+                     static_cast<unsigned long long>(stats.urbs),
+                     static_cast<unsigned long long>(stats.client_gap_avg_us),
+                     static_cast<unsigned long long>(stats.client_gap_p50_us),
+                     static_cast<unsigned long long>(stats.client_gap_p99_us),
+                     static_cast<unsigned long long>(stats.turnaround_p50_us),
+                     static_cast<unsigned long long>(stats.turnaround_p99_us));
+        }
+
+        if (bot_read_cache_)
+        {
+            auto stats = bot_read_cache_->stats();
+            ESP_LOGI(TAG, "BOT读缓存: 命中率=%.1f%% (命中=%llu, 未命中=%llu), 节省=%llu字节, 已缓存=%zu/%zu块, 淘汰=%llu, 作废=%llu",
+                     stats.hit_ratio() * 100.0,
+                     static_cast<unsigned long long>(stats.hits),
+                     static_cast<unsigned long long>(stats.misses),
+                     static_cast<unsigned long long>(stats.bytes_saved),
+                     stats.cached_blocks, stats.capacity_blocks,
+                     static_cast<unsigned long long>(stats.evictions),
+                     static_cast<unsigned long long>(stats.invalidations));
+        }
+
+        if (auto stats = bot_write_combine_stats())
+        {
+            ESP_LOGI(TAG, "BOT写合并: 合并命令=%llu, 下发=%llu (平均每次%.1f条), 字节=%llu, 失败=%llu",
+                     static_cast<unsigned long long>(stats->commands_combined),
+                     static_cast<unsigned long long>(stats->flushes),
+                     stats->commands_per_flush(),
+                     static_cast<unsigned long long>(stats->bytes_flushed),
+                     static_cast<unsigned long long>(stats->flush_errors));
+        }
+
+        if (auto stats = probe_prefetch_stats())
+        {
+            ESP_LOGI(TAG, "调试器预取: 命中率=%.1f%% (命中=%llu, 迟到命中=%llu, 未命中=%llu), 预取=%llu, 过期=%llu, 补读=%llu, 拆分=%llu",
+                     stats->hit_ratio() * 100.0,
+                     static_cast<unsigned long long>(stats->hits),
+                     static_cast<unsigned long long>(stats->late_hits),
+                     static_cast<unsigned long long>(stats->misses),
+                     static_cast<unsigned long long>(stats->armed),
+                     static_cast<unsigned long long>(stats->expired),
+                     static_cast<unsigned long long>(stats->continuations),
+                     static_cast<unsigned long long>(stats->splits));
+        }
+
+        if (auto stats = write_behind_stats())
+        {
+            ESP_LOGI(TAG, "bulk OUT提前应答: 提前应答=%llu, 队列满=%llu, 之后失败=%llu, 已报告=%llu",
+                     static_cast<unsigned long long>(stats->early_acks),
+                     static_cast<unsigned long long>(stats->throttled),
+                     static_cast<unsigned long long>(stats->deferred_errors),
+                     static_cast<unsigned long long>(stats->reported_errors));
+        }
+
+        for (const auto &[ep_address, stats] : serial_stream_stats())
+        {
+            ESP_LOGI(TAG, "串口接收 %02x: 收到=%llu, 交付=%llu, 溢出=%llu字节/%llu次, 立即应答=%llu, 等待=%llu, 峰值=%zu/%zu",
+                     ep_address,
+                     static_cast<unsigned long long>(stats.bytes_received),
+                     static_cast<unsigned long long>(stats.bytes_delivered),
+                     static_cast<unsigned long long>(stats.overflow_bytes),
+                     static_cast<unsigned long long>(stats.overflow_events),
+                     static_cast<unsigned long long>(stats.immediate_urbs),
+                     static_cast<unsigned long long>(stats.waited_urbs),
+                     stats.peak_fill, stats.capacity);
+        }
+
+        if (enumeration_entry_)
+        {
+            auto stats = enumeration_cache_->stats();
+            ESP_LOGI(TAG, "枚举缓存: 命中=%llu, 未命中=%llu, 应答描述符=%llu (本设备%zu), 学习=%llu, 校验=%llu/变化%llu, 写入=%llu/失败%llu",
+                     static_cast<unsigned long long>(stats.hits),
+                     static_cast<unsigned long long>(stats.misses),
+                     static_cast<unsigned long long>(stats.descriptors_served),
+                     enumeration_entry_->served,
+                     static_cast<unsigned long long>(stats.descriptors_learned),
+                     static_cast<unsigned long long>(stats.revalidated),
+                     static_cast<unsigned long long>(stats.revalidation_changes),
+                     static_cast<unsigned long long>(stats.persist_writes),
+                     static_cast<unsigned long long>(stats.persist_errors));
+        }
+
+        // 如果内存太低，强制清理
+        if (free_heap < 10000)
+        { // 10KB阈值
+            ESP_LOGW(TAG, "内存不足，强制清理");
+            cancel_all_transfer();
+
+            // 清理所有当前的转移
+            transfer_tracker_.clear();
+
+            // 强制垃圾回收
+            // heap_caps_print_heap_info(MALLOC_CAP_DEFAULT);
+        }
+    }
+}
 
 void usbipdcpp::Esp32DeviceHandler::handle_interrupt_transfer(std::uint32_t seqnum,
                                                               const UsbEndpoint &ep,
@@ -438,7 +1067,21 @@ void usbipdcpp::Esp32DeviceHandler::handle_interrupt_transfer(std::uint32_t seqn
         return;
     }
 
+    check_and_clean_memory();
+
     bool is_out = !ep.is_in();
+    auto recv_time = esp_timer_get_time();
+    if (!is_out)
+    {
+        if (auto latency = find_interrupt_latency(ep.address))
+        {
+            auto last_completion = latency->last_completion.exchange(0, std::memory_order_relaxed);
+            if (last_completion != 0)
+            {
+                latency->client_gap.record(static_cast<uint64_t>(recv_time - last_completion));
+            }
+        }
+    }
 
     SPDLOG_DEBUG("中断传输 {}，ep addr: {:02x}", is_out ? "Out" : "In", ep.address);
     usb_transfer_t *transfer = nullptr;
@@ -471,7 +1114,8 @@ void usbipdcpp::Esp32DeviceHandler::handle_interrupt_transfer(std::uint32_t seqn
             .transfer_type = USB_TRANSFER_TYPE_INTR,
             .is_out = is_out,
             .original_transfer_buffer_length = transfer_buffer_length, // 保存原始长度
-            .counted_in_concurrent = false};
+            .counted_in_concurrent = false,
+            .recv_time = static_cast<uint64_t>(recv_time)};
         transfer->device_handle = native_handle;
         transfer->callback = transfer_callback;
         transfer->context = callback_args;
@@ -503,7 +1147,7 @@ error_occurred:
     SPDLOG_ERROR("中断传输失败，{}", esp_err_to_name(err));
     // 不认为是错误，让服务器重置
     //  ec = make_error_code(ErrorType::TRANSFER_ERROR);
-    session.load()->submit_ret_submit(
+    submit_ret_submit(
         UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
 }
 
@@ -587,7 +1231,7 @@ void usbipdcpp::Esp32DeviceHandler::handle_isochronous_transfer(
     return;
 error_occurred:
     SPDLOG_ERROR("同步传输失败，{}", esp_err_to_name(err));
-    session.load()->submit_ret_submit(
+    submit_ret_submit(
         UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
 }
 
@@ -683,6 +1327,107 @@ esp_err_t usbipdcpp::Esp32DeviceHandler::sync_control_transfer(const SetupPacket
     return ESP_OK;
 }
 
+esp_err_t usbipdcpp::Esp32DeviceHandler::sync_control_in(const SetupPacket &setup_packet,
+                                                         std::vector<std::uint8_t> &data)
+{
+    usb_transfer_t *transfer = nullptr;
+    auto err = usb_host_transfer_alloc(USB_SETUP_PACKET_SIZE + setup_packet.length, 0, &transfer);
+    if (err != ESP_OK)
+    {
+        SPDLOG_ERROR("无法申请transfer: {}", esp_err_to_name(err));
+        return err;
+    }
+
+    auto setup_pkt = reinterpret_cast<usb_setup_packet_t *>(transfer->data_buffer);
+    setup_pkt->bmRequestType = setup_packet.request_type;
+    setup_pkt->bRequest = setup_packet.request;
+    setup_pkt->wValue = setup_packet.value;
+    setup_pkt->wIndex = setup_packet.index;
+    setup_pkt->wLength = setup_packet.length;
+
+    std::binary_semaphore semaphore{0};
+
+    transfer->device_handle = native_handle;
+    transfer->callback = [](usb_transfer_t *trx)
+    {
+        static_cast<std::binary_semaphore *>(trx->context)->release();
+    };
+    transfer->context = &semaphore;
+    transfer->bEndpointAddress = setup_packet.calc_ep0_address();
+    transfer->num_bytes = USB_SETUP_PACKET_SIZE + setup_packet.length;
+
+    {
+        std::shared_lock lock(endpoint_cancellation_mutex);
+        err = usb_host_transfer_submit_control(host_client_handle, transfer);
+    }
+    if (err != ESP_OK)
+    {
+        usb_host_transfer_free(transfer);
+        return err;
+    }
+    semaphore.acquire();
+
+    if (transfer->status != USB_TRANSFER_STATUS_COMPLETED || transfer->actual_num_bytes < USB_SETUP_PACKET_SIZE)
+    {
+        err = ESP_FAIL;
+    }
+    else
+    {
+        data.assign(transfer->data_buffer + USB_SETUP_PACKET_SIZE, transfer->data_buffer + transfer->actual_num_bytes);
+    }
+    usb_host_transfer_free(transfer);
+    return err;
+}
+
+esp_err_t usbipdcpp::Esp32DeviceHandler::sync_control_out(const SetupPacket &setup_packet,
+                                                          const std::vector<std::uint8_t> &data)
+{
+    usb_transfer_t *transfer = nullptr;
+    auto err = usb_host_transfer_alloc(USB_SETUP_PACKET_SIZE + data.size(), 0, &transfer);
+    if (err != ESP_OK)
+    {
+        SPDLOG_ERROR("无法申请transfer: {}", esp_err_to_name(err));
+        return err;
+    }
+
+    auto setup_pkt = reinterpret_cast<usb_setup_packet_t *>(transfer->data_buffer);
+    setup_pkt->bmRequestType = setup_packet.request_type;
+    setup_pkt->bRequest = setup_packet.request;
+    setup_pkt->wValue = setup_packet.value;
+    setup_pkt->wIndex = setup_packet.index;
+    setup_pkt->wLength = static_cast<std::uint16_t>(data.size());
+    memcpy(transfer->data_buffer + USB_SETUP_PACKET_SIZE, data.data(), data.size());
+
+    std::binary_semaphore semaphore{0};
+
+    transfer->device_handle = native_handle;
+    transfer->callback = [](usb_transfer_t *trx)
+    {
+        static_cast<std::binary_semaphore *>(trx->context)->release();
+    };
+    transfer->context = &semaphore;
+    transfer->bEndpointAddress = setup_packet.calc_ep0_address();
+    transfer->num_bytes = static_cast<int>(USB_SETUP_PACKET_SIZE + data.size());
+
+    {
+        std::shared_lock lock(endpoint_cancellation_mutex);
+        err = usb_host_transfer_submit_control(host_client_handle, transfer);
+    }
+    if (err != ESP_OK)
+    {
+        usb_host_transfer_free(transfer);
+        return err;
+    }
+    semaphore.acquire();
+
+    if (transfer->status != USB_TRANSFER_STATUS_COMPLETED)
+    {
+        err = ESP_FAIL;
+    }
+    usb_host_transfer_free(transfer);
+    return err;
+}
+
 esp_err_t usbipdcpp::Esp32DeviceHandler::tweak_clear_halt_cmd(const SetupPacket &setup_packet)
 {
     auto target_endp = setup_packet.index;
@@ -852,6 +1597,18 @@ usb_transfer_status_t usbipdcpp::Esp32DeviceHandler::error2trxstat(int e)
 }
 
 void usbipdcpp::Esp32DeviceHandler::transfer_callback(usb_transfer_t *trx)
+{
+    auto callback_arg_ptr = static_cast<esp32_callback_args *>(trx->context);
+    if (callback_arg_ptr && callback_arg_ptr->handler.completion_worker_ &&
+        callback_arg_ptr->handler.completion_worker_->post(trx))
+    {
+        return;
+    }
+    // 没有完成处理线程或者它已经停止
+    process_completion(trx);
+}
+
+void usbipdcpp::Esp32DeviceHandler::process_completion(usb_transfer_t *trx)
 {
     auto callback_arg_ptr = static_cast<esp32_callback_args *>(trx->context);
     if (!callback_arg_ptr)
@@ -865,6 +1622,15 @@ void usbipdcpp::Esp32DeviceHandler::transfer_callback(usb_transfer_t *trx)
 
     if (callback_arg.handler.all_transfer_should_stop)
     {
+        if (callback_arg.probe_response)
+        {
+            callback_arg.handler.probe_prefetcher_->on_client_in_completed();
+        }
+        if (callback_arg.write_behind)
+        {
+            callback_arg.handler.write_behind_->on_complete(trx->bEndpointAddress,
+                                                            static_cast<uint32_t>(trxstat2error(trx->status)));
+        }
         usb_host_transfer_free(trx);
         delete callback_arg_ptr;
         return;
@@ -873,8 +1639,30 @@ void usbipdcpp::Esp32DeviceHandler::transfer_callback(usb_transfer_t *trx)
     // 从追踪器中移除转移
     callback_arg.handler.transfer_tracker_.remove(callback_arg.seqnum);
 
-    auto unlink_found = callback_arg.handler.session.load()->get_unlink_seqnum(callback_arg.seqnum);
+    auto unlink_found = callback_arg.handler.get_unlink_seqnum(callback_arg.seqnum);
     bool should_send_response = true;
+    bool resubmitted = false;
+
+    if (callback_arg.transfer_type == USB_TRANSFER_TYPE_INTR && !callback_arg.is_out &&
+        trx->status == USB_TRANSFER_STATUS_COMPLETED)
+    {
+        if (auto latency = callback_arg.handler.find_interrupt_latency(trx->bEndpointAddress))
+        {
+            auto now = esp_timer_get_time();
+            latency->turnaround.record(static_cast<uint64_t>(now - static_cast<int64_t>(callback_arg.recv_time)));
+            latency->last_completion.store(now, std::memory_order_relaxed);
+        }
+    }
+
+    if (callback_arg.transfer_type == USB_TRANSFER_TYPE_BULK)
+    {
+        auto &sizer = callback_arg.handler.transfer_sizer_;
+        sizer.on_urb_completed(callback_arg.seqnum, static_cast<size_t>(trx->actual_num_bytes));
+        if (!callback_arg.is_out && trx->status == USB_TRANSFER_STATUS_COMPLETED)
+        {
+            sizer.on_in_complete(trx->bEndpointAddress, static_cast<uint32_t>(trx->actual_num_bytes));
+        }
+    }
 
     // 数据偏移：仅控制传输的 IN 方向需要跳过 SETUP 包
     size_t data_offset = 0;
@@ -896,6 +1684,8 @@ void usbipdcpp::Esp32DeviceHandler::transfer_callback(usb_transfer_t *trx)
         if (!std::get<0>(unlink_found))
         {
             trx->status = USB_TRANSFER_STATUS_COMPLETED;
+            // 必须在提交前注册，重新提交的传输可能在另一个线程先完成
+            callback_arg.handler.transfer_tracker_.register_transfer(callback_arg.seqnum, trx, trx->bEndpointAddress);
             esp_err_t err;
             {
                 std::shared_lock lock(callback_arg.handler.endpoint_cancellation_mutex);
@@ -911,12 +1701,23 @@ void usbipdcpp::Esp32DeviceHandler::transfer_callback(usb_transfer_t *trx)
             if (err != ESP_OK)
             {
                 SPDLOG_ERROR("重新提交失败 seq={}: {}", callback_arg.seqnum, esp_err_to_name(err));
-                callback_arg.handler.session.load()->submit_ret_submit(
-                    UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(callback_arg.seqnum));
+                callback_arg.handler.transfer_tracker_.remove(callback_arg.seqnum);
+                if (callback_arg.write_behind)
+                {
+                    // 已经应答过，交给下面记录为待报告的错误
+                    trx->status = USB_TRANSFER_STATUS_CANCELED;
+                }
+                else
+                {
+                    callback_arg.handler.submit_ret_submit(
+                        UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(callback_arg.seqnum));
+                    should_send_response = false;
+                }
             }
             else
             {
                 should_send_response = false;
+                resubmitted = true;
             }
         }
         break;
@@ -939,8 +1740,73 @@ void usbipdcpp::Esp32DeviceHandler::transfer_callback(usb_transfer_t *trx)
         break;
     }
 
+    if (resubmitted)
+    {
+        // trx 和回调参数随重新提交的传输继续使用
+        return;
+    }
+
+    if (auto &prefetcher = callback_arg.handler.probe_prefetcher_)
+    {
+        if (callback_arg.probe_response && should_send_response)
+        {
+            prefetcher->on_client_in_completed();
+        }
+        // 必须在回复 OUT 之前提交预取，客户端收到回复后才会发出读响应的 IN
+        if (callback_arg.is_out && trx->bEndpointAddress == prefetcher->command_ep() &&
+            trx->status == USB_TRANSFER_STATUS_COMPLETED)
+        {
+            prefetcher->on_command_complete();
+        }
+    }
+
+    if (callback_arg.write_behind)
+    {
+        // 客户端早已收到成功的应答，这里只记录失败，由该端点的下一个 URB 报告
+        callback_arg.handler.write_behind_->on_complete(trx->bEndpointAddress,
+                                                        static_cast<uint32_t>(trxstat2error(trx->status)));
+        if (std::get<0>(unlink_found))
+        {
+            // 在客户端看来这个 URB 已经完成，按来不及取消应答
+            callback_arg.handler.session.load()->submit_ret_unlink_and_then_remove_seqnum_unlink(
+                UsbIpResponse::UsbIpRetUnlink::create_ret_unlink(std::get<1>(unlink_found), 0),
+                callback_arg.seqnum);
+        }
+        usb_host_transfer_free(trx);
+        if (callback_arg.counted_in_concurrent)
+        {
+            callback_arg.handler.concurrent_transfer_count--;
+        }
+        delete callback_arg_ptr;
+        return;
+    }
+
     if (should_send_response && !std::get<0>(unlink_found))
     {
+        if (callback_arg.bot_hook.kind != BotTransferHook::Kind::None && trx->status == USB_TRANSFER_STATUS_COMPLETED)
+        {
+            // 必须在 trx 所有权转移给响应之前处理
+            callback_arg.handler.on_bot_in_complete(callback_arg.bot_hook, trx->data_buffer,
+                                                    static_cast<size_t>(trx->actual_num_bytes));
+        }
+        if (callback_arg.learn_descriptor && trx->status == USB_TRANSFER_STATUS_COMPLETED &&
+            trx->actual_num_bytes > static_cast<int>(data_offset))
+        {
+            auto &handler = callback_arg.handler;
+            handler.enumeration_cache_->learn_descriptor(
+                handler.enumeration_entry_, callback_arg.setup.request_type, callback_arg.setup.value,
+                callback_arg.setup.index, callback_arg.setup.length, trx->data_buffer + data_offset,
+                static_cast<size_t>(trx->actual_num_bytes) - data_offset);
+        }
+        if (callback_arg.transfer_type == USB_TRANSFER_TYPE_CTRL && !callback_arg.is_out &&
+            callback_arg.handler.interval_override_ && trx->actual_num_bytes > static_cast<int>(data_offset) &&
+            InterruptIntervalOverride::is_config_descriptor_request(callback_arg.setup))
+        {
+            // 枚举缓存保存的是设备原始的描述符，只改发给客户端的这一份
+            callback_arg.handler.interval_override_->rewrite(
+                trx->data_buffer + data_offset, static_cast<size_t>(trx->actual_num_bytes) - data_offset);
+        }
+
         int data_len = 0;
         if (!callback_arg.is_out)
         {
@@ -968,7 +1834,7 @@ void usbipdcpp::Esp32DeviceHandler::transfer_callback(usb_transfer_t *trx)
                 data_offset,
                 {});
             response.actual_length = static_cast<uint32_t>(data_len);
-            callback_arg.handler.session.load()->submit_ret_submit(std::move(response));
+            callback_arg.handler.submit_ret_submit(std::move(response));
             // 注意：trx 已被 unique_ptr 接管，不能 free
         }
         else
@@ -985,7 +1851,7 @@ void usbipdcpp::Esp32DeviceHandler::transfer_callback(usb_transfer_t *trx)
             response.transfer_buffer = nullptr;
             response.usb_transfer = nullptr;
             response.iso_packet_descriptor = {};
-            callback_arg.handler.session.load()->submit_ret_submit(std::move(response));
+            callback_arg.handler.submit_ret_submit(std::move(response));
             usb_host_transfer_free(trx);
         }
     }
@@ -1011,4 +1877,650 @@ void usbipdcpp::Esp32DeviceHandler::transfer_callback(usb_transfer_t *trx)
     }
 
     delete callback_arg_ptr;
-}
\ No newline at end of file
+}
+void usbipdcpp::Esp32DeviceHandler::reset_bot_state()
+{
+    std::lock_guard lock(bot_mutex_);
+    if (bot_write_combiner_ && bot_state_.local == BotSnoopState::Local::CombinedWrite)
+    {
+        bot_write_combiner_->abort_command();
+    }
+    bot_state_ = {};
+    // 主机已经放弃了这条命令
+    bot_deferred_.reset();
+}
+
+void usbipdcpp::Esp32DeviceHandler::bot_ack_out(std::uint32_t seqnum, std::size_t length)
+{
+    auto response = UsbIpResponse::UsbIpRetSubmit::create_ret_submit_ok_without_data(seqnum);
+    response.actual_length = static_cast<std::uint32_t>(length);
+    submit_ret_submit(std::move(response));
+}
+
+void usbipdcpp::Esp32DeviceHandler::bot_fail_command()
+{
+    bot_state_.local = BotSnoopState::Local::Failed;
+    if (bot_pending_error_)
+    {
+        bot_pending_error_->reported = true;
+    }
+}
+
+bool usbipdcpp::Esp32DeviceHandler::bot_intercept_bulk(std::uint32_t seqnum, const UsbEndpoint &ep,
+                                                       UsbInterface &interface, std::uint32_t transfer_flags,
+                                                       std::uint32_t transfer_buffer_length,
+                                                       const data_type &out_data, BotTransferHook &hook)
+{
+    std::lock_guard lock(bot_mutex_);
+    auto &state = bot_state_;
+
+    if (!ep.is_in())
+    {
+        if (state.phase == BotSnoopState::Phase::Data && !state.data_in)
+        {
+            // 数据 OUT 阶段，先于 CBW 判断，避免数据恰好长得像 CBW
+            state.data_done += static_cast<std::uint32_t>(out_data.size());
+            if (state.data_done >= state.data_length)
+            {
+                state.phase = BotSnoopState::Phase::Status;
+            }
+            switch (state.local)
+            {
+            case BotSnoopState::Local::CombinedWrite:
+                bot_write_combiner_->append(out_data.data(), out_data.size());
+                bot_ack_out(seqnum, out_data.size());
+                return true;
+            case BotSnoopState::Local::Failed:
+                bot_ack_out(seqnum, out_data.size());
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        auto cbw = bot::CommandBlockWrapper::parse(out_data.data(), out_data.size());
+        if (!cbw)
+        {
+            return false;
+        }
+
+        // 缓冲区正在下发，或者这条命令需要先看到之前的写入：交给下发线程，下发后重新处理，
+        // 不在会话的执行器上等待设备。主机收到 CBW 的应答前不会发下一个 URB
+        if (bot_write_combiner_ && (bot_flushing_ || !bot_write_combiner_->empty()))
+        {
+            auto block_size = bot_block_size_[cbw->lun].load();
+            auto write_range = bot::parse_write_range(cbw->cb);
+            bool appendable = write_range && cbw->opcode() == bot::scsi::WRITE_10 && !cbw->data_in &&
+                              (cbw->cb[1] & bot::scsi::CDB_FUA) == 0 && block_size != 0 &&
+                              static_cast<std::uint64_t>(write_range->blocks) * block_size == cbw->data_transfer_length &&
+                              bot_write_combiner_->can_append(cbw->lun, static_cast<std::uint32_t>(write_range->lba),
+                                                              write_range->blocks, block_size);
+            if (bot_flushing_ || !appendable)
+            {
+                if (bot_flush_thread_stop_)
+                {
+                    // 下发线程已经退出，没有人会处理这条命令
+                    submit_ret_submit(UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
+                    return true;
+                }
+                bot_deferred_ = BotDeferredUrb{
+                    .seqnum = seqnum,
+                    .ep = &ep,
+                    .interface = &interface,
+                    .transfer_flags = transfer_flags,
+                    .transfer_buffer_length = transfer_buffer_length,
+                    .out_data = out_data};
+                bot_flush_requested_ = true;
+                bot_flush_cv_.notify_all();
+                return true;
+            }
+        }
+
+        state = BotSnoopState{
+            .phase = cbw->data_transfer_length ? BotSnoopState::Phase::Data : BotSnoopState::Phase::Status,
+            .local = BotSnoopState::Local::None,
+            .data_in = cbw->data_in,
+            .read_capacity = bot::is_read_capacity(cbw->cb),
+            .lun = cbw->lun,
+            .opcode = cbw->opcode(),
+            .tag = cbw->tag,
+            .lba = 0,
+            .blocks = 0,
+            .data_length = cbw->data_transfer_length,
+            .data_done = 0};
+
+        // 先报告之前合并写入的失败：下一条命令返回 Command Failed，随后的 REQUEST SENSE 返回 deferred error
+        if (bot_pending_error_)
+        {
+            if (!bot_pending_error_->reported)
+            {
+                bot_fail_command();
+                bot_ack_out(seqnum, out_data.size());
+                return true;
+            }
+            if (cbw->opcode() == bot::scsi::REQUEST_SENSE && cbw->lun == bot_pending_error_->lun)
+            {
+                state.local = BotSnoopState::Local::Sense;
+                bot_ack_out(seqnum, out_data.size());
+                return true;
+            }
+            // 主机没有取 sense 就发了别的命令，sense 数据随之失效
+            bot_pending_error_.reset();
+        }
+
+        auto write_range = bot::parse_write_range(cbw->cb);
+
+        if (bot_write_combiner_)
+        {
+            auto block_size = bot_block_size_[cbw->lun].load();
+            bool combinable = write_range && cbw->opcode() == bot::scsi::WRITE_10 && !cbw->data_in &&
+                              (cbw->cb[1] & bot::scsi::CDB_FUA) == 0 && block_size != 0 &&
+                              static_cast<std::uint64_t>(write_range->blocks) * block_size == cbw->data_transfer_length;
+            auto lba = static_cast<std::uint32_t>(write_range ? write_range->lba : 0);
+            auto blocks = write_range ? write_range->blocks : 0;
+
+            // 其它命令（包括 SYNCHRONIZE CACHE 和 READ）都必须看到之前的写入，走到这里时缓冲区
+            // 要么为空，要么可以接上这条命令，不能接上的命令在上面已经交给下发线程
+            if (combinable && bot_write_combiner_->can_append(cbw->lun, lba, blocks, block_size))
+            {
+                if (bot_read_cache_)
+                {
+                    bot_read_cache_->invalidate(cbw->lun, lba, blocks);
+                }
+                bot_write_combiner_->begin_command(cbw->lun, lba, blocks, block_size);
+                state.local = BotSnoopState::Local::CombinedWrite;
+                bot_ack_out(seqnum, out_data.size());
+                return true;
+            }
+        }
+
+        if (!bot_read_cache_)
+        {
+            return false;
+        }
+
+        if (auto range = bot::parse_read_range(cbw->cb))
+        {
+            state.lba = range->lba;
+            state.blocks = range->blocks;
+
+            auto block_size = bot_read_cache_->block_size(cbw->lun);
+            if (block_size != 0 && cbw->data_in && range->blocks != 0 &&
+                static_cast<std::uint64_t>(range->blocks) * block_size == cbw->data_transfer_length &&
+                bot_read_cache_->lookup(cbw->lun, range->lba, range->blocks))
+            {
+                // 整条命令都能由缓存应答，CBW 不再下发给设备
+                state.local = BotSnoopState::Local::CachedRead;
+                bot_ack_out(seqnum, out_data.size());
+                return true;
+            }
+            return false;
+        }
+
+        if (write_range)
+        {
+            bot_read_cache_->invalidate(cbw->lun, write_range->lba, write_range->blocks);
+            return false;
+        }
+
+        switch (cbw->opcode())
+        {
+        case bot::scsi::FORMAT_UNIT:
+        case bot::scsi::START_STOP_UNIT:
+            // 格式化/弹出/装载都会使介质内容失效
+            bot_read_cache_->invalidate_lun(cbw->lun);
+            break;
+        case bot::scsi::MODE_SELECT_6:
+        case bot::scsi::MODE_SELECT_10:
+            break;
+        default:
+            if (!cbw->data_in && cbw->data_transfer_length != 0)
+            {
+                // 不认识的带数据 OUT 命令（厂商命令等）可能改写介质，保守处理
+                SPDLOG_DEBUG("BOT未知OUT命令 {:02x}，作废LUN {} 的读缓存", cbw->opcode(), cbw->lun);
+                bot_read_cache_->invalidate_lun(cbw->lun);
+            }
+            break;
+        }
+        return false;
+    }
+
+    std::uint32_t remaining = state.data_length > state.data_done ? state.data_length - state.data_done : 0;
+
+    // 数据阶段被设备提前结束（短包或 STALL）后，主机会直接读 13 字节的 CSW
+    bool is_status_read = state.phase == BotSnoopState::Phase::Status ||
+                          (state.phase == BotSnoopState::Phase::Data && transfer_buffer_length == bot::CSW_LENGTH &&
+                           remaining != bot::CSW_LENGTH);
+
+    if (state.phase == BotSnoopState::Phase::Data && state.data_in && !is_status_read)
+    {
+        auto length = std::min(transfer_buffer_length, remaining);
+        switch (state.local)
+        {
+        case BotSnoopState::Local::CachedRead:
+        {
+            auto buffer = std::make_shared<data_type>(length);
+            if (!bot_read_cache_->copy_out(state.lun, state.lba, state.data_done, buffer->data(), length))
+            {
+                // 命中之后缓存块不应被淘汰，出现时只能让主机做 reset recovery
+                SPDLOG_ERROR("BOT读缓存数据丢失，lun={} lba={} offset={}", state.lun, state.lba, state.data_done);
+                state = {};
+                submit_ret_submit(
+                    UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
+                return true;
+            }
+            state.data_done += length;
+            if (state.data_done >= state.data_length)
+            {
+                state.phase = BotSnoopState::Phase::Status;
+            }
+            submit_ret_submit(
+                UsbIpResponse::UsbIpRetSubmit::create_ret_submit(
+                    seqnum, static_cast<std::uint32_t>(UrbStatusType::StatusOK), 0, 0, buffer, {}));
+            return true;
+        }
+        case BotSnoopState::Local::Failed:
+            // 用零长度包提前结束数据阶段，CSW 中的 residue 说明没有传输数据
+            state.phase = BotSnoopState::Phase::Status;
+            submit_ret_submit(
+                UsbIpResponse::UsbIpRetSubmit::create_ret_submit_ok_without_data(seqnum));
+            return true;
+        case BotSnoopState::Local::Sense:
+        {
+            auto sense = bot::make_fixed_sense(bot_pending_error_->response_code, bot::scsi::SENSE_KEY_MEDIUM_ERROR,
+                                               bot::scsi::ASC_WRITE_ERROR, 0);
+            auto n = std::min<std::size_t>(length, sense.size());
+            state.data_done += static_cast<std::uint32_t>(n);
+            state.phase = BotSnoopState::Phase::Status;
+            submit_ret_submit(
+                UsbIpResponse::UsbIpRetSubmit::create_ret_submit(
+                    seqnum, static_cast<std::uint32_t>(UrbStatusType::StatusOK), 0, 0,
+                    data_type(sense.begin(), sense.begin() + n), {}));
+            return true;
+        }
+        default:
+            break;
+        }
+
+        if (state.blocks != 0)
+        {
+            hook = BotTransferHook{
+                .kind = BotTransferHook::Kind::FillCache,
+                .lun = state.lun,
+                .opcode = state.opcode,
+                .lba = state.lba,
+                .byte_offset = state.data_done,
+                .expected_length = length};
+        }
+        else if (state.read_capacity)
+        {
+            hook = BotTransferHook{
+                .kind = BotTransferHook::Kind::ReadCapacity,
+                .lun = state.lun,
+                .opcode = state.opcode};
+        }
+        state.data_done += length;
+        if (state.data_done >= state.data_length)
+        {
+            state.phase = BotSnoopState::Phase::Status;
+        }
+        return false;
+    }
+
+    if (!is_status_read)
+    {
+        return false;
+    }
+
+    if (state.local == BotSnoopState::Local::None)
+    {
+        hook = BotTransferHook{
+            .kind = BotTransferHook::Kind::Status,
+            .lun = state.lun,
+            .opcode = state.opcode};
+        state = {};
+        return false;
+    }
+
+    bot::CommandStatusWrapper csw{
+        .tag = state.tag,
+        .data_residue = remaining,
+        .status = bot::CSW_STATUS_PASSED};
+
+    switch (state.local)
+    {
+    case BotSnoopState::Local::CombinedWrite:
+        bot_write_combiner_->commit_command();
+        if (bot_write_combiner_->full())
+        {
+            // 缓冲区满后由下发线程立即下发，失败和超时下发一样由下一条命令报告
+            bot_flush_requested_ = true;
+            bot_flush_cv_.notify_all();
+        }
+        break;
+    case BotSnoopState::Local::Failed:
+        csw.data_residue = state.data_length;
+        csw.status = bot::CSW_STATUS_FAILED;
+        break;
+    case BotSnoopState::Local::Sense:
+        bot_pending_error_.reset();
+        break;
+    default:
+        break;
+    }
+    state = {};
+
+    auto csw_bytes = csw.to_bytes();
+    submit_ret_submit(
+        UsbIpResponse::UsbIpRetSubmit::create_ret_submit(
+            seqnum, static_cast<std::uint32_t>(UrbStatusType::StatusOK), 0, 0,
+            data_type(csw_bytes.begin(), csw_bytes.end()), {}));
+    return true;
+}
+
+void usbipdcpp::Esp32DeviceHandler::on_bot_in_complete(const BotTransferHook &hook, const std::uint8_t *data,
+                                                       std::size_t length)
+{
+    switch (hook.kind)
+    {
+    case BotTransferHook::Kind::FillCache:
+        if (bot_read_cache_ && length >= hook.expected_length)
+        {
+            bot_read_cache_->fill(hook.lun, hook.lba, hook.byte_offset, data, hook.expected_length);
+        }
+        break;
+    case BotTransferHook::Kind::ReadCapacity:
+    {
+        auto block_size = bot::parse_capacity_block_size(hook.opcode, data, length);
+        if (block_size != 0)
+        {
+            bot_block_size_[hook.lun & 0x0F] = block_size;
+            if (bot_read_cache_)
+            {
+                bot_read_cache_->set_block_size(hook.lun, block_size);
+            }
+        }
+        break;
+    }
+    case BotTransferHook::Kind::Status:
+    {
+        auto csw = bot::CommandStatusWrapper::parse(data, length);
+        if (bot_read_cache_ && csw && csw->status != bot::CSW_STATUS_PASSED)
+        {
+            // 命令失败（可能是介质变化的 UNIT ATTENTION），缓存不再可信
+            bot_read_cache_->invalidate_lun(hook.lun);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+bool usbipdcpp::Esp32DeviceHandler::bot_flush_writes(std::unique_lock<std::mutex> &lock)
+{
+    if (!bot_write_combiner_ || bot_write_combiner_->empty())
+    {
+        return true;
+    }
+
+    auto &combiner = *bot_write_combiner_;
+    // 和设备通信期间不持有 bot_mutex_，新的 CBW 看到 bot_flushing_ 后交给下发线程，不会修改缓冲区
+    bot_flushing_ = true;
+    lock.unlock();
+    bool ok = has_device && bot_device_write(combiner.lun(), combiner.lba(), combiner.committed_blocks(),
+                                             combiner.data(), combiner.committed_bytes());
+    lock.lock();
+    bot_flushing_ = false;
+    bot_flush_cv_.notify_all();
+
+    combiner.record_flush(ok);
+    if (!ok)
+    {
+        SPDLOG_ERROR("BOT写合并下发失败，lun={} lba={} blocks={}", combiner.lun(), combiner.lba(),
+                     combiner.committed_blocks());
+        bot_pending_error_ = BotPendingError{
+            .lun = combiner.lun(),
+            .response_code = bot::scsi::SENSE_RESPONSE_DEFERRED,
+            .reported = false};
+        if (bot_read_cache_)
+        {
+            bot_read_cache_->invalidate_lun(combiner.lun());
+        }
+    }
+    combiner.reset();
+    return ok;
+}
+
+bool usbipdcpp::Esp32DeviceHandler::bot_device_write(std::uint8_t lun, std::uint32_t lba, std::uint32_t blocks,
+                                                     const std::uint8_t *data, std::size_t length)
+{
+    // 服务器自己发起一条完整的 CBW -> 数据 OUT -> CSW
+    constexpr std::size_t MAX_CHUNK_SIZE = 64 * 1024;
+
+    bot::CommandBlockWrapper cbw{
+        .tag = bot_internal_tag_++,
+        .data_transfer_length = static_cast<std::uint32_t>(length),
+        .data_in = false,
+        .lun = lun,
+        .cb_length = 10,
+        .cb = {}};
+    cbw.cb[0] = bot::scsi::WRITE_10;
+    bot::store_be32(&cbw.cb[2], lba);
+    // BotWriteCombiner 保证合并后不超过 0xFFFF 块
+    bot::store_be16(&cbw.cb[7], static_cast<std::uint16_t>(blocks));
+    auto cbw_bytes = cbw.to_bytes();
+
+    std::size_t actual = 0;
+    usb_transfer_status_t status;
+    auto err = sync_bulk_transfer(bot_out_ep_, cbw_bytes.data(), cbw_bytes.size(), actual, status);
+    if (err != ESP_OK || status != USB_TRANSFER_STATUS_COMPLETED)
+    {
+        SPDLOG_ERROR("BOT写合并: CBW 发送失败 {}", static_cast<int>(status));
+        bot_reset_recovery();
+        return false;
+    }
+
+    bool data_stalled = false;
+    for (std::size_t offset = 0; offset < length; offset += MAX_CHUNK_SIZE)
+    {
+        auto n = std::min(MAX_CHUNK_SIZE, length - offset);
+        err = sync_bulk_transfer(bot_out_ep_, const_cast<std::uint8_t *>(data + offset), n, actual, status);
+        if (err == ESP_OK && status == USB_TRANSFER_STATUS_STALL)
+        {
+            // 设备拒绝接收剩余数据，清除 halt 后仍然读取 CSW
+            bot_clear_halt(bot_out_ep_);
+            data_stalled = true;
+            break;
+        }
+        if (err != ESP_OK || status != USB_TRANSFER_STATUS_COMPLETED)
+        {
+            SPDLOG_ERROR("BOT写合并: 数据发送失败 {}", static_cast<int>(status));
+            bot_reset_recovery();
+            return false;
+        }
+    }
+
+    std::vector<std::uint8_t> csw_buffer(
+        (bot::CSW_LENGTH + bot_in_max_packet_size_ - 1) / bot_in_max_packet_size_ * bot_in_max_packet_size_);
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        err = sync_bulk_transfer(bot_in_ep_, csw_buffer.data(), csw_buffer.size(), actual, status);
+        if (err == ESP_OK && status == USB_TRANSFER_STATUS_STALL)
+        {
+            bot_clear_halt(bot_in_ep_);
+            continue;
+        }
+        break;
+    }
+    auto csw = (err == ESP_OK && status == USB_TRANSFER_STATUS_COMPLETED)
+                   ? bot::CommandStatusWrapper::parse(csw_buffer.data(), actual)
+                   : std::nullopt;
+    if (!csw || csw->tag != cbw.tag || csw->status == bot::CSW_STATUS_PHASE_ERROR)
+    {
+        SPDLOG_ERROR("BOT写合并: CSW 无效");
+        bot_reset_recovery();
+        return false;
+    }
+    return csw->status == bot::CSW_STATUS_PASSED && !data_stalled;
+}
+
+void usbipdcpp::Esp32DeviceHandler::bot_clear_halt(std::uint8_t ep_address)
+{
+    usb_host_endpoint_clear(native_handle, ep_address);
+    sync_control_transfer(SetupPacket{
+        .request_type = 0x02, // 标准请求，接收者为端点
+        .request = 0x01,      // CLEAR_FEATURE
+        .value = SetupPacket::USB_ENDPOINT_HALT,
+        .index = ep_address,
+        .length = 0});
+}
+
+void usbipdcpp::Esp32DeviceHandler::bot_reset_recovery()
+{
+    SPDLOG_WARN("BOT写合并: 执行 reset recovery");
+    sync_control_transfer(SetupPacket{
+        .request_type = 0x21, // 类请求，接收者为接口
+        .request = bot::REQUEST_BULK_ONLY_RESET,
+        .value = 0,
+        .index = bot_interface_number_,
+        .length = 0});
+    bot_clear_halt(bot_in_ep_);
+    bot_clear_halt(bot_out_ep_);
+}
+
+esp_err_t usbipdcpp::Esp32DeviceHandler::sync_bulk_transfer(std::uint8_t ep_address, std::uint8_t *buffer,
+                                                            std::size_t length, std::size_t &actual_length,
+                                                            usb_transfer_status_t &status)
+{
+    constexpr auto TIMEOUT = std::chrono::milliseconds(5000);
+    // 取消端点上的传输后等待回调的时间
+    constexpr auto CANCEL_TIMEOUT = std::chrono::milliseconds(500);
+
+    // 放弃等待后由回调释放 transfer 和上下文
+    struct SyncContext
+    {
+        std::binary_semaphore semaphore{0};
+        std::atomic_bool settled = false;
+    };
+
+    usb_transfer_t *transfer = nullptr;
+    auto err = usb_host_transfer_alloc(length, 0, &transfer);
+    if (err != ESP_OK)
+    {
+        SPDLOG_ERROR("无法申请transfer: {}", esp_err_to_name(err));
+        return err;
+    }
+
+    bool is_in = (ep_address & 0x80) != 0;
+    if (!is_in)
+    {
+        memcpy(transfer->data_buffer, buffer, length);
+    }
+
+    auto *context = new SyncContext;
+    transfer->device_handle = native_handle;
+    transfer->callback = [](usb_transfer_t *trx)
+    {
+        auto *ctx = static_cast<SyncContext *>(trx->context);
+        if (ctx->settled.exchange(true))
+        {
+            // 等待方已经放弃
+            usb_host_transfer_free(trx);
+            delete ctx;
+            return;
+        }
+        ctx->semaphore.release();
+    };
+    transfer->context = context;
+    transfer->bEndpointAddress = ep_address;
+    transfer->num_bytes = static_cast<int>(length);
+
+    {
+        std::shared_lock lock(endpoint_cancellation_mutex);
+        err = usb_host_transfer_submit(transfer);
+    }
+    if (err != ESP_OK)
+    {
+        SPDLOG_ERROR("sync_bulk_transfer 提交失败: {}", esp_err_to_name(err));
+        usb_host_transfer_free(transfer);
+        delete context;
+        return err;
+    }
+
+    if (!context->semaphore.try_acquire_for(TIMEOUT))
+    {
+        // bulk 传输不支持超时，手动取消端点上的传输
+        SPDLOG_WARN("sync_bulk_transfer 端点 {:02x} 超时", ep_address);
+        {
+            std::lock_guard lock(endpoint_cancellation_mutex);
+            usb_host_endpoint_halt(native_handle, ep_address);
+            usb_host_endpoint_flush(native_handle, ep_address);
+            usb_host_endpoint_clear(native_handle, ep_address);
+        }
+        if (!context->semaphore.try_acquire_for(CANCEL_TIMEOUT))
+        {
+            if (!context->settled.exchange(true))
+            {
+                SPDLOG_ERROR("sync_bulk_transfer 端点 {:02x} 取消后仍未完成，放弃等待", ep_address);
+                return ESP_ERR_TIMEOUT;
+            }
+            // 回调恰好在这之间执行
+            context->semaphore.acquire();
+        }
+    }
+    delete context;
+
+    status = transfer->status;
+    actual_length = static_cast<std::size_t>(std::max(transfer->actual_num_bytes, 0));
+    if (is_in)
+    {
+        memcpy(buffer, transfer->data_buffer, std::min(actual_length, length));
+    }
+    usb_host_transfer_free(transfer);
+    return ESP_OK;
+}
+
+void usbipdcpp::Esp32DeviceHandler::bot_flush_thread_main()
+{
+    auto timeout = std::chrono::milliseconds(policy_.bot_write_combine_flush_ms);
+    std::unique_lock lock(bot_mutex_);
+    while (true)
+    {
+        if (!bot_flush_requested_ && !bot_flush_thread_stop_)
+        {
+            bot_flush_cv_.wait_for(lock, timeout);
+        }
+        // 等待下发的 CBW 还没有应答时不能退出，否则主机会一直等下去
+        if (bot_flush_thread_stop_ && !bot_deferred_)
+        {
+            break;
+        }
+        auto requested = std::exchange(bot_flush_requested_, false) || bot_flush_thread_stop_;
+        // 只在两条命令之间下发，避免打断主机正在进行的命令
+        if (!requested &&
+            (!has_device || bot_write_combiner_->empty() || bot_state_.phase != BotSnoopState::Phase::Idle ||
+             std::chrono::steady_clock::now() - bot_write_combiner_->last_append() < timeout))
+        {
+            continue;
+        }
+        bot_flush_writes(lock);
+        // 缓冲区为空时 bot_flush_writes 不会通知，on_disconnection 要靠这里知道请求已经处理
+        bot_flush_cv_.notify_all();
+
+        // 缓冲区已经清空，重新处理等待下发的 CBW
+        if (auto deferred = std::exchange(bot_deferred_, std::nullopt))
+        {
+            lock.unlock();
+            error_code ec;
+            handle_bulk_transfer(deferred->seqnum, *deferred->ep, *deferred->interface, deferred->transfer_flags,
+                                 deferred->transfer_buffer_length, deferred->out_data, ec);
+            if (ec)
+            {
+                submit_ret_submit(
+                    UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(deferred->seqnum));
+            }
+            lock.lock();
+        }
+    }
+}
@@ -0,0 +1,292 @@
+#include "Esp32HidReportSource.h"
+
+#include <chrono>
+#include <format>
+
+#include <usb/usb_helpers.h>
+#include <spdlog/spdlog.h>
+
+#include "Esp32DeviceHandler.h"
+
+namespace usbipdcpp
+{
+
+    std::unique_ptr<Esp32HidReportSource> Esp32HidReportSource::create(std::shared_ptr<UsbDevice> device,
+                                                                       std::uint8_t interface_number)
+    {
+        auto handler = std::dynamic_pointer_cast<Esp32DeviceHandler>(device->handler);
+        if (!handler || interface_number >= device->interfaces.size())
+        {
+            return nullptr;
+        }
+        const auto &intf = device->interfaces[interface_number];
+        if (intf.interface_class != static_cast<std::uint8_t>(ClassCode::HID))
+        {
+            return nullptr;
+        }
+        const UsbEndpoint *in_ep = nullptr;
+        for (const auto &ep : intf.endpoints)
+        {
+            if (ep.is_in() && (ep.attributes & 0x03) == static_cast<std::uint8_t>(EndpointAttributes::Interrupt))
+            {
+                in_ep = &ep;
+                break;
+            }
+        }
+        if (!in_ep)
+        {
+            SPDLOG_WARN("组合 HID: 设备 {} 接口 {} 没有中断 IN 端点", device->busid, interface_number);
+            return nullptr;
+        }
+
+        auto length = report_descriptor_length(*handler, interface_number);
+        if (length == 0)
+        {
+            // 没有找到 HID 描述符，设备会返回实际长度
+            length = 1024;
+        }
+        data_type report_descriptor;
+        auto err = handler->sync_control_in(
+            SetupPacket{
+                .request_type = 0x81, // IN, Standard, Interface
+                .request = static_cast<std::uint8_t>(StandardRequest::GetDescriptor),
+                .value = static_cast<std::uint16_t>(HidDescriptorType::Report << 8),
+                .index = interface_number,
+                .length = length},
+            report_descriptor);
+        if (err != ESP_OK || report_descriptor.empty())
+        {
+            SPDLOG_ERROR("组合 HID: 读取设备 {} 接口 {} 的报告描述符失败: {}", device->busid, interface_number,
+                         esp_err_to_name(err));
+            return nullptr;
+        }
+
+        auto source = std::unique_ptr<Esp32HidReportSource>(new Esp32HidReportSource(
+            device, *handler, interface_number, in_ep->address, in_ep->max_packet_size, std::move(report_descriptor)));
+        if (source->transfers_.empty())
+        {
+            return nullptr;
+        }
+        return source;
+    }
+
+    Esp32HidReportSource::Esp32HidReportSource(std::shared_ptr<UsbDevice> device, Esp32DeviceHandler &handler,
+                                               std::uint8_t interface_number, std::uint8_t ep_address,
+                                               std::uint16_t max_packet_size, data_type &&report_descriptor) :
+        device_(std::move(device)), handler_(handler), interface_number_(interface_number), ep_address_(ep_address),
+        report_descriptor_(std::move(report_descriptor))
+    {
+        // 一个传输只收一个包，报告正好等于最大包长时也能立即完成
+        auto submit_length = max_packet_size ? max_packet_size : 64;
+        for (std::size_t i = 0; i < TRANSFER_COUNT; i++)
+        {
+            usb_transfer_t *trx = nullptr;
+            auto err = usb_host_transfer_alloc(submit_length, 0, &trx);
+            if (err != ESP_OK)
+            {
+                SPDLOG_WARN("组合 HID: 只申请到 {} 个transfer: {}", transfers_.size(), esp_err_to_name(err));
+                break;
+            }
+            trx->device_handle = handler_.native_handle;
+            trx->callback = transfer_callback;
+            trx->context = this;
+            trx->bEndpointAddress = ep_address_;
+            trx->num_bytes = submit_length;
+            transfers_.push_back(trx);
+        }
+        idle_ = transfers_;
+    }
+
+    Esp32HidReportSource::~Esp32HidReportSource()
+    {
+        stop();
+        std::lock_guard lock(mutex_);
+        if (idle_.size() != transfers_.size())
+        {
+            // 在途的传输随设备关闭一起结束，不能在这里释放
+            SPDLOG_WARN("组合 HID: 端点 {:02x} 还有 {} 个传输在途", ep_address_, transfers_.size() - idle_.size());
+        }
+        for (auto trx : idle_)
+        {
+            usb_host_transfer_free(trx);
+        }
+    }
+
+    std::string Esp32HidReportSource::name() const
+    {
+        return std::format("{}:{}", device_->busid, interface_number_);
+    }
+
+    std::uint16_t Esp32HidReportSource::report_descriptor_length(Esp32DeviceHandler &handler,
+                                                                 std::uint8_t interface_number)
+    {
+        const usb_config_desc_t *config_desc = nullptr;
+        if (usb_host_get_active_config_descriptor(handler.native_handle, &config_desc) != ESP_OK)
+        {
+            return 0;
+        }
+        int offset = 0;
+        if (!usb_parse_interface_descriptor(config_desc, interface_number, 0, &offset))
+        {
+            return 0;
+        }
+        // HID 描述符紧跟在接口描述符之后、端点描述符之前
+        auto raw = reinterpret_cast<const std::uint8_t *>(config_desc);
+        std::size_t pos = static_cast<std::size_t>(offset) + raw[offset];
+        while (pos + 2 <= config_desc->wTotalLength)
+        {
+            auto length = raw[pos];
+            auto type = raw[pos + 1];
+            if (length < 2 || pos + length > config_desc->wTotalLength ||
+                type == static_cast<std::uint8_t>(DescriptorType::Interface))
+            {
+                break;
+            }
+            if (type == HidDescriptorType::Hid && length >= 9 && raw[pos + 6] == HidDescriptorType::Report)
+            {
+                return static_cast<std::uint16_t>(raw[pos + 7] | (raw[pos + 8] << 8));
+            }
+            pos += length;
+        }
+        return 0;
+    }
+
+    void Esp32HidReportSource::start(ReportSink sink)
+    {
+        if (!handler_.has_device)
+        {
+            return;
+        }
+        // 只在报告变化时发送，和主机驱动对键盘做的一样
+        handler_.sync_control_transfer(SetupPacket{
+            .request_type = 0x21, // OUT, Class, Interface
+            .request = static_cast<std::uint8_t>(HIDRequest::SetIdle),
+            .value = 0,
+            .index = interface_number_,
+            .length = 0});
+
+        std::lock_guard lock(mutex_);
+        sink_ = std::move(sink);
+        running_ = true;
+        while (!idle_.empty())
+        {
+            if (!submit(idle_.back()))
+            {
+                break;
+            }
+            idle_.pop_back();
+        }
+        if (idle_.size() == transfers_.size())
+        {
+            running_ = false;
+        }
+    }
+
+    void Esp32HidReportSource::stop()
+    {
+        std::unique_lock lock(mutex_);
+        running_ = false;
+        if (idle_.size() != transfers_.size() && handler_.has_device)
+        {
+            lock.unlock();
+            {
+                // 中断 IN 在没有输入时不会完成，手动取消端点上的传输
+                std::lock_guard cancel_lock(handler_.endpoint_cancellation_mutex);
+                usb_host_endpoint_halt(handler_.native_handle, ep_address_);
+                usb_host_endpoint_flush(handler_.native_handle, ep_address_);
+                usb_host_endpoint_clear(handler_.native_handle, ep_address_);
+            }
+            lock.lock();
+        }
+        if (!idle_cv_.wait_for(lock, std::chrono::milliseconds(500), [this]()
+                               { return idle_.size() == transfers_.size(); }))
+        {
+            SPDLOG_WARN("组合 HID: 端点 {:02x} 的传输没有在取消后结束", ep_address_);
+        }
+        sink_ = nullptr;
+    }
+
+    bool Esp32HidReportSource::submit(usb_transfer_t *trx)
+    {
+        esp_err_t err;
+        {
+            std::shared_lock cancel_lock(handler_.endpoint_cancellation_mutex);
+            err = usb_host_transfer_submit(trx);
+        }
+        if (err != ESP_OK)
+        {
+            SPDLOG_WARN("组合 HID: 端点 {:02x} 提交失败: {}", ep_address_, esp_err_to_name(err));
+            return false;
+        }
+        return true;
+    }
+
+    void Esp32HidReportSource::transfer_callback(usb_transfer_t *trx)
+    {
+        auto self = static_cast<Esp32HidReportSource *>(trx->context);
+        std::lock_guard lock(self->mutex_);
+
+        if (self->running_)
+        {
+            switch (trx->status)
+            {
+            case USB_TRANSFER_STATUS_COMPLETED:
+                if (trx->actual_num_bytes > 0 && self->sink_)
+                {
+                    self->sink_(trx->data_buffer, static_cast<std::size_t>(trx->actual_num_bytes));
+                }
+                break;
+            case USB_TRANSFER_STATUS_NO_DEVICE:
+                self->handler_.has_device = false;
+                self->running_ = false;
+                break;
+            default:
+                SPDLOG_WARN("组合 HID: 端点 {:02x} 传输失败，状态 {}", self->ep_address_, (int)trx->status);
+                self->running_ = false;
+                break;
+            }
+        }
+
+        if (!self->running_ || !self->submit(trx))
+        {
+            self->idle_.push_back(trx);
+            self->idle_cv_.notify_all();
+        }
+    }
+
+    std::uint32_t Esp32HidReportSource::get_report(std::uint8_t type, std::uint8_t report_id, std::uint16_t length,
+                                                   data_type &data)
+    {
+        if (!handler_.has_device)
+        {
+            return static_cast<std::uint32_t>(UrbStatusType::StatusEPIPE);
+        }
+        auto err = handler_.sync_control_in(
+            SetupPacket{
+                .request_type = 0xA1, // IN, Class, Interface
+                .request = static_cast<std::uint8_t>(HIDRequest::GetReport),
+                .value = static_cast<std::uint16_t>(type << 8 | report_id),
+                .index = interface_number_,
+                .length = length},
+            data);
+        return static_cast<std::uint32_t>(err == ESP_OK ? UrbStatusType::StatusOK : UrbStatusType::StatusEPIPE);
+    }
+
+    std::uint32_t Esp32HidReportSource::set_report(std::uint8_t type, std::uint8_t report_id, const data_type &data)
+    {
+        if (!handler_.has_device)
+        {
+            return static_cast<std::uint32_t>(UrbStatusType::StatusEPIPE);
+        }
+        auto err = handler_.sync_control_out(
+            SetupPacket{
+                .request_type = 0x21, // OUT, Class, Interface
+                .request = static_cast<std::uint8_t>(HIDRequest::SetReport),
+                .value = static_cast<std::uint16_t>(type << 8 | report_id),
+                .index = interface_number_,
+                .length = static_cast<std::uint16_t>(data.size())},
+            data);
+        return static_cast<std::uint32_t>(err == ESP_OK ? UrbStatusType::StatusOK : UrbStatusType::StatusEPIPE);
+    }
+
+} // namespace usbipdcpp
@@ -8,8 +8,12 @@
 #include <iostream>
 
 #include <esp_pthread.h>
+#include <esp_rom_crc.h>
+#include <esp_timer.h>
 
 #include "Esp32DeviceHandler.h"
+#include "Esp32HidReportSource.h"
+#include "TaskTopology.h"
 #include "tools.h"
 
 const char *usbipdcpp::Esp32Server::TAG = "esp32_uspipdcpp_server";
@@ -118,12 +122,35 @@ void usbipdcpp::Esp32Server::bind_host_device(usb_device_handle_t dev)
     }
 
     SPDLOG_DEBUG("该设备有{}个interface", active_config_desc->bNumInterfaces);
+
+    auto bind_start = esp_timer_get_time();
+    EnumerationKey cache_key{
+        .vendor_id = device_descriptor->idVendor,
+        .product_id = device_descriptor->idProduct,
+        .bcd_device = device_descriptor->bcdDevice,
+        .serial = read_serial_number(dev_info)};
+    auto config_crc = esp_rom_crc32_le(0, reinterpret_cast<const std::uint8_t *>(active_config_desc),
+                                       active_config_desc->wTotalLength);
+    auto cache_entry = enumeration_cache_.lookup(cache_key, config_crc, active_config_desc->wTotalLength);
+    const bool cache_hit = cache_entry != nullptr;
+
+    std::vector<EnumerationCache::InterfaceLayout> layout;
+    if (cache_hit)
+    {
+        // 配置描述符没有变化，直接使用上次解析的接口布局
+        layout = cache_entry->interfaces;
+    }
+    else
+    {
+        layout = parse_interface_layout(active_config_desc);
+    }
+
     std::vector<UsbInterface> interfaces;
 
     // 预分配内存避免频繁重新分配
     try
     {
-        interfaces.reserve(active_config_desc->bNumInterfaces);
+        interfaces.reserve(layout.size());
     }
     catch (const std::bad_alloc &e)
     {
@@ -131,88 +158,48 @@ void usbipdcpp::Esp32Server::bind_host_device(usb_device_handle_t dev)
         return;
     }
 
-    for (auto intf_i = 0; intf_i < active_config_desc->bNumInterfaces; intf_i++)
+    for (std::size_t i = 0; i < layout.size(); i++)
     {
-        [[maybe_unused]] auto alter_setting_num = usb_parse_interface_number_of_alternate(active_config_desc, intf_i);
-        SPDLOG_DEBUG("第{}个interface有{}个altsetting", intf_i, alter_setting_num);
-
-        int intf_offset;
-        auto intf_desc = usb_parse_interface_descriptor(active_config_desc, intf_i, 0, &intf_offset);
-        if (!intf_desc)
-        {
-            SPDLOG_ERROR("无法解析接口{}的描述符", intf_i);
-            continue;
-        }
-
-        // 只使用第一个alsetting
-        err = usb_host_interface_claim(host_client_handle, dev, intf_i, 0);
+        const auto &intf = layout[i];
+        err = usb_host_interface_claim(host_client_handle, dev, intf.number, intf.alternate_setting);
         if (err != ESP_OK)
         {
-            SPDLOG_ERROR("无法声明接口{}：{}", intf_i, esp_err_to_name(err));
+            SPDLOG_ERROR("无法声明接口{}：{}", intf.number, esp_err_to_name(err));
             // 释放之前已经声明的接口
-            for (int j = 0; j < intf_i; j++)
+            for (std::size_t j = 0; j < i; j++)
             {
-                usb_host_interface_release(host_client_handle, dev, j);
+                usb_host_interface_release(host_client_handle, dev, layout[j].number);
             }
             return;
         }
 
-        std::vector<UsbEndpoint> endpoints;
-        try
-        {
-            endpoints.reserve(intf_desc->bNumEndpoints);
-        }
-        catch (const std::bad_alloc &e)
-        {
-            SPDLOG_ERROR("无法为endpoints预分配内存: {}", e.what());
-            usb_host_interface_release(host_client_handle, dev, intf_i);
-            for (int j = 0; j < intf_i; j++)
-            {
-                usb_host_interface_release(host_client_handle, dev, j);
-            }
-            return;
-        }
-
-        for (auto ep_i = 0; ep_i < intf_desc->bNumEndpoints; ep_i++)
-        {
-            int endpoint_offset = intf_offset;
-            auto ep_desc = usb_parse_endpoint_descriptor_by_index(intf_desc, ep_i, active_config_desc->wTotalLength,
-                                                                  &endpoint_offset);
-            if (!ep_desc)
-            {
-                SPDLOG_ERROR("无法解析端点{}的描述符", ep_i);
-                continue;
-            }
-
-            endpoints.emplace_back(
-                ep_desc->bEndpointAddress,
-                ep_desc->bmAttributes,
-                ep_desc->wMaxPacketSize,
-                ep_desc->bInterval);
-        }
-
         try
         {
             interfaces.emplace_back(
                 UsbInterface{
-                    intf_desc->bInterfaceClass,
-                    intf_desc->bInterfaceSubClass,
-                    intf_desc->bInterfaceProtocol,
-                    std::move(endpoints),
+                    intf.interface_class,
+                    intf.interface_subclass,
+                    intf.interface_protocol,
+                    intf.endpoints,
                     nullptr});
         }
         catch (const std::bad_alloc &e)
         {
             SPDLOG_ERROR("无法创建UsbInterface: {}", e.what());
-            usb_host_interface_release(host_client_handle, dev, intf_i);
-            for (int j = 0; j < intf_i; j++)
+            for (std::size_t j = 0; j <= i; j++)
             {
-                usb_host_interface_release(host_client_handle, dev, j);
+                usb_host_interface_release(host_client_handle, dev, layout[j].number);
             }
             return;
         }
     }
 
+    if (!cache_hit)
+    {
+        cache_entry = enumeration_cache_.create(cache_key, config_crc, active_config_desc->wTotalLength,
+                                                std::move(layout));
+    }
+
     try
     {
         std::lock_guard lock(devices_mutex);
@@ -234,8 +221,21 @@ void usbipdcpp::Esp32Server::bind_host_device(usb_device_handle_t dev)
             .ep0_in = UsbEndpoint::get_ep0_in(device_descriptor->bMaxPacketSize0),
             .ep0_out = UsbEndpoint::get_ep0_out(device_descriptor->bMaxPacketSize0),
             .handler = {}});
-        current_device->with_handler<Esp32DeviceHandler>(dev, host_client_handle);
+        auto handler = current_device->with_handler<Esp32DeviceHandler>(dev, host_client_handle);
+        handler->apply_policy(device_policies_.resolve(current_device->vendor_id, current_device->product_id,
+                                                       current_device->interfaces));
+        if (cache_entry)
+        {
+            handler->attach_enumeration_cache(enumeration_cache_, cache_entry);
+            if (cache_hit)
+            {
+                enumeration_cache_.revalidate(cache_entry, handler);
+            }
+        }
         available_devices.emplace_back(std::move(current_device));
+        ESP_LOGI(TAG, "设备 %04x:%04x 绑定完成: 枚举缓存%s, 绑定耗时 %lld us, 上电后 %lld ms 可导出",
+                 cache_key.vendor_id, cache_key.product_id, cache_hit ? "命中" : "未命中",
+                 esp_timer_get_time() - bind_start, esp_timer_get_time() / 1000);
     }
     catch (const std::bad_alloc &e)
     {
@@ -248,6 +248,71 @@ void usbipdcpp::Esp32Server::bind_host_device(usb_device_handle_t dev)
     }
 }
 
+std::string usbipdcpp::Esp32Server::read_serial_number(const usb_device_info_t &dev_info)
+{
+    std::string serial;
+    if (auto desc = dev_info.str_desc_serial_num)
+    {
+        // UTF-16LE，序列号一般只有 ASCII，取低字节即可
+        for (int i = 0; i < (desc->bLength - 2) / 2; i++)
+        {
+            serial.push_back(static_cast<char>(desc->wData[i] & 0xFF));
+        }
+    }
+    return serial;
+}
+
+std::vector<usbipdcpp::EnumerationCache::InterfaceLayout> usbipdcpp::Esp32Server::parse_interface_layout(
+    const usb_config_desc_t *active_config_desc)
+{
+    std::vector<EnumerationCache::InterfaceLayout> layout;
+    layout.reserve(active_config_desc->bNumInterfaces);
+
+    for (auto intf_i = 0; intf_i < active_config_desc->bNumInterfaces; intf_i++)
+    {
+        [[maybe_unused]] auto alter_setting_num = usb_parse_interface_number_of_alternate(active_config_desc, intf_i);
+        SPDLOG_DEBUG("第{}个interface有{}个altsetting", intf_i, alter_setting_num);
+
+        // 只使用第一个alsetting
+        int intf_offset;
+        auto intf_desc = usb_parse_interface_descriptor(active_config_desc, intf_i, 0, &intf_offset);
+        if (!intf_desc)
+        {
+            SPDLOG_ERROR("无法解析接口{}的描述符", intf_i);
+            continue;
+        }
+
+        EnumerationCache::InterfaceLayout intf{
+            .number = static_cast<std::uint8_t>(intf_i),
+            .alternate_setting = 0,
+            .interface_class = intf_desc->bInterfaceClass,
+            .interface_subclass = intf_desc->bInterfaceSubClass,
+            .interface_protocol = intf_desc->bInterfaceProtocol,
+            .endpoints = {}};
+        intf.endpoints.reserve(intf_desc->bNumEndpoints);
+
+        for (auto ep_i = 0; ep_i < intf_desc->bNumEndpoints; ep_i++)
+        {
+            int endpoint_offset = intf_offset;
+            auto ep_desc = usb_parse_endpoint_descriptor_by_index(intf_desc, ep_i, active_config_desc->wTotalLength,
+                                                                  &endpoint_offset);
+            if (!ep_desc)
+            {
+                SPDLOG_ERROR("无法解析端点{}的描述符", ep_i);
+                continue;
+            }
+
+            intf.endpoints.emplace_back(
+                ep_desc->bEndpointAddress,
+                ep_desc->bmAttributes,
+                ep_desc->wMaxPacketSize,
+                ep_desc->bInterval);
+        }
+        layout.push_back(std::move(intf));
+    }
+    return layout;
+}
+
 void usbipdcpp::Esp32Server::unbind_host_device(usb_device_handle_t dev)
 {
     usb_device_info_t dev_info;
@@ -300,13 +365,14 @@ void usbipdcpp::Esp32Server::unbind_host_device(usb_device_handle_t dev)
 
 void usbipdcpp::Esp32Server::start(asio::ip::tcp::endpoint &ep)
 {
-    Server::start(ep);
-    esp_pthread_cfg_t pthread_cfg = esp_pthread_get_default_config();
-    pthread_cfg.pin_to_core = 1; // 设置核心1
-    pthread_cfg.thread_name = "Esp32Server client_event_thread";
-    esp_pthread_set_cfg(&pthread_cfg);
+    {
+        TaskTopology::ScopedThreadConfig thread_config(TaskRole::NetworkIo);
+        Server::start(ep);
+    }
+    TaskTopology::ScopedThreadConfig thread_config(TaskRole::ClientEvent);
     client_event_thread = std::thread([this]()
                                       {
+        TaskTopology::instance().register_task(TaskRole::ClientEvent, xTaskGetCurrentTaskHandle());
         try {
             SPDLOG_INFO("启动一个client event handle的事件循环线程");
             ESP_LOGI(TAG, "client_event_thread 启动，当前堆内存: %d", esp_get_free_heap_size());
@@ -372,9 +438,25 @@ void usbipdcpp::Esp32Server::start(asio::ip::tcp::endpoint &ep)
         } catch (const std::exception &e) {
             ESP_LOGE(TAG, "client_event_thread发生异常: %s", e.what());
             SPDLOG_ERROR("An unexpected exception occurs in client event handle thread: {}", e.what());
-        } });
-    esp_pthread_cfg_t default_cfg = esp_pthread_get_default_config();
-    esp_pthread_set_cfg(&default_cfg);
+        }
+        TaskTopology::instance().unregister_task(xTaskGetCurrentTaskHandle()); });
+}
+
+void usbipdcpp::Esp32Server::before_session_thread_create()
+{
+    // 会话执行器线程只在启动时创建一次，离开 Server::start 后由 ScopedThreadConfig 恢复默认配置
+    TaskTopology::instance().apply_to_current_thread(TaskRole::Session);
+}
+
+void usbipdcpp::Esp32Server::on_session_thread_start()
+{
+    // 登记后运行时切换方案会更新执行器线程的优先级
+    TaskTopology::instance().register_task(TaskRole::Session, xTaskGetCurrentTaskHandle());
+}
+
+void usbipdcpp::Esp32Server::on_session_thread_exit()
+{
+    TaskTopology::instance().unregister_task(xTaskGetCurrentTaskHandle());
 }
 
 void usbipdcpp::Esp32Server::stop()
@@ -438,6 +520,102 @@ void usbipdcpp::Esp32Server::stop()
     spdlog::info("client handle事件线程结束");
 }
 
+usbipdcpp::UsbThroughputProbe::Result usbipdcpp::Esp32Server::run_throughput_probe(
+    const std::string &busid, const UsbThroughputProbe::Config &config)
+{
+    // 放进正在使用的设备，测试期间客户端导入会失败
+    auto device = try_moving_device_to_using(busid);
+    if (!device)
+    {
+        return {.error = "设备不存在或正在被导入"};
+    }
+
+    UsbThroughputProbe::Result result;
+    if (auto esp32_handler = std::dynamic_pointer_cast<Esp32DeviceHandler>(device->handler))
+    {
+        ESP_LOGI(TAG, "开始吞吐测试: 设备 %s 端点 %02x, 每次 %lu 字节, 在途 %u, %lu ms", busid.c_str(),
+                 config.ep_address, static_cast<unsigned long>(config.transfer_size), config.queue_depth,
+                 static_cast<unsigned long>(config.duration_ms));
+        result = UsbThroughputProbe::run(*esp32_handler, config);
+    }
+    else
+    {
+        result.error = "不是直通设备";
+    }
+
+    try_moving_device_to_available(busid);
+    return result;
+}
+
+usbipdcpp::Esp32Server::HidAggregateResult usbipdcpp::Esp32Server::aggregate_hid_devices(
+    const std::vector<std::string> &busids, StringPool &string_pool, const HidCompositeDeviceConfig &config)
+{
+    HidAggregateResult result;
+    if (has_bound_device(config.busid))
+    {
+        result.error = "busid " + config.busid + " 已经被占用";
+        return result;
+    }
+
+    std::vector<std::string> taken;
+    std::vector<std::unique_ptr<HidReportSource>> sources;
+    auto fail = [&](std::string error)
+    {
+        // 成员持有设备，先释放成员再把设备放回可用设备
+        sources.clear();
+        for (const auto &busid : taken)
+        {
+            try_moving_device_to_available(busid);
+        }
+        result.error = std::move(error);
+        return result;
+    };
+
+    for (const auto &busid : busids)
+    {
+        // 放进正在使用的设备，之后客户端不能再单独导入
+        auto device = try_moving_device_to_using(busid);
+        if (!device)
+        {
+            return fail("设备 " + busid + " 不存在或正在被导入");
+        }
+        taken.push_back(busid);
+        if (!std::dynamic_pointer_cast<Esp32DeviceHandler>(device->handler))
+        {
+            return fail("设备 " + busid + " 不是直通设备");
+        }
+
+        auto before = sources.size();
+        for (std::size_t i = 0; i < device->interfaces.size(); i++)
+        {
+            if (device->interfaces[i].interface_class != static_cast<std::uint8_t>(ClassCode::HID))
+            {
+                continue;
+            }
+            if (auto source = Esp32HidReportSource::create(device, static_cast<std::uint8_t>(i)))
+            {
+                sources.push_back(std::move(source));
+            }
+        }
+        if (sources.size() == before)
+        {
+            return fail("设备 " + busid + " 没有可用的 HID 接口");
+        }
+    }
+
+    auto member_count = sources.size();
+    auto device = make_hid_composite_device(string_pool, std::move(sources), config);
+    if (!device)
+    {
+        return fail("报告描述符无法合并");
+    }
+    ESP_LOGI(TAG, "%u 个设备的 %u 个 HID 接口合成为 %s", static_cast<unsigned>(taken.size()),
+             static_cast<unsigned>(member_count), config.busid.c_str());
+    result.device = device;
+    add_device(std::move(device));
+    return result;
+}
+
 usbipdcpp::Esp32Server::~Esp32Server()
 {
 }
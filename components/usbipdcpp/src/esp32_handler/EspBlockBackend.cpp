@@ -0,0 +1,197 @@
+#include "EspBlockBackend.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <esp_heap_caps.h>
+#include <spdlog/spdlog.h>
+
+namespace usbipdcpp
+{
+
+    RamDiskBlockBackend::RamDiskBlockBackend(std::uint32_t block_size, std::uint64_t block_count) :
+        block_size_(block_size)
+    {
+        auto bytes = static_cast<std::size_t>(block_size * block_count);
+        data_ = static_cast<std::uint8_t *>(heap_caps_calloc_prefer(bytes, 1, 2,
+                                                                    MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+                                                                    MALLOC_CAP_8BIT));
+        if (!data_)
+        {
+            SPDLOG_ERROR("RAM 盘: 分配 {} 字节失败", bytes);
+            return;
+        }
+        block_count_ = block_count;
+    }
+
+    RamDiskBlockBackend::~RamDiskBlockBackend()
+    {
+        heap_caps_free(data_);
+    }
+
+    bool RamDiskBlockBackend::read(std::uint64_t offset, std::uint8_t *dst, std::size_t length)
+    {
+        std::memcpy(dst, data_ + offset, length);
+        return true;
+    }
+
+    bool RamDiskBlockBackend::write(std::uint64_t offset, const std::uint8_t *src, std::size_t length)
+    {
+        std::memcpy(data_ + offset, src, length);
+        return true;
+    }
+
+    PartitionBlockBackend::PartitionBlockBackend(const esp_partition_t *partition, std::uint32_t block_size,
+                                                 bool read_only) : partition_(partition),
+                                                                   block_size_(block_size),
+                                                                   read_only_(read_only)
+    {
+        if (!partition_ || block_size_ == 0)
+        {
+            SPDLOG_ERROR("分区盘: 参数无效");
+            return;
+        }
+        if (!read_only_)
+        {
+            sector_buffer_ = static_cast<std::uint8_t *>(heap_caps_malloc(partition_->erase_size, MALLOC_CAP_8BIT));
+            if (!sector_buffer_)
+            {
+                SPDLOG_ERROR("分区盘: 分配扇区缓冲区失败");
+                return;
+            }
+        }
+
+        const void *mapped = nullptr;
+        auto err = esp_partition_mmap(partition_, 0, partition_->size, ESP_PARTITION_MMAP_DATA, &mapped,
+                                      &mmap_handle_);
+        if (err == ESP_OK)
+        {
+            mapped_ = static_cast<const std::uint8_t *>(mapped);
+        }
+        else
+        {
+            SPDLOG_WARN("分区盘: 映射分区 {} 失败，读取退回 esp_partition_read: {}", partition_->label,
+                        esp_err_to_name(err));
+        }
+        block_count_ = partition_->size / block_size_;
+        SPDLOG_INFO("分区盘: {}，{} 块 x {} 字节{}", partition_->label, block_count_, block_size_,
+                    read_only_ ? "，只读" : "");
+    }
+
+    PartitionBlockBackend::~PartitionBlockBackend()
+    {
+        if (mapped_)
+        {
+            esp_partition_munmap(mmap_handle_);
+        }
+        heap_caps_free(sector_buffer_);
+    }
+
+    const std::uint8_t *PartitionBlockBackend::map(std::uint64_t offset, std::size_t length)
+    {
+        if (!mapped_ || !commit_sector(offset, length))
+        {
+            return nullptr;
+        }
+        return mapped_ + offset;
+    }
+
+    bool PartitionBlockBackend::read(std::uint64_t offset, std::uint8_t *dst, std::size_t length)
+    {
+        if (!commit_sector(offset, length))
+        {
+            return false;
+        }
+        if (mapped_)
+        {
+            std::memcpy(dst, mapped_ + offset, length);
+            return true;
+        }
+        return esp_partition_read(partition_, offset, dst, length) == ESP_OK;
+    }
+
+    bool PartitionBlockBackend::write(std::uint64_t offset, const std::uint8_t *src, std::size_t length)
+    {
+        if (read_only_)
+        {
+            return false;
+        }
+        const std::size_t sector_size = partition_->erase_size;
+        while (length > 0)
+        {
+            auto sector_base = offset / sector_size * sector_size;
+            auto in_sector = static_cast<std::size_t>(offset - sector_base);
+            auto chunk = std::min(length, sector_size - in_sector);
+
+            if (chunk == sector_size)
+            {
+                if (sector_dirty_ && buffered_sector_ == sector_base)
+                {
+                    // 缓冲区中的修改整个被覆盖
+                    sector_dirty_ = false;
+                }
+                if (!program_sector(sector_base, src))
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                if (!sector_dirty_ || buffered_sector_ != sector_base)
+                {
+                    // 换到新的扇区，先写回上一个扇区再读出原内容
+                    if (!commit_sector(0, partition_->size) || !read(sector_base, sector_buffer_, sector_size))
+                    {
+                        return false;
+                    }
+                    buffered_sector_ = sector_base;
+                    sector_dirty_ = true;
+                }
+                std::memcpy(sector_buffer_ + in_sector, src, chunk);
+                // 顺序写入到了扇区末尾，之后不会再回到这个扇区
+                if (in_sector + chunk == sector_size && !commit_sector(sector_base, sector_size))
+                {
+                    return false;
+                }
+            }
+            offset += chunk;
+            src += chunk;
+            length -= chunk;
+        }
+        return true;
+    }
+
+    bool PartitionBlockBackend::flush()
+    {
+        return read_only_ || commit_sector(0, partition_->size);
+    }
+
+    bool PartitionBlockBackend::program_sector(std::uint64_t sector_base, const std::uint8_t *data)
+    {
+        const std::size_t sector_size = partition_->erase_size;
+        auto err = esp_partition_erase_range(partition_, sector_base, sector_size);
+        if (err == ESP_OK)
+        {
+            err = esp_partition_write(partition_, sector_base, data, sector_size);
+        }
+        if (err != ESP_OK)
+        {
+            SPDLOG_ERROR("分区盘: 写入偏移 {} 失败: {}", sector_base, esp_err_to_name(err));
+            return false;
+        }
+        return true;
+    }
+
+    bool PartitionBlockBackend::commit_sector(std::uint64_t offset, std::uint64_t length)
+    {
+        if (!sector_dirty_ || offset >= buffered_sector_ + partition_->erase_size ||
+            buffered_sector_ >= offset + length)
+        {
+            return true;
+        }
+        // 失败时这个扇区的修改丢失，由这次调用报告
+        sector_dirty_ = false;
+        return program_sector(buffered_sector_, sector_buffer_);
+    }
+
+} // namespace usbipdcpp
@@ -0,0 +1,45 @@
+#include "EspReplayTrace.h"
+
+#include <algorithm>
+#include <string_view>
+
+#include <esp_partition.h>
+#include <spdlog/spdlog.h>
+
+namespace usbipdcpp
+{
+    std::shared_ptr<const ReplayTrace> load_replay_trace_from_partition(const char *label)
+    {
+        auto partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, label);
+        if (!partition)
+        {
+            SPDLOG_ERROR("回放: 找不到分区 {}", label);
+            return nullptr;
+        }
+        const void *mapped = nullptr;
+        esp_partition_mmap_handle_t mmap_handle;
+        auto err = esp_partition_mmap(partition, 0, partition->size, ESP_PARTITION_MMAP_DATA, &mapped, &mmap_handle);
+        if (err != ESP_OK)
+        {
+            SPDLOG_ERROR("回放: 映射分区 {} 失败: {}", label, esp_err_to_name(err));
+            return nullptr;
+        }
+        auto begin = static_cast<const char *>(mapped);
+        auto end = std::find_if(begin, begin + partition->size, [](char c)
+                                { return c == '\0' || static_cast<std::uint8_t>(c) == 0xFF; });
+        // 解析时数据都复制出来了，之后就可以取消映射
+        auto trace = ReplayTrace::parse(std::string_view(begin, static_cast<std::size_t>(end - begin)));
+        esp_partition_munmap(mmap_handle);
+        if (!trace)
+        {
+            return nullptr;
+        }
+        std::size_t urbs = trace->control.size();
+        for (const auto &[ep, responses] : trace->endpoints)
+        {
+            urbs += responses.size();
+        }
+        SPDLOG_INFO("回放: 从分区 {} 读入 {} 个 URB，{} 个端点", label, urbs, trace->endpoints.size());
+        return std::make_shared<const ReplayTrace>(std::move(*trace));
+    }
+}
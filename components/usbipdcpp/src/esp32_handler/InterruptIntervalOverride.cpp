@@ -0,0 +1,87 @@
+#include "InterruptIntervalOverride.h"
+
+#include <algorithm>
+
+namespace usbipdcpp
+{
+    namespace
+    {
+        constexpr std::uint8_t REQUEST_GET_DESCRIPTOR = 0x06;
+        constexpr std::uint8_t DESCRIPTOR_TYPE_CONFIGURATION = 0x02;
+        constexpr std::uint8_t DESCRIPTOR_TYPE_INTERFACE = 0x04;
+        constexpr std::uint8_t DESCRIPTOR_TYPE_ENDPOINT = 0x05;
+        constexpr std::uint8_t TRANSFER_TYPE_MASK = 0x03;
+        constexpr std::uint8_t TRANSFER_TYPE_INTERRUPT = 0x03;
+    }
+
+    InterruptIntervalOverride::InterruptIntervalOverride(std::uint8_t interval_ms, bool hid_only)
+        : interval_ms_(std::max<std::uint8_t>(interval_ms, 1)), hid_only_(hid_only)
+    {
+    }
+
+    bool InterruptIntervalOverride::is_config_descriptor_request(const SetupPacket &setup)
+    {
+        return setup.request_type == 0x80 && setup.request == REQUEST_GET_DESCRIPTOR &&
+               (setup.value >> 8) == DESCRIPTOR_TYPE_CONFIGURATION;
+    }
+
+    bool InterruptIntervalOverride::should_rewrite(std::uint8_t interface_class, std::uint8_t attributes,
+                                                   std::uint8_t interval) const
+    {
+        if ((attributes & TRANSFER_TYPE_MASK) != TRANSFER_TYPE_INTERRUPT)
+        {
+            return false;
+        }
+        if (hid_only_ && interface_class != HID_CLASS)
+        {
+            return false;
+        }
+        return interval > interval_ms_;
+    }
+
+    std::size_t InterruptIntervalOverride::rewrite(std::uint8_t *data, std::size_t length) const
+    {
+        std::size_t rewritten = 0;
+        std::uint8_t interface_class = 0;
+        std::size_t offset = 0;
+        while (offset + 2 <= length)
+        {
+            auto descriptor_length = data[offset];
+            if (descriptor_length < 2)
+            {
+                break;
+            }
+            auto descriptor_type = data[offset + 1];
+            if (descriptor_type == DESCRIPTOR_TYPE_INTERFACE && offset + 6 <= length)
+            {
+                interface_class = data[offset + 5];
+            }
+            else if (descriptor_type == DESCRIPTOR_TYPE_ENDPOINT && descriptor_length >= 7 && offset + 7 <= length)
+            {
+                auto &interval = data[offset + 6];
+                if (should_rewrite(interface_class, data[offset + 3], interval))
+                {
+                    interval = interval_ms_;
+                    rewritten++;
+                }
+            }
+            offset += descriptor_length;
+        }
+        return rewritten;
+    }
+
+    void InterruptIntervalOverride::apply(std::vector<UsbInterface> &interfaces) const
+    {
+        for (auto &intf : interfaces)
+        {
+            for (auto &ep : intf.endpoints)
+            {
+                if (should_rewrite(intf.interface_class, ep.attributes, ep.interval))
+                {
+                    ep.interval = interval_ms_;
+                }
+            }
+        }
+    }
+
+} // namespace usbipdcpp
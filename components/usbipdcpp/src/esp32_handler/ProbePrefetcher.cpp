@@ -0,0 +1,404 @@
+#include "ProbePrefetcher.h"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include <spdlog/spdlog.h>
+
+#include "Esp32DeviceHandler.h"
+#include "Session.h"
+#include "protocol.h"
+
+namespace usbipdcpp
+{
+
+    ProbePrefetcher::ProbePrefetcher(Esp32DeviceHandler &handler, std::uint8_t command_ep, std::uint8_t response_ep,
+                                     std::uint16_t max_packet_size, std::uint32_t prefetch_length,
+                                     std::uint32_t expire_ms) : handler_(handler),
+                                                                command_ep_(command_ep),
+                                                                response_ep_(response_ep),
+                                                                max_packet_size_(max_packet_size ? max_packet_size : 64),
+                                                                prefetch_length_(std::max<std::uint32_t>(
+                                                                    (prefetch_length + max_packet_size_ - 1) / max_packet_size_ * max_packet_size_,
+                                                                    max_packet_size_)),
+                                                                expire_(expire_ms),
+                                                                anchor_(new CallbackAnchor{.self = this})
+    {
+    }
+
+    ProbePrefetcher::~ProbePrefetcher()
+    {
+        constexpr auto CANCEL_TIMEOUT = std::chrono::milliseconds(500);
+
+        {
+            std::lock_guard lock(mutex_);
+            waiting_.reset();
+            buffered_.reset();
+            if (transfer_ && completed_)
+            {
+                usb_host_transfer_free(transfer_);
+            }
+            transfer_ = nullptr;
+        }
+
+        if (anchor_->pending.load() != 0)
+        {
+            // 取消在途的预取和补读，回调随后以取消状态执行
+            std::lock_guard cancel_lock(handler_.endpoint_cancellation_mutex);
+            usb_host_endpoint_halt(handler_.native_handle, response_ep_);
+            usb_host_endpoint_flush(handler_.native_handle, response_ep_);
+            usb_host_endpoint_clear(handler_.native_handle, response_ep_);
+        }
+
+        std::unique_lock anchor_lock(anchor_->mutex);
+        if (anchor_->cv.wait_for(anchor_lock, CANCEL_TIMEOUT, [this]()
+                                 { return anchor_->pending.load() == 0; }))
+        {
+            return;
+        }
+        SPDLOG_WARN("端点 {:02x} 的预取传输在析构时仍未回调，之后的回调只释放传输", response_ep_);
+        anchor_->self = nullptr;
+        anchor_lock.unlock();
+        anchor_.release();
+    }
+
+    bool ProbePrefetcher::claim(std::uint32_t seqnum, std::uint32_t length)
+    {
+        std::lock_guard lock(mutex_);
+        if (buffered_)
+        {
+            // 上一次没读完的响应比设备之后发出的任何数据都早
+            stats_.hits++;
+            serve_buffered(seqnum, length);
+            return true;
+        }
+
+        if (!transfer_ || waiting_)
+        {
+            stats_.misses++;
+            return false;
+        }
+
+        if (!completed_)
+        {
+            // 预取还在等设备，客户端的 URB 直接挂在它上面
+            waiting_ = Waiting{seqnum, length};
+            stats_.late_hits++;
+            return true;
+        }
+
+        auto trx = transfer_;
+        transfer_ = nullptr;
+        stats_.hits++;
+        serve(seqnum, length, trx);
+        return true;
+    }
+
+    void ProbePrefetcher::on_command_complete()
+    {
+        std::lock_guard lock(mutex_);
+        arm();
+    }
+
+    void ProbePrefetcher::on_client_in_submitted()
+    {
+        std::lock_guard lock(mutex_);
+        client_in_flight_++;
+    }
+
+    void ProbePrefetcher::on_client_in_completed()
+    {
+        std::lock_guard lock(mutex_);
+        if (client_in_flight_ > 0)
+        {
+            client_in_flight_--;
+        }
+    }
+
+    void ProbePrefetcher::discard()
+    {
+        std::lock_guard lock(mutex_);
+        waiting_.reset();
+        buffered_.reset();
+        if (transfer_ && completed_)
+        {
+            usb_host_transfer_free(transfer_);
+            transfer_ = nullptr;
+        }
+        // 在途的预取保留，下一个会话的 IN 仍然可以接管它
+    }
+
+    void ProbePrefetcher::expire_pending()
+    {
+        std::lock_guard lock(mutex_);
+        // 已完成的结果是设备真实的响应，丢掉会让命令和响应错位，只取消还在等设备的预取
+        // 透传的 IN 在途时不能取消端点上的传输
+        if (!transfer_ || completed_ || waiting_ || expiring_ || client_in_flight_ > 0 || expire_.count() == 0 ||
+            std::chrono::steady_clock::now() - armed_time_ <= expire_)
+        {
+            return;
+        }
+        SPDLOG_DEBUG("端点 {:02x} 的预取等待设备超过 {} ms，取消", response_ep_, expire_.count());
+        expiring_ = true;
+        stats_.expired++;
+        std::lock_guard cancel_lock(handler_.endpoint_cancellation_mutex);
+        usb_host_endpoint_halt(handler_.native_handle, response_ep_);
+        usb_host_endpoint_flush(handler_.native_handle, response_ep_);
+        usb_host_endpoint_clear(handler_.native_handle, response_ep_);
+    }
+
+    ProbePrefetcher::Stats ProbePrefetcher::stats() const
+    {
+        std::lock_guard lock(mutex_);
+        return stats_;
+    }
+
+    bool ProbePrefetcher::arm()
+    {
+        if (transfer_ || buffered_ || client_in_flight_ > 0 || continuation_in_flight_ ||
+            handler_.all_transfer_should_stop || !handler_.has_device)
+        {
+            return false;
+        }
+
+        usb_transfer_t *trx = nullptr;
+        auto err = usb_host_transfer_alloc(prefetch_length_, 0, &trx);
+        if (err != ESP_OK)
+        {
+            SPDLOG_WARN("无法申请预取transfer: {}", esp_err_to_name(err));
+            return false;
+        }
+        trx->device_handle = handler_.native_handle;
+        trx->callback = prefetch_callback;
+        trx->context = anchor_.get();
+        trx->bEndpointAddress = response_ep_;
+        trx->num_bytes = static_cast<int>(prefetch_length_);
+
+        anchor_->pending.fetch_add(1);
+        {
+            std::shared_lock cancel_lock(handler_.endpoint_cancellation_mutex);
+            err = usb_host_transfer_submit(trx);
+        }
+        if (err != ESP_OK)
+        {
+            SPDLOG_WARN("预取transfer提交失败: {}", esp_err_to_name(err));
+            anchor_->pending.fetch_sub(1);
+            usb_host_transfer_free(trx);
+            return false;
+        }
+        transfer_ = trx;
+        completed_ = false;
+        armed_time_ = std::chrono::steady_clock::now();
+        stats_.armed++;
+        return true;
+    }
+
+    void ProbePrefetcher::finish_callback(CallbackAnchor *anchor, std::unique_lock<std::mutex> &lock)
+    {
+        bool orphaned = anchor->pending.fetch_sub(1) == 1 && !anchor->self;
+        anchor->cv.notify_all();
+        lock.unlock();
+        if (orphaned)
+        {
+            delete anchor;
+        }
+    }
+
+    void ProbePrefetcher::prefetch_callback(usb_transfer_t *trx)
+    {
+        auto anchor = static_cast<CallbackAnchor *>(trx->context);
+        std::unique_lock anchor_lock(anchor->mutex);
+        auto self = anchor->self;
+        if (!self)
+        {
+            usb_host_transfer_free(trx);
+            finish_callback(anchor, anchor_lock);
+            return;
+        }
+
+        std::unique_lock lock(self->mutex_);
+        self->completed_ = true;
+        if (std::exchange(self->expiring_, false) && trx->status == USB_TRANSFER_STATUS_CANCELED &&
+            trx->actual_num_bytes > 0)
+        {
+            // 取消前设备已经发出的数据同样是响应的一部分，不能丢，剩余部分由补读取得
+            trx->status = USB_TRANSFER_STATUS_COMPLETED;
+            self->truncated_ = true;
+        }
+        if (self->waiting_)
+        {
+            auto waiting = *self->waiting_;
+            self->waiting_.reset();
+            self->transfer_ = nullptr;
+            self->serve(waiting.seqnum, waiting.length, trx);
+        }
+        else if (trx->status != USB_TRANSFER_STATUS_COMPLETED)
+        {
+            // 被取消或设备已移除，没有数据可以保留
+            self->transfer_ = nullptr;
+            usb_host_transfer_free(trx);
+        }
+        // 否则保留到客户端的 IN 到达
+        lock.unlock();
+        finish_callback(anchor, anchor_lock);
+    }
+
+    void ProbePrefetcher::serve(std::uint32_t seqnum, std::uint32_t length, usb_transfer_t *trx)
+    {
+        auto session = handler_.session.load();
+        if (!session)
+        {
+            usb_host_transfer_free(trx);
+            return;
+        }
+
+        auto unlink_found = session->get_unlink_seqnum(seqnum);
+        if (std::get<0>(unlink_found))
+        {
+            session->submit_ret_unlink_and_then_remove_seqnum_unlink(
+                UsbIpResponse::UsbIpRetUnlink::create_ret_unlink(
+                    std::get<1>(unlink_found),
+                    Esp32DeviceHandler::trxstat2error(trx->status)),
+                seqnum);
+            usb_host_transfer_free(trx);
+            return;
+        }
+
+        if (trx->status != USB_TRANSFER_STATUS_COMPLETED)
+        {
+            session->submit_ret_submit(
+                UsbIpResponse::UsbIpRetSubmit::create_ret_submit_with_status_and_no_data(
+                    seqnum, Esp32DeviceHandler::trxstat2error(trx->status)));
+            usb_host_transfer_free(trx);
+            return;
+        }
+
+        auto actual = static_cast<std::uint32_t>(std::max(trx->actual_num_bytes, 0));
+        buffered_ = Buffered{
+            .transfer = std::shared_ptr<usb_transfer_t>(trx, usb_host_transfer_free),
+            .offset = 0,
+            .actual = actual,
+            .ended = actual < prefetch_length_ && !std::exchange(truncated_, false)};
+        serve_buffered(seqnum, length);
+    }
+
+    void ProbePrefetcher::serve_buffered(std::uint32_t seqnum, std::uint32_t length)
+    {
+        auto session = handler_.session.load();
+        if (!session)
+        {
+            return;
+        }
+
+        auto &buffered = *buffered_;
+        auto data = buffered.transfer->data_buffer + buffered.offset;
+        auto remaining = buffered.actual - buffered.offset;
+        if (!buffered.ended && length > remaining)
+        {
+            // 没有短包，说明设备的响应还没有结束
+            continue_read(seqnum, length, data, remaining);
+            buffered_.reset();
+            return;
+        }
+
+        // 客户端请求的比收到的短时只应答请求的长度，和直接透传时分成多个 URB 读取相同
+        auto served = std::min(length, remaining);
+        if (served < remaining)
+        {
+            stats_.splits++;
+        }
+        auto response = UsbIpResponse::UsbIpRetSubmit::create_ret_submit_view(
+            seqnum,
+            static_cast<std::uint32_t>(UrbStatusType::StatusOK),
+            buffered.transfer,
+            data,
+            served);
+        buffered.offset += served;
+        if (buffered.offset == buffered.actual)
+        {
+            buffered_.reset();
+        }
+        session->submit_ret_submit(std::move(response));
+    }
+
+    void ProbePrefetcher::continue_read(std::uint32_t seqnum, std::uint32_t length, const std::uint8_t *prefix,
+                                        std::size_t prefix_length)
+    {
+        stats_.continuations++;
+        auto buffer = std::make_shared<std::vector<std::uint8_t>>(prefix, prefix + prefix_length);
+
+        auto rest = length - static_cast<std::uint32_t>(prefix_length);
+        auto submit_length = (rest + max_packet_size_ - 1) / max_packet_size_ * max_packet_size_;
+
+        usb_transfer_t *next = nullptr;
+        auto err = usb_host_transfer_alloc(submit_length, 0, &next);
+        if (err == ESP_OK)
+        {
+            auto ctx = new ContinuationContext{anchor_.get(), seqnum, length, buffer};
+            next->device_handle = handler_.native_handle;
+            next->callback = continuation_callback;
+            next->context = ctx;
+            next->bEndpointAddress = response_ep_;
+            next->num_bytes = static_cast<int>(submit_length);
+            anchor_->pending.fetch_add(1);
+            {
+                std::shared_lock cancel_lock(handler_.endpoint_cancellation_mutex);
+                err = usb_host_transfer_submit(next);
+            }
+            if (err == ESP_OK)
+            {
+                continuation_in_flight_ = true;
+                return;
+            }
+            anchor_->pending.fetch_sub(1);
+            delete ctx;
+            usb_host_transfer_free(next);
+        }
+
+        SPDLOG_ERROR("预取补读失败: {}", esp_err_to_name(err));
+        if (auto session = handler_.session.load())
+        {
+            session->submit_ret_submit(
+                UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(seqnum));
+        }
+    }
+
+    void ProbePrefetcher::continuation_callback(usb_transfer_t *trx)
+    {
+        auto ctx = static_cast<ContinuationContext *>(trx->context);
+        auto anchor = ctx->anchor;
+        std::unique_lock anchor_lock(anchor->mutex);
+        auto self = anchor->self;
+        if (!self)
+        {
+            usb_host_transfer_free(trx);
+            delete ctx;
+            finish_callback(anchor, anchor_lock);
+            return;
+        }
+
+        std::unique_lock lock(self->mutex_);
+        self->continuation_in_flight_ = false;
+
+        auto session = self->handler_.session.load();
+        if (session)
+        {
+            auto status = Esp32DeviceHandler::trxstat2error(trx->status);
+            if (trx->status == USB_TRANSFER_STATUS_COMPLETED)
+            {
+                auto actual = std::min<std::size_t>(std::max(trx->actual_num_bytes, 0),
+                                                    ctx->length - ctx->buffer->size());
+                ctx->buffer->insert(ctx->buffer->end(), trx->data_buffer, trx->data_buffer + actual);
+            }
+            session->submit_ret_submit(
+                UsbIpResponse::UsbIpRetSubmit::create_ret_submit(
+                    ctx->seqnum, static_cast<std::uint32_t>(status), 0, 0, ctx->buffer, {}));
+        }
+        usb_host_transfer_free(trx);
+        delete ctx;
+        lock.unlock();
+        finish_callback(anchor, anchor_lock);
+    }
+
+} // namespace usbipdcpp
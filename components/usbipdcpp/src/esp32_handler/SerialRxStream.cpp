@@ -0,0 +1,371 @@
+#include "SerialRxStream.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <esp_heap_caps.h>
+#include <spdlog/spdlog.h>
+
+#include "Esp32DeviceHandler.h"
+#include "Session.h"
+#include "protocol.h"
+
+namespace usbipdcpp
+{
+
+    SerialRxStream::SerialRxStream(Esp32DeviceHandler &handler, std::uint8_t ep_address,
+                                   std::uint16_t max_packet_size, std::size_t transfer_count,
+                                   std::uint32_t transfer_size, std::size_t ring_bytes,
+                                   bool packet_framing) : handler_(handler),
+                                                          ep_address_(ep_address),
+                                                          max_packet_size_(max_packet_size ? max_packet_size : 64),
+                                                          packet_framing_(packet_framing)
+    {
+        // 有 PSRAM 时缓冲区放在 PSRAM，否则放在内部 RAM
+        ring_ = static_cast<std::uint8_t *>(heap_caps_malloc_prefer(ring_bytes, 2,
+                                                                    MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+                                                                    MALLOC_CAP_8BIT));
+        if (!ring_)
+        {
+            SPDLOG_ERROR("串口接收: 分配 {} 字节环形缓冲区失败", ring_bytes);
+            return;
+        }
+        capacity_ = ring_bytes;
+        stats_.capacity = capacity_;
+
+        // IN 传输的长度必须是最大包长的整数倍
+        auto submit_length = std::max<std::uint32_t>(
+            (transfer_size + max_packet_size_ - 1) / max_packet_size_ * max_packet_size_, max_packet_size_);
+        for (std::size_t i = 0; i < transfer_count; i++)
+        {
+            usb_transfer_t *trx = nullptr;
+            auto err = usb_host_transfer_alloc(submit_length, 0, &trx);
+            if (err != ESP_OK)
+            {
+                SPDLOG_WARN("串口接收: 只申请到 {} 个transfer: {}", transfers_.size(), esp_err_to_name(err));
+                break;
+            }
+            trx->device_handle = handler_.native_handle;
+            trx->callback = transfer_callback;
+            trx->context = this;
+            trx->bEndpointAddress = ep_address_;
+            trx->num_bytes = static_cast<int>(submit_length);
+            transfers_.push_back(trx);
+        }
+        idle_ = transfers_;
+    }
+
+    SerialRxStream::~SerialRxStream()
+    {
+        std::lock_guard lock(mutex_);
+        if (idle_.size() != transfers_.size())
+        {
+            // 在途的传输随设备关闭一起结束，不能在这里释放
+            SPDLOG_WARN("串口接收: 端点 {:02x} 还有 {} 个传输在途", ep_address_, transfers_.size() - idle_.size());
+        }
+        for (auto trx : idle_)
+        {
+            usb_host_transfer_free(trx);
+        }
+        heap_caps_free(ring_);
+    }
+
+    void SerialRxStream::claim(std::uint32_t seqnum, std::uint32_t length)
+    {
+        std::lock_guard lock(mutex_);
+        if (waiting_.empty() && size_ > 0)
+        {
+            stats_.immediate_urbs++;
+            deliver(seqnum, length);
+        }
+        else
+        {
+            stats_.waited_urbs++;
+            waiting_.push_back({seqnum, length});
+        }
+
+        if (!running_)
+        {
+            arm();
+        }
+        drain_waiting();
+    }
+
+    bool SerialRxStream::unlink(std::uint32_t seqnum)
+    {
+        std::lock_guard lock(mutex_);
+        auto it = std::find_if(waiting_.begin(), waiting_.end(), [seqnum](const Waiting &w)
+                               { return w.seqnum == seqnum; });
+        if (it == waiting_.end())
+        {
+            return false;
+        }
+        waiting_.erase(it);
+
+        auto session = handler_.session.load();
+        if (session)
+        {
+            auto unlink_found = session->get_unlink_seqnum(seqnum);
+            if (std::get<0>(unlink_found))
+            {
+                session->submit_ret_unlink_and_then_remove_seqnum_unlink(
+                    UsbIpResponse::UsbIpRetUnlink::create_ret_unlink(
+                        std::get<1>(unlink_found),
+                        static_cast<std::uint32_t>(UrbStatusType::StatusECONNRESET)),
+                    seqnum);
+            }
+        }
+        return true;
+    }
+
+    void SerialRxStream::stop()
+    {
+        std::lock_guard lock(mutex_);
+        running_ = false;
+        fault_status_ = 0;
+        waiting_.clear();
+        head_ = 0;
+        size_ = 0;
+        records_.clear();
+    }
+
+    SerialRxStream::Stats SerialRxStream::stats() const
+    {
+        std::lock_guard lock(mutex_);
+        return stats_;
+    }
+
+    void SerialRxStream::arm()
+    {
+        if (handler_.all_transfer_should_stop || !handler_.has_device || fault_status_ != 0)
+        {
+            return;
+        }
+
+        running_ = true;
+        while (!idle_.empty())
+        {
+            if (!submit(idle_.back()))
+            {
+                break;
+            }
+            idle_.pop_back();
+        }
+
+        if (idle_.size() == transfers_.size())
+        {
+            // 一个都没有提交成功，让等待的 URB 失败，避免客户端一直等下去
+            running_ = false;
+            fault_status_ = static_cast<int>(UrbStatusType::StatusEPIPE);
+        }
+    }
+
+    bool SerialRxStream::submit(usb_transfer_t *trx)
+    {
+        esp_err_t err;
+        {
+            std::shared_lock cancel_lock(handler_.endpoint_cancellation_mutex);
+            err = usb_host_transfer_submit(trx);
+        }
+        if (err != ESP_OK)
+        {
+            SPDLOG_WARN("串口接收: 端点 {:02x} 提交失败: {}", ep_address_, esp_err_to_name(err));
+            return false;
+        }
+        return true;
+    }
+
+    void SerialRxStream::transfer_callback(usb_transfer_t *trx)
+    {
+        auto self = static_cast<SerialRxStream *>(trx->context);
+        std::lock_guard lock(self->mutex_);
+
+        if (self->handler_.all_transfer_should_stop)
+        {
+            // 会话已经结束，数据没有人要
+            self->idle_.push_back(trx);
+            return;
+        }
+
+        switch (trx->status)
+        {
+        case USB_TRANSFER_STATUS_COMPLETED:
+        case USB_TRANSFER_STATUS_CANCELED:
+            // 被取消的传输可能已经收到了一部分数据
+            self->push(trx->data_buffer, static_cast<std::size_t>(std::max(trx->actual_num_bytes, 0)));
+            break;
+        case USB_TRANSFER_STATUS_NO_DEVICE:
+            self->handler_.has_device = false;
+            self->running_ = false;
+            self->fault_status_ = Esp32DeviceHandler::trxstat2error(trx->status);
+            break;
+        default:
+            SPDLOG_WARN("串口接收: 端点 {:02x} 传输失败，状态 {}", self->ep_address_, (int)trx->status);
+            self->running_ = false;
+            self->fault_status_ = Esp32DeviceHandler::trxstat2error(trx->status);
+            break;
+        }
+
+        if (!self->running_ || !self->submit(trx))
+        {
+            self->idle_.push_back(trx);
+            if (self->running_ && self->idle_.size() == self->transfers_.size())
+            {
+                self->running_ = false;
+                self->fault_status_ = static_cast<int>(UrbStatusType::StatusEPIPE);
+            }
+        }
+
+        self->drain_waiting();
+    }
+
+    void SerialRxStream::push(const std::uint8_t *data, std::size_t length)
+    {
+        if (length == 0)
+        {
+            return;
+        }
+        stats_.bytes_received += length;
+
+        // FTDI 即使没有数据也会定时发送只有 2 字节状态的包，缓冲区中已有数据时不保留
+        if (packet_framing_ && length <= 2 && !records_.empty())
+        {
+            return;
+        }
+
+        auto free_bytes = capacity_ - size_;
+        auto n = std::min(length, free_bytes);
+        if (packet_framing_ && n < length)
+        {
+            // 按包切分的数据不能只保留一部分
+            n = 0;
+        }
+        if (n < length)
+        {
+            stats_.overflow_bytes += length - n;
+            stats_.overflow_events++;
+        }
+        if (n == 0)
+        {
+            return;
+        }
+
+        auto tail = (head_ + size_) % capacity_;
+        auto first = std::min(n, capacity_ - tail);
+        std::memcpy(ring_ + tail, data, first);
+        std::memcpy(ring_, data + first, n - first);
+        size_ += n;
+        if (packet_framing_)
+        {
+            records_.push_back(n);
+        }
+        stats_.peak_fill = std::max(stats_.peak_fill, size_);
+    }
+
+    std::size_t SerialRxStream::next_chunk(std::uint32_t length) const
+    {
+        if (!packet_framing_)
+        {
+            return std::min<std::size_t>(length, size_);
+        }
+
+        // 客户端按最大包长解析状态头，只有以短包结尾的记录之后不能再接其它数据
+        std::size_t total = 0;
+        for (auto record : records_)
+        {
+            if (total + record <= length)
+            {
+                total += record;
+                if (record % max_packet_size_ != 0)
+                {
+                    break;
+                }
+                continue;
+            }
+            total += (length - total) / max_packet_size_ * max_packet_size_;
+            break;
+        }
+        if (total == 0 && !records_.empty())
+        {
+            // URB 比一个包还小，只能截断
+            total = std::min<std::size_t>(length, records_.front());
+        }
+        return total;
+    }
+
+    void SerialRxStream::pop(std::uint8_t *dst, std::size_t length)
+    {
+        auto first = std::min(length, capacity_ - head_);
+        std::memcpy(dst, ring_ + head_, first);
+        std::memcpy(dst + first, ring_, length - first);
+        head_ = (head_ + length) % capacity_;
+        size_ -= length;
+
+        if (packet_framing_)
+        {
+            while (length > 0 && !records_.empty())
+            {
+                auto n = std::min(length, records_.front());
+                records_.front() -= n;
+                length -= n;
+                if (records_.front() == 0)
+                {
+                    records_.pop_front();
+                }
+            }
+        }
+    }
+
+    void SerialRxStream::deliver(std::uint32_t seqnum, std::uint32_t length)
+    {
+        auto session = handler_.session.load();
+        if (!session)
+        {
+            return;
+        }
+
+        auto unlink_found = session->get_unlink_seqnum(seqnum);
+        if (std::get<0>(unlink_found))
+        {
+            // 数据留在缓冲区给下一个 URB
+            session->submit_ret_unlink_and_then_remove_seqnum_unlink(
+                UsbIpResponse::UsbIpRetUnlink::create_ret_unlink(
+                    std::get<1>(unlink_found),
+                    static_cast<std::uint32_t>(UrbStatusType::StatusECONNRESET)),
+                seqnum);
+            return;
+        }
+
+        auto buffer = std::make_shared<data_type>(next_chunk(length));
+        pop(buffer->data(), buffer->size());
+        stats_.bytes_delivered += buffer->size();
+        session->submit_ret_submit(
+            UsbIpResponse::UsbIpRetSubmit::create_ret_submit(
+                seqnum, static_cast<std::uint32_t>(UrbStatusType::StatusOK), 0, 0, buffer, {}));
+    }
+
+    void SerialRxStream::drain_waiting()
+    {
+        while (!waiting_.empty() && size_ > 0)
+        {
+            auto waiting = waiting_.front();
+            waiting_.pop_front();
+            deliver(waiting.seqnum, waiting.length);
+        }
+
+        if (fault_status_ != 0 && !waiting_.empty())
+        {
+            // 缓冲的数据都交出去之后再报告错误，只报告一次
+            auto waiting = waiting_.front();
+            waiting_.pop_front();
+            if (auto session = handler_.session.load())
+            {
+                session->submit_ret_submit(
+                    UsbIpResponse::UsbIpRetSubmit::create_ret_submit_with_status_and_no_data(
+                        waiting.seqnum, static_cast<std::uint32_t>(fault_status_)));
+            }
+            fault_status_ = 0;
+        }
+    }
+
+} // namespace usbipdcpp
@@ -0,0 +1,231 @@
+#include "TaskTopology.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <esp_log.h>
+#include <nvs.h>
+
+namespace usbipdcpp
+{
+    namespace
+    {
+        const char *TAG = "TaskTopology";
+
+        constexpr const char *NVS_NAMESPACE = "usbipd";
+        constexpr const char *NVS_KEY = "topology";
+
+        constexpr int CORE_0 = 0;
+        constexpr int CORE_1 = 1;
+
+        // Wi-Fi 和 lwIP 的任务默认在核心0
+        constexpr std::array<TaskTopologyProfile, 2> PROFILES{{
+            {
+                .name = "usb_core1",
+                .description = "Wi-Fi/lwIP 独占核心0，USB 和会话在核心1",
+                .tasks = {{
+                    {"main_worker", CORE_1, 8192, 5},
+                    {"usb_host_event", CORE_1, 4096, 10},
+                    {"client_event", CORE_1, 16384, 6},
+                    {"network_io", CORE_0, 16384, 5},
+                    {"session", CORE_1, 16384, 5},
+                    {"usb_completion", CORE_1, 8192, 6},
+                    {"bot_flush", CORE_1, 4096, 4},
+                    {"enum_cache", CORE_0, 6144, 3},
+                }},
+            },
+            {
+                .name = "split",
+                .description = "USB 在核心1，会话和网络与 Wi-Fi/lwIP 一起在核心0",
+                .tasks = {{
+                    {"main_worker", CORE_0, 8192, 5},
+                    {"usb_host_event", CORE_1, 4096, 10},
+                    {"client_event", CORE_1, 16384, 6},
+                    {"network_io", CORE_0, 16384, 5},
+                    {"session", CORE_0, 16384, 5},
+                    {"usb_completion", CORE_1, 8192, 6},
+                    {"bot_flush", CORE_1, 4096, 4},
+                    {"enum_cache", CORE_0, 6144, 3},
+                }},
+            },
+        }};
+
+        const char *ROLE_NAMES[] = {
+            "MainWorker", "UsbHostEvent", "ClientEvent", "NetworkIo", "Session", "CompletionWorker", "BotFlush", "EnumCache"};
+
+        BaseType_t to_freertos_core(int core)
+        {
+            return core == TaskTopology::NO_AFFINITY ? tskNO_AFFINITY : static_cast<BaseType_t>(core);
+        }
+    }
+
+    TaskTopology &TaskTopology::instance()
+    {
+        static TaskTopology topology;
+        return topology;
+    }
+
+    std::span<const TaskTopologyProfile> TaskTopology::builtin_profiles()
+    {
+        return PROFILES;
+    }
+
+    bool TaskTopology::select(std::string_view name)
+    {
+        auto it = std::find_if(PROFILES.begin(), PROFILES.end(), [name](const TaskTopologyProfile &p)
+                               { return name == p.name; });
+        if (it == PROFILES.end())
+        {
+            ESP_LOGW(TAG, "没有名为 %.*s 的任务方案", static_cast<int>(name.size()), name.data());
+            return false;
+        }
+
+        std::lock_guard lock(mutex_);
+        auto previous = current_ ? current_ : &PROFILES[0];
+        current_ = &*it;
+        for (const auto &task : registered_)
+        {
+            if ((*previous)[task.role].core != (*current_)[task.role].core)
+            {
+                ESP_LOGW(TAG, "%s 的核心绑定在重启后生效", (*current_)[task.role].name);
+            }
+        }
+        apply_priorities();
+        ESP_LOGI(TAG, "切换到任务方案 %s: %s", current_->name, current_->description);
+        return true;
+    }
+
+    const TaskTopologyProfile &TaskTopology::current() const
+    {
+        std::lock_guard lock(mutex_);
+        return current_ ? *current_ : PROFILES[0];
+    }
+
+    TaskPlacement TaskTopology::placement(TaskRole role) const
+    {
+        return current()[role];
+    }
+
+    esp_pthread_cfg_t TaskTopology::pthread_config(TaskRole role) const
+    {
+        auto p = placement(role);
+        auto cfg = esp_pthread_get_default_config();
+        cfg.thread_name = p.name;
+        cfg.pin_to_core = to_freertos_core(p.core);
+        cfg.stack_size = p.stack_size;
+        cfg.prio = p.priority;
+        return cfg;
+    }
+
+    BaseType_t TaskTopology::create_task(TaskRole role, TaskFunction_t func, void *arg, TaskHandle_t *handle)
+    {
+        auto p = placement(role);
+        TaskHandle_t created = nullptr;
+        auto ret = xTaskCreatePinnedToCore(func, p.name, p.stack_size, arg, p.priority, &created,
+                                           to_freertos_core(p.core));
+        if (ret == pdPASS)
+        {
+            register_task(role, created);
+            if (handle)
+            {
+                *handle = created;
+            }
+        }
+        else
+        {
+            ESP_LOGE(TAG, "创建任务 %s 失败", p.name);
+        }
+        return ret;
+    }
+
+    void TaskTopology::apply_to_current_thread(TaskRole role) const
+    {
+        auto cfg = pthread_config(role);
+        esp_pthread_set_cfg(&cfg);
+    }
+
+    void TaskTopology::register_task(TaskRole role, TaskHandle_t handle)
+    {
+        std::lock_guard lock(mutex_);
+        registered_.push_back({role, handle});
+    }
+
+    void TaskTopology::unregister_task(TaskHandle_t handle)
+    {
+        std::lock_guard lock(mutex_);
+        std::erase_if(registered_, [handle](const RegisteredTask &t)
+                      { return t.handle == handle; });
+    }
+
+    void TaskTopology::apply_priorities()
+    {
+        auto &profile = current_ ? *current_ : PROFILES[0];
+        for (const auto &task : registered_)
+        {
+            vTaskPrioritySet(task.handle, profile[task.role].priority);
+        }
+    }
+
+    esp_err_t TaskTopology::load_from_nvs()
+    {
+        nvs_handle_t handle;
+        auto err = nvs_open(NVS_NAMESPACE, NVS_READONLY, &handle);
+        if (err != ESP_OK)
+        {
+            // 从来没有保存过
+            return err;
+        }
+
+        char name[32] = {0};
+        size_t length = sizeof(name);
+        err = nvs_get_str(handle, NVS_KEY, name, &length);
+        nvs_close(handle);
+        if (err != ESP_OK)
+        {
+            return err;
+        }
+        return select(name) ? ESP_OK : ESP_ERR_NOT_FOUND;
+    }
+
+    esp_err_t TaskTopology::save_to_nvs() const
+    {
+        nvs_handle_t handle;
+        auto err = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &handle);
+        if (err != ESP_OK)
+        {
+            ESP_LOGE(TAG, "打开NVS失败: %s", esp_err_to_name(err));
+            return err;
+        }
+        err = nvs_set_str(handle, NVS_KEY, current().name);
+        if (err == ESP_OK)
+        {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+        return err;
+    }
+
+    void TaskTopology::log_current() const
+    {
+        const auto &profile = current();
+        ESP_LOGI(TAG, "任务方案 %s: %s", profile.name, profile.description);
+        for (std::size_t i = 0; i < profile.tasks.size(); i++)
+        {
+            const auto &p = profile.tasks[i];
+            ESP_LOGI(TAG, "  %-16s %-16s 核心=%d 优先级=%u 栈=%lu", ROLE_NAMES[i], p.name, p.core,
+                     static_cast<unsigned>(p.priority), static_cast<unsigned long>(p.stack_size));
+        }
+    }
+
+    TaskTopology::ScopedThreadConfig::ScopedThreadConfig(TaskRole role)
+    {
+        TaskTopology::instance().apply_to_current_thread(role);
+    }
+
+    TaskTopology::ScopedThreadConfig::~ScopedThreadConfig()
+    {
+        esp_pthread_cfg_t default_cfg = esp_pthread_get_default_config();
+        esp_pthread_set_cfg(&default_cfg);
+    }
+
+} // namespace usbipdcpp
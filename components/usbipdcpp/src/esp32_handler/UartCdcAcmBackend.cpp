@@ -0,0 +1,186 @@
+#include "UartCdcAcmBackend.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+
+#include <spdlog/spdlog.h>
+
+namespace usbipdcpp
+{
+
+    UartCdcAcmBackend::UartCdcAcmBackend(uart_port_t uart, int tx_pin, int rx_pin, std::size_t buffer_bytes) :
+        uart_(uart)
+    {
+        auto err = uart_driver_install(uart_, static_cast<int>(buffer_bytes), static_cast<int>(buffer_bytes), 0,
+                                       nullptr, 0);
+        if (err != ESP_OK)
+        {
+            SPDLOG_ERROR("CDC UART: 安装 UART{} 驱动失败: {}", static_cast<int>(uart_), esp_err_to_name(err));
+            return;
+        }
+        installed_ = true;
+
+        uart_config_t config = {
+            .baud_rate = static_cast<int>(baud_rate_),
+            .data_bits = UART_DATA_8_BITS,
+            .parity = UART_PARITY_DISABLE,
+            .stop_bits = UART_STOP_BITS_1,
+            .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+            .source_clk = UART_SCLK_DEFAULT,
+        };
+        ESP_ERROR_CHECK(uart_param_config(uart_, &config));
+        ESP_ERROR_CHECK(uart_set_pin(uart_, tx_pin, rx_pin, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+    }
+
+    UartCdcAcmBackend::~UartCdcAcmBackend()
+    {
+        stop();
+        if (installed_)
+        {
+            uart_driver_delete(uart_);
+        }
+    }
+
+    void UartCdcAcmBackend::start(CdcAcmPort &port)
+    {
+        if (!installed_ || running_)
+        {
+            return;
+        }
+        uart_flush_input(uart_);
+        running_ = true;
+        rx_thread_ = std::thread([this, &port]()
+                                 { rx_loop(port); });
+        tx_thread_ = std::thread([this, &port]()
+                                 { tx_loop(port); });
+    }
+
+    void UartCdcAcmBackend::stop()
+    {
+        {
+            std::lock_guard lock(tx_mutex_);
+            running_ = false;
+        }
+        tx_cv_.notify_all();
+        if (rx_thread_.joinable())
+        {
+            rx_thread_.join();
+        }
+        if (tx_thread_.joinable())
+        {
+            tx_thread_.join();
+        }
+    }
+
+    void UartCdcAcmBackend::on_data_from_host(CdcAcmPort &port)
+    {
+        {
+            std::lock_guard lock(tx_mutex_);
+            tx_pending_ = true;
+        }
+        tx_cv_.notify_one();
+    }
+
+    void UartCdcAcmBackend::on_line_coding(CdcAcmPort &port, const CdcLineCoding &line_coding)
+    {
+        if (!installed_)
+        {
+            return;
+        }
+        if (line_coding.baud_rate != 0)
+        {
+            baud_rate_ = line_coding.baud_rate;
+            uart_set_baudrate(uart_, baud_rate_);
+        }
+        if (line_coding.data_bits >= 5 && line_coding.data_bits <= 8)
+        {
+            uart_set_word_length(uart_, static_cast<uart_word_length_t>(line_coding.data_bits - 5));
+        }
+        switch (line_coding.parity)
+        {
+        case 1:
+            uart_set_parity(uart_, UART_PARITY_ODD);
+            break;
+        case 2:
+            uart_set_parity(uart_, UART_PARITY_EVEN);
+            break;
+        default:
+            // mark/space 校验 UART 不支持，按无校验处理
+            uart_set_parity(uart_, UART_PARITY_DISABLE);
+            break;
+        }
+        switch (line_coding.stop_bits)
+        {
+        case 1:
+            uart_set_stop_bits(uart_, UART_STOP_BITS_1_5);
+            break;
+        case 2:
+            uart_set_stop_bits(uart_, UART_STOP_BITS_2);
+            break;
+        default:
+            uart_set_stop_bits(uart_, UART_STOP_BITS_1);
+            break;
+        }
+    }
+
+    void UartCdcAcmBackend::on_break(CdcAcmPort &port, std::uint16_t duration_ms)
+    {
+        if (!installed_ || duration_ms == 0)
+        {
+            return;
+        }
+        // 驱动的 break 长度以位时间计，最多 255
+        auto bits = std::clamp<std::uint64_t>(static_cast<std::uint64_t>(baud_rate_) * duration_ms / 1000, 1, 255);
+        uart_write_bytes_with_break(uart_, "", 0, static_cast<int>(bits));
+    }
+
+    void UartCdcAcmBackend::rx_loop(CdcAcmPort &port)
+    {
+        std::array<std::uint8_t, 256> buffer{};
+        while (running_)
+        {
+            auto space = port.writable();
+            if (space == 0)
+            {
+                // 主机来不及取，数据留在 UART 驱动的缓冲区里
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                continue;
+            }
+            auto n = uart_read_bytes(uart_, buffer.data(), std::min(buffer.size(), space), pdMS_TO_TICKS(10));
+            if (n > 0)
+            {
+                port.write(buffer.data(), static_cast<std::size_t>(n));
+            }
+        }
+    }
+
+    void UartCdcAcmBackend::tx_loop(CdcAcmPort &port)
+    {
+        std::array<std::uint8_t, 256> buffer{};
+        while (true)
+        {
+            {
+                std::unique_lock lock(tx_mutex_);
+                tx_cv_.wait(lock, [this]()
+                            { return tx_pending_ || !running_; });
+                if (!running_)
+                {
+                    return;
+                }
+                tx_pending_ = false;
+            }
+            // read 腾出空间后暂存的 OUT URB 会被应答，主机随之发来下一批
+            while (running_)
+            {
+                auto n = port.read(buffer.data(), buffer.size());
+                if (n == 0)
+                {
+                    break;
+                }
+                uart_write_bytes(uart_, buffer.data(), n);
+            }
+        }
+    }
+
+} // namespace usbipdcpp
@@ -0,0 +1,192 @@
+#include "UsbThroughputProbe.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include <esp_timer.h>
+#include <spdlog/spdlog.h>
+
+#include "Esp32DeviceHandler.h"
+#include "BotProtocol.h"
+
+namespace usbipdcpp
+{
+
+    UsbThroughputProbe::UsbThroughputProbe(const Config &config) : config_(config)
+    {
+    }
+
+    void UsbThroughputProbe::on_response(const UsbIpResponse::UsbIpRetSubmit &response)
+    {
+        auto now = esp_timer_get_time();
+        std::lock_guard lock(mutex_);
+        auto submitted = submit_times_[response.header.seqnum % submit_times_.size()];
+        latency_.record(static_cast<std::uint64_t>(std::max<std::int64_t>(now - submitted, 0)));
+        completed_++;
+        if (response.status != static_cast<std::uint32_t>(UrbStatusType::StatusOK))
+        {
+            failed_++;
+        }
+        else
+        {
+            bytes_ += response.actual_length;
+        }
+        if (in_flight_ > 0)
+        {
+            in_flight_--;
+        }
+        cv_.notify_all();
+    }
+
+    UsbThroughputProbe::Result UsbThroughputProbe::run(Esp32DeviceHandler &handler, const Config &config)
+    {
+        Result result;
+
+        const UsbEndpoint *ep = nullptr;
+        UsbInterface *interface = nullptr;
+        for (auto &intf : handler.handle_device.interfaces)
+        {
+            for (auto &endpoint : intf.endpoints)
+            {
+                if (endpoint.address == config.ep_address)
+                {
+                    ep = &endpoint;
+                    interface = &intf;
+                }
+            }
+        }
+        if (!ep || (ep->attributes & 0x03) != static_cast<std::uint8_t>(EndpointAttributes::Bulk))
+        {
+            result.error = "不是 bulk 端点";
+            return result;
+        }
+        if (handler.find_serial_stream(ep->address) ||
+            (handler.probe_prefetcher_ && (ep->address == handler.probe_prefetcher_->command_ep() ||
+                                           ep->address == handler.probe_prefetcher_->response_ep())))
+        {
+            result.error = "端点由串口接收或调试器预取占用";
+            return result;
+        }
+        if (handler.bot_snoop_enabled() &&
+            bot::is_bot_interface(interface->interface_class, interface->interface_subclass,
+                                  interface->interface_protocol))
+        {
+            result.error = "BOT 接口启用了读缓存或写合并，不能直接测试";
+            return result;
+        }
+        if (!handler.has_device || config.transfer_size == 0)
+        {
+            result.error = "设备已移除或参数无效";
+            return result;
+        }
+
+        auto effective = config;
+        effective.queue_depth = std::clamp<std::uint8_t>(config.queue_depth, 1, MAX_QUEUE_DEPTH);
+        UsbThroughputProbe probe(effective);
+        {
+            std::unique_lock lock(handler.throughput_probe_mutex_);
+            if (handler.session.load() || handler.throughput_probe_.load())
+            {
+                result.error = "设备正在被使用";
+                return result;
+            }
+            handler.throughput_probe_ = &probe;
+        }
+
+        handler.start_completion_worker();
+        handler.all_transfer_should_stop = false;
+        auto busy_before = handler.completion_stats() ? handler.completion_stats()->busy_us : 0;
+
+        data_type out_data;
+        if (!ep->is_in())
+        {
+            out_data.assign(effective.transfer_size, 0xA5);
+        }
+
+        std::uint64_t submit_busy_us = 0;
+        std::uint32_t seqnum = 0;
+        bool stalled = false;
+        auto start = esp_timer_get_time();
+        auto deadline = start + static_cast<std::int64_t>(effective.duration_ms) * 1000;
+        std::int64_t end = start;
+        {
+            std::unique_lock lock(probe.mutex_);
+            while (true)
+            {
+                auto now = esp_timer_get_time();
+                end = now;
+                if (now >= deadline || !handler.has_device)
+                {
+                    if (probe.in_flight_ == 0)
+                    {
+                        break;
+                    }
+                }
+                else if (probe.in_flight_ < effective.queue_depth)
+                {
+                    auto seq = ++seqnum;
+                    probe.submit_times_[seq % probe.submit_times_.size()] = now;
+                    probe.in_flight_++;
+                    lock.unlock();
+
+                    std::error_code ec;
+                    handler.handle_bulk_transfer(seq, *ep, *interface, 0, effective.transfer_size, out_data, ec);
+                    submit_busy_us += static_cast<std::uint64_t>(esp_timer_get_time() - now);
+
+                    lock.lock();
+                    if (ec)
+                    {
+                        // 出错时 handle_bulk_transfer 不会应答
+                        probe.in_flight_--;
+                        result.error = "提交失败: " + ec.message();
+                        deadline = now;
+                    }
+                    continue;
+                }
+
+                auto completed = probe.completed_;
+                if (!probe.cv_.wait_for(lock, std::chrono::milliseconds(effective.stall_timeout_ms),
+                                        [&]()
+                                        { return probe.completed_ != completed; }))
+                {
+                    stalled = true;
+                    break;
+                }
+            }
+        }
+
+        handler.all_transfer_should_stop = true;
+        if (stalled)
+        {
+            result.error = "端点 " + std::to_string(effective.stall_timeout_ms) + " ms 内没有完成任何传输";
+            handler.cancel_endpoint_all_transfers(ep->address);
+        }
+        {
+            std::unique_lock lock(handler.throughput_probe_mutex_);
+            handler.throughput_probe_ = nullptr;
+        }
+        if (stalled)
+        {
+            // 被取消的传输在 all_transfer_should_stop 分支中直接释放，不会从追踪器移除
+            handler.transfer_tracker_.clear();
+        }
+
+        auto busy_after = handler.completion_stats() ? handler.completion_stats()->busy_us : busy_before;
+
+        std::lock_guard lock(probe.mutex_);
+        result.transfers = probe.completed_;
+        result.failed = probe.failed_;
+        result.bytes = probe.bytes_;
+        result.elapsed_us = static_cast<std::uint64_t>(std::max<std::int64_t>(end - start, 1));
+        result.mb_per_s = static_cast<double>(result.bytes) / static_cast<double>(result.elapsed_us);
+        result.latency_avg_us = probe.latency_.average_us();
+        result.latency_p50_us = probe.latency_.percentile_us(50);
+        result.latency_p90_us = probe.latency_.percentile_us(90);
+        result.latency_p99_us = probe.latency_.percentile_us(99);
+        result.latency_max_us = probe.latency_.max_us();
+        result.cpu_percent = static_cast<double>(submit_busy_us + (busy_after - busy_before)) * 100.0 /
+                             static_cast<double>(result.elapsed_us);
+        return result;
+    }
+
+} // namespace usbipdcpp
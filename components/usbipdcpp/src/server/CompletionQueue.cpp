@@ -0,0 +1,83 @@
+#include "CompletionQueue.h"
+
+#include <spdlog/spdlog.h>
+
+bool usbipdcpp::CompletionQueue::push(UsbIpResponse::RetVariant &&response)
+{
+    if (closed())
+    {
+        SPDLOG_DEBUG("应答队列已关闭，丢弃应答");
+        return false;
+    }
+
+    bool queued = false;
+    if (!has_overflow.load(std::memory_order_acquire))
+    {
+        // 失败时 response 保持不变
+        queued = ring.try_push(std::move(response));
+    }
+    if (!queued)
+    {
+        std::lock_guard lock(overflow_mutex);
+        overflow.emplace_back(std::move(response));
+        has_overflow.store(true, std::memory_order_release);
+        overflow_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 和 prepare_wait 中的 exchange 构成全序：
+    // 要么这里读到 false 由本线程唤醒，要么消费者清标志时能看到这次入队
+    return !wakeup_pending.exchange(true, std::memory_order_acq_rel);
+}
+
+std::size_t usbipdcpp::CompletionQueue::pop_batch(std::vector<UsbIpResponse::RetVariant> &out, std::size_t max)
+{
+    std::size_t count = 0;
+    auto take_spilled = [&]()
+    {
+        while (count < max && !spilled.empty())
+        {
+            out.emplace_back(std::move(spilled.front()));
+            spilled.pop_front();
+            count++;
+        }
+    };
+
+    // 换出来的应答比之后进入无锁队列的早
+    take_spilled();
+    while (count < max)
+    {
+        auto response = ring.try_pop();
+        if (!response)
+        {
+            break;
+        }
+        out.emplace_back(std::move(*response));
+        count++;
+    }
+
+    // 溢出期间生产者不再写无锁队列，其中的应答都比溢出队列中的早。
+    // 还有生产者抢占了槽位没写完时不能越过它，等它写完后唤醒消费者再取
+    if (count < max && has_overflow.load(std::memory_order_acquire) && ring.size_approx() == 0)
+    {
+        {
+            std::lock_guard lock(overflow_mutex);
+            // 走到这里 spilled 一定已经取空
+            spilled.swap(overflow);
+            has_overflow.store(false, std::memory_order_release);
+        }
+        take_spilled();
+    }
+    return count;
+}
+
+bool usbipdcpp::CompletionQueue::prepare_wait()
+{
+    wakeup_pending.exchange(false, std::memory_order_acq_rel);
+    // 生产者已经抢占槽位但还没写完时 front 为空，它写完后会读到 false 并负责唤醒
+    if (!spilled.empty() || ring.front() != nullptr)
+    {
+        return false;
+    }
+    // 溢出队列要等无锁队列中没写完的槽写完才能取，同样由那个生产者唤醒
+    return !has_overflow.load(std::memory_order_acquire) || ring.size_approx() != 0;
+}
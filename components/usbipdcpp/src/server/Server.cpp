@@ -1,5 +1,6 @@
 #include "Server.h"
 
+#include <algorithm>
 #include <thread>
 #include <iostream>
 
@@ -43,6 +44,39 @@ void usbipdcpp::Server::start(asio::ip::tcp::endpoint &ep)
             SPDLOG_ERROR("An unexpected exception occurs in network thread: {}", e.what());
             std::exit(1);
         } });
+
+    auto thread_count = session_thread_count;
+    if (thread_count == 0)
+    {
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    session_work_guard.emplace(asio::make_work_guard(session_io_context));
+    before_session_thread_create();
+    for (std::size_t i = 0; i < thread_count; i++)
+    {
+        session_threads.emplace_back([this]()
+                                     {
+            on_session_thread_start();
+            try {
+                session_io_context.run();
+            } catch (const std::exception &e) {
+                SPDLOG_ERROR("An unexpected exception occurs in session thread: {}", e.what());
+                std::exit(1);
+            }
+            on_session_thread_exit(); });
+    }
+    device_hook_work_guard.emplace(asio::make_work_guard(device_hook_io_context));
+    device_hook_thread = std::thread([this]()
+                                     {
+        on_session_thread_start();
+        try {
+            device_hook_io_context.run();
+        } catch (const std::exception &e) {
+            SPDLOG_ERROR("An unexpected exception occurs in device hook thread: {}", e.what());
+            std::exit(1);
+        }
+        on_session_thread_exit(); });
+    spdlog::info("Sessions run on {} shared executor threads", thread_count);
 }
 
 void usbipdcpp::Server::stop()
@@ -82,6 +116,21 @@ void usbipdcpp::Server::stop()
     SPDLOG_TRACE("Successfully stop io_context");
     should_stop = true;
     network_io_thread.join();
+
+    // 会话都已结束，放开work guard后执行器线程处理完剩下的任务就会退出
+    session_work_guard.reset();
+    for (auto &thread : session_threads)
+    {
+        thread.join();
+    }
+    session_threads.clear();
+    SPDLOG_TRACE("All session threads exited");
+
+    device_hook_work_guard.reset();
+    if (device_hook_thread.joinable())
+    {
+        device_hook_thread.join();
+    }
 }
 
 void usbipdcpp::Server::add_device(std::shared_ptr<UsbDevice> &&device)
@@ -181,7 +230,7 @@ asio::awaitable<void> usbipdcpp::Server::do_accept(asio::ip::tcp::acceptor &acce
         auto session = std::make_shared<Session>(*this);
 
         asio::error_code ec;
-        // 服务器io_context接收到socket后将其转移到session内部专有的io_context
+        // 服务器io_context接收到socket后将其交给会话执行器，socket绑定在session自己的strand上
         co_await acceptor.async_accept(session->socket, asio::redirect_error(asio::use_awaitable, ec));
 
         if (!ec)
@@ -213,7 +262,7 @@ asio::awaitable<void> usbipdcpp::Server::do_accept(asio::ip::tcp::acceptor &acce
             spdlog::info("A new connection from {}", remote_endpoint_name);
 
             // 函数会直接返回，但内部获取了自身的shared_ptr因此不会被析构
-            // 每个session启动一个线程，防止某些必须阻塞的操作影响其他设备
+            // 不再为每个session创建线程，建立连接只需要一个socket和一个strand
             session->run();
         }
         else if (ec == asio::error::operation_aborted)
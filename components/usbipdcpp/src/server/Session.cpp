@@ -14,7 +14,9 @@
 #include "esp_log.h"
 
 usbipdcpp::Session::Session(Server &server) : server(server),
-                                              socket(session_io_context)
+                                              strand(asio::make_strand(server.session_io_context)),
+                                              socket(strand),
+                                              sender_wakeup(strand)
 {
 }
 
@@ -44,31 +46,41 @@ void usbipdcpp::Session::submit_ret_unlink_and_then_remove_seqnum_unlink(UsbIpRe
 void usbipdcpp::Session::submit_ret_unlink(UsbIpResponse::UsbIpRetUnlink &&unlink)
 {
     SPDLOG_DEBUG("收到提交的unlink包 {}", unlink.header.seqnum);
-    error_code send_ec;
-    transfer_channel->async_send(send_ec, UsbIpResponse::RetVariant{std::move(unlink)}, asio::detached);
-    if (send_ec)
-    {
-        SPDLOG_ERROR("transfer_channel async_send unlink seq={} error: {}", unlink.header.seqnum, send_ec.message());
-    }
-    else
-    {
-        SPDLOG_DEBUG("transfer_channel async_send unlink seq={} queued", unlink.header.seqnum);
-    }
+    auto seqnum = unlink.header.seqnum;
+    queue_response(UsbIpResponse::RetVariant{std::move(unlink)}, seqnum);
 }
 
 void usbipdcpp::Session::submit_ret_submit(UsbIpResponse::UsbIpRetSubmit &&submit)
 {
     SPDLOG_DEBUG("收到提交的submit包{}", submit.header.seqnum);
-    error_code send_ec;
-    transfer_channel->async_send(send_ec, UsbIpResponse::RetVariant{std::move(submit)}, asio::detached);
-    if (send_ec)
+    auto seqnum = submit.header.seqnum;
+    queue_response(UsbIpResponse::RetVariant{std::move(submit)}, seqnum);
+}
+
+void usbipdcpp::Session::queue_response(UsbIpResponse::RetVariant &&response, std::uint32_t seqnum)
+{
+    auto queue = completion_queue.get();
+    if (!queue)
     {
-        SPDLOG_ERROR("transfer_channel async_send submit seq={} error: {}", submit.header.seqnum, send_ec.message());
+        SPDLOG_WARN("completion_queue 还没有创建，丢弃 seq={}", seqnum);
+        return;
     }
-    else
+    // 入队不加锁也不分配内存，只有发送协程睡眠时才需要派发一次唤醒
+    if (queue->push(std::move(response)))
     {
-        SPDLOG_TRACE("transfer_channel async_send submit seq={} queued", submit.header.seqnum);
+        asio::post(strand, [self = shared_from_this()]()
+                   { self->sender_wakeup.cancel(); });
     }
+    SPDLOG_TRACE("completion_queue seq={} queued", seqnum);
+}
+
+void usbipdcpp::Session::close_completion_queue()
+{
+    if (completion_queue)
+    {
+        completion_queue->close();
+    }
+    sender_wakeup.cancel();
 }
 
 usbipdcpp::Session::~Session()
@@ -78,14 +90,12 @@ usbipdcpp::Session::~Session()
 
 void usbipdcpp::Session::run()
 {
-    auto self = shared_from_this();
-    asio::co_spawn(session_io_context, [this]()
-                   { return parse_op(); }, if_has_value_than_rethrow);
-
-    SPDLOG_TRACE("创建Session线程");
-    run_thread = std::thread([self = std::move(self)]()
-                             {
-        self->session_io_context.run();
+    SPDLOG_TRACE("在会话执行器上启动Session");
+    // 协程持有自身的shared_ptr，结束前不会被析构
+    asio::co_spawn(strand, [self = shared_from_this()]()
+                   { return self->parse_op(); }, [self = shared_from_this()](std::exception_ptr e)
+                   {
+        if_has_value_than_rethrow(e);
 
         //处理结束后自动往服务器中删除自身
         {
@@ -105,8 +115,7 @@ void usbipdcpp::Session::run()
                 }
             }
         }
-        self->server.on_session_exit();
-        self->run_thread.detach(); });
+        self->server.on_session_exit(); });
 }
 
 asio::awaitable<void> usbipdcpp::Session::parse_op()
@@ -198,10 +207,7 @@ asio::awaitable<void> usbipdcpp::Session::parse_op()
             static_assert(!std::is_same_v<T, T>);
         } }, op);
 
-    if (this->transfer_channel)
-    {
-        this->transfer_channel->close();
-    }
+    close_completion_queue();
 
 close_socket:
     std::error_code ignore_ec;
@@ -216,20 +222,36 @@ void usbipdcpp::Session::immediately_stop()
 
     SPDLOG_INFO("session immediately_stop called");
 
-    asio::post(session_io_context,
-               [this]()
+    asio::post(strand,
+               [self = shared_from_this()]()
                {
-                   this->socket.close();
-                   if (this->transfer_channel)
-                   {
-                       this->transfer_channel->close();
-                   }
+                   std::error_code ignore_ec;
+                   self->socket.close(ignore_ec);
+                   self->close_completion_queue();
                });
 }
 
+asio::awaitable<void> usbipdcpp::Session::run_device_hook(std::function<void()> hook)
+{
+    // co_spawn 的完成回调在调用者的执行器上执行，等待结束后回到会话的 strand
+    co_await asio::co_spawn(
+        server.device_hook_io_context,
+        [&hook]() -> asio::awaitable<void>
+        {
+            hook();
+            co_return;
+        },
+        asio::use_awaitable);
+}
+
 asio::awaitable<void> usbipdcpp::Session::transfer_loop(usbipdcpp::error_code &transferring_ec)
 {
-    current_import_device->on_new_connection(*this, transferring_ec);
+    // 设备在on_new_connection中就可能开始提交应答
+    completion_queue = std::make_unique<CompletionQueue>();
+
+    current_import_device->build_routes();
+    co_await run_device_hook([&]()
+                             { current_import_device->on_new_connection(*this, transferring_ec); });
     if (transferring_ec)
         co_return;
 
@@ -237,8 +259,6 @@ asio::awaitable<void> usbipdcpp::Session::transfer_loop(usbipdcpp::error_code &t
     error_code sender_ec;
     using namespace asio::experimental::awaitable_operators;
 
-    transfer_channel = std::make_unique<transfer_channel_type>(server.asio_io_context, transfer_channel_size);
-
     co_await (receiver(receiver_ec) && sender(sender_ec));
 
     if (sender_ec)
@@ -292,28 +312,31 @@ asio::awaitable<void> usbipdcpp::Session::receiver_single(usbipdcpp::error_code
                     SPDLOG_TRACE("收到 UsbIpCmdSubmit 包，序列号: {}", cmd2.header.seqnum);
                     auto out = cmd2.header.direction == UsbIpDirection::Out;
                     SPDLOG_TRACE("Usbip传输方向为：{}", out ? "out" : "in");
+                    // 端点号只有 4 位，更大的值截断后会落到别的端点的路由上
+                    if (cmd2.header.ep > 15) {
+                        SPDLOG_WARN("非法的端点号 {}", cmd2.header.ep);
+                        submit_ret_submit(
+                                UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_without_data(cmd2.header.seqnum));
+                        co_return;
+                    }
                     std::uint8_t real_ep = out
                                                ? static_cast<std::uint8_t>(cmd2.header.ep)
                                                : (static_cast<std::uint8_t>(cmd2.header.ep) | 0x80);
                     SPDLOG_TRACE("传输的真实端口为 {:02x}", real_ep);
                     auto current_seqnum = cmd2.header.seqnum;
 
-                    auto ep_find_ret = current_import_device->find_ep(real_ep);
-
-                    if (ep_find_ret.has_value()) {
-                        auto &ep = ep_find_ret->first;
-                        auto &intf = ep_find_ret->second;
+                    auto &route = current_import_device->route(real_ep);
 
-                        SPDLOG_TRACE("->端口{0:02x}", ep.address);
+                    if (route.entry) {
+                        SPDLOG_TRACE("->端口{0:02x}", route.endpoint->address);
                         SPDLOG_TRACE("->setup数据{}", get_every_byte(cmd2.setup.to_bytes()));
                         SPDLOG_TRACE("->请求数据{}", get_every_byte(cmd2.data));
 
                         usbipdcpp::error_code ec_during_handling_urb;
                         current_import_device->handle_urb(
-                                cmd2,
+                                route,
                                 current_seqnum,
-                                ep,
-                                intf,
+                                cmd2.transfer_flags,
                                 cmd2.transfer_buffer_length, cmd2.setup, cmd2.data, cmd2.iso_packet_descriptor,
                                 ec_during_handling_urb
                                 );
@@ -359,8 +382,9 @@ asio::awaitable<void> usbipdcpp::Session::receiver_single(usbipdcpp::error_code
                 co_return; }, command);
         }
     }
-    current_import_device->on_disconnection(receiver_ec);
-    transfer_channel->close();
+    co_await run_device_hook([&]()
+                             { current_import_device->on_disconnection(receiver_ec); });
+    close_completion_queue();
 
     server.try_moving_device_to_available(*current_import_device_id);
     current_import_device_id.reset();
@@ -370,19 +394,30 @@ asio::awaitable<void> usbipdcpp::Session::receiver_single(usbipdcpp::error_code
 
 asio::awaitable<void> usbipdcpp::Session::sender(usbipdcpp::error_code &ec)
 {
-    while (!should_immediately_stop)
+    // 一次取出一批应答依次发送，队列空了才睡眠
+    std::vector<UsbIpResponse::RetVariant> batch;
+    batch.reserve(sender_batch_size);
+    std::size_t batch_index = 0;
+    while (!should_immediately_stop && !completion_queue->closed())
     {
-        auto send_data = co_await transfer_channel->async_receive(asio::redirect_error(asio::use_awaitable, ec));
-        if (ec)
+        if (batch_index == batch.size())
         {
-            if (ec != asio::experimental::error::channel_closed)
+            batch.clear();
+            batch_index = 0;
+            if (completion_queue->pop_batch(batch, sender_batch_size) == 0)
             {
-                SPDLOG_ERROR("transfer_channel async_receive error: {}", ec.message());
+                if (completion_queue->prepare_wait())
+                {
+                    sender_wakeup.expires_at(asio::steady_timer::time_point::max());
+                    error_code wait_ec;
+                    co_await sender_wakeup.async_wait(asio::redirect_error(asio::use_awaitable, wait_ec));
+                }
+                continue;
             }
-            break;
         }
+        auto send_data = std::move(batch[batch_index++]);
 
-        SPDLOG_TRACE("channel收到消息，准备发送");
+        SPDLOG_TRACE("completion_queue取出应答，准备发送");
         error_code sending_ec;
 
         co_await std::visit([&](auto &&cmd) -> asio::awaitable<void>
@@ -455,14 +490,13 @@ asio::awaitable<void> usbipdcpp::Session::sender(usbipdcpp::error_code &ec)
         }
     }
 
-    if (ec == asio::experimental::error::channel_closed ||
-        ec == asio::experimental::error::channel_cancelled)
+    if (ec)
     {
-        SPDLOG_DEBUG("sender ec:{}", ec.message());
-        ec.clear();
+        SPDLOG_ERROR("sender exiting with ec: {}", ec.message());
     }
-    else if (ec)
+    else
     {
-        SPDLOG_ERROR("sender exiting with ec: {}", ec.message());
+        SPDLOG_DEBUG("sender exiting, {} responses went through the overflow queue",
+                     completion_queue->overflow_count());
     }
 }
\ No newline at end of file
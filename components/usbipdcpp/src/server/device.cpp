@@ -93,21 +93,45 @@ std::optional<std::pair<usbipdcpp::UsbEndpoint, std::optional<usbipdcpp::UsbInte
     return std::nullopt;
 }
 
+void usbipdcpp::UsbDevice::build_routes()
+{
+    routes.fill({});
+    auto add_route = [this](const UsbEndpoint &ep, UsbInterface *interface)
+    {
+        auto transfer_type = static_cast<EndpointAttributes>(ep.attributes & 0x03);
+        routes[route_index(ep.address)] = UsbEndpointRoute{
+            .endpoint = &ep,
+            .interface = interface,
+            .transfer_type = transfer_type,
+            .entry = AbstDeviceHandler::route_entry(transfer_type),
+        };
+    };
+
+    add_route(ep0_in, nullptr);
+    add_route(ep0_out, nullptr);
+    for (auto &intf : interfaces)
+    {
+        for (auto &endpoint : intf.endpoints)
+        {
+            add_route(endpoint, &intf);
+        }
+    }
+}
+
 void usbipdcpp::UsbDevice::handle_urb(
-    const UsbIpCommand::UsbIpCmdSubmit &cmd,
+    const UsbEndpointRoute &route,
     std::uint32_t seqnum,
-    const UsbEndpoint &ep,
-    std::optional<UsbInterface> &interface,
-    std::uint32_t transfer_buffer_length, const SetupPacket &setup_packet,
-    const std::vector<std::uint8_t> &out_data,
+    std::uint32_t transfer_flags, std::uint32_t transfer_buffer_length,
+    const SetupPacket &setup_packet,
+    const data_type &out_data,
     const std::vector<UsbIpIsoPacketDescriptor> &iso_packet_descriptors,
     std::error_code &ec)
 {
     SPDLOG_TRACE("设备处理URB，将其转发到对应handler中");
     if (handler)
     {
-        handler->dispatch_urb(cmd, seqnum, ep, interface, transfer_buffer_length, transfer_buffer_length,
-                              setup_packet, out_data, iso_packet_descriptors, ec);
+        handler->dispatch_urb(route, seqnum, transfer_flags, transfer_buffer_length, setup_packet, out_data,
+                              iso_packet_descriptors, ec);
     }
     else
     {
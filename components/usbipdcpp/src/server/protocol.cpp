@@ -248,7 +248,11 @@ data_type usbipdcpp::UsbIpResponse::UsbIpRetSubmit::to_bytes() const
 
     total_result.resize(total_result.size() + 8, 0);
 
-    if (transfer_buffer && !transfer_buffer->empty())
+    if (data_view && actual_length > 0)
+    {
+        total_result.insert(total_result.end(), data_view, data_view + actual_length);
+    }
+    else if (transfer_buffer && !transfer_buffer->empty())
     {
         vector_append_to_net(total_result, *transfer_buffer);
     }
@@ -298,6 +302,13 @@ asio::awaitable<void> UsbIpResponse::UsbIpRetSubmit::to_socket_co(asio::ip::tcp:
             co_await asio::async_write(sock, buffers_with_iso, asio::redirect_error(asio::use_awaitable, ec));
         }
     }
+    else if (data_view && actual_length > 0)
+    {
+        std::array<asio::const_buffer, 2> buffers;
+        buffers[0] = asio::buffer(header_data);
+        buffers[1] = asio::buffer(data_view, actual_length);
+        co_await asio::async_write(sock, buffers, asio::redirect_error(asio::use_awaitable, ec));
+    }
     else if (transfer_buffer && !transfer_buffer->empty())
     {
         if (iso_packet_descriptor.empty())
@@ -334,7 +345,14 @@ void UsbIpResponse::UsbIpRetSubmit::to_socket(asio::ip::tcp::socket &sock, error
 
     auto data1 = array_add_padding<8>(to_network_array(header.to_bytes(), status, actual_length, start_frame,
                                                        number_of_packets, error_count));
-    if (transfer_buffer && !transfer_buffer->empty())
+    if (data_view && actual_length > 0)
+    {
+        std::array<asio::const_buffer, 2> buffers;
+        buffers[0] = asio::buffer(data1);
+        buffers[1] = asio::buffer(data_view, actual_length);
+        asio::write(sock, buffers, ec);
+    }
+    else if (transfer_buffer && !transfer_buffer->empty())
     {
         if (iso_packet_descriptor.empty())
         {
@@ -438,6 +456,24 @@ usbipdcpp::UsbIpResponse::UsbIpRetSubmit usbipdcpp::UsbIpResponse::UsbIpRetSubmi
     return ret;
 }
 
+usbipdcpp::UsbIpResponse::UsbIpRetSubmit usbipdcpp::UsbIpResponse::UsbIpRetSubmit::create_ret_submit_view(
+    std::uint32_t seqnum, std::uint32_t status, std::shared_ptr<const void> owner, const std::uint8_t *data,
+    std::uint32_t length)
+{
+    UsbIpRetSubmit ret;
+    ret.header = UsbIpHeaderBasic::get_server_header(USBIP_RET_SUBMIT, seqnum);
+    ret.status = status;
+    ret.actual_length = length;
+    ret.start_frame = 0;
+    ret.number_of_packets = 0;
+    ret.error_count = 0;
+    ret.transfer_buffer = nullptr;
+    ret.data_owner = std::move(owner);
+    ret.data_view = data;
+    ret.iso_packet_descriptor = {};
+    return ret;
+}
+
 usbipdcpp::UsbIpResponse::UsbIpRetSubmit usbipdcpp::UsbIpResponse::UsbIpRetSubmit::create_ret_submit_ok_without_data(
     std::uint32_t seqnum)
 {
@@ -474,6 +510,21 @@ usbipdcpp::UsbIpResponse::UsbIpRetSubmit usbipdcpp::UsbIpResponse::UsbIpRetSubmi
     return ret;
 }
 
+usbipdcpp::UsbIpResponse::UsbIpRetSubmit usbipdcpp::UsbIpResponse::UsbIpRetSubmit::
+    create_ret_submit_with_status_and_no_iso(std::uint32_t seqnum, std::uint32_t status, data_type &&transfer_buffer)
+{
+    UsbIpRetSubmit ret;
+    ret.header = UsbIpHeaderBasic::get_server_header(USBIP_RET_SUBMIT, seqnum);
+    ret.status = status;
+    ret.actual_length = static_cast<std::uint32_t>(transfer_buffer.size());
+    ret.start_frame = 0;
+    ret.number_of_packets = 0;
+    ret.error_count = 0;
+    ret.transfer_buffer = std::make_shared<data_type>(std::move(transfer_buffer));
+    ret.iso_packet_descriptor = {};
+    return ret;
+}
+
 usbipdcpp::UsbIpResponse::UsbIpRetSubmit usbipdcpp::UsbIpResponse::UsbIpRetSubmit::create_ret_submit_epipe_no_iso(
     std::uint32_t seqnum,
     const data_type &transfer_buffer)
@@ -15,6 +15,11 @@ extern "C"
 namespace usbipdcpp
 {
     class Esp32Server;
+    class StringPool;
+    class SourceSinkVirtualInterfaceHandler;
+    class HidLatencyProbeVirtualInterfaceHandler;
+    class ReplayVirtualDeviceHandler;
+    class HidCompositeVirtualInterfaceHandler;
 }
 
 class UsbipServer
@@ -36,7 +41,13 @@ private:
 
     TaskHandle_t usb_host_event_task = nullptr;
     TaskHandle_t main_worker_task = nullptr;
+    // 虚拟设备的字符串描述符，要比 server 活得久
+    std::unique_ptr<usbipdcpp::StringPool> virtual_string_pool;
     std::unique_ptr<usbipdcpp::Esp32Server> server;
+    std::shared_ptr<usbipdcpp::SourceSinkVirtualInterfaceHandler> source_sink;
+    std::shared_ptr<usbipdcpp::HidLatencyProbeVirtualInterfaceHandler> hid_probe;
+    std::shared_ptr<usbipdcpp::ReplayVirtualDeviceHandler> replay;
+    std::shared_ptr<usbipdcpp::HidCompositeVirtualInterfaceHandler> hid_composite;
 
     // 内部方法
     esp_pthread_cfg_t create_config(const char *name, int core_id, int stack, int prio);
@@ -44,8 +55,23 @@ private:
                                  int32_t event_id, void *event_data);
     void init_usb_host();
     void init_server();
+    void init_console();
     void thread_main();
 
+    // 控制台命令：usbprobe <busid> <端点> [每次字节数] [毫秒] [在途数]
+    static int usbprobe_command(int argc, char **argv);
+    // 控制台命令：gadgetzero add [最大包长] [处理时间us] [模式] [中断环回] | gadgetzero stats
+    static int gadgetzero_command(int argc, char **argv);
+    // 控制台命令：hidprobe add [间隔us] [合并 0/1] | hidprobe stats
+    static int hidprobe_command(int argc, char **argv);
+    // 控制台命令：replay <分区名> [计时 0=录制 1=缩放 2=立即] [倍数] | replay stats
+    static int replay_command(int argc, char **argv);
+    // 控制台命令：hidagg <busid> [busid...] | hidagg stats
+    static int hidagg_command(int argc, char **argv);
+    // 控制台命令：cqbench [生产者数] [每个生产者的应答数] [每批个数]
+    static int cqbench_command(int argc, char **argv);
+    static UsbipServer *console_instance;
+
     // 静态任务函数
     static void usb_host_event_task_func(void *arg);
     static void main_worker_task_func(void *arg);
@@ -1,5 +1,6 @@
 #include "usbip_server.h"
 
+#include <cstring>
 #include <iostream>
 #include <asio.hpp>
 #include <spdlog/spdlog.h>
@@ -11,15 +12,28 @@
 #include <lwip/sys.h>
 #include <lwip/sockets.h>
 
+#include "CompletionQueueBenchmark.h"
 #include "Esp32Server.h"
+#include "EspReplayTrace.h"
+#include "HidCompositeVirtualInterfaceHandler.h"
+#include "HidLatencyProbeDevice.h"
+#include "ReplayVirtualDeviceHandler.h"
+#include "SourceSinkDevice.h"
+#include "StringPool.h"
+#include "TaskTopology.h"
 #include "wifi_manager.h"
 
 #include <lwip/tcp.h>
 #include <lwip/netif.h>
 
+#if CONFIG_ESP_CONSOLE_UART
+#include <esp_console.h>
+#endif
+
 using namespace std;
 
 const char *UsbipServer::TAG = "usbip_server";
+UsbipServer *UsbipServer::console_instance = nullptr;
 
 UsbipServer::UsbipServer()
 {
@@ -96,6 +110,7 @@ void UsbipServer::usb_host_event_task_func(void *arg)
     ESP_LOGI(server->TAG, "Uninstalling USB Host Library");
     usb_host_uninstall();
     ESP_LOGI(server->TAG, "USB host event thread finished");
+    usbipdcpp::TaskTopology::instance().unregister_task(xTaskGetCurrentTaskHandle());
     vTaskDelete(NULL);
 }
 
@@ -117,6 +132,7 @@ void UsbipServer::main_worker_task_func(void *arg)
 
     ESP_LOGI(server->TAG, "Thread end heap: %d bytes", esp_get_free_heap_size());
     ESP_LOGI(server->TAG, "Main thread finished");
+    usbipdcpp::TaskTopology::instance().unregister_task(xTaskGetCurrentTaskHandle());
     vTaskDelete(NULL);
 }
 
@@ -139,15 +155,9 @@ void UsbipServer::init_usb_host()
 
     ESP_LOGI(TAG, "USB Host Library installed successfully");
 
-    // 启动USB主机事件处理任务（使用 FreeRTOS API）
-    xTaskCreatePinnedToCore(
-        usb_host_event_task_func,
-        "usb_host_event",
-        4096,
-        this,
-        10,
-        &usb_host_event_task,
-        1);
+    // 启动USB主机事件处理任务，核心和优先级由任务方案决定
+    usbipdcpp::TaskTopology::instance().create_task(usbipdcpp::TaskRole::UsbHostEvent,
+                                                     usb_host_event_task_func, this, &usb_host_event_task);
 }
 
 void UsbipServer::init_server()
@@ -158,6 +168,424 @@ void UsbipServer::init_server()
     ESP_LOGI(TAG, "All systems initialized");
 }
 
+int UsbipServer::usbprobe_command(int argc, char **argv)
+{
+    auto *self = console_instance;
+    if (!self || !self->server)
+    {
+        printf("服务器还没有启动\n");
+        return 1;
+    }
+    if (argc < 3)
+    {
+        printf("用法: usbprobe <busid> <端点地址，如 0x81> [每次字节数] [毫秒] [在途数]\n");
+        printf("OUT 端点会写入填充数据，只对 loopback 或 source/sink 测试设备使用\n");
+        std::shared_lock lock(self->server->get_devices_mutex());
+        for (const auto &device : self->server->get_available_devices())
+        {
+            printf("  %s  %04x:%04x\n", device->busid.c_str(), device->vendor_id, device->product_id);
+        }
+        return 1;
+    }
+
+    usbipdcpp::UsbThroughputProbe::Config config;
+    config.ep_address = static_cast<uint8_t>(strtoul(argv[2], nullptr, 0));
+    if (argc > 3)
+    {
+        config.transfer_size = static_cast<uint32_t>(strtoul(argv[3], nullptr, 0));
+    }
+    if (argc > 4)
+    {
+        config.duration_ms = static_cast<uint32_t>(strtoul(argv[4], nullptr, 0));
+    }
+    if (argc > 5)
+    {
+        config.queue_depth = static_cast<uint8_t>(strtoul(argv[5], nullptr, 0));
+    }
+
+    auto result = self->server->run_throughput_probe(argv[1], config);
+    if (!result.error.empty())
+    {
+        printf("测试没有正常结束: %s\n", result.error.c_str());
+    }
+    printf("传输 %llu 次 (失败 %llu)，%llu 字节，用时 %llu ms，%.2f MB/s\n",
+           static_cast<unsigned long long>(result.transfers),
+           static_cast<unsigned long long>(result.failed),
+           static_cast<unsigned long long>(result.bytes),
+           static_cast<unsigned long long>(result.elapsed_us / 1000),
+           result.mb_per_s);
+    printf("延迟: 平均=%llu p50=%llu p90=%llu p99=%llu 最大=%llu us\n",
+           static_cast<unsigned long long>(result.latency_avg_us),
+           static_cast<unsigned long long>(result.latency_p50_us),
+           static_cast<unsigned long long>(result.latency_p90_us),
+           static_cast<unsigned long long>(result.latency_p99_us),
+           static_cast<unsigned long long>(result.latency_max_us));
+    printf("提交和完成处理 CPU: %.1f%%\n", result.cpu_percent);
+    return result.error.empty() ? 0 : 1;
+}
+
+int UsbipServer::gadgetzero_command(int argc, char **argv)
+{
+    auto *self = console_instance;
+    if (!self || !self->server)
+    {
+        printf("服务器还没有启动\n");
+        return 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "stats") == 0)
+    {
+        if (!self->source_sink)
+        {
+            printf("还没有添加 source/sink 设备\n");
+            return 1;
+        }
+        for (const auto &ep : self->source_sink->sample_stats())
+        {
+            printf("端点 %02x: %llu URB，%llu 字节，%llu 错误，%.2f MB/s，%.0f URB/s\n", ep.address,
+                   static_cast<unsigned long long>(ep.urbs), static_cast<unsigned long long>(ep.bytes),
+                   static_cast<unsigned long long>(ep.errors), ep.mb_per_s, ep.urbs_per_s);
+        }
+        return 0;
+    }
+    if (argc < 2 || strcmp(argv[1], "add") != 0)
+    {
+        printf("用法: gadgetzero add [最大包长] [处理时间us] [模式 0=全0 1=mod63] [中断环回 0/1]\n");
+        printf("      gadgetzero stats\n");
+        return 1;
+    }
+    if (self->source_sink)
+    {
+        printf("source/sink 设备已经添加过了\n");
+        return 1;
+    }
+
+    usbipdcpp::SourceSinkDeviceConfig config;
+    if (argc > 2)
+    {
+        config.max_packet_size = static_cast<uint16_t>(strtoul(argv[2], nullptr, 0));
+        if (config.max_packet_size <= 64)
+        {
+            config.speed = usbipdcpp::UsbSpeed::Full;
+        }
+    }
+    if (argc > 3)
+    {
+        config.interface.service_time_us = static_cast<uint32_t>(strtoul(argv[3], nullptr, 0));
+    }
+    if (argc > 4 && strtoul(argv[4], nullptr, 0) == 1)
+    {
+        config.interface.pattern = usbipdcpp::SourceSinkVirtualInterfaceHandler::Pattern::Mod63;
+    }
+    if (argc > 5)
+    {
+        config.interrupt_loopback = strtoul(argv[5], nullptr, 0) != 0;
+    }
+
+    if (!self->virtual_string_pool)
+    {
+        self->virtual_string_pool = std::make_unique<usbipdcpp::StringPool>();
+    }
+    auto device = usbipdcpp::make_source_sink_device(*self->virtual_string_pool, config);
+    self->source_sink = std::dynamic_pointer_cast<usbipdcpp::SourceSinkVirtualInterfaceHandler>(
+        device->interfaces[0].handler);
+    self->server->add_device(std::move(device));
+    printf("已添加 source/sink 设备 %s (0525:a4a0)，可以用 usbip attach 后加载 usbtest 测试\n",
+           config.busid.c_str());
+    return 0;
+}
+
+int UsbipServer::hidprobe_command(int argc, char **argv)
+{
+    auto *self = console_instance;
+    if (!self || !self->server)
+    {
+        printf("服务器还没有启动\n");
+        return 1;
+    }
+    if (argc >= 2 && strcmp(argv[1], "stats") == 0)
+    {
+        if (!self->hid_probe)
+        {
+            printf("还没有添加延迟测试 HID 设备\n");
+            return 1;
+        }
+        auto stats = self->hid_probe->report_stats();
+        printf("已生成 %lu 份报告，推送 %llu，送达 %llu，合并 %llu，丢弃 %llu\n",
+               static_cast<unsigned long>(self->hid_probe->next_sequence()),
+               static_cast<unsigned long long>(stats.pushed), static_cast<unsigned long long>(stats.delivered),
+               static_cast<unsigned long long>(stats.merged), static_cast<unsigned long long>(stats.dropped));
+        printf("URB 等待报告 %llu 次，暂存满拒绝 %llu 个\n", static_cast<unsigned long long>(stats.waited_urbs),
+               static_cast<unsigned long long>(stats.rejected_urbs));
+        return 0;
+    }
+    if (argc < 2 || strcmp(argv[1], "add") != 0)
+    {
+        printf("用法: hidprobe add [间隔us] [合并 0/1]\n");
+        printf("      hidprobe stats\n");
+        return 1;
+    }
+    if (self->hid_probe)
+    {
+        printf("延迟测试 HID 设备已经添加过了\n");
+        return 1;
+    }
+
+    usbipdcpp::HidLatencyProbeDeviceConfig config;
+    if (argc > 2)
+    {
+        config.interface.interval_us = static_cast<uint32_t>(strtoul(argv[2], nullptr, 0));
+    }
+    if (argc > 3 && strtoul(argv[3], nullptr, 0) != 0)
+    {
+        config.interface.report_mode = usbipdcpp::HidVirtualInterfaceHandler::ReportMode::Coalesce;
+    }
+
+    if (!self->virtual_string_pool)
+    {
+        self->virtual_string_pool = std::make_unique<usbipdcpp::StringPool>();
+    }
+    auto device = usbipdcpp::make_hid_latency_probe_device(*self->virtual_string_pool, config);
+    self->hid_probe = std::dynamic_pointer_cast<usbipdcpp::HidLatencyProbeVirtualInterfaceHandler>(
+        device->interfaces[0].handler);
+    self->server->add_device(std::move(device));
+    printf("已添加延迟测试 HID 设备 %s (1209:0001)，每 %lu us 一份报告，客户端用 tools/hid_latency_reader 读取\n",
+           config.busid.c_str(), static_cast<unsigned long>(config.interface.interval_us));
+    return 0;
+}
+
+int UsbipServer::replay_command(int argc, char **argv)
+{
+    auto *self = console_instance;
+    if (!self || !self->server)
+    {
+        printf("服务器还没有启动\n");
+        return 1;
+    }
+    if (argc < 2)
+    {
+        printf("用法: replay <分区名> [计时 0=录制 1=缩放 2=立即] [倍数]\n");
+        printf("      replay stats\n");
+        return 1;
+    }
+    if (strcmp(argv[1], "stats") == 0)
+    {
+        if (!self->replay)
+        {
+            printf("还没有添加回放设备\n");
+            return 1;
+        }
+        auto stats = self->replay->stats();
+        printf("已回放 %llu 个 URB，未录到的控制请求 %llu，长度不一致 %llu，循环 %llu 次\n",
+               static_cast<unsigned long long>(stats.replayed),
+               static_cast<unsigned long long>(stats.unmatched_control),
+               static_cast<unsigned long long>(stats.length_mismatches),
+               static_cast<unsigned long long>(stats.wrapped));
+        return 0;
+    }
+    if (self->replay)
+    {
+        printf("回放设备已经添加过了\n");
+        return 1;
+    }
+
+    usbipdcpp::ReplayDeviceConfig config;
+    if (argc > 2)
+    {
+        auto timing = strtoul(argv[2], nullptr, 0);
+        config.handler.timing = timing == 1   ? usbipdcpp::ReplayVirtualDeviceHandler::Timing::Scaled
+                                : timing == 2 ? usbipdcpp::ReplayVirtualDeviceHandler::Timing::Zero
+                                              : usbipdcpp::ReplayVirtualDeviceHandler::Timing::Recorded;
+    }
+    if (argc > 3)
+    {
+        config.handler.scale = strtod(argv[3], nullptr);
+    }
+
+    auto trace = usbipdcpp::load_replay_trace_from_partition(argv[1]);
+    if (!trace)
+    {
+        printf("读取回放文件失败\n");
+        return 1;
+    }
+    auto device = usbipdcpp::make_replay_device(std::move(trace), config);
+    if (!device)
+    {
+        printf("回放文件中的描述符不完整\n");
+        return 1;
+    }
+    self->replay = std::dynamic_pointer_cast<usbipdcpp::ReplayVirtualDeviceHandler>(device->handler);
+    printf("已添加回放设备 %s (%04x:%04x)\n", config.busid.c_str(), device->vendor_id, device->product_id);
+    self->server->add_device(std::move(device));
+    return 0;
+}
+
+int UsbipServer::hidagg_command(int argc, char **argv)
+{
+    auto *self = console_instance;
+    if (!self || !self->server)
+    {
+        printf("服务器还没有启动\n");
+        return 1;
+    }
+    if (argc < 2)
+    {
+        printf("用法: hidagg <busid> [busid...]\n");
+        printf("      hidagg stats\n");
+        return 1;
+    }
+    if (strcmp(argv[1], "stats") == 0)
+    {
+        if (!self->hid_composite)
+        {
+            printf("还没有合成 HID 设备\n");
+            return 1;
+        }
+        for (const auto &member : self->hid_composite->member_stats())
+        {
+            printf("%s: report id %u-%u，转发 %llu 份报告，未知 report id %llu\n", member.name.c_str(),
+                   member.first_report_id, member.first_report_id + member.report_ids - 1,
+                   static_cast<unsigned long long>(member.reports),
+                   static_cast<unsigned long long>(member.unknown_ids));
+        }
+        auto stats = self->hid_composite->report_stats();
+        printf("推送 %llu，送达 %llu，丢弃 %llu，URB 等待报告 %llu 次\n", static_cast<unsigned long long>(stats.pushed),
+               static_cast<unsigned long long>(stats.delivered), static_cast<unsigned long long>(stats.dropped),
+               static_cast<unsigned long long>(stats.waited_urbs));
+        return 0;
+    }
+    if (self->hid_composite)
+    {
+        printf("组合 HID 设备已经添加过了\n");
+        return 1;
+    }
+
+    std::vector<std::string> busids(argv + 1, argv + argc);
+    if (!self->virtual_string_pool)
+    {
+        self->virtual_string_pool = std::make_unique<usbipdcpp::StringPool>();
+    }
+    usbipdcpp::HidCompositeDeviceConfig config;
+    auto result = self->server->aggregate_hid_devices(busids, *self->virtual_string_pool, config);
+    if (!result.error.empty())
+    {
+        printf("合成失败: %s\n", result.error.c_str());
+        return 1;
+    }
+    self->hid_composite = std::dynamic_pointer_cast<usbipdcpp::HidCompositeVirtualInterfaceHandler>(
+        result.device->interfaces[0].handler);
+    printf("已把 %u 个设备合成为组合 HID 设备 %s (1209:0002)，原设备不再单独导出\n",
+           static_cast<unsigned>(busids.size()), config.busid.c_str());
+    return 0;
+}
+
+int UsbipServer::cqbench_command(int argc, char **argv)
+{
+    usbipdcpp::CompletionQueueBenchmark::Config config;
+    if (argc > 1)
+    {
+        config.producers = static_cast<uint8_t>(strtoul(argv[1], nullptr, 0));
+    }
+    if (argc > 2)
+    {
+        config.messages_per_producer = static_cast<uint32_t>(strtoul(argv[2], nullptr, 0));
+    }
+    if (argc > 3)
+    {
+        config.burst = static_cast<uint32_t>(strtoul(argv[3], nullptr, 0));
+    }
+
+    auto results = usbipdcpp::CompletionQueueBenchmark::run(config);
+    for (const auto &result : results)
+    {
+        printf("%s: %llu 个应答，用时 %llu ms\n", result.name,
+               static_cast<unsigned long long>(result.messages),
+               static_cast<unsigned long long>(result.elapsed_us / 1000));
+        printf("  入队耗时: 平均=%llu p50=%llu p99=%llu 最大=%llu ns\n",
+               static_cast<unsigned long long>(result.enqueue_avg_ns),
+               static_cast<unsigned long long>(result.enqueue_p50_ns),
+               static_cast<unsigned long long>(result.enqueue_p99_ns),
+               static_cast<unsigned long long>(result.enqueue_max_ns));
+        printf("  入队到取出: 平均=%llu p50=%llu p99=%llu 最大=%llu us\n",
+               static_cast<unsigned long long>(result.latency_avg_us),
+               static_cast<unsigned long long>(result.latency_p50_us),
+               static_cast<unsigned long long>(result.latency_p99_us),
+               static_cast<unsigned long long>(result.latency_max_us));
+        if (result.wakeups || result.overflowed)
+        {
+            printf("  唤醒 %llu 次，溢出 %llu 个\n",
+                   static_cast<unsigned long long>(result.wakeups),
+                   static_cast<unsigned long long>(result.overflowed));
+        }
+    }
+    return 0;
+}
+
+void UsbipServer::init_console()
+{
+#if CONFIG_ESP_CONSOLE_UART
+    console_instance = this;
+
+    esp_console_repl_t *repl = nullptr;
+    esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+    repl_config.prompt = "usbip>";
+    // 吞吐测试在控制台任务中阻塞运行
+    repl_config.task_stack_size = 6144;
+    esp_console_dev_uart_config_t uart_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+    esp_err_t err = esp_console_new_repl_uart(&uart_config, &repl_config, &repl);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(TAG, "无法启动控制台: %s", esp_err_to_name(err));
+        return;
+    }
+
+    const esp_console_cmd_t probe_cmd = {
+        .command = "usbprobe",
+        .help = "不经过网络测试直通设备一个 bulk 端点的吞吐量和延迟",
+        .hint = "<busid> <ep> [bytes] [ms] [depth]",
+        .func = &UsbipServer::usbprobe_command,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&probe_cmd));
+    const esp_console_cmd_t gadgetzero_cmd = {
+        .command = "gadgetzero",
+        .help = "添加一个 gadget zero 式的 source/sink 虚拟设备，或查看它各端点的速率",
+        .hint = "add [mps] [service_us] [pattern] [loopback] | stats",
+        .func = &UsbipServer::gadgetzero_command,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&gadgetzero_cmd));
+    const esp_console_cmd_t hidprobe_cmd = {
+        .command = "hidprobe",
+        .help = "添加一个带时间戳和序号的延迟测试 HID 虚拟设备，或查看它的报告统计",
+        .hint = "add [interval_us] [coalesce] | stats",
+        .func = &UsbipServer::hidprobe_command,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&hidprobe_cmd));
+    const esp_console_cmd_t replay_cmd = {
+        .command = "replay",
+        .help = "从数据分区读取录制文件，添加一个按录制内容和时间应答的回放设备，或查看回放统计",
+        .hint = "<partition> [timing] [scale] | stats",
+        .func = &UsbipServer::replay_command,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&replay_cmd));
+    const esp_console_cmd_t hidagg_cmd = {
+        .command = "hidagg",
+        .help = "把几个直通的键盘、鼠标、手柄合成一个 HID 设备导出，客户端只需导入一次，或查看各成员的统计",
+        .hint = "<busid> [busid...] | stats",
+        .func = &UsbipServer::hidagg_command,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&hidagg_cmd));
+    const esp_console_cmd_t cqbench_cmd = {
+        .command = "cqbench",
+        .help = "比较应答从完成线程交给发送协程的两种方式：asio channel 和无锁的 CompletionQueue",
+        .hint = "[producers] [messages] [burst]",
+        .func = &UsbipServer::cqbench_command,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&cqbench_cmd));
+    ESP_ERROR_CHECK(esp_console_start_repl(repl));
+#else
+    ESP_LOGI(TAG, "控制台不在 UART 上，不启动 usbprobe、gadgetzero、hidprobe、replay、hidagg 和 cqbench 命令");
+#endif
+}
+
 void UsbipServer::thread_main()
 {
     ESP_LOGI(TAG, "Starting main thread...");
@@ -170,6 +598,44 @@ void UsbipServer::thread_main()
 
     // 创建服务器实例
     server = std::make_unique<usbipdcpp::Esp32Server>();
+    // ST-Link V2 / V2-1 / V3 和 J-Link 的命令/响应接口开启预取，自带的虚拟串口开启连续接收
+    // 规则按顺序匹配，放在U盘规则之前，ST-Link V2-1 自带的虚拟U盘不影响匹配
+    for (std::uint16_t pid : {0x3748, 0x374b, 0x374f})
+    {
+        server->device_policies().add_rule({.vendor_id = 0x0483, .product_id = pid,
+                                            .policy = {.probe_prefetch = true, .serial_stream = true}});
+    }
+    server->device_policies().add_rule({.vendor_id = 0x1366,
+                                        .policy = {.probe_prefetch = true, .serial_stream = true}});
+    // USB 转串口芯片：CH340、CP210x、FTDI
+    server->device_policies().add_rule({.vendor_id = 0x1a86,
+                                        .policy = {.serial_stream = true, .serial_stream_vendor = true}});
+    for (std::uint16_t pid : {0xea60, 0xea70, 0xea71})
+    {
+        server->device_policies().add_rule({.vendor_id = 0x10c4, .product_id = pid,
+                                            .policy = {.serial_stream = true, .serial_stream_vendor = true}});
+    }
+    for (std::uint16_t pid : {0x6001, 0x6010, 0x6011, 0x6014, 0x6015})
+    {
+        server->device_policies().add_rule({.vendor_id = 0x0403, .product_id = pid,
+                                            .policy = {.serial_stream = true,
+                                                       .serial_stream_vendor = true,
+                                                       .serial_stream_packet_framing = true}});
+    }
+#if CONFIG_SPIRAM
+    // 有 PSRAM 时为U盘类设备开启读缓存
+    server->device_policies().add_rule({.interface_class = 0x08,
+                                        .policy = {.bot_read_cache = true}});
+#endif
+    // 其它 CDC ACM 串口
+    server->device_policies().add_rule({.interface_class = 0x0A,
+                                        .policy = {.serial_stream = true}});
+    // 打印机：打印数据只写不读，bulk OUT 提前应答
+    server->device_policies().add_rule({.interface_class = 0x07,
+                                        .policy = {.bulk_out_write_behind_mask = 0xFFFE}});
+    // 键盘、鼠标等 HID 设备：客户端按 1 ms 轮询，ESP32 对设备的轮询周期不变
+    server->device_policies().add_rule({.interface_class = 0x03,
+                                        .policy = {.interrupt_interval_ms = 1}});
     server->init_client();
 
     // 设置监听端点
@@ -179,6 +645,8 @@ void UsbipServer::thread_main()
     ESP_LOGI(TAG, "Starting USB/IP server on port %d", listening_port);
     server->start(endpoint);
 
+    init_console();
+
     // 主循环
     ESP_LOGI(TAG, "Entering main loop...");
     while (true)
@@ -213,16 +681,16 @@ void UsbipServer::start()
     ESP_LOGI(TAG, "Free heap: %d bytes", esp_get_free_heap_size());
     ESP_LOGI(TAG, "Minimum free heap: %d bytes", esp_get_minimum_free_heap_size());
 
-    // 创建主任务（使用 FreeRTOS API）
-    xTaskCreatePinnedToCore(
-        main_worker_task_func,
-        "main_worker",
-        8192,
-        this,
-        5,
-        &main_worker_task,
-        1 // 核心 1
-    );
+    // 读取上次保存的任务方案，之后创建的所有任务都按方案分配核心
+    auto &topology = usbipdcpp::TaskTopology::instance();
+    if (topology.load_from_nvs() != ESP_OK)
+    {
+        ESP_LOGI(TAG, "使用默认任务方案");
+    }
+    topology.log_current();
+
+    // 创建主任务
+    topology.create_task(usbipdcpp::TaskRole::MainWorker, main_worker_task_func, this, &main_worker_task);
 }
 
 void UsbipServer::stop()
@@ -239,6 +707,7 @@ void UsbipServer::stop()
     // 等待并删除主任务
     if (main_worker_task)
     {
+        usbipdcpp::TaskTopology::instance().unregister_task(main_worker_task);
         vTaskDelete(main_worker_task);
         main_worker_task = nullptr;
     }
@@ -246,6 +715,7 @@ void UsbipServer::stop()
     // 等待并删除 USB 事件任务
     if (usb_host_event_task)
     {
+        usbipdcpp::TaskTopology::instance().unregister_task(usb_host_event_task);
         vTaskDelete(usb_host_event_task);
         usb_host_event_task = nullptr;
     }
@@ -0,0 +1,364 @@
+// 延迟测试 HID 设备（HidLatencyProbeVirtualInterfaceHandler）在 Linux 客户端上的读取程序。
+//
+// 编译：g++ -std=c++20 -O2 -pthread -o hid_latency_reader hid_latency_reader.cpp
+// 用法：usbip attach 之后运行
+//     hid_latency_reader [/dev/hidrawN] [秒数=10] [迟到阈值us=4000] [校时间隔ms=100]
+// 不指定 hidraw 时按 VID/PID 1209:0001 自动查找，需要对 hidraw 节点有读写权限。
+//
+// 程序定期写一份带本机时间戳的输出报告，设备在之后的输入报告中带回它和收到它的时间，
+// 像 NTP 一样估计两边时钟的偏差（只用往返时间最短的样本，并用最近的样本跟踪时钟漂移），
+// 然后对每份输入报告计算“设备生成报告”到“read 返回”的单向延迟。
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace
+{
+    constexpr std::size_t input_report_size = 64;
+    constexpr std::size_t output_report_size = 8;
+    // 用最近多少个校时样本估计时钟偏差，太多跟不上晶振漂移，太少容易受网络抖动影响
+    constexpr std::size_t sync_window = 32;
+
+    std::int64_t host_now_us()
+    {
+        timespec ts{};
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return static_cast<std::int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+    }
+
+    std::uint64_t get_le(const std::uint8_t *data, std::size_t size)
+    {
+        std::uint64_t value = 0;
+        for (std::size_t i = 0; i < size; i++)
+        {
+            value |= static_cast<std::uint64_t>(data[i]) << (8 * i);
+        }
+        return value;
+    }
+
+    struct ProbeReport
+    {
+        std::uint32_t seq;
+        std::int64_t server_us;
+        std::int64_t echo_host_us;
+        std::int64_t echo_server_us;
+        std::uint32_t interval_us;
+    };
+
+    ProbeReport parse_report(const std::uint8_t *data)
+    {
+        return ProbeReport{
+            .seq = static_cast<std::uint32_t>(get_le(data, 4)),
+            .server_us = static_cast<std::int64_t>(get_le(data + 4, 8)),
+            .echo_host_us = static_cast<std::int64_t>(get_le(data + 12, 8)),
+            .echo_server_us = static_cast<std::int64_t>(get_le(data + 20, 8)),
+            .interval_us = static_cast<std::uint32_t>(get_le(data + 28, 4))};
+    }
+
+    /**
+     * @brief 每个不同的客户端时间戳只保留往返时间最短的一次，偏差取窗口内往返最短的样本
+     */
+    class ClockSync
+    {
+    public:
+        void add(const ProbeReport &report, std::int64_t receive_us)
+        {
+            if (report.echo_host_us == 0)
+            {
+                return;
+            }
+            // t0 客户端发出，t1 服务端收到，t2 服务端发出，t3 客户端收到
+            auto t0 = report.echo_host_us;
+            auto t1 = report.echo_server_us;
+            auto t2 = report.server_us;
+            auto t3 = receive_us;
+            Sample sample{
+                .echo = t0,
+                .round_trip = (t3 - t0) - (t2 - t1),
+                .offset = ((t1 - t0) + (t2 - t3)) / 2};
+            if (!samples.empty() && samples.back().echo == t0)
+            {
+                if (sample.round_trip < samples.back().round_trip)
+                {
+                    samples.back() = sample;
+                }
+                return;
+            }
+            samples.push_back(sample);
+            if (samples.size() > sync_window)
+            {
+                samples.pop_front();
+            }
+        }
+
+        /**
+         * @return 服务端时钟减去客户端时钟
+         */
+        [[nodiscard]] std::optional<std::int64_t> offset() const
+        {
+            if (samples.empty())
+            {
+                return std::nullopt;
+            }
+            return std::ranges::min(samples, {}, &Sample::round_trip).offset;
+        }
+
+        [[nodiscard]] std::optional<std::int64_t> best_round_trip() const
+        {
+            if (samples.empty())
+            {
+                return std::nullopt;
+            }
+            return std::ranges::min(samples, {}, &Sample::round_trip).round_trip;
+        }
+
+    private:
+        struct Sample
+        {
+            std::int64_t echo;
+            std::int64_t round_trip;
+            std::int64_t offset;
+        };
+
+        std::deque<Sample> samples;
+    };
+
+    std::optional<std::string> find_probe_hidraw()
+    {
+        std::error_code ec;
+        for (const auto &entry : std::filesystem::directory_iterator("/sys/class/hidraw", ec))
+        {
+            std::ifstream uevent(entry.path() / "device" / "uevent");
+            std::string line;
+            while (std::getline(uevent, line))
+            {
+                if (line == "HID_ID=0003:00001209:00000001")
+                {
+                    return "/dev/" + entry.path().filename().string();
+                }
+            }
+        }
+        return std::nullopt;
+    }
+
+    std::int64_t percentile(const std::vector<std::int64_t> &sorted, double p)
+    {
+        if (sorted.empty())
+        {
+            return 0;
+        }
+        auto index = static_cast<std::size_t>(p / 100.0 * static_cast<double>(sorted.size() - 1) + 0.5);
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::string path;
+    int arg = 1;
+    if (argc > arg && argv[arg][0] == '/')
+    {
+        path = argv[arg++];
+    }
+    else if (auto found = find_probe_hidraw())
+    {
+        path = *found;
+    }
+    else
+    {
+        fprintf(stderr, "没有找到 1209:0001 的 hidraw 节点，请先 usbip attach 或手动指定\n");
+        return 1;
+    }
+    auto duration_s = argc > arg ? strtol(argv[arg++], nullptr, 0) : 10;
+    auto late_threshold_us = argc > arg ? strtol(argv[arg++], nullptr, 0) : 4000;
+    auto sync_period_ms = argc > arg ? strtol(argv[arg++], nullptr, 0) : 100;
+
+    int fd = open(path.c_str(), O_RDWR);
+    if (fd < 0)
+    {
+        fprintf(stderr, "打开 %s 失败: %s\n", path.c_str(), strerror(errno));
+        return 1;
+    }
+    printf("读取 %s，%ld 秒，迟到阈值 %ld us\n", path.c_str(), duration_s, late_threshold_us);
+
+    // 没有中断 OUT 端点时写 hidraw 会同步等待 SET_REPORT 完成，放在单独的线程里不耽误读
+    std::atomic<bool> running = true;
+    std::thread sync_thread([&]()
+                            {
+        while (running.load())
+        {
+            std::uint8_t buffer[1 + output_report_size] = {0}; // 第一个字节是 report ID，设备没有 ID 时为 0
+            auto now = static_cast<std::uint64_t>(host_now_us());
+            for (std::size_t i = 0; i < output_report_size; i++)
+            {
+                buffer[1 + i] = static_cast<std::uint8_t>(now >> (8 * i));
+            }
+            if (write(fd, buffer, sizeof(buffer)) < 0)
+            {
+                fprintf(stderr, "写输出报告失败: %s\n", strerror(errno));
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(sync_period_ms));
+        } });
+
+    ClockSync clock_sync;
+    std::vector<std::int64_t> latencies;
+    std::optional<std::uint32_t> last_seq;
+    std::uint64_t received = 0;
+    std::uint64_t lost = 0;
+    std::uint64_t late = 0;
+    std::uint64_t out_of_order = 0;
+    std::uint64_t unsynced = 0;
+    std::uint32_t interval_us = 0;
+
+    auto start = host_now_us();
+    auto end = start + duration_s * 1000000;
+    auto next_print = start + 1000000;
+    std::size_t latencies_at_print = 0;
+    std::uint64_t lost_at_print = 0;
+    std::uint64_t late_at_print = 0;
+    while (true)
+    {
+        auto now = host_now_us();
+        if (now >= end)
+        {
+            break;
+        }
+        pollfd pfd{.fd = fd, .events = POLLIN, .revents = 0};
+        auto ready = poll(&pfd, 1, static_cast<int>(std::min<std::int64_t>((end - now) / 1000 + 1, 100)));
+        if (ready < 0 && errno != EINTR)
+        {
+            fprintf(stderr, "poll 失败: %s\n", strerror(errno));
+            break;
+        }
+        if (ready > 0)
+        {
+            std::uint8_t buffer[input_report_size];
+            auto n = read(fd, buffer, sizeof(buffer));
+            auto receive_us = host_now_us();
+            if (n < 0)
+            {
+                fprintf(stderr, "读输入报告失败: %s\n", strerror(errno));
+                break;
+            }
+            if (static_cast<std::size_t>(n) < 32)
+            {
+                continue;
+            }
+            auto report = parse_report(buffer);
+            received++;
+            interval_us = report.interval_us;
+            clock_sync.add(report, receive_us);
+
+            if (last_seq)
+            {
+                if (report.seq == 0 && *last_seq != 0xFFFFFFFF)
+                {
+                    printf("序号回到 0，设备重新连接过\n");
+                }
+                else if (report.seq <= *last_seq)
+                {
+                    out_of_order++;
+                }
+                else
+                {
+                    lost += report.seq - *last_seq - 1;
+                }
+            }
+            last_seq = report.seq;
+
+            auto offset = clock_sync.offset();
+            if (!offset)
+            {
+                unsynced++;
+            }
+            else
+            {
+                auto latency = receive_us - (report.server_us - *offset);
+                latencies.push_back(latency);
+                if (latency > late_threshold_us)
+                {
+                    late++;
+                }
+            }
+        }
+
+        now = host_now_us();
+        if (now >= next_print)
+        {
+            std::vector<std::int64_t> window(latencies.begin() + static_cast<std::ptrdiff_t>(latencies_at_print),
+                                             latencies.end());
+            std::ranges::sort(window);
+            printf("%3" PRId64 "s: %zu 份, p50 %" PRId64 " us, p99 %" PRId64 " us, max %" PRId64
+                   " us, 丢失 %" PRIu64 ", 迟到 %" PRIu64 ", 最短往返 %" PRId64 " us\n",
+                   (now - start) / 1000000, window.size(), percentile(window, 50), percentile(window, 99),
+                   window.empty() ? 0 : window.back(), lost - lost_at_print, late - late_at_print,
+                   clock_sync.best_round_trip().value_or(0));
+            latencies_at_print = latencies.size();
+            lost_at_print = lost;
+            late_at_print = late;
+            next_print += 1000000;
+        }
+    }
+    running = false;
+    sync_thread.join();
+    close(fd);
+
+    std::ranges::sort(latencies);
+    printf("\n共收到 %" PRIu64 " 份报告（发送间隔 %u us），丢失 %" PRIu64 "，乱序或重复 %" PRIu64
+           "，校时前 %" PRIu64 " 份未计入\n",
+           received, interval_us, lost, out_of_order, unsynced);
+    if (latencies.empty())
+    {
+        printf("没有可用的延迟数据，确认设备收到了输出报告\n");
+        return 1;
+    }
+    printf("延迟 us: min %" PRId64 ", p50 %" PRId64 ", p90 %" PRId64 ", p99 %" PRId64 ", p99.9 %" PRId64
+           ", max %" PRId64 "\n",
+           latencies.front(), percentile(latencies, 50), percentile(latencies, 90), percentile(latencies, 99),
+           percentile(latencies, 99.9), latencies.back());
+    printf("超过 %ld us 的迟到报告: %" PRIu64 " (%.3f%%)\n", late_threshold_us, late,
+           100.0 * static_cast<double>(late) / static_cast<double>(latencies.size()));
+
+    // 粗略的分布，每个桶的宽度是发送间隔的一半
+    auto bucket_us = std::max<std::int64_t>(interval_us / 2, 100);
+    std::vector<std::uint64_t> buckets;
+    for (auto latency : latencies)
+    {
+        auto index = static_cast<std::size_t>(std::max<std::int64_t>(latency, 0) / bucket_us);
+        if (index >= buckets.size())
+        {
+            buckets.resize(std::min<std::size_t>(index + 1, 64));
+        }
+        buckets[std::min(index, buckets.size() - 1)]++;
+    }
+    for (std::size_t i = 0; i < buckets.size(); i++)
+    {
+        if (buckets[i] == 0)
+        {
+            continue;
+        }
+        printf("%6" PRId64 " - %6" PRId64 " us%s: %" PRIu64 "\n", static_cast<std::int64_t>(i) * bucket_us,
+               static_cast<std::int64_t>(i + 1) * bucket_us, i == 63 ? "+" : "", buckets[i]);
+    }
+    return 0;
+}
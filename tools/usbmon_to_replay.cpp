@@ -0,0 +1,289 @@
+// 把 Linux usbmon 抓到的 pcap 转成 ReplayVirtualDeviceHandler 的回放文件。
+//
+// 编译：g++ -std=c++20 -O2 -o usbmon_to_replay usbmon_to_replay.cpp
+// 抓包：modprobe usbmon 后用 tcpdump -i usbmonN -s 0 -w session.pcap，或用 Wireshark 保存为 pcap（不是 pcapng），
+//       从插入设备开始抓，这样枚举时的描述符请求也会录下来。
+// 用法：usbmon_to_replay session.pcap <设备地址> [速度 low/full/high/super] > session.trace
+//
+// 同一个 URB 的提交（S）和完成（C）按 URB ID 配对，两者的时间差作为处理时间。
+// 被主机取消（-ENOENT、-ECONNRESET）的 URB 不是设备的行为，不写入回放文件；同步传输不支持。
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+    constexpr std::uint32_t linktype_usb_linux = 189;
+    constexpr std::uint32_t linktype_usb_linux_mmapped = 220;
+
+    constexpr std::uint8_t xfer_isochronous = 0;
+    constexpr std::uint8_t xfer_interrupt = 1;
+    constexpr std::uint8_t xfer_control = 2;
+    constexpr std::uint8_t xfer_bulk = 3;
+
+    constexpr int status_enoent = -2;
+    constexpr int status_econnreset = -104;
+
+    /**
+     * @brief usbmon 二进制接口的包头，前 48 字节两种链路类型相同，都是抓包机器的字节序
+     */
+    struct UsbmonHeader
+    {
+        std::uint64_t id;
+        char type;
+        std::uint8_t xfer_type;
+        std::uint8_t epnum;
+        std::uint8_t devnum;
+        std::uint16_t busnum;
+        char flag_setup;
+        char flag_data;
+        std::int64_t ts_sec;
+        std::int32_t ts_usec;
+        std::int32_t status;
+        std::uint32_t length;
+        std::uint32_t len_cap;
+        std::uint8_t setup[8];
+    };
+
+    struct Submit
+    {
+        std::int64_t ts_us;
+        std::uint8_t xfer_type;
+        std::uint8_t epnum;
+        bool has_setup;
+        std::uint8_t setup[8];
+    };
+
+    template <typename T>
+    T read_raw(const std::uint8_t *p)
+    {
+        T value;
+        std::memcpy(&value, p, sizeof(T));
+        return value;
+    }
+
+    std::string to_hex(const std::uint8_t *data, std::size_t length)
+    {
+        if (length == 0)
+        {
+            return "-";
+        }
+        static constexpr char digits[] = "0123456789abcdef";
+        std::string result(length * 2, '0');
+        for (std::size_t i = 0; i < length; i++)
+        {
+            result[i * 2] = digits[data[i] >> 4];
+            result[i * 2 + 1] = digits[data[i] & 0x0F];
+        }
+        return result;
+    }
+
+    int speed_value(const char *name)
+    {
+        // 和 usbipdcpp::UsbSpeed 的取值一致
+        if (std::strcmp(name, "low") == 0)
+        {
+            return 1;
+        }
+        if (std::strcmp(name, "full") == 0)
+        {
+            return 2;
+        }
+        if (std::strcmp(name, "super") == 0)
+        {
+            return 5;
+        }
+        return 3;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "用法: %s <pcap 文件> <设备地址> [low/full/high/super]\n", argv[0]);
+        return 1;
+    }
+    auto devnum = static_cast<std::uint8_t>(strtoul(argv[2], nullptr, 0));
+    auto speed = argc > 3 ? speed_value(argv[3]) : 3;
+
+    std::ifstream file(argv[1], std::ios::binary);
+    std::vector<std::uint8_t> pcap((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (pcap.size() < 24)
+    {
+        fprintf(stderr, "读取 %s 失败或文件太短\n", argv[1]);
+        return 1;
+    }
+    auto magic = read_raw<std::uint32_t>(pcap.data());
+    bool nanoseconds = magic == 0xa1b23c4d;
+    if (magic != 0xa1b2c3d4 && !nanoseconds)
+    {
+        fprintf(stderr, "不是本机字节序的 pcap 文件（pcapng 请先用 editcap -F pcap 转换）\n");
+        return 1;
+    }
+    auto linktype = read_raw<std::uint32_t>(pcap.data() + 20) & 0x0FFFFFFF;
+    std::size_t header_size;
+    if (linktype == linktype_usb_linux_mmapped)
+    {
+        header_size = 64;
+    }
+    else if (linktype == linktype_usb_linux)
+    {
+        header_size = 48;
+    }
+    else
+    {
+        fprintf(stderr, "链路类型 %u 不是 usbmon\n", linktype);
+        return 1;
+    }
+
+    std::unordered_map<std::uint64_t, Submit> submits;
+    std::vector<std::uint8_t> device_descriptor;
+    std::vector<std::uint8_t> configuration_descriptor;
+    std::vector<std::string> lines;
+    std::uint64_t skipped = 0;
+    std::uint64_t truncated = 0;
+
+    std::size_t offset = 24;
+    while (offset + 16 <= pcap.size())
+    {
+        auto incl_len = read_raw<std::uint32_t>(pcap.data() + offset + 8);
+        auto record = pcap.data() + offset + 16;
+        offset += 16 + incl_len;
+        if (offset > pcap.size() || incl_len < header_size)
+        {
+            break;
+        }
+
+        UsbmonHeader hdr{};
+        hdr.id = read_raw<std::uint64_t>(record);
+        hdr.type = static_cast<char>(record[8]);
+        hdr.xfer_type = record[9];
+        hdr.epnum = record[10];
+        hdr.devnum = record[11];
+        hdr.busnum = read_raw<std::uint16_t>(record + 12);
+        hdr.flag_setup = static_cast<char>(record[14]);
+        hdr.flag_data = static_cast<char>(record[15]);
+        hdr.ts_sec = read_raw<std::int64_t>(record + 16);
+        hdr.ts_usec = read_raw<std::int32_t>(record + 24);
+        hdr.status = read_raw<std::int32_t>(record + 28);
+        hdr.length = read_raw<std::uint32_t>(record + 32);
+        hdr.len_cap = read_raw<std::uint32_t>(record + 36);
+        std::memcpy(hdr.setup, record + 40, 8);
+        if (hdr.devnum != devnum)
+        {
+            continue;
+        }
+        const std::uint8_t *data = record + header_size;
+        std::size_t data_length = std::min<std::size_t>(hdr.len_cap, incl_len - header_size);
+        if (data_length < hdr.len_cap)
+        {
+            truncated++;
+        }
+        auto ts_us = hdr.ts_sec * 1000000 + (nanoseconds ? hdr.ts_usec / 1000 : hdr.ts_usec);
+
+        if (hdr.type == 'S')
+        {
+            Submit submit{
+                .ts_us = ts_us,
+                .xfer_type = hdr.xfer_type,
+                .epnum = hdr.epnum,
+                .has_setup = hdr.flag_setup == 0,
+                .setup = {}};
+            std::memcpy(submit.setup, hdr.setup, 8);
+            submits[hdr.id] = submit;
+            continue;
+        }
+        if (hdr.type != 'C')
+        {
+            continue;
+        }
+        auto it = submits.find(hdr.id);
+        if (it == submits.end())
+        {
+            // 抓包开始前就提交了的 URB
+            skipped++;
+            continue;
+        }
+        auto submit = it->second;
+        submits.erase(it);
+        if (hdr.status == status_enoent || hdr.status == status_econnreset ||
+            submit.xfer_type == xfer_isochronous)
+        {
+            skipped++;
+            continue;
+        }
+        auto service_us = std::max<std::int64_t>(ts_us - submit.ts_us, 0);
+        char prefix[64];
+        if (submit.xfer_type == xfer_control)
+        {
+            if (!submit.has_setup)
+            {
+                skipped++;
+                continue;
+            }
+            bool is_in = (submit.setup[0] & 0x80) != 0;
+            auto response = is_in ? to_hex(data, data_length) : std::string("-");
+            snprintf(prefix, sizeof(prefix), "c %s %d %" PRId64 " ", to_hex(submit.setup, 8).c_str(), hdr.status,
+                     service_us);
+            lines.push_back(prefix + response);
+
+            // GET_DESCRIPTOR(设备) 和 GET_DESCRIPTOR(配置)，保留最完整的一次
+            if (is_in && submit.setup[1] == 6 && hdr.status == 0)
+            {
+                auto descriptor_type = submit.setup[3];
+                auto &target = descriptor_type == 1 ? device_descriptor : configuration_descriptor;
+                if ((descriptor_type == 1 || (descriptor_type == 2 && submit.setup[2] == 0)) &&
+                    data_length > target.size())
+                {
+                    target.assign(data, data + data_length);
+                }
+            }
+        }
+        else if (submit.xfer_type == xfer_bulk || submit.xfer_type == xfer_interrupt)
+        {
+            auto ep = submit.epnum;
+            if (ep & 0x80)
+            {
+                snprintf(prefix, sizeof(prefix), "i %02x %d %" PRId64 " ", ep, hdr.status, service_us);
+                lines.push_back(prefix + to_hex(data, data_length));
+            }
+            else
+            {
+                snprintf(prefix, sizeof(prefix), "o %02x %d %" PRId64 " %u", ep, hdr.status, service_us,
+                         hdr.length);
+                lines.push_back(prefix);
+            }
+        }
+    }
+
+    if (device_descriptor.size() < 18 || configuration_descriptor.size() < 9)
+    {
+        fprintf(stderr, "没有抓到设备 %u 完整的设备描述符和配置描述符，请从插入设备开始抓包\n", devnum);
+        return 1;
+    }
+    printf("usbipdcpp-replay 1\n");
+    printf("# %s 中设备 %u 的 %zu 个 URB\n", argv[1], devnum, lines.size());
+    printf("speed %d\n", speed);
+    printf("device %s\n", to_hex(device_descriptor.data(), device_descriptor.size()).c_str());
+    printf("config %s\n", to_hex(configuration_descriptor.data(), configuration_descriptor.size()).c_str());
+    for (const auto &line : lines)
+    {
+        printf("%s\n", line.c_str());
+    }
+    fprintf(stderr, "写出 %zu 个 URB，跳过 %" PRIu64 " 个，数据被截断 %" PRIu64 " 个\n", lines.size(), skipped,
+            truncated);
+    if (truncated > 0)
+    {
+        fprintf(stderr, "有数据被截断，抓包时请加 -s 0\n");
+    }
+    return 0;
+}